@@ -1,54 +1,131 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+#ifdef CSVIEW_GZIP
+#include <zlib.h>
+#endif
 
 #include "csv-handler.h"
 
-// REMINDER: Need to pass stdin for this to work!
+// REMINDER: Need to pass stdin for this to work!  (For the last test.  The
+// ones before it write files of their own to the current directory, and
+// remove them after.)
+
+#define BIG_FILE "csv-handler-test-big.csv"
+#define CUT_GZIP "csv-handler-test-cut.csv.gz"
+#define BAD_GZIP "csv-handler-test-bad.csv.gz"
+#define BIG_BGZF "csv-handler-test-big.csv.gz"
+#define STRAY_FILE "csv-handler-test-stray.csv"
+#define STRAY_BGZF "csv-handler-test-stray.csv.gz"
+#define STRAY_SMALL "csv-handler-test-stray-small.csv"
+#define RESYNC_FILE "csv-handler-test-resync.csv"
+#define RESYNC_GOOD "csv-handler-test-resync-good.csv"
+#define EQUALS_FILE "csv-handler-test-equals.csv"
+#define EQUALS_VALUES "csv-handler-test-equals-values.csv"
+#define EQUALS_GOOD "csv-handler-test-equals-good.csv"
+#define STREAM_FILE "csv-handler-test-stream.csv"
+
+/**
+ * What the stream callbacks write down what they were called with in (see
+ * streamTrace).
+ */
+typedef struct {
+    char *trace;
+    int records;
+    int stopAfter;
+} streamState;
 
 void testfunc(char **line);
 
+void testCompressed();
+void testBgzf();
+void testReverse();
+void testSeveralFiles();
+void testStrayQuotes();
+void testResync();
+void testParts();
+void testEqualsFile();
+void testStream();
+
+void writeBig(char *path, int rows);
+void writeStray(char *path, int rows);
+void writeOpenQuote(char *path, int len);
+char *readWhole(char *path, size_t *len);
+void writeBytes(char *path, const char *data, size_t len);
+char readFile(char *path, char useIndex, int skip, char reverse, char numbered, FILE *out);
+char readRest(csv_handler *handler, char numbered, FILE *out);
+char readLimited(char *path, char *encoding, long maxRecord, FILE *out);
+char readEquals(char *path, char *valuesPath, char *column, FILE *out);
+char readParts(char **paths, int count, int threadCount, FILE *out);
+char printPart(csv_handler *part, FILE *out, void *data);
+void countMalformed(void *data, long count, size_t at);
+char streamTrace(char *fields, int stopAfter, char *trace);
+char traceField(void *data, int lineNum, int pos, const csv_span *field);
+char traceRecord(void *data, int lineNum, const csv_span *fields, int count);
+char sameOutput(FILE *a, FILE *b);
+char reversedOutput(FILE *a, FILE *b);
+char *outputRecords(FILE *out, size_t *len);
+
+#ifdef CSVIEW_GZIP
+void writeGzip(char *path, const char *data, size_t len);
+void writeBgzf(char *path, const char *data, size_t len, size_t blockLen);
+#endif
+
 int main()
 {
+    // Tests with files of their own.
+    testCompressed();
+    testBgzf();
+    testReverse();
+    testSeveralFiles();
+    testStrayQuotes();
+    testResync();
+    testParts();
+    testEqualsFile();
+    testStream();
+
     char *outputLine = NULL;
     char *borderLine = NULL;
     char *borderPadd = NULL;
+    csv_handler *handler = csv_handler_new();
 
-    csv_handler_set_width(17);
+    csv_handler_set_width(handler, 17);
 
     // Normal test.
 
     // Print header, with border.
-    //csv_handler_set_has_headers(0); // Need to do this, if do it, before read_next_line.
-    //csv_handler_set_delim('|');
-    csv_handler_read_next_line(); // Not bothering checking RCs right now.
-    csv_handler_set_headers_from_line(); // Needed for setting fields.
+    //csv_handler_set_has_headers(handler, 0); // Need to do this, if do it, before read_next_line.
+    //csv_handler_set_delim(handler, '|');
+    csv_handler_read_next_line(handler); // Not bothering checking RCs right now.
+    csv_handler_set_headers_from_line(handler); // Needed for setting fields.
     // Always do above two things *first*.
-    //csv_handler_set_selected_fields("B,D");
+    //csv_handler_set_selected_fields(handler, "B,D");
 
-    csv_handler_output_line_padding(&borderPadd);
+    csv_handler_output_line_padding(handler, &borderPadd);
 
-    csv_handler_border_line(&borderLine);
+    csv_handler_border_line(handler, &borderLine);
     printf("%s", borderPadd);
     printf("%s\n", borderLine);
 
-    csv_handler_output_line(&outputLine);
+    csv_handler_output_line(handler, &outputLine);
     printf("%s", borderPadd);
     printf("%s\n", outputLine);
     printf("%s", borderPadd);
     printf("%s\n", borderLine);
 
-    //csv_handler_restrict_by_lines("2-3,5");
+    //csv_handler_restrict_by_lines(handler, "2-3,5");
     //// This specific restriction can technically be done before getting the
     //// headers, but since other restrictions can't, putting this here for
     //// consistency.
 
-    //csv_handler_restrict_by_ranges("3", "10-17,23");
-    //csv_handler_restrict_by_equals("3", "7,15");
+    //csv_handler_restrict_by_ranges(handler, "3", "10-17,23");
+    //csv_handler_restrict_by_equals(handler, "3", "7,15");
 
-    while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
-        csv_handler_output_line_number(&outputLine);
+    while (csv_handler_read_next_line(handler) == CSV_HANDLER__OK) {
+        csv_handler_output_line_number(handler, &outputLine);
         printf("%s", outputLine);
-        csv_handler_output_line(&outputLine);
+        csv_handler_output_line(handler, &outputLine);
         printf("%s\n", outputLine);
     }
 
@@ -56,63 +133,879 @@ int main()
     printf("%s\n", borderLine);
 
     // Transposed test.
-    ////csv_handler_set_has_headers(0);
-    //csv_handler_read_next_line();
-    //csv_handler_set_headers_from_line();
-    //csv_handler_set_selected_fields("HeadA,HeadC,Range");
-    //csv_handler_restrict_by_lines("1-4");
-    ////csv_handler_restrict_by_ranges("Range", "5,7-9");
-    //csv_handler_initialize_transpose();
-
-    //csv_handler_transposed_number_line(&outputLine);
+    ////csv_handler_set_has_headers(handler, 0);
+    //csv_handler_read_next_line(handler);
+    //csv_handler_set_headers_from_line(handler);
+    //csv_handler_set_selected_fields(handler, "HeadA,HeadC,Range");
+    //csv_handler_restrict_by_lines(handler, "1-4");
+    ////csv_handler_restrict_by_ranges(handler, "Range", "5,7-9");
+    //csv_handler_initialize_transpose(handler);
+
+    //csv_handler_transposed_number_line(handler, &outputLine);
     //printf("%s\n", outputLine);
 
-    //csv_handler_transposed_border_line(&borderLine);
+    //csv_handler_transposed_border_line(handler, &borderLine);
     //printf("%s\n", borderLine);
-    //while (csv_handler_transposed_line(&outputLine) == CSV_HANDLER__OK) {
+    //while (csv_handler_transposed_line(handler, &outputLine) == CSV_HANDLER__OK) {
     //    printf("%s\n", outputLine);
     //}
     //printf("%s\n", borderLine);
 
     // Vertical test.
-    //csv_handler_set_has_headers(0);
-    //csv_handler_vertical_border_line(&borderLine);
-    //csv_handler_read_next_line();
-    //csv_handler_set_headers_from_line(); // Needed for vertical output.
-    //csv_handler_set_selected_fields("B,C");
-    //csv_handler_restrict_by_lines("1-2,4");
-
-    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    //csv_handler_set_has_headers(handler, 0);
+    //csv_handler_vertical_border_line(handler, &borderLine);
+    //csv_handler_read_next_line(handler);
+    //csv_handler_set_headers_from_line(handler); // Needed for vertical output.
+    //csv_handler_set_selected_fields(handler, "B,C");
+    //csv_handler_restrict_by_lines(handler, "1-2,4");
+
+    //while (csv_handler_read_next_line(handler) == CSV_HANDLER__OK) {
     //    printf("%s\n", borderLine);
-    //    csv_handler_output_vertical_entry(&outputLine);
+    //    csv_handler_output_vertical_entry(handler, &outputLine);
     //    printf("%s\n", outputLine);
     //}
     //printf("%s\n", borderLine);
 
     // Print headers test.
-    //csv_handler_read_next_line();
-    //csv_handler_set_headers_from_line();
-    //while (csv_handler_output_headers(&outputLine) == CSV_HANDLER__OK) {
+    //csv_handler_read_next_line(handler);
+    //csv_handler_set_headers_from_line(handler);
+    //while (csv_handler_output_headers(handler, &outputLine) == CSV_HANDLER__OK) {
     //    printf("%s\n", outputLine);
     //}
 
     // Print raw lines.
-    //csv_handler_set_delim('|');
-    //csv_handler_read_next_line(); // Not bothering checking RCs right now.
-    //csv_handler_set_headers_from_line(); // Needed for setting fields.
-    //csv_handler_set_selected_fields("B,D");
-    //csv_handler_restrict_by_lines("2-4");
-    //csv_handler_raw_line(&outputLine);
+    //csv_handler_set_delim(handler, '|');
+    //csv_handler_read_next_line(handler); // Not bothering checking RCs right now.
+    //csv_handler_set_headers_from_line(handler); // Needed for setting fields.
+    //csv_handler_set_selected_fields(handler, "B,D");
+    //csv_handler_restrict_by_lines(handler, "2-4");
+    //csv_handler_raw_line(handler, &outputLine);
     //printf("%s\n", outputLine);
 
-    //while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
-    //    csv_handler_raw_line(&outputLine);
+    //while (csv_handler_read_next_line(handler) == CSV_HANDLER__OK) {
+    //    csv_handler_raw_line(handler, &outputLine);
     //    printf("%s\n", outputLine);
     //}
 
 
-    free(outputLine);
     free(borderLine);
     free(borderPadd);
-    csv_handler_close();
+    csv_handler_close(handler);
+}
+
+/**
+ * Compressed input that's cut off or corrupt is an error, after the records
+ * that could be read.
+ */
+void testCompressed()
+{
+#ifdef CSVIEW_GZIP
+    FILE *out = tmpfile();
+    size_t len;
+    char *data;
+
+    writeBig(BIG_FILE, 20000);
+    data = readWhole(BIG_FILE, &len);
+    writeGzip(CUT_GZIP, data, len);
+    free(data);
+    data = readWhole(CUT_GZIP, &len);
+
+    writeBytes(CUT_GZIP, data, len / 2);
+    printf("cut off gzip: should be %d: %d\n", CSV_HANDLER__READ_ERROR,
+        readFile(CUT_GZIP, 0, 0, 0, 1, out));
+
+    data[len / 2] ^= 0x55;
+    data[len / 2 + 1] ^= 0x55;
+    writeBytes(BAD_GZIP, data, len);
+    printf("corrupt gzip: should be %d: %d\n", CSV_HANDLER__READ_ERROR,
+        readFile(BAD_GZIP, 0, 0, 0, 1, out));
+
+    free(data);
+    remove(BIG_FILE);
+    remove(CUT_GZIP);
+    remove(BAD_GZIP);
+    fclose(out);
+#endif
+}
+
+/**
+ * Skipping lines of BGZF input (which jumps to the block they're in) gets to
+ * the same records as in the plain file, and input that's cut off is an
+ * error.
+ */
+void testBgzf()
+{
+#ifdef CSVIEW_GZIP
+    FILE *plain = tmpfile();
+    FILE *other = tmpfile();
+    size_t len;
+    char *data;
+
+    writeBig(BIG_FILE, 20000);
+    data = readWhole(BIG_FILE, &len);
+    writeBgzf(BIG_BGZF, data, len, 4096);
+    free(data);
+
+    readFile(BIG_FILE, 0, 15000, 0, 1, plain);
+    readFile(BIG_BGZF, 0, 15000, 0, 1, other);
+    printf("BGZF skipping: should be 1: %d\n", sameOutput(plain, other));
+
+    // With an index (of virtual offsets), the index jumps to the right block,
+    // and the BGZF skipping goes on from there.
+    readFile(BIG_BGZF, 1, 15000, 0, 1, other); // Writes the index.
+    printf("BGZF, -I writing: should be 1: %d\n", sameOutput(plain, other));
+    readFile(BIG_BGZF, 1, 15000, 0, 1, other); // Reads it.
+    printf("BGZF, -I reading: should be 1: %d\n", sameOutput(plain, other));
+
+    // Fewer than BGZF skipping bothers with, so just the index.
+    readFile(BIG_FILE, 0, 3000, 0, 1, plain);
+    readFile(BIG_BGZF, 1, 3000, 0, 1, other);
+    printf("BGZF, -I only: should be 1: %d\n", sameOutput(plain, other));
+
+    // Blocks appended (the way cat would) only get indexed.
+    size_t bgzfLen;
+    char *bgzfData = readWhole(BIG_BGZF, &bgzfLen);
+
+    data = readWhole(BIG_FILE, &len);
+    char *twice = malloc(len * 2); // (Longer than the BGZF.)
+    memcpy(twice, data, len);
+    memcpy(twice + len, data, len);
+    writeBytes(BIG_FILE, twice, len * 2);
+    memcpy(twice, bgzfData, bgzfLen);
+    memcpy(twice + bgzfLen, bgzfData, bgzfLen);
+    writeBytes(BIG_BGZF, twice, bgzfLen * 2);
+    free(twice);
+    free(bgzfData);
+    free(data);
+
+    readFile(BIG_FILE, 0, 33000, 0, 1, plain);
+    readFile(BIG_BGZF, 1, 33000, 0, 1, other);
+    printf("BGZF, -I appended: should be 1: %d\n", sameOutput(plain, other));
+
+    data = readWhole(BIG_BGZF, &len);
+    writeBytes(CUT_GZIP, data, len / 4);
+    printf("cut off BGZF: should be %d: %d\n", CSV_HANDLER__READ_ERROR,
+        readFile(CUT_GZIP, 0, 15000, 0, 1, other));
+
+    free(data);
+    remove(BIG_FILE);
+    remove(BIG_BGZF);
+    remove(BIG_BGZF ".csvidx");
+    remove(CUT_GZIP);
+    fclose(plain);
+    fclose(other);
+#endif
+}
+
+/**
+ * Reading backwards (-b) gets the records last to first, with their true line
+ * numbers if there's an index (and otherwise, numbers counting back from the
+ * end, which are left out here).
+ */
+void testReverse()
+{
+    FILE *plain = tmpfile();
+    FILE *other = tmpfile();
+
+    writeBig(BIG_FILE, 20000);
+
+    readFile(BIG_FILE, 0, 0, 0, 0, plain);
+    readFile(BIG_FILE, 0, 0, 1, 0, other);
+    printf("-b: should be 1: %d\n", reversedOutput(plain, other));
+
+    readFile(BIG_FILE, 1, 0, 0, 1, plain); // Writes the index.
+    readFile(BIG_FILE, 1, 0, 1, 1, other);
+    printf("-b with -I, numbered: should be 1: %d\n", reversedOutput(plain, other));
+
+    remove(BIG_FILE);
+    remove(BIG_FILE ".csvidx");
+    fclose(plain);
+    fclose(other);
+}
+
+/**
+ * Several files read in parts (-j), each file a part of its own at least, get
+ * the same records, numbered the same, as on one thread.  A file with quoting
+ * mistakes in the middle stops the parts there.
+ */
+void testSeveralFiles()
+{
+    FILE *plain = tmpfile();
+    FILE *other = tmpfile();
+    char *paths[] = { BIG_FILE, STRAY_FILE, BIG_FILE };
+    char rc;
+
+    writeBig(BIG_FILE, 20000);
+    writeStray(STRAY_FILE, 8000);
+
+    readParts(paths, 3, 1, plain);
+    rc = readParts(paths, 3, 4, other);
+    printf("parts, several files rc: should be 0: %d\n", rc);
+    printf("parts, several files: should be 1: %d\n", sameOutput(plain, other));
+
+    remove(BIG_FILE);
+    remove(STRAY_FILE);
+
+    // The mistakes are passed to the callback (instead of printed), and can
+    // be looked up after.
+    csv_handler *handler = csv_handler_new();
+    long counted[2] = { 0, -1 };
+    size_t at = 0;
+
+    writeBytes(STRAY_SMALL, "a,b\n1,x\"y\n2,3\n4,z\"w\n", 20);
+    csv_handler_set_malformed_callback(handler, countMalformed, counted);
+    csv_handler_set_input_file(handler, STRAY_SMALL);
+    csv_handler_read_next_line(handler);
+    csv_handler_set_headers_from_line(handler);
+    readRest(handler, 0, plain);
+    printf("stray, callback: should be 2 17: %ld %ld\n", counted[0], counted[1]);
+    counted[0] = csv_handler_malformed(handler, &at);
+    printf("stray, looked up: should be 2 17: %ld %d\n", counted[0], (int) at);
+
+    csv_handler_close(handler);
+    remove(STRAY_SMALL);
+    fclose(plain);
+    fclose(other);
+}
+
+/**
+ * Stray quotes: plain ones in the middle of a field, and quoted fields that
+ * are never closed or are closed in the middle of a field.  Every way of
+ * getting to the records gets the same ones as reading straight through.
+ */
+void testStrayQuotes()
+{
+    FILE *plain = tmpfile();
+    FILE *other = tmpfile();
+
+    writeStray(STRAY_FILE, 8000);
+
+    readFile(STRAY_FILE, 0, 5000, 0, 1, plain);
+    readFile(STRAY_FILE, 1, 5000, 0, 1, other); // Writes the index.
+    printf("stray, -I writing: should be 1: %d\n", sameOutput(plain, other));
+    readFile(STRAY_FILE, 1, 5000, 0, 1, other); // Reads it.
+    printf("stray, -I reading: should be 1: %d\n", sameOutput(plain, other));
+
+#ifdef CSVIEW_GZIP
+    size_t len;
+    char *data = readWhole(STRAY_FILE, &len);
+
+    writeBgzf(STRAY_BGZF, data, len, 4096);
+    readFile(STRAY_BGZF, 0, 5000, 0, 1, other);
+    printf("stray, BGZF: should be 1: %d\n", sameOutput(plain, other));
+
+    free(data);
+    remove(STRAY_BGZF);
+#endif
+
+    // (The index stops at the first quoting mistake, so line numbers going
+    // backwards count back from the end either way, and are left out.)
+    readFile(STRAY_FILE, 0, 0, 0, 0, plain);
+    readFile(STRAY_FILE, 1, 0, 1, 0, other);
+    printf("stray, -b with -I: should be 1: %d\n", reversedOutput(plain, other));
+
+    remove(STRAY_FILE ".csvidx");
+    readFile(STRAY_FILE, 0, 0, 1, 0, other);
+    printf("stray, -b: should be 1: %d\n", reversedOutput(plain, other));
+
+    remove(STRAY_FILE);
+    fclose(plain);
+    fclose(other);
+}
+
+/**
+ * A quoted field that's never closed, on a line longer than the -q limit.
+ * The rest of the line goes with it, and reading picks back up on the next
+ * one.
+ */
+void testResync()
+{
+    FILE *plain = tmpfile();
+    FILE *other = tmpfile();
+
+    writeBytes(RESYNC_GOOD, "a,b\n1,2\n6,7\n", 12);
+    readFile(RESYNC_GOOD, 0, 0, 0, 1, plain);
+
+    writeOpenQuote(RESYNC_FILE, 100);
+    readLimited(RESYNC_FILE, NULL, 50, other);
+    printf("resync past the limit: should be 1: %d\n", sameOutput(plain, other));
+
+    // The same for a stream (read as Latin-1, so it's transcoded), with no
+    // newline after the quote in all of the buffer.
+    writeOpenQuote(RESYNC_FILE, 300000);
+    readLimited(RESYNC_FILE, "latin1", 1000, other);
+    printf("resync past the buffer: should be 1: %d\n", sameOutput(plain, other));
+
+    remove(RESYNC_FILE);
+    remove(RESYNC_GOOD);
+    fclose(plain);
+    fclose(other);
+}
+
+/**
+ * A file big enough to split into parts (-j) gets the same records, numbered
+ * the same, as on one thread.
+ */
+void testParts()
+{
+    FILE *plain = tmpfile();
+    FILE *other = tmpfile();
+    char *paths[] = { BIG_FILE };
+    char rc;
+
+    writeBig(BIG_FILE, 300000);
+
+    readFile(BIG_FILE, 0, 0, 0, 1, plain);
+    rc = readParts(paths, 1, 4, other);
+    printf("parts, one file rc: should be 0: %d\n", rc);
+    printf("parts, one file: should be 1: %d\n", sameOutput(plain, other));
+
+    remove(BIG_FILE);
+    fclose(plain);
+    fclose(other);
+}
+
+/**
+ * Equals restrictions with the values in a file (-r f): one a line, or the
+ * fields under a header of a CSV.
+ */
+void testEqualsFile()
+{
+    FILE *plain = tmpfile();
+    FILE *other = tmpfile();
+
+    writeBytes(EQUALS_FILE, "id,name\n1,a\n2,b\n3,c\n4,d\n", 24);
+
+    // Empty lines are skipped.
+    writeBytes(EQUALS_VALUES, "2\n\n4\n", 5);
+    writeBytes(EQUALS_GOOD, "id,name\n2,b\n4,d\n", 16);
+    readFile(EQUALS_GOOD, 0, 0, 0, 0, plain);
+    readEquals(EQUALS_FILE, EQUALS_VALUES, NULL, other);
+    printf("-r f, a value a line: should be 1: %d\n", sameOutput(plain, other));
+
+    // A quoted field in the way, and an empty one (which is skipped).
+    writeBytes(EQUALS_VALUES, "x,id\n\"q,r\",3\ns,1\nt,\n", 20);
+    writeBytes(EQUALS_GOOD, "id,name\n1,a\n3,c\n", 16);
+    readFile(EQUALS_GOOD, 0, 0, 0, 0, plain);
+    readEquals(EQUALS_FILE, EQUALS_VALUES, "id", other);
+    printf("-r f, a column: should be 1: %d\n", sameOutput(plain, other));
+
+    printf("-r f, no such column: should be %d: %d\n", CSV_HANDLER__HEADER_NOT_FOUND,
+        readEquals(EQUALS_FILE, EQUALS_VALUES, "nope", other));
+
+    remove(EQUALS_VALUES);
+    printf("-r f, no such file: should be %d: %d\n", CSV_HANDLER__FILE_NOT_FOUND,
+        readEquals(EQUALS_FILE, EQUALS_VALUES, NULL, other));
+
+    remove(EQUALS_FILE);
+    remove(EQUALS_GOOD);
+    fclose(plain);
+    fclose(other);
+}
+
+/**
+ * The fields of each line handed to callbacks (-> csv_handler_stream), with
+ * fields selected, a quoted field with doubled quotes, and a callback that
+ * stops the stream early.
+ */
+void testStream()
+{
+    char trace[1024];
+
+    writeBytes(STREAM_FILE, "a,b,c\n1,\"x,\"\"y\"\"\",3\n4,5,6\n7,8,9\n", 32);
+
+    printf("stream: should be 0: %d\n", streamTrace("c,b", 0, trace));
+    printf("stream trace: should be 1: %d\n",
+        strcmp(trace, "1:0=3;1:1=x,\"y\";|2\n2:0=6;2:1=5;|2\n3:0=9;3:1=8;|2\n") == 0);
+
+    printf("stream stopped: should be %d: %d\n", CSV_HANDLER__DONE, streamTrace("a", 2, trace));
+    printf("stream stopped trace: should be 1: %d\n", strcmp(trace, "1:0=1;|1\n2:0=4;|1\n") == 0);
+
+    remove(STREAM_FILE);
+}
+
+/**
+ * Write a well-formed file, with multi-line fields.
+ *
+ * @param   path
+ * @param   rows
+ */
+void writeBig(char *path, int rows)
+{
+    FILE *file = fopen(path, "wb");
+
+    fprintf(file, "Num,Text,Other\n");
+    for (int i = 1; i <= rows; i++) {
+        if (i % 11 == 5) {
+            fprintf(file, "%d,\"multi\nline, \"\"quoted\"\"\",%d\n", i, i * 7);
+        } else {
+            fprintf(file, "%d,some text for row %d,%d\n", i, i, i * 7);
+        }
+    }
+
+    fclose(file);
+}
+
+/**
+ * Write a file with quoting mistakes in it, and multi-line fields.
+ *
+ * @param   path
+ * @param   rows
+ */
+void writeStray(char *path, int rows)
+{
+    FILE *file = fopen(path, "wb");
+
+    fprintf(file, "Num,Text,Other\n");
+    for (int i = 1; i <= rows; i++) {
+        if (i % 50 == 10) {
+            // Not closed before the next row's opening quote.
+            fprintf(file, "%d,\"open,x\n", i);
+        } else if (i % 97 == 7) {
+            fprintf(file, "%d,\"bad\"close,x\n", i);
+        } else if (i % 13 == 5) {
+            fprintf(file, "%d,\"multi\nline, \"\"quoted\"\"\",x\n", i);
+        } else if (i % 7 == 3) {
+            fprintf(file, "%d,ab\"cd,\"x\"\n", i);
+        } else {
+            fprintf(file, "%d,plain %d,x\n", i, i);
+        }
+    }
+
+    fclose(file);
+}
+
+/**
+ * Write a file with a quoted field that's never closed, with len more bytes
+ * after it on its line, between two good lines.
+ *
+ * @param   path
+ * @param   len
+ */
+void writeOpenQuote(char *path, int len)
+{
+    FILE *file = fopen(path, "wb");
+
+    fprintf(file, "a,b\n1,2\n4,\"open");
+    for (int i = 0; i < len; i++) {
+        fputc('x', file);
+    }
+    fprintf(file, ",5\n6,7\n");
+
+    fclose(file);
+}
+
+/**
+ * Read a whole file into memory.  Free what's returned.
+ *
+ * @param   path
+ * @param   len
+ */
+char *readWhole(char *path, size_t *len)
+{
+    FILE *file = fopen(path, "rb");
+
+    fseek(file, 0, SEEK_END);
+    *len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *data = malloc(*len);
+    *len = fread(data, 1, *len, file);
+    fclose(file);
+
+    return data;
+}
+
+/**
+ * Write len bytes of data to a file.
+ *
+ * @param   path
+ * @param   data
+ * @param   len
+ */
+void writeBytes(char *path, const char *data, size_t len)
+{
+    FILE *file = fopen(path, "wb");
+
+    fwrite(data, 1, len, file);
+    fclose(file);
+}
+
+/**
+ * Read the records of a file (after skipping some, maybe with an index, or
+ * last to first) to out, from the start.
+ *
+ * @param   path
+ * @param   useIndex
+ * @param   skip
+ * @param   reverse
+ * @param   numbered    Whether to write line numbers.
+ * @param   out
+ */
+char readFile(char *path, char useIndex, int skip, char reverse, char numbered, FILE *out)
+{
+    csv_handler *handler = csv_handler_new();
+    char rc;
+
+    rewind(out);
+
+    if ((rc = csv_handler_set_input_file(handler, path)) == CSV_HANDLER__OK
+        && (!useIndex || (rc = csv_handler_set_use_index(handler)) == CSV_HANDLER__OK)
+        && (skip == 0 || (rc = csv_handler_skip_lines(handler, skip)) == CSV_HANDLER__OK)
+        && (!reverse || (rc = csv_handler_set_tail(handler, 0, 1)) == CSV_HANDLER__OK)
+        && (rc = csv_handler_read_next_line(handler)) == CSV_HANDLER__OK
+        && (rc = csv_handler_set_headers_from_line(handler)) == CSV_HANDLER__OK
+    ) {
+        rc = readRest(handler, numbered, out);
+    }
+
+    csv_handler_close(handler);
+
+    return rc;
+}
+
+/**
+ * Write the rest of the records to out, each one NUL-terminated (after its
+ * line number, if numbered).
+ *
+ * @param   handler
+ * @param   numbered
+ * @param   out
+ */
+char readRest(csv_handler *handler, char numbered, FILE *out)
+{
+    char *outputLine = NULL;
+    char rc;
+
+    while ((rc = csv_handler_read_next_line(handler)) == CSV_HANDLER__OK) {
+        csv_handler_raw_line(handler, &outputLine);
+        if (numbered) {
+            fprintf(out, "%d:", csv_handler_line_num(handler));
+        }
+        fprintf(out, "%s%c", outputLine, '\0');
+    }
+
+    return (rc == CSV_HANDLER__DONE) ? CSV_HANDLER__OK : rc;
+}
+
+/**
+ * Read the records of a file to out, from the start, with a limit on how
+ * long a record can be inside of a quoted field (see
+ * csv_handler_set_max_record), and maybe an encoding.
+ *
+ * @param   path
+ * @param   encoding    NULL for the default.
+ * @param   maxRecord
+ * @param   out
+ */
+char readLimited(char *path, char *encoding, long maxRecord, FILE *out)
+{
+    csv_handler *handler = csv_handler_new();
+    char rc;
+
+    rewind(out);
+    csv_handler_set_max_record(handler, maxRecord);
+
+    if ((encoding == NULL || (rc = csv_handler_set_encoding(handler, encoding)) == CSV_HANDLER__OK)
+        && (rc = csv_handler_set_input_file(handler, path)) == CSV_HANDLER__OK
+        && (rc = csv_handler_read_next_line(handler)) == CSV_HANDLER__OK
+        && (rc = csv_handler_set_headers_from_line(handler)) == CSV_HANDLER__OK
+    ) {
+        rc = readRest(handler, 1, out);
+    }
+
+    csv_handler_close(handler);
+
+    return rc;
+}
+
+/**
+ * Read the records of a file to out, from the start, restricted to the ones
+ * with an id in the values file (see csv_handler_restrict_by_equals_file).
+ *
+ * @param   path
+ * @param   valuesPath
+ * @param   column      NULL for a value a line.
+ * @param   out
+ */
+char readEquals(char *path, char *valuesPath, char *column, FILE *out)
+{
+    csv_handler *handler = csv_handler_new();
+    char rc;
+
+    rewind(out);
+
+    if ((rc = csv_handler_set_input_file(handler, path)) == CSV_HANDLER__OK
+        && (rc = csv_handler_read_next_line(handler)) == CSV_HANDLER__OK
+        && (rc = csv_handler_set_headers_from_line(handler)) == CSV_HANDLER__OK
+        && (rc = csv_handler_restrict_by_equals_file(handler, "id", valuesPath, column)) == CSV_HANDLER__OK
+    ) {
+        rc = readRest(handler, 0, out);
+    }
+
+    csv_handler_close(handler);
+
+    return rc;
+}
+
+/**
+ * Read the records of the files to out, from the start, in parts on
+ * threadCount threads (see csv_handler_run_parts).
+ *
+ * @param   paths
+ * @param   count
+ * @param   threadCount
+ * @param   out
+ */
+char readParts(char **paths, int count, int threadCount, FILE *out)
+{
+    csv_handler *handler = csv_handler_new();
+    char rc;
+
+    rewind(out);
+
+    if ((rc = csv_handler_set_input_files(handler, paths, count)) == CSV_HANDLER__OK
+        && (rc = csv_handler_read_next_line(handler)) == CSV_HANDLER__OK
+        && (rc = csv_handler_set_headers_from_line(handler)) == CSV_HANDLER__OK
+        && (rc = csv_handler_run_parts(handler, threadCount, printPart, NULL, out)) == CSV_HANDLER__OK
+    ) {
+        rc = readRest(handler, 1, out);
+    }
+
+    csv_handler_close(handler);
+
+    return rc;
+}
+
+/**
+ * Write the records of a part (see csv_handler_run_parts).
+ *
+ * @param   part
+ * @param   out
+ * @param   unused
+ */
+char printPart(csv_handler *part, FILE *out, void *unused)
+{
+    return readRest(part, 1, out);
+}
+
+/**
+ * Add up the quoting mistakes passed to it in data[0], and put where the last
+ * one was in data[1].
+ *
+ * @param   data
+ * @param   count
+ * @param   at
+ */
+void countMalformed(void *data, long count, size_t at)
+{
+    long *counted = data;
+
+    counted[0] += count;
+    counted[1] = at;
+}
+
+/**
+ * Stream STREAM_FILE with the fields selected, writing down each field and
+ * record the callbacks get in trace.  Returns what csv_handler_stream does.
+ *
+ * @param   fields
+ * @param   stopAfter   Records to stop after (0 to go to the end).
+ * @param   trace
+ */
+char streamTrace(char *fields, int stopAfter, char *trace)
+{
+    csv_handler *handler = csv_handler_new();
+    streamState state = { trace, 0, stopAfter };
+    char rc;
+
+    trace[0] = '\0';
+
+    if ((rc = csv_handler_set_input_file(handler, STREAM_FILE)) == CSV_HANDLER__OK
+        && (rc = csv_handler_read_next_line(handler)) == CSV_HANDLER__OK
+        && (rc = csv_handler_set_headers_from_line(handler)) == CSV_HANDLER__OK
+        && (rc = csv_handler_set_selected_fields(handler, fields)) == CSV_HANDLER__OK
+    ) {
+        csv_handler_set_callbacks(handler, traceRecord, traceField, &state);
+        rc = csv_handler_stream(handler);
+    }
+
+    csv_handler_close(handler);
+
+    return rc;
+}
+
+/**
+ * Field callback: write down "line:pos=field;".
+ *
+ * @param   data
+ * @param   lineNum
+ * @param   pos
+ * @param   field
+ */
+char traceField(void *data, int lineNum, int pos, const csv_span *field)
+{
+    streamState *state = data;
+    char *end = state->trace + strlen(state->trace);
+
+    sprintf(end, "%d:%d=%.*s;", lineNum, pos, (int) field->len, field->start);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Record callback: write down "|count" and a newline, and stop once there
+ * have been stopAfter records.
+ *
+ * @param   data
+ * @param   lineNum
+ * @param   fields
+ * @param   count
+ */
+char traceRecord(void *data, int lineNum, const csv_span *fields, int count)
+{
+    streamState *state = data;
+    char *end = state->trace + strlen(state->trace);
+
+    sprintf(end, "|%d\n", count);
+    state->records++;
+
+    return (state->records == state->stopAfter) ? CSV_HANDLER__DONE : CSV_HANDLER__OK;
+}
+
+/**
+ * Whether what was written to a and b is the same (and not nothing).
+ *
+ * @param   a
+ * @param   b
+ */
+char sameOutput(FILE *a, FILE *b)
+{
+    size_t aLen;
+    size_t bLen;
+    char *aRecords = outputRecords(a, &aLen);
+    char *bRecords = outputRecords(b, &bLen);
+    char same = aLen > 0 && aLen == bLen && memcmp(aRecords, bRecords, aLen) == 0;
+
+    free(aRecords);
+    free(bRecords);
+
+    return same;
+}
+
+/**
+ * Whether the records written to b are the ones written to a, last to first
+ * (and not nothing).
+ *
+ * @param   a
+ * @param   b
+ */
+char reversedOutput(FILE *a, FILE *b)
+{
+    size_t aLen;
+    size_t bLen;
+    char *aRecords = outputRecords(a, &aLen);
+    char *bRecords = outputRecords(b, &bLen);
+    char same = aLen > 0 && aLen == bLen;
+
+    // Each record in b, from the start, against a from the end.
+    for (size_t bPos = 0, aEnd = aLen; same && bPos < bLen; ) {
+        size_t recLen = strlen(bRecords + bPos) + 1;
+
+        same = recLen <= aEnd && memcmp(aRecords + aEnd - recLen, bRecords + bPos, recLen) == 0;
+        bPos += recLen;
+        aEnd -= recLen;
+    }
+
+    free(aRecords);
+    free(bRecords);
+
+    return same;
+}
+
+/**
+ * What's been written to out since it was rewound.  Free what's returned.
+ *
+ * @param   out
+ * @param   len
+ */
+char *outputRecords(FILE *out, size_t *len)
+{
+    fflush(out);
+    *len = ftell(out);
+
+    char *records = malloc(*len + 1);
+    rewind(out);
+    *len = fread(records, 1, *len, out);
+    records[*len] = '\0';
+
+    return records;
+}
+
+#ifdef CSVIEW_GZIP
+/**
+ * Write data to a gzip file.
+ *
+ * @param   path
+ * @param   data
+ * @param   len
+ */
+void writeGzip(char *path, const char *data, size_t len)
+{
+    gzFile file = gzopen(path, "wb");
+
+    gzwrite(file, data, len);
+    gzclose(file);
+}
+
+/**
+ * Write data to a BGZF file, blockLen bytes of it (at most) to a block.
+ *
+ * @param   path
+ * @param   data
+ * @param   len
+ * @param   blockLen
+ */
+void writeBgzf(char *path, const char *data, size_t len, size_t blockLen)
+{
+    FILE *file = fopen(path, "wb");
+    unsigned char block[65536];
+    size_t pos = 0;
+
+    // (The last block, with nothing in it, marks the end.)
+    for (;;) {
+        size_t inLen = (len - pos < blockLen) ? len - pos : blockLen;
+        z_stream strm;
+
+        memset(&strm, 0, sizeof(strm));
+        deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        strm.next_in = (unsigned char *) data + pos;
+        strm.avail_in = inLen;
+        strm.next_out = block + 18;
+        strm.avail_out = sizeof(block) - 26;
+        deflate(&strm, Z_FINISH);
+
+        size_t blockSize = 18 + strm.total_out + 8;
+        unsigned long crc = crc32(0, (unsigned char *) data + pos, inLen);
+        unsigned char header[18] = {
+            0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0,
+            (blockSize - 1) & 0xff, (blockSize - 1) >> 8
+        };
+
+        deflateEnd(&strm);
+        memcpy(block, header, 18);
+        for (int i = 0; i < 4; i++) {
+            block[blockSize - 8 + i] = (crc >> (8 * i)) & 0xff;
+            block[blockSize - 4 + i] = (inLen >> (8 * i)) & 0xff;
+        }
+        fwrite(block, 1, blockSize, file);
+
+        if (inLen == 0) {
+            break;
+        }
+        pos += inLen;
+    }
+
+    fclose(file);
 }
+#endif
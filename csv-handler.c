@@ -1,255 +1,826 @@
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "csv.h"
+#include "csvh-arena.h"
+#include "csvh-filter.h"
 #include "csvh-line-helper.h"
+#include "csvh-memout.h"
+#include "csvh-pool.h"
+#include "csvh-reader.h"
+#include "csvh-scan.h"
+#include "csvh-sniff.h"
+#include "csvh-transcode.h"
 
 #include "csv-handler.h"
 
 /**
- * Delimiter.
+ * Everything about one input being handled (see csv_handler_new).
  */
-static char delim = ',';
+struct csv_handler {
+    /**
+     * Delimiter and quoting.
+     */
+    csv_dialect dialect;
+
+    /**
+     * For unparsedLength: what each byte means to the dialect (UNPARSE_*).
+     */
+    unsigned char unparseClasses[256];
+
+    /**
+     * Where the input comes from.  Opened on stdin on first read if no input
+     * file was set.
+     */
+    csvh_reader *reader;
+
+    /**
+     * Current complete line.  Not null-terminated when it points into the
+     * reader, so always go by lineLen.
+     */
+    char *line;
+
+    /**
+     * Length of the current line.
+     */
+    size_t lineLen;
+
+    /**
+     * Whether line was allocated by this module (as opposed to pointing into
+     * the reader's memory).
+     */
+    char lineOwned;
+
+    /**
+     * Longest a record can be while inside of a quoted field before it's taken
+     * to be a quoting mistake and skipped.  0 means no limit.
+     */
+    size_t maxRecord;
+
+    /**
+     * Count of quoting mistakes that have been passed to malformedCallback.
+     */
+    long malformedReported;
+
+    /**
+     * What's called with quoting mistakes as they're run into (see
+     * csv_handler_set_malformed_callback), and what it's passed.
+     */
+    csv_handler_malformed_callback malformedCallback;
+    void *malformedData;
+
+    /**
+     * Fields of the current line (all of them, not just the selected ones), or
+     * -1 if it hasn't been split up yet.  See getLineSpans.
+     */
+    csv_span *spans;
+    int spanCap;
+    int spanCount;
+
+    /**
+     * Which fields of a line have to be parsed for output, when only some are
+     * selected: field i does if neededFields[i] is nonzero.  There's no need to
+     * look at fields past neededCount at all.  NULL if all fields are output.
+     */
+    char *neededFields;
+    int neededCount;
+
+    /**
+     * Memory that only lasts as long as the current line: everything that gets
+     * output for it, and a copy of it if it had to be copied to be unescaped.
+     * Reset each time a line is let go of (see freeLine), or for transposed
+     * output, each time a line is output.
+     */
+    csvh_arena *lineArena;
+
+    /**
+     * Width used to display line numbers.
+     */
+    int linePad;
+
+    /**
+     * Temporary line to hold in memory until called.
+     */
+    char *lineBuff;
+
+    /**
+     * Length of lineBuff.
+     */
+    size_t lineBuffLen;
+
+    /**
+     * Headers as array of strings.
+     */
+    char **headers;
+
+    /**
+     * Source file has text headers.  Default to true.
+     */
+    char hasHeaders;
+
+    /**
+     * Whether the delimiter, quote and hasHeaders were set (so shouldn't be
+     * guessed).
+     */
+    char delimSet;
+    char quoteSet;
+    char hasHeadersSet;
+
+    /**
+     * Guess the delimiter, quote and hasHeaders from the start of the input,
+     * unless they were set.  Default to true.
+     */
+    char sniff;
+
+    /**
+     * Encoding of the input (CSVH_TRANSCODE_ENCODING__*).  Default to AUTO,
+     * i.e., told from the start of the input.
+     */
+    int encoding;
+
+    /**
+     * The fields to be included in output.  Terminated by -1.  If NULL, then
+     * include all values.
+     */
+    int *selectedFields;
+
+    /**
+     * Count of headers in source file.
+     */
+    int countHeaders;
+
+    /**
+     * Count of fields displayed in output.  -1 means display everything.
+     */
+    int selectedFieldCount;
+
+    /**
+     * Width of cells to output.
+     */
+    int width;
+
+    /**
+     * Array of array of strings, terminated by a NULL at the end.  Good grief;
+     * this will be annoying.  Holds the entirety of the input file except what
+     * is filtered out, and except for the headers.  Currently only used for
+     * displaying transposed output.
+     */
+    char ***entireInput;
+
+    /**
+     * Array of integers of line numbers from the source file to display.  Only
+     * used for transposed output.
+     */
+    int *lineNums;
+
+    /**
+     * The selected fields of the current line, for csv_handler_line_fields.
+     * NULL if all fields are output (so spans is used as is).
+     */
+    csv_span *outputSpans;
+
+    /**
+     * What csv_handler_stream calls for each line, and what it passes them.
+     * Either can be NULL.
+     */
+    csv_handler_record_callback recordCallback;
+    csv_handler_field_callback fieldCallback;
+    void *callbackData;
+
+    /**
+     * Where csv_handler_output_headers and csv_handler_transposed_line are up
+     * to.
+     */
+    int headerOutputInd;
+    int transposedInd;
+
+    /**
+     * Which lines to output.
+     */
+    csvh_line_helper *lineHelper;
+
+    /**
+     * Set for a part of the input (see csv_handler_run_parts).  A part shares
+     * the headers and selected fields of the handler it came from, so it
+     * doesn't free them.
+     */
+    char isPart;
+};
 
 /**
- * Current complete line.
+ * For csv_handler_run_parts: how much of the input goes into each part.
+ * There has to be at least two parts' worth left for it to bother, unless
+ * there are more files to go.
  */
-static char *line = NULL;
+#define PART_SIZE (4 * 1024 * 1024)
 
 /**
- * Width used to display line numbers.
+ * For csv_handler_run_parts: how many files after the current one (if there
+ * are several) are split up at a time.  They're all open until they're done.
  */
-static int linePad = 3;
+#define FILES_PER_ROUND 256
 
 /**
- * Temporary line to hold in memory until called.
+ * For csv_handler_run_parts: how many parts each thread can get ahead of the
+ * one being written out, since each one's output is held in memory until
+ * then.
  */
-static char *lineBuff = NULL;
+#define PARTS_AHEAD_PER_THREAD 2
 
 /**
- * Headers as array of strings.
+ * For csv_handler_run_parts: one stretch of the input, what csvh_scan_count
+ * found in it, and (once it's a part) what it was turned into.
  */
-static char **headers = NULL;
+typedef struct {
+    const char *start;
+    const char *end;
+    csvh_scan_counts counts;
+
+    /**
+     * What it's a stretch of: the input, or with several files, one of the
+     * files after the current one (the fileInd-th, or -1 for the input).
+     */
+    csvh_reader *source;
+    int fileInd;
+
+    /**
+     * Number of the part's first line.
+     */
+    int firstLine;
+
+    csv_handler *part;
+    char rc;
+} partTask;
+
+/**
+ * Everything the csv_handler_run_parts tasks need.
+ */
+typedef struct {
+    csv_handler *handler;
+    partTask *tasks;
+    int taskCount;
+
+    /**
+     * What the parts were written out as.  There's one for each part that
+     * can be ahead of the one being written out, and each is reused for part
+     * after part.
+     */
+    csvh_memout *outputs;
+    int outputCount;
+
+    /**
+     * With several files, the ones after the current one that are split up
+     * too (see csvh_reader_open_later_file).  NULL for one that can't be.
+     */
+    csvh_reader **files;
+    int fileCount;
+    char quote;
+    csv_handler_part_callback run;
+    void *data;
+
+    /**
+     * Set once the parts that are left aren't going to be used.
+     */
+    atomic_char stop;
+} partRun;
+
+
+// START forward declarations for static functions.
+
+static char getParsedLine(csv_handler *handler, char ***parsedLine);
+
+static char getLineSpans(csv_handler *handler);
+
+static const csv_span *getOutputSpan(csv_handler *handler, int pos);
+
+static int getOutputSpanCount(csv_handler *handler);
+
+static void *lineAlloc(csv_handler *handler, size_t size);
+
+static char *writeBoxed(char *dest, const char *value, size_t len, int width, char useBrace);
+
+static size_t unparsedLength(csv_handler *handler, const csv_span *span);
+
+static char hasDelim(csv_handler *handler, const csv_span *span);
+
+static void useDialect(csv_handler *handler, const csv_dialect *updated);
+
+static void setUnparseClasses(csv_handler *handler);
+
+static char *writeUnparsed(csv_handler *handler, char *dest, const csv_span *span);
+
+static int getSelectedFieldCount(csv_handler *handler);
+
+static char *getHeaderFromPosition(csv_handler *handler, int pos);
+
+
+
+static int getHeaderIndexFromString(csv_handler *handler, char *critHeader);
+
+static char setHeadersAsNumbers(csv_handler *handler);
+
+static int countDigits(int num);
+
+static char openReader(csv_handler *handler);
+
+static char fromReaderRc(char rc);
+
+static void setUpReader(csv_handler *handler);
+
+static void sniffDialect(csv_handler *handler, csvh_reader *sampleReader);
+
+static void sniffDelim(csv_handler *handler, const char *sample, size_t len, char complete);
+
+static void reportMalformed(csv_handler *handler);
+
+static void freeLine(csv_handler *handler);
+
+static char runPartRound(
+    csv_handler *handler,
+    int threadCount,
+    csv_handler_part_callback run,
+    void *data,
+    FILE *out,
+    char *more
+);
+
+static void endPartRun(partRun *run);
+
+static int countChunks(const char *start, const char *end);
+
+static int addChunks(
+    partTask *tasks,
+    int ind,
+    csvh_reader *source,
+    int fileInd,
+    const char *start,
+    const char *end
+);
+
+static int planParts(csv_handler *handler, partTask *tasks, int chunkCount);
+
+static void openFileTask(void *context, int taskInd);
+
+static void countTask(void *context, int taskInd);
+
+static void partTaskRun(void *context, int taskInd);
+
+static char newPart(csv_handler *handler, csv_handler **part, partTask *task, char first);
+
+// END forward declarations.
 
 /**
- * Source file has text headers.  Default to true.
+ * unparseClasses values: has to be escaped, has to be quoted, and starts the
+ * delimiter (which for a delimiter of more than one byte might be nothing).
  */
-static char hasHeaders = 1;
+#define UNPARSE_ESCAPE 1
+#define UNPARSE_QUOTE 2
+#define UNPARSE_DELIM 4
 
 /**
- * The fields to be included in output.  Terminated by -1.  If NULL, then
- * include all values.
+ * Start handling an input (stdin, unless an input file is set).  Handlers
+ * don't share anything, so there can be any number of them at once, each
+ * used by one thread at a time.  Returns NULL if out of memory.  Let go of it
+ * with csv_handler_close.
  */
-static int *selectedFields = NULL;
+csv_handler *csv_handler_new()
+{
+    csv_handler *handler = calloc(1, sizeof(csv_handler));
+
+    if (handler == NULL) {
+        return NULL;
+    }
+
+    handler->lineHelper = csvh_line_helper_new();
+
+    if (handler->lineHelper == NULL) {
+        free(handler);
+        return NULL;
+    }
+
+    handler->dialect = (csv_dialect) CSV_DIALECT_DEFAULT;
+    handler->maxRecord = CSVH_READER__DEFAULT_MAX_RECORD;
+    handler->spanCount = -1;
+    handler->linePad = 3;
+    handler->hasHeaders = 1;
+    handler->sniff = 1;
+    handler->countHeaders = -1;
+    handler->selectedFieldCount = -1;
+    handler->width = 15;
+    handler->headerOutputInd = -1;
+    setUnparseClasses(handler);
+
+    return handler;
+}
 
 /**
- * Count of headers in source file.
+ * Set value for hasHeaders.
+ *
+ * @param   hasHeadersIn
  */
-static int countHeaders = -1;
+void csv_handler_set_has_headers(csv_handler *handler, char hasHeadersIn)
+{
+    handler->hasHeaders = hasHeadersIn;
+    handler->hasHeadersSet = 1;
+}
 
 /**
- * Count of fields displayed in output.  -1 means display everything.
+ * Set the delimiter.  It can be more than one byte (e.g., "||").  Must be
+ * called before setting the input file.
+ *
+ * @param   delimIn
  */
-static int selectedFieldCount = -1;
+char csv_handler_set_delim(csv_handler *handler, const char *delimIn)
+{
+    csv_dialect updated;
+
+    if (csv_dialect_init(&updated, delimIn, handler->dialect.quote, handler->dialect.escape) != 0) {
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    handler->delimSet = 1;
+    useDialect(handler, &updated);
+
+    return CSV_HANDLER__OK;
+}
 
 /**
- * Width of cells to output.
+ * Set the quote ('\0' to leave it as it is, and guessed), and the escape
+ * character for inside of quoted fields ('\0' for none, i.e., quotes are
+ * escaped by doubling them).  Must be called before setting the input file.
+ *
+ * @param   quote
+ * @param   escape
  */
-static int width = 15;
+char csv_handler_set_quoting(csv_handler *handler, char quote, char escape)
+{
+    csv_dialect updated;
+    char quoteSet = (quote != '\0');
+
+    if (!quoteSet) {
+        quote = handler->dialect.quote;
+    }
+
+    if (csv_dialect_init(&updated, handler->dialect.delim, quote, escape) != 0) {
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    handler->quoteSet = handler->quoteSet || quoteSet;
+    useDialect(handler, &updated);
+
+    return CSV_HANDLER__OK;
+}
 
 /**
- * Array of array of strings, terminated by a NULL at the end.  Good grief;
- * this will be annoying.  Holds the entirety of the input file except what is
- * filtered out, and except for the headers.  Currently only used for displaying
- * transposed output.
+ * Whether to guess the delimiter, quote and whether there are headers from the
+ * start of the input, when they aren't set.  On by default.  Must be called before
+ * setting the input file.
+ *
+ * @param   sniffIn
  */
-static char ***entireInput = NULL;
+void csv_handler_set_sniff(csv_handler *handler, char sniffIn)
+{
+    handler->sniff = sniffIn;
+}
 
 /**
- * Array of integers of line numbers from the source file to display.  Only
- * used for transposed output.
+ * Set the encoding of the input, by name: "utf-8", "utf-16le", "utf-16be",
+ * "latin1" or "cp1252" (or "auto", the default, to tell from a byte order
+ * mark or the start of the input).  Whatever it is, the lines come out as
+ * UTF-8.  Must be called before setting the input file.
+ *
+ * @param   name
  */
-static int *lineNums = NULL;
+char csv_handler_set_encoding(csv_handler *handler, const char *name)
+{
+    int encoding = csvh_transcode_encoding(name);
 
+    if (encoding == -1) {
+        return CSV_HANDLER__INVALID_INPUT;
+    }
 
-// START forward declarations for static functions.
+    handler->encoding = encoding;
 
-static char getParsedLine(char ***parsedLine);
+    return CSV_HANDLER__OK;
+}
 
-static char appendBoxedValue(char **outputLine, char *newValue, char useBrace);
+/**
+ * Read from a file instead of stdin.  Must be called before reading anything.
+ *
+ * @param   path
+ */
+char csv_handler_set_input_file(csv_handler *handler, char *path)
+{
+    if (handler->reader != NULL) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
 
-static int getSelectedFieldCount();
+    char rc = csvh_reader_open(&handler->reader, path, handler->encoding);
+    sniffDialect(handler, handler->reader);
+    setUpReader(handler);
 
-static char *getHeaderFromPosition(int pos);
+    return fromReaderRc(rc);
+}
 
-static char unparseValue(char **value);
+/**
+ * Read from a list of files and directories (of files) instead of stdin, in
+ * order, as if they were one file.  Line numbers keep counting up across the
+ * files.  If there are headers, every file has to have the same ones, and
+ * only the first file's are read.  Must be called before reading anything.
+ *
+ * @param   paths
+ * @param   count
+ */
+char csv_handler_set_input_files(csv_handler *handler, char **paths, int count)
+{
+    if (handler->reader != NULL) {
+        return CSV_HANDLER__ALREADY_SET;
+    }
 
-static char copyArrayOfStrings(char ***destArray, char ***srcArray, int *specInds);
+    csvh_reader *first = NULL;
 
-static int getHeaderIndexFromString(char *critHeader);
+    if (handler->sniff && (!handler->delimSet || !handler->quoteSet || !handler->hasHeadersSet)) {
+        // Several files can't be looked at without reading them, so look at a
+        // sample of the first one on its own.  That comes first, since the
+        // reader has to know whether there are headers, to check them and
+        // skip all but the first file's.
+        if (csvh_reader_open_first(&first, paths, count, handler->encoding) == CSVH_READER__OK) {
+            sniffDialect(handler, first);
+            csvh_reader_close(first);
+        }
+    }
 
-static char setHeadersAsNumbers();
+    char rc = csvh_reader_open_many(
+        &handler->reader,
+        paths,
+        count,
+        handler->hasHeaders,
+        handler->encoding
+    );
 
-static int countDigits(int num);
+    setUpReader(handler);
 
-// END forward declarations.
+    return fromReaderRc(rc);
+}
 
 /**
- * Set value for hasHeaders.
+ * Set how long a record can get while inside of a quoted field before it's
+ * taken to be a quoting mistake (e.g., a stray quote in an unquoted field).
+ * Such a record is skipped (and the mistake passed to the callback set with
+ * csv_handler_set_malformed_callback), and reading picks back up at the next
+ * line after the quote to blame.  0 means no limit (the record is still
+ * skipped if its quote is never closed at all).  Must be called before
+ * setting the input file.
  *
- * @param   hasHeadersIn
+ * @param   bytes
  */
-void csv_handler_set_has_headers(char hasHeadersIn)
+void csv_handler_set_max_record(csv_handler *handler, long bytes)
 {
-    hasHeaders = hasHeadersIn;
+    handler->maxRecord = (bytes > 0) ? bytes : 0;
 }
 
 /**
- * Set value for delim.
- *
- * @param   delimIn
+ * Read ahead of what's being parsed, so that waiting on the input overlaps with
+ * everything else.  Must be called after setting the input file (if any) and
+ * before reading anything.
  */
-void csv_handler_set_delim(char delimIn)
+char csv_handler_set_read_ahead(csv_handler *handler)
 {
-    delim = delimIn;
+    char rc;
+    if ((rc = openReader(handler)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    return fromReaderRc(csvh_reader_start_read_ahead(handler->reader));
 }
 
 /**
- * Skip next line before even reading it.
+ * Keep a row-offset index next to the input file, so skipping lines (including
+ * with line restrictions) can jump straight to them.  Must be called after
+ * setting the input file and before reading anything.  Quietly does nothing
+ * if the input isn't a plain or BGZF file.
  */
-char csv_handler_skip_next_line()
+char csv_handler_set_use_index(csv_handler *handler)
 {
-    int buffsize = 255;
-    char buff[buffsize];
-    while (1) {
-        if (fgets(buff, buffsize, stdin) == NULL) {
-            // This will happen *after* the final line has already been read.
-            return CSV_HANDLER__DONE;
-        }
+    char rc;
+    if ((rc = openReader(handler)) != CSV_HANDLER__OK) {
+        return rc;
+    }
 
-        if (buff[strlen(buff) - 1] == '\n') {
-            // Reached EOL.
-            break;
-        }
+    return fromReaderRc(csvh_reader_use_index(handler->reader));
+}
+
+/**
+ * Keep waiting for more lines at the end of the input file instead of
+ * stopping (like `tail -f`).  Must be called after setting the input file and
+ * before reading anything.
+ */
+char csv_handler_set_follow(csv_handler *handler)
+{
+    char rc;
+    if ((rc = openReader(handler)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    return fromReaderRc(csvh_reader_set_follow(handler->reader));
+}
+
+/**
+ * Only show the last count lines, or (with reverse) show the lines last to
+ * first.  A count less than 1 means all of them.  The end of the file is found
+ * without reading the rest of it, so this needs the input to be a regular
+ * file.  Must be called before reading anything (except skipped lines).
+ *
+ * Line numbers are the true ones if the file has an index (see
+ * csv_handler_set_use_index).  Otherwise they count back from the end: the
+ * last line is -1.
+ *
+ * @param   count
+ * @param   reverse
+ */
+char csv_handler_set_tail(csv_handler *handler, int count, char reverse)
+{
+    char rc;
+    long found;
+
+    if ((rc = openReader(handler)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    rc = csvh_reader_set_tail(handler->reader, count, reverse, handler->hasHeaders, &found);
+    if (rc != CSVH_READER__OK) {
+        return fromReaderRc(rc);
+    }
+
+    long lineCount = csvh_reader_record_count(handler->reader);
+    if (lineCount > 0 && handler->hasHeaders) {
+        lineCount--;
+    }
+
+    if (reverse) {
+        csvh_line_helper_set_line_num(
+            handler->lineHelper,
+            (lineCount >= 0) ? lineCount : -1,
+            -1
+        );
+    } else if (found >= 0) {
+        csvh_line_helper_set_line_num(
+            handler->lineHelper,
+            (lineCount >= 0) ? lineCount - found + 1 : -found,
+            1
+        );
     }
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Read next line into memory.
+ * Skip next line before even reading it.
  */
-char csv_handler_read_next_line()
+char csv_handler_skip_next_line(csv_handler *handler)
 {
-    if (line != NULL) {
-        free(line);
-        line = NULL;
+    char rc;
+    if ((rc = openReader(handler)) != CSV_HANDLER__OK) {
+        return rc;
     }
 
-    if (lineBuff != NULL) {
-        // Have a line in memory being held, so just switch around the pointers.
-        line = lineBuff;
-        lineBuff = NULL;
-    } else {
-        // Might be good to abstract this to a different function?
-        line = malloc(sizeof(char));
+    if (csvh_reader_skip_record(handler->reader) != CSVH_READER__OK) {
+        // This will happen *after* the final line has already been read.
+        return CSV_HANDLER__DONE;
+    }
 
-        if (line == NULL) {
-            return CSV_HANDLER__OUT_OF_MEMORY;
-        }
+    return CSV_HANDLER__OK;
+}
 
-        line[0] = '\0'; // Empty string for now because we don't know how long it
-        // will be.
+/**
+ * Skip the next count lines before even reading them.  Same as calling
+ * csv_handler_skip_next_line count times, but the reader might be able to
+ * jump straight there.
+ *
+ * @param   count
+ */
+char csv_handler_skip_lines(csv_handler *handler, int count)
+{
+    char rc;
+    long skipped;
 
-        int buffsize = 255;
-        char buff[buffsize];
-        while (1) {
-            if (fgets(buff, buffsize, stdin) == NULL) {
-                // Note that this should happen *after* the final line has already
-                // been read into memory.
-                return CSV_HANDLER__DONE;
-            }
+    if ((rc = openReader(handler)) != CSV_HANDLER__OK) {
+        return rc;
+    }
 
-            line = realloc(
-                line,
-                sizeof(char) * (strlen(line) + strlen(buff) + 1) // +1 for null terminator
-            );
+    rc = csvh_reader_skip_records(handler->reader, count, &skipped);
+    reportMalformed(handler);
 
-            if (line == NULL) {
-                return CSV_HANDLER__OUT_OF_MEMORY;
-            }
+    return fromReaderRc(rc);
+}
 
-            strcat(line, buff);
+/**
+ * Read next line into memory.
+ */
+char csv_handler_read_next_line(csv_handler *handler)
+{
+    char rc;
 
-            size_t lst = strlen(line) - 1;
-            if (line[lst] == '\n' && ((countHeaders = count_fields(line, delim)) != -1)) {
-                // If count_fields is -1, then that means the line is not parseable
-                // as a CSV line, which probably means that the file has a field
-                // with a line break in it, meaning we have to include both of the
-                // *file*'s lines as part of the same logical CSV line.  Example:
+    while (1) {
+        freeLine(handler);
+
+        if (handler->lineBuff != NULL) {
+            // Have a line in memory being held, so just switch around the
+            // pointers.  (Still points into the reader, which hasn't been
+            // touched since.)
+            handler->line = handler->lineBuff;
+            handler->lineLen = handler->lineBuffLen;
+            handler->lineBuff = NULL;
+        } else {
+            if ((rc = openReader(handler)) != CSV_HANDLER__OK) {
+                return rc;
+            }
 
-                // field one,field two,"field with
-                // line break", field four
+            // Lines that are sure to be skipped don't need to be read.
+            int toSkip = csvh_line_helper_lines_to_skip(handler->lineHelper);
+            if (toSkip > 0) {
+                long skipped;
+                rc = csvh_reader_skip_records(handler->reader, toSkip, &skipped);
+                reportMalformed(handler);
+                if (rc != CSVH_READER__OK) {
+                    handler->line = NULL;
+                    return fromReaderRc(rc);
+                }
+                csvh_line_helper_advance(handler->lineHelper, skipped);
+            }
 
-                // From the CSV perspective, this is one line, but if we don't check
-                // that the line we just found is parseable when we reach the first
-                // newline, we'll get an unparseable string and csv.c will return
-                // null.
+            rc = csvh_reader_next_record(handler->reader, &handler->line, &handler->lineLen);
+            reportMalformed(handler);
+
+            switch (rc) {
+                case CSVH_READER__OK:
+                    break;
+                case CSVH_READER__DONE:
+                    // Note that this should happen *after* the final line has
+                    // already been read into memory.
+                    handler->line = NULL;
+                    return CSV_HANDLER__DONE;
+                default:
+                    handler->line = NULL;
+                    return fromReaderRc(rc);
+            }
+        }
 
-                line[lst] = '\0'; // Removing newline, but not reallocing.
-                break;
+        if (!handler->hasHeaders) {
+            // Take the line that was just found and stash it away, because
+            // we're going to print out the numerical headers first.
+            handler->lineBuff = handler->line;
+            handler->lineBuffLen = handler->lineLen;
+            if ((rc = setHeadersAsNumbers(handler)) != CSV_HANDLER__OK) {
+                return rc;
             }
+            handler->hasHeaders = 1; // Now have headers.  (Basically just don't want to
+            // come back here.)
         }
-    }
 
-    if (!hasHeaders) {
-        // Take the line that was just found and stash it away, because we're
-        // going to print out the numerical headers first.
-        lineBuff = line;
-        char rc;
-        if ((rc = setHeadersAsNumbers()) != CSV_HANDLER__OK) {
-            return rc;
+        // Determine if should skip, stop, print, or what-have-you.
+        switch (csvh_line_helper_should_skip(handler->lineHelper, handler->line, handler->lineLen)) {
+            case CSVH_LINE_HELPER__SKIP:
+                continue;
+            case CSVH_LINE_HELPER__DONE:
+                return CSV_HANDLER__DONE;
+            case CSVH_LINE_HELPER__OK:
+                return CSV_HANDLER__OK;
+            case CSVH_LINE_HELPER__INVALID_INPUT:
+                return CSV_HANDLER__INVALID_INPUT;
         }
-        hasHeaders = 1; // Now have headers.  (Basically just don't want to come
-        // back here.)
-    }
 
-    // Determine if should skip, stop, print, or what-have-you.
-    switch (csvh_line_helper_should_skip(line)) {
-        case CSVH_LINE_HELPER__SKIP:
-            return csv_handler_read_next_line();
-        case CSVH_LINE_HELPER__DONE:
-            return CSV_HANDLER__DONE;
-        case CSVH_LINE_HELPER__OK:
-            return CSV_HANDLER__OK;
-        case CSVH_LINE_HELPER__INVALID_INPUT:
-            return CSV_HANDLER__INVALID_INPUT;
+        return CSV_HANDLER__UNKNOWN_ERROR;
     }
-
-    return CSV_HANDLER__UNKNOWN_ERROR;
 }
 
 /**
  * Set the headers from the line in memory.
  */
-char csv_handler_set_headers_from_line()
+char csv_handler_set_headers_from_line(csv_handler *handler)
 {
-    if (line == NULL) {
+    if (handler->line == NULL) {
         return CSV_HANDLER__LINE_IS_NULL;
     }
-    if (headers != NULL) {
+    if (handler->headers != NULL) {
         return CSV_HANDLER__ALREADY_SET;
     }
 
-    headers = parse_csv(line, delim);
+    handler->headers = parse_csv_len(&handler->dialect, handler->line, handler->lineLen);
     // Not using getParsedLine because don't want to filter anything out for
     // headers.
 
-    if (headers == NULL) {
+    if (handler->headers == NULL) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
+    handler->countHeaders = 0;
+    while (handler->headers[handler->countHeaders] != NULL) {
+        handler->countHeaders++;
+    }
+
     return CSV_HANDLER__OK;
 }
 
@@ -258,9 +829,19 @@ char csv_handler_set_headers_from_line()
  *
  * @param   lines
  */
-char csv_handler_restrict_by_lines(char *lines)
+char csv_handler_restrict_by_lines(csv_handler *handler, char *lines)
 {
-    return csvh_line_helper_init_lines(lines);
+    char rc = csvh_line_helper_init_lines(handler->lineHelper, lines);
+
+    if (rc == CSVH_LINE_HELPER__INVALID_INPUT) {
+        return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    if (rc != CSVH_LINE_HELPER__OK) {
+        return CSV_HANDLER__UNKNOWN_ERROR;
+    }
+
+    return CSV_HANDLER__OK;
 }
 
 /**
@@ -269,15 +850,15 @@ char csv_handler_restrict_by_lines(char *lines)
  * @param   critHeader
  * @param   ranges
  */
-char csv_handler_restrict_by_ranges(char *critHeader, char *ranges)
+char csv_handler_restrict_by_ranges(csv_handler *handler, char *critHeader, char *ranges)
 {
-    int critInd = getHeaderIndexFromString(critHeader);
+    int critInd = getHeaderIndexFromString(handler, critHeader);
 
     if (critInd == -1) {
         return CSV_HANDLER__HEADER_NOT_FOUND;
     }
 
-    char rc = csvh_line_helper_init_ranges(critInd, ranges);
+    char rc = csvh_line_helper_init_ranges(handler->lineHelper, critInd, ranges);
 
     if (rc == CSVH_LINE_HELPER__INVALID_INPUT) {
         return CSV_HANDLER__INVALID_INPUT;
@@ -296,15 +877,15 @@ char csv_handler_restrict_by_ranges(char *critHeader, char *ranges)
  * @param   critHeader
  * @param   equals
  */
-char csv_handler_restrict_by_equals(char *critHeader, char *equals)
+char csv_handler_restrict_by_equals(csv_handler *handler, char *critHeader, char *equals)
 {
-    int critInd = getHeaderIndexFromString(critHeader);
+    int critInd = getHeaderIndexFromString(handler, critHeader);
 
     if (critInd == -1) {
         return CSV_HANDLER__HEADER_NOT_FOUND;
     }
 
-    char rc = csvh_line_helper_init_equals(critInd, equals);
+    char rc = csvh_line_helper_init_equals(handler->lineHelper, critInd, equals);
 
     if (rc == CSVH_LINE_HELPER__INVALID_INPUT) {
         return CSV_HANDLER__INVALID_INPUT;
@@ -314,147 +895,274 @@ char csv_handler_restrict_by_equals(char *critHeader, char *equals)
 }
 
 /**
- * Get a single header to print out (to loop through so can get all headers).
+ * Equals restrictions with the values read from a file instead of passed in,
+ * for when there are too many of them for a command line.
  *
- * @param   outputLine
+ * Without a column, each line of the file is a value, as is (empty lines are
+ * skipped).  With one, the file is CSV (comma-separated, with a header), and
+ * the values are the fields under that header.  Either way, empty values
+ * are ignored.
+ *
+ * @param   critHeader
+ * @param   path
+ * @param   column
  */
-char csv_handler_output_headers(char **outputLine)
-{
-    static int ind = -1;
+char csv_handler_restrict_by_equals_file(
+    csv_handler *handler,
+    char *critHeader,
+    char *path,
+    char *column
+) {
+    int critInd = getHeaderIndexFromString(handler, critHeader);
 
-    if (*outputLine != NULL) {
-        free(*outputLine);
-        *outputLine = NULL;
+    if (critInd == -1) {
+        return CSV_HANDLER__HEADER_NOT_FOUND;
     }
 
-    ind++;
-
-    if (headers[ind] == NULL) {
-        return CSV_HANDLER__DONE;
+    if (csvh_line_helper_init_equals(handler->lineHelper, critInd, NULL) != CSVH_LINE_HELPER__OK) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    *outputLine = malloc(sizeof(char) * (strlen(headers[ind]) + 1));
-    strcpy(*outputLine, headers[ind]);
-
-    return CSV_HANDLER__OK;
-}
-
-/**
- * Get the line in CSV format.
- *
- * @param   wholeLine   Pointer to string.
- */
-char csv_handler_raw_line(char **wholeLine)
-{
-    if (line == NULL) {
-        return CSV_HANDLER__LINE_IS_NULL;
-    }
+    csvh_reader *values;
+    char rc = csvh_reader_open(&values, path, CSVH_TRANSCODE_ENCODING__AUTO);
 
-    if (*wholeLine != NULL) {
-        free(*wholeLine);
-        *wholeLine = NULL;
+    if (rc != CSVH_READER__OK) {
+        return fromReaderRc(rc);
     }
 
-    char **parsedLine = NULL;
-    getParsedLine(&parsedLine);
-
-    *wholeLine = malloc(sizeof(char));
-
-    if (*wholeLine == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
-    }
+    csv_dialect dialect = CSV_DIALECT_DEFAULT;
+    int columnInd = -1;
+    char *field = NULL;
+    size_t fieldCap = 0;
+    char *record;
+    size_t len;
 
-    strcpy(*wholeLine, "");
+    char res = CSV_HANDLER__OK;
 
-    char rc = 0;
+    while (res == CSV_HANDLER__OK
+        && (rc = csvh_reader_next_record(values, &record, &len)) == CSVH_READER__OK
+    ) {
+        if (column == NULL) {
+            if (len > 0
+                && csvh_line_helper_add_equal(handler->lineHelper, record, len) != CSVH_LINE_HELPER__OK
+            ) {
+                res = CSV_HANDLER__OUT_OF_MEMORY;
+            }
+            continue;
+        }
 
-    char delimStr[] = " ";
-    delimStr[0] = delim;
-    // This is an annoying way of concatenating a single char.
+        if (fieldCap < len + 1) {
+            char *newField = realloc(field, len + 1);
+            if (newField == NULL) {
+                res = CSV_HANDLER__OUT_OF_MEMORY;
+                break;
+            }
+            field = newField;
+            fieldCap = len + 1;
+        }
 
-    for (int i = 0; parsedLine[i] != NULL; i++) {
-        if ((rc = unparseValue(&(parsedLine[i]))) != CSV_HANDLER__OK) {
-            return rc;
+        if (columnInd == -1) {
+            // The header.
+            char **headers = parse_csv_len(&dialect, record, len);
+            if (headers == NULL) {
+                res = CSV_HANDLER__INVALID_INPUT;
+                break;
+            }
+            for (int i = 0; headers[i] != NULL; i++) {
+                if (strcmp(headers[i], column) == 0) {
+                    columnInd = i;
+                    break;
+                }
+            }
+            free_csv_line(headers);
+            if (columnInd == -1) {
+                res = CSV_HANDLER__HEADER_NOT_FOUND;
+            }
+            continue;
         }
-        *wholeLine = realloc(
-            *wholeLine,
-            sizeof(char) * (strlen(*wholeLine) + strlen(parsedLine[i]) + 2)
-        );
-        if (*wholeLine == NULL) {
-            return CSV_HANDLER__OUT_OF_MEMORY;
+
+        // (Empty fields are ignored too, like empty lines.)
+        if (parse_csv_field(&dialect, record, len, columnInd, field) == 0
+            && field[0] != '\0'
+            && csvh_line_helper_add_equal(handler->lineHelper, field, strlen(field)) != CSVH_LINE_HELPER__OK
+        ) {
+            res = CSV_HANDLER__OUT_OF_MEMORY;
         }
-        strcat(*wholeLine, parsedLine[i]);
-        strcat(*wholeLine, delimStr);
     }
 
-    (*wholeLine)[strlen(*wholeLine) - 1] = '\0';  // Don't resize.
-    free_csv_line(parsedLine);
+    free(field);
+    csvh_reader_close(values);
 
-    return CSV_HANDLER__OK;
+    if (res == CSV_HANDLER__OK && rc != CSVH_READER__DONE) {
+        res = fromReaderRc(rc);
+    }
+
+    return res;
 }
 
 /**
- * Get line to print out to stdout.
+ * Restrict by a filter expression that can test several columns at once,
+ * like "Amount 100-500 and State in (CA,NV) and not Status = void" (see
+ * csvh-filter.c).  It's compiled once, here, and handed to csvh-line-helper.
  *
- * @param   outputLine
+ * @param   expr
  */
-char csv_handler_output_line(char **outputLine)
+char csv_handler_restrict_by_filter(csv_handler *handler, char *expr)
+{
+    csvh_filter *filter;
+
+    switch (csvh_filter_compile(&filter, expr, handler->headers)) {
+        case CSVH_FILTER__OK:
+            break;
+        case CSVH_FILTER__OUT_OF_MEMORY:
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        case CSVH_FILTER__HEADER_NOT_FOUND:
+            return CSV_HANDLER__HEADER_NOT_FOUND;
+        default:
+            return CSV_HANDLER__INVALID_INPUT;
+    }
+
+    csvh_line_helper_init_filter(handler->lineHelper, filter);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Turn range, equals and filter restrictions around, to put out only the
+ * lines that don't meet them.
+ *
+ * @param   exclude
+ */
+char csv_handler_set_exclude(csv_handler *handler, char exclude)
+{
+    csvh_line_helper_set_exclude(handler->lineHelper, exclude);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get a single header to print out (to loop through so can get all headers).
+ *
+ * @param   outputLine
+ */
+char csv_handler_output_headers(csv_handler *handler, char **outputLine)
 {
     if (*outputLine != NULL) {
         free(*outputLine);
         *outputLine = NULL;
     }
 
-    if (line == NULL) {
+    int ind = ++handler->headerOutputInd;
+
+    if (handler->headers[ind] == NULL) {
+        return CSV_HANDLER__DONE;
+    }
+
+    *outputLine = malloc(sizeof(char) * (strlen(handler->headers[ind]) + 1));
+    strcpy(*outputLine, handler->headers[ind]);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get the line in CSV format.  Like everything else that's output for a line,
+ * it belongs to this module, and only lasts until the next line is read.
+ *
+ * @param   wholeLine   Pointer to string.
+ */
+char csv_handler_raw_line(csv_handler *handler, char **wholeLine)
+{
+    if (handler->line == NULL) {
         return CSV_HANDLER__LINE_IS_NULL;
     }
-    char **parsedLine = NULL;
-    getParsedLine(&parsedLine);
 
-    *outputLine = malloc(sizeof(char) * 2);
+    char rc;
+    if ((rc = getLineSpans(handler)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    // Measure first, so it's a single allocation.
+    int count = getOutputSpanCount(handler);
+    size_t total = 1;
+    for (int i = 0; i < count; i++) {
+        total += unparsedLength(handler, getOutputSpan(handler, i)) + handler->dialect.delimLen;
+    }
+
+    *wholeLine = lineAlloc(handler, sizeof(char) * total);
+
+    if (*wholeLine == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    char *dest = *wholeLine;
+    for (int i = 0; i < count; i++) {
+        if (i != 0) {
+            memcpy(dest, handler->dialect.delim, handler->dialect.delimLen);
+            dest += handler->dialect.delimLen;
+        }
+        dest = writeUnparsed(handler, dest, getOutputSpan(handler, i));
+    }
+    *dest = '\0';
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get line to print out to stdout.  Only lasts until the next line is read.
+ *
+ * @param   outputLine
+ */
+char csv_handler_output_line(csv_handler *handler, char **outputLine)
+{
+    if (handler->line == NULL) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+
+    char rc;
+    if ((rc = getLineSpans(handler)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    int count = getOutputSpanCount(handler);
+    int width = handler->width;
+    *outputLine = lineAlloc(handler, sizeof(char) * ((width + 1) * count + 2));
+    // (width + 1) is the width of every field plus its right brace.  + 2 is
+    // one for the opening brace and one for the null terminator.
 
     if (*outputLine == NULL) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    (*outputLine)[0] = '|'; // Opening brace.
-    (*outputLine)[1] = '\0';
+    char *dest = *outputLine;
+    *dest++ = '|'; // Opening brace.
 
     // Add content.
-    char rc = 0;
-    for (int i = 0; parsedLine[i] != NULL; i++) {
-        if ((rc = appendBoxedValue(outputLine, parsedLine[i], 1)) != CSV_HANDLER__OK) {
-            return rc;
-        }
+    for (int i = 0; i < count; i++) {
+        const csv_span *span = getOutputSpan(handler, i);
+        dest = writeBoxed(dest, span->start, span->len, width, 1);
     }
-
-    free_csv_line(parsedLine);
+    *dest = '\0';
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Get the line number as string.
+ * Get the line number as string.  Only lasts until the next line is read.
  *
  * @param outputString
  */
-char csv_handler_output_line_number(char **outputString)
+char csv_handler_output_line_number(csv_handler *handler, char **outputString)
 {
-    if (*outputString != NULL) {
-        free(*outputString);
-        *outputString = NULL;
-    }
-
-    int num = csvh_line_helper_get_line_num();
+    int num = csvh_line_helper_get_line_num(handler->lineHelper);
 
     int numLen = countDigits(num);
-    int sizeDum = (numLen > linePad) ? numLen : linePad;
-    *outputString = malloc(sizeof(char) * (sizeDum + 1));
+    int sizeDum = (numLen > handler->linePad) ? numLen : handler->linePad;
+    *outputString = lineAlloc(handler, sizeof(char) * (sizeDum + 1));
     if (*outputString == NULL) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    if (numLen < linePad) {
+    if (numLen < handler->linePad) {
         sprintf(*outputString, "% 3d", num);
     } else {
         sprintf(*outputString, "%d", num);
@@ -468,21 +1176,21 @@ char csv_handler_output_line_number(char **outputString)
  *
  * @param   outputString
  */
-char csv_handler_output_line_padding(char **outputString)
+char csv_handler_output_line_padding(csv_handler *handler, char **outputString)
 {
     if (*outputString != NULL) {
         free(*outputString);
         *outputString = NULL;
     }
 
-    *outputString = malloc(sizeof(char) * linePad + 1);
+    *outputString = malloc(sizeof(char) * handler->linePad + 1);
     if (*outputString == NULL) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
-    for (int i = 0; i < linePad; i++) {
+    for (int i = 0; i < handler->linePad; i++) {
         (*outputString)[i] = ' ';
     }
-    (*outputString)[linePad] = '\0';
+    (*outputString)[handler->linePad] = '\0';
 
     return CSV_HANDLER__OK;
 }
@@ -492,9 +1200,9 @@ char csv_handler_output_line_padding(char **outputString)
  *
  * @param   outputLine
  */
-char csv_handler_border_line(char **outputLine)
+char csv_handler_border_line(csv_handler *handler, char **outputLine)
 {
-    if (countHeaders == -1) {
+    if (handler->countHeaders == -1) {
         return CSV_HANDLER__LINE_IS_NULL; // Not sure what else to call this.
     }
 
@@ -503,7 +1211,7 @@ char csv_handler_border_line(char **outputLine)
         *outputLine = NULL;
     }
 
-    int lineLen = (width + 1) * getSelectedFieldCount() + 1;
+    int lineLen = (handler->width + 1) * getSelectedFieldCount(handler) + 1;
     // I almost wanted to name this "linLen" because then it would be pronounced
     // "len-len" and that would be funny.
     // (width + 1) is the width of every field plus its left brace.
@@ -532,49 +1240,51 @@ char csv_handler_border_line(char **outputLine)
  * Get *vertical* entry to print to stdout.
  *
  * This is not a single line, so behavior is inconsistent.  It's the entirety of
- * an entry, line breaks and all.
+ * an entry, line breaks and all.  Only lasts until the next line is read.
  *
  * @param   outputEntry
  */
-char csv_handler_output_vertical_entry(char **outputEntry)
+char csv_handler_output_vertical_entry(csv_handler *handler, char **outputEntry)
 {
-    if (*outputEntry != NULL) {
-        free(*outputEntry);
-        *outputEntry = NULL;
-    }
-
-    if (line == NULL) {
+    if (handler->line == NULL) {
         return CSV_HANDLER__LINE_IS_NULL;
     }
 
-    if (headers == NULL) {
+    if (handler->headers == NULL) {
         return CSV_HANDLER__HEADERS_NOT_SET;
     }
 
-    char **parsedLine = NULL;
-    getParsedLine(&parsedLine);
-
-    *outputEntry = malloc(sizeof(char));
-    (*outputEntry)[0] = '\0';
-
-    for (int i = 0; parsedLine[i] != NULL; i++) {
-        *outputEntry = realloc(
-            *outputEntry,
-            strlen(*outputEntry)
-            + strlen(parsedLine[i])
-            + strlen(headers[i])
-            + (i == 0 ? 3 : 4)
-        );
-        // +1 for null term, +1 for line break, +2 for ": "
+    char rc;
+    if ((rc = getLineSpans(handler)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    // Measure first, so it's a single allocation.
+    int count = getOutputSpanCount(handler);
+    size_t total = 1;
+    for (int i = 0; i < count; i++) {
+        total += strlen(getHeaderFromPosition(handler, i)) + getOutputSpan(handler, i)->len + 3;
+        // +1 for line break, +2 for ": "
+    }
+
+    *outputEntry = lineAlloc(handler, sizeof(char) * total);
+
+    if (*outputEntry == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    char *dest = *outputEntry;
+    for (int i = 0; i < count; i++) {
+        const csv_span *span = getOutputSpan(handler, i);
+
         if (i != 0) {
-            strcat(*outputEntry, "\n");
+            *dest++ = '\n';
         }
-        strcat(*outputEntry, getHeaderFromPosition(i));
-        strcat(*outputEntry, ": ");
-        strcat(*outputEntry, parsedLine[i]);
+        dest += sprintf(dest, "%s: ", getHeaderFromPosition(handler, i));
+        memcpy(dest, span->start, span->len);
+        dest += span->len;
     }
-
-    free_csv_line(parsedLine);
+    *dest = '\0';
 
     return CSV_HANDLER__OK;
 }
@@ -584,27 +1294,225 @@ char csv_handler_output_vertical_entry(char **outputEntry)
  *
  * @param   outputLine
  */
-char csv_handler_vertical_border_line(char **outputLine)
+char csv_handler_vertical_border_line(csv_handler *handler, char **outputLine)
 {
     if (*outputLine != NULL) {
         free(*outputLine);
         *outputLine = NULL;
     }
 
-    *outputLine = malloc(sizeof(char) * width + 1); // Re-use width, so can
+    *outputLine = malloc(sizeof(char) * handler->width + 1); // Re-use width, so can
     // change it if want to.
 
     if (*outputLine == NULL) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    for (int i = 0; i < width; i++) {
+    for (int i = 0; i < handler->width; i++) {
         (*outputLine)[i] = '*';
     }
 
-    (*outputLine)[width] = '\0';
+    (*outputLine)[handler->width] = '\0';
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get the fields of the line in memory that are output (i.e., after selecting
+ * fields), without copying or rendering them.  They point into the line, so
+ * they aren't null-terminated, and they only last until the next line is read.
+ * A selected field that the line doesn't have is empty.
+ *
+ * @param   fields
+ * @param   count
+ */
+char csv_handler_line_fields(csv_handler *handler, const csv_span **fields, int *count)
+{
+    if (handler->line == NULL) {
+        return CSV_HANDLER__LINE_IS_NULL;
+    }
+
+    char rc;
+    if ((rc = getLineSpans(handler)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+
+    *count = getOutputSpanCount(handler);
+
+    if (handler->outputSpans == NULL) {
+        *fields = handler->spans;
+        return CSV_HANDLER__OK;
+    }
+
+    for (int i = 0; i < *count; i++) {
+        handler->outputSpans[i] = *getOutputSpan(handler, i);
+    }
+    *fields = handler->outputSpans;
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Get the number of the line in memory (not counting the header).
+ */
+int csv_handler_line_num(csv_handler *handler)
+{
+    return csvh_line_helper_get_line_num(handler->lineHelper);
+}
+
+/**
+ * Set what csv_handler_stream calls: fieldCallback for each field that's
+ * output, in order, and then recordCallback for the whole line.  Either can
+ * be NULL.  data is passed along to them as is.
+ *
+ * @param   recordCallback
+ * @param   fieldCallback
+ * @param   data
+ */
+void csv_handler_set_callbacks(
+    csv_handler *handler,
+    csv_handler_record_callback recordCallback,
+    csv_handler_field_callback fieldCallback,
+    void *data
+) {
+    handler->recordCallback = recordCallback;
+    handler->fieldCallback = fieldCallback;
+    handler->callbackData = data;
+}
+
+/**
+ * Set what's called when there are quoting mistakes in the input (quotes out
+ * of place, or records given up on), as they're run into.  NULL for nothing
+ * (they can still be looked up with csv_handler_malformed).  data is passed
+ * along to it as is.
+ *
+ * @param   callback
+ * @param   data
+ */
+void csv_handler_set_malformed_callback(
+    csv_handler *handler,
+    csv_handler_malformed_callback callback,
+    void *data
+) {
+    handler->malformedCallback = callback;
+    handler->malformedData = data;
+}
+
+/**
+ * Count of quoting mistakes in the input so far.  If there were any, at is
+ * set to the byte where the quote to blame for the last one was.
+ *
+ * @param   at
+ */
+long csv_handler_malformed(csv_handler *handler, size_t *at)
+{
+    if (handler->reader == NULL) {
+        return 0;
+    }
+
+    return csvh_reader_malformed(handler->reader, at);
+}
+
+/**
+ * Read the rest of the lines (after restrictions), passing the fields of each
+ * to the callbacks (see csv_handler_set_callbacks) instead of rendering it.
+ * Like the output functions, this comes after the headers have been set.
+ *
+ * The fields are the same as from csv_handler_line_fields, so they only last
+ * as long as the callback.  A callback returns CSV_HANDLER__OK to go on; any
+ * other value stops the stream, and is returned from here.  Otherwise,
+ * returns CSV_HANDLER__OK once the input is done.
+ */
+char csv_handler_stream(csv_handler *handler)
+{
+    const csv_span *fields;
+    int count;
+    char rc;
+
+    while ((rc = csv_handler_read_next_line(handler)) == CSV_HANDLER__OK) {
+        if ((rc = csv_handler_line_fields(handler, &fields, &count)) != CSV_HANDLER__OK) {
+            return rc;
+        }
+
+        int lineNum = csv_handler_line_num(handler);
+
+        if (handler->fieldCallback != NULL) {
+            for (int i = 0; i < count; i++) {
+                rc = handler->fieldCallback(handler->callbackData, lineNum, i, &fields[i]);
+                if (rc != CSV_HANDLER__OK) {
+                    return rc;
+                }
+            }
+        }
+
+        if (handler->recordCallback != NULL) {
+            rc = handler->recordCallback(handler->callbackData, lineNum, fields, count);
+            if (rc != CSV_HANDLER__OK) {
+                return rc;
+            }
+        }
+    }
+
+    return (rc == CSV_HANDLER__DONE) ? CSV_HANDLER__OK : rc;
+}
 
+/**
+ * Read the rest of the lines (after restrictions) on threadCount threads at
+ * once (less than 1 means one per CPU), for a big enough mapped file, or
+ * several files.  The rest of the input is split into parts, and each one is
+ * read by a handler of its own, on another thread, through run.  What run
+ * writes to the stream it's given is held on to, and written out to out in
+ * order.  Like the output functions, this comes after the headers have been
+ * set.
+ *
+ * The parts are split at line breaks that look like they're outside of
+ * quotes, going by a count of the quotes before them.  That's only right if
+ * the quoting is well-formed, so a part with any quoting mistakes in it isn't
+ * used: its output is thrown away, and so is everything after it.  With
+ * several files, every file starts a part of its own, and the line breaks
+ * before it say what its first line number is.
+ *
+ * Either way, the lines that are left (if any) after this returns are read
+ * as usual: this only ever does the lines it can.  That's all of them unless
+ * the input is a stream, compressed or transcoded, read from the end or
+ * followed (with several files, up to the first one like that), the quoting
+ * has an escape character, or there was a quoting mistake.  Returns
+ * CSV_HANDLER__OK unless run (or something else) fails.
+ *
+ * @param   threadCount
+ * @param   run
+ * @param   data    Passed along to run as is.
+ * @param   out
+ */
+char csv_handler_run_parts(
+    csv_handler *handler,
+    int threadCount,
+    csv_handler_part_callback run,
+    void *data,
+    FILE *out
+) {
+#ifdef _WIN32
+    // Nothing is mapped there anyway.
     return CSV_HANDLER__OK;
+#else
+    char more = 1;
+    char rc = CSV_HANDLER__OK;
+
+    if (threadCount < 1) {
+        threadCount = csvh_pool_default_threads();
+    }
+
+    if (threadCount == 1 || handler->reader == NULL || handler->dialect.escape != '\0') {
+        return CSV_HANDLER__OK;
+    }
+
+    // With several files, they're done FILES_PER_ROUND at a time.
+    while (more && rc == CSV_HANDLER__OK) {
+        rc = runPartRound(handler, threadCount, run, data, out, &more);
+    }
+
+    return rc;
+#endif
 }
 
 /**
@@ -613,9 +1521,9 @@ char csv_handler_vertical_border_line(char **outputLine)
  *
  * @param   fields      Passed fields, if any.
  */
-char csv_handler_initialize_transpose()
+char csv_handler_initialize_transpose(csv_handler *handler)
 {
-    if (entireInput != NULL) {
+    if (handler->entireInput != NULL) {
         return CSV_HANDLER__ALREADY_SET;
     }
 
@@ -624,160 +1532,143 @@ char csv_handler_initialize_transpose()
     char rc = 0;
 
     // Create lineNums array.  Use zero as terminator.
-    lineNums = malloc(sizeof(int));
-    lineNums[0] = 0;
+    handler->lineNums = malloc(sizeof(int));
+    handler->lineNums[0] = 0;
     int lineNumsCount = 1;
 
-    while (csv_handler_read_next_line() == CSV_HANDLER__OK) {
+    while (csv_handler_read_next_line(handler) == CSV_HANDLER__OK) {
         // Append entireInput array.
-        getParsedLine(&parsedLine);
+        if ((rc = getParsedLine(handler, &parsedLine)) != CSV_HANDLER__OK) {
+            return rc;
+        }
         arrLen++;
-        entireInput = realloc(entireInput, sizeof(char ***) * arrLen);
-        entireInput[arrLen - 1] = NULL;
+        handler->entireInput = realloc(handler->entireInput, sizeof(char ***) * arrLen);
 
-        if (entireInput == NULL) {
+        if (handler->entireInput == NULL) {
             return CSV_HANDLER__OUT_OF_MEMORY;
         }
 
-        if ((rc = copyArrayOfStrings(&(entireInput[arrLen - 1]), &parsedLine, NULL))) {
-            return rc;
-        }
-
-        free_csv_line(parsedLine);
+        handler->entireInput[arrLen - 1] = parsedLine; // Kept as is.
+        parsedLine = NULL;
 
         // Append lineNums array.
-        lineNums = realloc(lineNums, sizeof(int) * ++lineNumsCount);
+        handler->lineNums = realloc(handler->lineNums, sizeof(int) * ++lineNumsCount);
 
-        if (lineNums == NULL) {
+        if (handler->lineNums == NULL) {
             return CSV_HANDLER__OUT_OF_MEMORY;
         }
 
-        lineNums[lineNumsCount - 2] = csvh_line_helper_get_line_num();
-        lineNums[lineNumsCount - 1] = 0;
+        handler->lineNums[lineNumsCount - 2] = csvh_line_helper_get_line_num(handler->lineHelper);
+        handler->lineNums[lineNumsCount - 1] = 0;
     }
 
-    entireInput = realloc(entireInput, sizeof(char ***) * (arrLen + 1));
+    handler->entireInput = realloc(handler->entireInput, sizeof(char ***) * (arrLen + 1));
 
-    if (entireInput == NULL) {
+    if (handler->entireInput == NULL) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    entireInput[arrLen] = NULL;
+    handler->entireInput[arrLen] = NULL;
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Get transposed line to print to stdout.
+ * Get transposed line to print to stdout.  Only lasts until the next one.
  *
  * @param   outputLine
  */
-char csv_handler_transposed_line(char **outputLine)
+char csv_handler_transposed_line(csv_handler *handler, char **outputLine)
 {
     // This one's very different.  Everything is already stored in memory in
     // entireInput, so go down the line from there.
 
-    static int ind = 0;
+    int ind = handler->transposedInd;
 
-    if (*outputLine != NULL) {
-        free(*outputLine);
-        *outputLine = NULL;
+    if (handler->lineArena != NULL) {
+        // There's no current line anymore, so this is what's reset per line.
+        csvh_arena_reset(handler->lineArena);
     }
 
-    if (entireInput == NULL) {
+    if (handler->entireInput == NULL) {
         return CSV_HANDLER__LINE_IS_NULL;
     }
 
-    if (entireInput[0][ind] == NULL) {
+    if (handler->entireInput[0][ind] == NULL) {
         return CSV_HANDLER__DONE;
     }
 
-    int headerInd = (selectedFields == NULL) ? ind : selectedFields[ind];
+    int headerInd = (handler->selectedFields == NULL) ? ind : handler->selectedFields[ind];
 
-    char *headerDum = malloc(sizeof(char) * (strlen(headers[headerInd]) + 3));
+    char *headerDum = lineAlloc(handler, sizeof(char) * (strlen(handler->headers[headerInd]) + 3));
     // Start with opening [, header, ], and null term.
     // This technically wastes memory because if it's a long header, only part
     // of what's allocated here will actually be used.  But, the code's slightly
     // easier this way.
+    if (headerDum == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
     strcpy(headerDum, "[");
-    strcat(headerDum, headers[headerInd]);
+    strcat(headerDum, handler->headers[headerInd]);
     strcat(headerDum, "]");
 
-    *outputLine = malloc(sizeof(char));
+    int rowCount = 0;
+    for (; handler->entireInput[rowCount] != NULL; rowCount++) {}
+
+    *outputLine = lineAlloc(handler, sizeof(char) * ((handler->width + 1) * (rowCount + 1) + 1));
     if (*outputLine == NULL) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
-    (*outputLine)[0] = '\0'; // Starting with empty string.
-
-    char rc = 0;
 
-    if ((rc = appendBoxedValue(outputLine, headerDum, 1)) != CSV_HANDLER__OK) {
-        return rc;
-    }
-    free(headerDum);
+    char *dest = writeBoxed(*outputLine, headerDum, strlen(headerDum), handler->width, 1);
 
-    if ((*outputLine)[width - 1] != ' ') {
+    if ((*outputLine)[handler->width - 1] != ' ') {
         // If header is too wide to fix in box, set its last character to ].
-        (*outputLine)[width - 1] = ']';
+        (*outputLine)[handler->width - 1] = ']';
     }
 
-    for (int i = 0; entireInput[i] != NULL; i++) {
-        if ((rc = appendBoxedValue(outputLine, entireInput[i][ind], 1)) != CSV_HANDLER__OK) {
-            return rc;
-        }
+    for (int i = 0; i < rowCount; i++) {
+        const char *value = handler->entireInput[i][ind];
+        dest = writeBoxed(dest, value, strlen(value), handler->width, 1);
     }
+    *dest = '\0';
 
-    ind++;
+    handler->transposedInd++;
 
     return CSV_HANDLER__OK;
 }
 
 /**
-   Get transposed line of line numbers to stdout.
+   Get transposed line of line numbers to stdout.  Only lasts until the next
+   transposed line.
  */
-char csv_handler_transposed_number_line(char **outputLine)
+char csv_handler_transposed_number_line(csv_handler *handler, char **outputLine)
 {
     // Similar to csv_handler_transposed_line, but just using lineNums.
 
-    if (*outputLine != NULL) {
-        free (*outputLine);
-        *outputLine = NULL;
-    }
-
-    if (lineNums == NULL) {
+    if (handler->lineNums == NULL) {
         return CSV_HANDLER__LINE_IS_NULL;
     }
 
-    *outputLine = malloc(sizeof(char));
+    int numCount = 0;
+    for (; handler->lineNums[numCount] != 0; numCount++) {}
+
+    *outputLine = lineAlloc(handler, sizeof(char) * ((handler->width + 1) * (numCount + 1) + 1));
     if (*outputLine == NULL) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
     // First part is just empty space and sadness.
-    char rc;
-    (*outputLine)[0] = '\0';
-    if ((rc = appendBoxedValue(outputLine, "", 0)) != CSV_HANDLER__OK) {
-        return rc;
-    }
+    char *dest = writeBoxed(*outputLine, "", 0, handler->width, 0);
 
-    int i = 0;
-    char *numStrDum;
+    char numStrDum[12]; // Enough for any int.
     int numStrLen;
 
-    while (lineNums[i] != 0) {
-        numStrLen = countDigits(lineNums[i]);
-        numStrDum = malloc(sizeof(char) * (numStrLen + 1));
-        if (numStrDum == NULL) {
-            return CSV_HANDLER__OUT_OF_MEMORY;
-        }
-        sprintf(numStrDum, "%d", lineNums[i]);
-
-        if ((rc = appendBoxedValue(outputLine, numStrDum, 0)) != CSV_HANDLER__OK) {
-            return rc;
-        }
-        free(numStrDum);
-        i++;
+    for (int i = 0; i < numCount; i++) {
+        numStrLen = sprintf(numStrDum, "%d", handler->lineNums[i]);
+        dest = writeBoxed(dest, numStrDum, numStrLen, handler->width, 0);
     }
+    *dest = '\0';
 
     return CSV_HANDLER__OK;
 }
@@ -787,24 +1678,24 @@ char csv_handler_transposed_number_line(char **outputLine)
  *
  * @param   outputLine
  */
-char csv_handler_transposed_border_line(char **outputLine)
+char csv_handler_transposed_border_line(csv_handler *handler, char **outputLine)
 {
     if (*outputLine != NULL) {
         free(*outputLine);
         *outputLine = NULL;
     }
 
-    if (entireInput == NULL) {
+    if (handler->entireInput == NULL) {
         return CSV_HANDLER__LINE_IS_NULL;
     }
 
     int len = 0;
 
     // Count up the number of fields in the array.
-    for (;entireInput[++len] != NULL;){};
+    for (;handler->entireInput[++len] != NULL;){};
     len++; // One more for headers.
 
-    len = (len * (width + 1));
+    len = (len * (handler->width + 1));
     // len is number of elements in first row, so multiply it by field width
     // (plus one for |).
 
@@ -829,9 +1720,9 @@ char csv_handler_transposed_border_line(char **outputLine)
  *
  * @param   newWidth
  */
-void csv_handler_set_width(int newWidth)
+void csv_handler_set_width(csv_handler *handler, int newWidth)
 {
-    width = newWidth;
+    handler->width = newWidth;
 }
 
 /**
@@ -839,12 +1730,12 @@ void csv_handler_set_width(int newWidth)
  *
  * @param   fields
  */
-char csv_handler_set_selected_fields(char *fields)
+char csv_handler_set_selected_fields(csv_handler *handler, char *fields)
 {
-    if (headers == NULL) {
+    if (handler->headers == NULL) {
         return CSV_HANDLER__HEADERS_NOT_SET;
     }
-    if (selectedFields != NULL) {
+    if (handler->selectedFields != NULL) {
         return CSV_HANDLER__ALREADY_SET;
     }
     if (fields[0] == '\0') {
@@ -852,8 +1743,8 @@ char csv_handler_set_selected_fields(char *fields)
         return CSV_HANDLER__OK;
     }
 
-    selectedFieldCount = count_fields(fields, ','); // Always use comma for this.
-    selectedFields = malloc(sizeof(int) * (getSelectedFieldCount() + 1));
+    handler->selectedFieldCount = count_fields(fields, ','); // Always use comma for this.
+    handler->selectedFields = malloc(sizeof(int) * (getSelectedFieldCount(handler) + 1));
     char **fieldArr = parse_csv(fields, ','); // Always comma for this.
 
     if (fieldArr == NULL) {
@@ -861,46 +1752,73 @@ char csv_handler_set_selected_fields(char *fields)
     }
 
     for (int i = 0; fieldArr[i] != NULL; i++) {
-        selectedFields[i] = -1;
-        for (int j = 0; headers[j] != NULL; j++) {
-            if (strcmp(fieldArr[i], headers[j]) == 0) {
-                selectedFields[i] = j;
+        handler->selectedFields[i] = -1;
+        for (int j = 0; handler->headers[j] != NULL; j++) {
+            if (strcmp(fieldArr[i], handler->headers[j]) == 0) {
+                handler->selectedFields[i] = j;
             }
         }
-        if (selectedFields[i] == -1) {
+        if (handler->selectedFields[i] == -1) {
             // Nothing was found, so return rc.
             return CSV_HANDLER__HEADER_NOT_FOUND;
         }
     }
 
-    selectedFields[getSelectedFieldCount()] = -1;
+    handler->selectedFields[getSelectedFieldCount(handler)] = -1;
 
     free_csv_line(fieldArr);
 
+    for (int i = 0; handler->selectedFields[i] != -1; i++) {
+        if (handler->selectedFields[i] >= handler->neededCount) {
+            handler->neededCount = handler->selectedFields[i] + 1;
+        }
+    }
+
+    handler->neededFields = calloc(handler->neededCount, sizeof(char));
+    handler->outputSpans = malloc(sizeof(csv_span) * getSelectedFieldCount(handler));
+
+    if (handler->neededFields == NULL || handler->outputSpans == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    for (int i = 0; handler->selectedFields[i] != -1; i++) {
+        handler->neededFields[handler->selectedFields[i]] = 1;
+    }
+
     return CSV_HANDLER__OK;
 }
 
 /**
- * Close out everything.
+ * Close out everything, including the handler itself.
  */
-char csv_handler_close()
+char csv_handler_close(csv_handler *handler)
 {
-    if (headers != NULL) {
-        free_csv_line(headers);
+    if (handler == NULL) {
+        return CSV_HANDLER__OK;
+    }
+
+    if (handler->headers != NULL && !handler->isPart) {
+        free_csv_line(handler->headers);
     }
-    if (entireInput != NULL) {
-        for (int i = 0; entireInput[i] != NULL; i++) {
-            free_csv_line(entireInput[i]);
-            entireInput[i] = NULL;
+    if (handler->entireInput != NULL) {
+        for (int i = 0; handler->entireInput[i] != NULL; i++) {
+            free_csv_line(handler->entireInput[i]);
         }
-        free(entireInput);
+        free(handler->entireInput);
     }
 
-    free(line);
-    line = NULL;
-    free(selectedFields);
-    selectedFields = NULL;
-    csvh_line_helper_close();
+    freeLine(handler);
+    free(handler->spans);
+    csvh_arena_free(handler->lineArena);
+    csvh_reader_close(handler->reader);
+    if (!handler->isPart) {
+        free(handler->selectedFields);
+        free(handler->neededFields);
+    }
+    free(handler->outputSpans);
+    free(handler->lineNums);
+    csvh_line_helper_close(handler->lineHelper);
+    free(handler);
 
     return CSV_HANDLER__OK;
 }
@@ -913,191 +1831,301 @@ char csv_handler_close()
  *
  * @param   parsedLine
  */
-static char getParsedLine(char ***parsedLine)
+static char getParsedLine(csv_handler *handler, char ***parsedLine)
 {
-    if (selectedFields == NULL) {
-        *parsedLine = parse_csv(line, delim);
-        if (*parsedLine == NULL) {
-            // Is this right?  I think it could mean it's unparseable.
-            return CSV_HANDLER__OUT_OF_MEMORY;
-        }
-
-        return CSV_HANDLER__OK;
+    char rc;
+    if ((rc = getLineSpans(handler)) != CSV_HANDLER__OK) {
+        return rc;
     }
 
-    char **dumParsed = parse_csv(line, delim);
+    // Only the fields that are output get copied.
+    int count = getOutputSpanCount(handler);
 
-    *parsedLine = malloc(sizeof(char **) * (getSelectedFieldCount() + 1));
+    *parsedLine = malloc(sizeof(char *) * (count + 1));
     if (*parsedLine == NULL) {
         return CSV_HANDLER__OUT_OF_MEMORY;
     }
 
-    for (int i = 0, j = 0; (j = selectedFields[i]) != -1; i++) {
-        (*parsedLine)[i] = malloc(sizeof(char *) * (strlen(dumParsed[j]) + 1));
-        strcpy((*parsedLine)[i], dumParsed[j]);
-    }
+    for (int i = 0; i < count; i++) {
+        const csv_span *span = getOutputSpan(handler, i);
 
-    (*parsedLine)[getSelectedFieldCount()] = NULL;
+        (*parsedLine)[i] = malloc(sizeof(char) * (span->len + 1));
+        if ((*parsedLine)[i] == NULL) {
+            free_csv_line(*parsedLine);
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+        memcpy((*parsedLine)[i], span->start, span->len);
+        (*parsedLine)[i][span->len] = '\0';
+        (*parsedLine)[i + 1] = NULL; // So it can be freed partway through.
+    }
 
-    free_csv_line(dumParsed);
+    (*parsedLine)[count] = NULL;
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Append string with new boxed value for printing to output.
- *
- * @param   outputLine
- * @param   newValue
- * @param   useBrace
+ * Split the current line up into its fields, if it hasn't been already.  The
+ * fields point into the line (or into a copy of it, if it has quotes to take
+ * out and it belongs to the reader), so nothing is allocated per field.
  */
-static char appendBoxedValue(char **outputLine, char *newValue, char useBrace)
+static char getLineSpans(csv_handler *handler)
 {
-    int initialLen = strlen(*outputLine);
-    *outputLine = realloc(*outputLine, sizeof(char) * (initialLen + 2 + width));
-    // +2 is one for '|' and one for null terminator.
-
-    if (*outputLine == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
+    if (handler->spanCount >= 0) {
+        return CSV_HANDLER__OK;
     }
 
-    // Only want to concat part of the string, so need to do some funky stuff.
-
-    int contentLength = strlen(newValue);
-    if (contentLength > width) {
-        contentLength = width;
+    if (handler->line == NULL) {
+        return CSV_HANDLER__LINE_IS_NULL;
     }
-    int fillerLength = width - contentLength; // Will be zero if content is larger than width.
 
-    for (int j = 0; j < contentLength; j++) {
-        if (newValue[j] == '\n') {
-            // Don't display newline.  It's confusing in this context.
-            (*outputLine)[initialLen + j] = ' ';
-        } else {
-            (*outputLine)[initialLen + j] = newValue[j];
+    char *record = handler->line;
+
+    if (!handler->lineOwned && memchr(handler->line, handler->dialect.quote, handler->lineLen) != NULL) {
+        // Quoted fields get unescaped in place, but the reader's memory is
+        // read-only.
+        record = lineAlloc(handler, handler->lineLen);
+        if (record == NULL) {
+            return CSV_HANDLER__OUT_OF_MEMORY;
         }
-        // Note that this starts with j = 0, so overwriting the null terminator.
+
+        memcpy(record, handler->line, handler->lineLen);
     }
-    for (int j = 0; j < fillerLength; j++) {
-        (*outputLine)[initialLen + contentLength + j] = ' ';
+
+    if (handler->neededFields == NULL) {
+        handler->spanCount = parse_csv_spans(
+            &handler->dialect,
+            record,
+            handler->lineLen,
+            &handler->spans,
+            &handler->spanCap
+        );
+    } else {
+        // Nothing past the last selected field is looked at.
+        handler->spanCount = parse_csv_spans_needed(
+            &handler->dialect,
+            record,
+            handler->lineLen,
+            handler->neededFields,
+            handler->neededCount,
+            &handler->spans,
+            &handler->spanCap
+        );
     }
 
-    (*outputLine)[initialLen + width] = useBrace ? '|' : ' '; // Next brace.
-    (*outputLine)[initialLen + width + 1] = '\0'; // Putting back in the null terminator.
+    if (handler->spanCount < 0) {
+        // Is this right?  I think it could mean it's unparseable.
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
 
     return CSV_HANDLER__OK;
 }
 
 /**
- * Get selected field count.
+ * Get the field of the current line at a position in the output (i.e., after
+ * selecting fields).  Must have called getLineSpans.  A field that the line
+ * doesn't have is empty.
+ *
+ * @param   pos
  */
-static int getSelectedFieldCount()
+static const csv_span *getOutputSpan(csv_handler *handler, int pos)
 {
-    return (selectedFieldCount == -1) ? countHeaders : selectedFieldCount;
+    static const csv_span missing = { "", 0 };
+    int ind = (handler->selectedFields == NULL) ? pos : handler->selectedFields[pos];
+
+    return (ind < handler->spanCount) ? &handler->spans[ind] : &missing;
 }
 
 /**
- * Get field name from position number.
- *
- * @param   pos
+ * Count of fields of the current line in the output.  Must have called
+ * getLineSpans.
  */
-static char *getHeaderFromPosition(int pos)
+static int getOutputSpanCount(csv_handler *handler)
 {
-    if (selectedFieldCount == -1) {
-        return headers[pos];
-    } else {
-        return headers[selectedFields[pos]];
-    }
+    return (handler->selectedFields == NULL) ? handler->spanCount : getSelectedFieldCount(handler);
 }
 
 /**
- * "Unparse" a specific value (i.e., cell), by surrounding with double-quotes if
- * necessary and doubling double-quotes if necessary.
+ * Get memory that lasts as long as the current line.
  *
- * @param   value
+ * @param   size
  */
-static char unparseValue(char **value)
+static void *lineAlloc(csv_handler *handler, size_t size)
 {
-    char dontParse = 1;
-    char doubleQuotes = 0;
-    for (long int i = 0; (*value)[i]; i++) {
-        if ((*value)[i] == delim || (*value)[i] == '\n') {
-            dontParse = 0;
-        } else if ((*value)[i] == '"') {
-            dontParse = 0;
-            doubleQuotes++;
+    if (handler->lineArena == NULL) {
+        handler->lineArena = csvh_arena_new(4096);
+
+        if (handler->lineArena == NULL) {
+            return NULL;
         }
     }
 
-    if (dontParse) {
-        return CSV_HANDLER__OK;
-    }
+    return csvh_arena_alloc(handler->lineArena, size);
+}
 
-    char *newValue = malloc(sizeof(char) * (strlen(*value) + doubleQuotes + 3));
-    // +1 for null term, +2 for opening and closing double quotes.
-    strcpy(newValue, "\"");
+/**
+ * Write a value boxed for printing to output (cut off or padded out to width,
+ * then the next brace).  Returns the end of what was written, which is always
+ * width + 1 characters, without a null terminator.
+ *
+ * @param   dest
+ * @param   value
+ * @param   len
+ * @param   width
+ * @param   useBrace
+ */
+static char *writeBoxed(char *dest, const char *value, size_t len, int width, char useBrace)
+{
+    int contentLength = (len > (size_t) width) ? width : (int) len;
+    int fillerLength = width - contentLength; // Will be zero if content is larger than width.
 
-    for (long int i = 0, j = 1; (*value)[i] != '\0'; i++) {
-        newValue[j] = (*value)[i];
-        if (newValue[j] == '"') {
-            newValue[++j] = '"';
+    for (int j = 0; j < contentLength; j++) {
+        if (value[j] == '\n') {
+            // Don't display newline.  It's confusing in this context.
+            dest[j] = ' ';
+        } else {
+            dest[j] = value[j];
         }
-        j++;
     }
+    memset(dest + contentLength, ' ', fillerLength);
 
-    newValue[strlen(*value) + doubleQuotes + 1] = '\0';
-    strcat(newValue, "\"");
+    dest[width] = useBrace ? '|' : ' '; // Next brace.
 
-    free(*value);
-    *value = newValue;
+    return dest + width + 1;
+}
 
-    return CSV_HANDLER__OK;
+/**
+ * Get selected field count.
+ */
+static int getSelectedFieldCount(csv_handler *handler)
+{
+    return (handler->selectedFieldCount == -1) ? handler->countHeaders : handler->selectedFieldCount;
 }
 
 /**
- * Copy an array of strings into first passed variable, where source array of
- * strings is terminated by a NULL pointer.
+ * Get field name from position number.
  *
- * @param   destArray
- * @param   srcArray
- * @param   specInds
- *  "Specify indices" array.  If null, then use all from source array.
+ * @param   pos
  */
-static char copyArrayOfStrings(char ***destArray, char ***srcArray, int *specInds)
+static char *getHeaderFromPosition(csv_handler *handler, int pos)
 {
-    if (*destArray != NULL) {
-        return CSV_HANDLER__ALREADY_SET;
+    if (handler->selectedFieldCount == -1) {
+        return handler->headers[pos];
+    } else {
+        return handler->headers[handler->selectedFields[pos]];
     }
+}
+
+/**
+ * Length of a value once it's "unparsed", i.e., surrounded with quotes and
+ * with its quotes escaped (doubled, or after the escape character if there is
+ * one, which gets escaped too), if necessary.
+ *
+ * @param   span
+ */
+static size_t unparsedLength(csv_handler *handler, const csv_span *span)
+{
+    unsigned char found = 0;
+    size_t escapes = 0;
 
-    *destArray = malloc(sizeof(char **) * (getSelectedFieldCount() + 1));
-    // Don't bother to get the count of the source array, at least not right
-    // now.  Anything other than output width is not *currently* a use case.
-    // Don't set this size to module-wide variable to reuse because it's
-    // *hypothetically* possible that it can change if one line has more fields
-    // than another.  (That would break RFC 4180, but, need to be prepared for
-    // that.)  So, we need to calculate it every time.
+    for (size_t i = 0; i < span->len; i++) {
+        unsigned char class = handler->unparseClasses[(unsigned char) span->start[i]];
 
-    if (*destArray == NULL) {
-        return CSV_HANDLER__OUT_OF_MEMORY;
+        found |= class;
+        escapes += class & UNPARSE_ESCAPE;
     }
 
-    int i = 0;
-    char *srcEl = NULL;
+    if (
+        found == 0
+        || (found == UNPARSE_DELIM && handler->dialect.delimLen > 1 && !hasDelim(handler, span))
+    ) {
+        return span->len;
+    }
 
-    for (;(srcEl = (specInds == NULL) ? (*srcArray)[i] : (*srcArray)[specInds[i]]); i++) {
-        // Expand this out to help understand it better.
-        (*destArray)[i] = malloc(sizeof(char) * (strlen(srcEl) + 1));
+    return span->len + escapes + 2;
+}
 
-        if ((*destArray)[i] == NULL) {
-            return CSV_HANDLER__OUT_OF_MEMORY;
+/**
+ * Whether a value has the whole delimiter in it (for one of more than one
+ * byte; see unparsedLength).
+ *
+ * @param   span
+ */
+static char hasDelim(csv_handler *handler, const csv_span *span)
+{
+    for (size_t i = 0; i + handler->dialect.delimLen <= span->len; i++) {
+        if (memcmp(span->start + i, handler->dialect.delim, handler->dialect.delimLen) == 0) {
+            return 1;
         }
+    }
+
+    return 0;
+}
 
-        strcpy((*destArray)[i], srcEl);
+/**
+ * Switch to another dialect.
+ *
+ * @param   updated
+ */
+static void useDialect(csv_handler *handler, const csv_dialect *updated)
+{
+    handler->dialect = *updated;
+    setUnparseClasses(handler);
+    csvh_line_helper_set_dialect(handler->lineHelper, &handler->dialect);
+}
+
+/**
+ * Fill in unparseClasses for the dialect.
+ */
+static void setUnparseClasses(csv_handler *handler)
+{
+    const csv_dialect *d = &handler->dialect;
+    unsigned char *classes = handler->unparseClasses;
+
+    memset(classes, 0, sizeof(handler->unparseClasses));
+
+    classes['\n'] = UNPARSE_QUOTE;
+    classes[(unsigned char) d->delim[0]] = (d->delimLen > 1) ? UNPARSE_DELIM : UNPARSE_QUOTE;
+    classes[(unsigned char) d->quote] = UNPARSE_ESCAPE | UNPARSE_QUOTE;
+    if (d->escape != '\0') {
+        classes[(unsigned char) d->escape] = UNPARSE_ESCAPE | UNPARSE_QUOTE;
     }
+}
 
-    (*destArray)[i] = NULL;
+/**
+ * "Unparse" a specific value (i.e., cell) into dest, by surrounding with
+ * quotes and escaping if necessary (see unparsedLength).  Returns the end of
+ * what was written.  dest needs room for unparsedLength.
+ *
+ * @param   dest
+ * @param   span
+ */
+static char *writeUnparsed(csv_handler *handler, char *dest, const csv_span *span)
+{
+    if (unparsedLength(handler, span) == span->len) {
+        memcpy(dest, span->start, span->len);
+        return dest + span->len;
+    }
 
-    return CSV_HANDLER__OK;
+    char quote = handler->dialect.quote;
+    char escape = handler->dialect.escape;
+
+    *dest++ = quote;
+    for (size_t i = 0; i < span->len; i++) {
+        char c = span->start[i];
+
+        if (escape == '\0') {
+            if (c == quote) {
+                *dest++ = quote;
+            }
+        } else if (c == quote || c == escape) {
+            *dest++ = escape;
+        }
+        *dest++ = c;
+    }
+    *dest++ = quote;
+
+    return dest;
 }
 
 /**
@@ -1107,12 +2135,12 @@ static char copyArrayOfStrings(char ***destArray, char ***srcArray, int *specInd
  *
  * @param   critHeader
  */
-static int getHeaderIndexFromString(char *critHeader)
+static int getHeaderIndexFromString(csv_handler *handler, char *critHeader)
 {
     int critInd = -1;
-    for (;strcmp(critHeader, headers[++critInd]) != 0 && headers[critInd] != NULL;) {}
+    for (;strcmp(critHeader, handler->headers[++critInd]) != 0 && handler->headers[critInd] != NULL;) {}
 
-    if (headers[critInd] == NULL) {
+    if (handler->headers[critInd] == NULL) {
         // Not found.
         return -1;
     }
@@ -1126,21 +2154,21 @@ static int getHeaderIndexFromString(char *critHeader)
  * This should only be called from csv_handler_read_next_line when
  * hasHeaders = 0!
  */
-static char setHeadersAsNumbers()
+static char setHeadersAsNumbers(csv_handler *handler)
 {
-    if (lineBuff == NULL) {
+    if (handler->lineBuff == NULL) {
         return CSV_HANDLER__LINE_IS_NULL;
     }
 
-    if (headers != NULL) {
+    if (handler->headers != NULL) {
         return CSV_HANDLER__ALREADY_SET;
     }
 
-    int lineLen = 0;
-    char **parsedLine = parse_csv(lineBuff, delim);
+    int fieldCount = 0;
+    char **parsedLine = parse_csv_len(&handler->dialect, handler->lineBuff, handler->lineBuffLen);
     // Not using getParsedLine because dont' want to filter anything out right
     // now.
-    for (;parsedLine[++lineLen] != NULL;) {}
+    for (;parsedLine[++fieldCount] != NULL;) {}
     free_csv_line(parsedLine);
 
     char *headerLine = malloc(sizeof(char));
@@ -1148,29 +2176,27 @@ static char setHeadersAsNumbers()
     int newDigitLen;
     char *newDigitStrDum;
 
-    char delimStr[2];
-    delimStr[0] = delim;
-    delimStr[1] = '\0';
-
-    for (int i = 1; i < lineLen + 1; i++) {
+    for (int i = 1; i < fieldCount + 1; i++) {
         newDigitLen = countDigits(i);
         newDigitStrDum = malloc(sizeof(char) * (newDigitLen + 1));
         if (newDigitStrDum == NULL) {
             return CSV_HANDLER__OUT_OF_MEMORY;
         }
-        headerLine = realloc(headerLine, strlen(headerLine) + newDigitLen + 2);
+        headerLine = realloc(headerLine, strlen(headerLine) + newDigitLen + handler->dialect.delimLen + 1);
         if (headerLine == NULL) {
             return CSV_HANDLER__OUT_OF_MEMORY;
         }
         sprintf(newDigitStrDum, "%d", i);
         strcat(headerLine, newDigitStrDum);
-        strcat(headerLine, delimStr);
+        strcat(headerLine, handler->dialect.delim);
         free(newDigitStrDum);
     }
 
-    headerLine[strlen(headerLine) - 1] = '\0'; // Remove last comma.
+    headerLine[strlen(headerLine) - handler->dialect.delimLen] = '\0'; // Remove last comma.
 
-    line = headerLine;
+    handler->line = headerLine;
+    handler->lineLen = strlen(headerLine);
+    handler->lineOwned = 1;
     headerLine = NULL;
 
     return CSV_HANDLER__OK;
@@ -1184,6 +2210,11 @@ static char setHeadersAsNumbers()
 static int countDigits(int num)
 {
     int cnt = 1;
+    if (num < 0) {
+        // For the minus sign.
+        cnt++;
+        num = -num;
+    }
     while (num >= 10) {
         num/=10;
         cnt++;
@@ -1191,3 +2222,623 @@ static int countDigits(int num)
 
     return cnt;
 }
+
+/**
+ * Open the reader on stdin, if no input file was set.
+ */
+static char openReader(csv_handler *handler)
+{
+    if (handler->reader != NULL) {
+        return CSV_HANDLER__OK;
+    }
+
+    char rc = csvh_reader_open(&handler->reader, NULL, handler->encoding);
+    sniffDialect(handler, handler->reader);
+    setUpReader(handler);
+
+    return fromReaderRc(rc);
+}
+
+/**
+ * Pass our settings on to a reader that was just opened (if it was).
+ */
+static void setUpReader(csv_handler *handler)
+{
+    if (handler->reader == NULL) {
+        return;
+    }
+
+    csvh_reader_set_resync(handler->reader, handler->maxRecord, &handler->dialect);
+}
+
+/**
+ * Guess the delimiter, quote and hasHeaders from a sample of the start of the
+ * input, for whichever of them wasn't set.  Left as they are if the guess is
+ * unsure.
+ *
+ * @param   sampleReader
+ */
+static void sniffDialect(csv_handler *handler, csvh_reader *sampleReader)
+{
+    const char *sample;
+    size_t len;
+    char complete;
+    char guess;
+
+    if (
+        sampleReader == NULL
+        || !handler->sniff
+        || (handler->delimSet && handler->quoteSet && handler->hasHeadersSet)
+    ) {
+        return;
+    }
+
+    if (
+        csvh_reader_peek(
+            sampleReader,
+            CSVH_SNIFF__SAMPLE,
+            CSVH_SNIFF__ROWS,
+            &sample,
+            &len,
+            &complete
+        ) != CSVH_READER__OK
+    ) {
+        return;
+    }
+
+    sniffDelim(handler, sample, len, complete);
+
+    if (
+        !handler->quoteSet
+        && csvh_sniff_quote(sample, len, complete, handler->dialect.delim[0], &guess) == CSVH_SNIFF__OK
+        && guess != handler->dialect.quote
+        && csv_handler_set_quoting(handler, guess, handler->dialect.escape) == CSV_HANDLER__OK
+    ) {
+        // The delimiter was guessed going by the other quote.
+        handler->quoteSet = 0;
+        sniffDelim(handler, sample, len, complete);
+    }
+
+    if (
+        !handler->hasHeadersSet
+        && csvh_sniff_has_header(
+            sample,
+            len,
+            complete,
+            handler->dialect.quote,
+            handler->dialect.delim[0],
+            &guess
+        ) == CSVH_SNIFF__OK
+    ) {
+        handler->hasHeaders = guess;
+    }
+}
+
+/**
+ * Guess the delimiter from the sample, going by the quote, unless it was set.
+ *
+ * @param   sample
+ * @param   len
+ * @param   complete
+ */
+static void sniffDelim(csv_handler *handler, const char *sample, size_t len, char complete)
+{
+    char guess;
+
+    if (
+        !handler->delimSet
+        && csvh_sniff_delim(sample, len, complete, handler->dialect.quote, &guess) == CSVH_SNIFF__OK
+    ) {
+        char guessStr[2] = { guess, '\0' };
+
+        csv_handler_set_delim(handler, guessStr);
+        handler->delimSet = 0;
+    }
+}
+
+/**
+ * Pass any quoting mistakes the reader has run into since last time to
+ * malformedCallback.
+ */
+static void reportMalformed(csv_handler *handler)
+{
+    size_t at;
+    long count = csvh_reader_malformed(handler->reader, &at);
+
+    if (handler->isPart) {
+        // A part with mistakes in it gets read over again, so they're passed
+        // along then (see csv_handler_run_parts).
+        return;
+    }
+
+    if (count <= handler->malformedReported || handler->malformedCallback == NULL) {
+        return;
+    }
+
+    handler->malformedCallback(handler->malformedData, count - handler->malformedReported, at);
+    handler->malformedReported = count;
+}
+
+/**
+ * Translate a return code from csvh-reader into one of ours.
+ *
+ * @param   rc
+ */
+static char fromReaderRc(char rc)
+{
+    switch (rc) {
+        case CSVH_READER__OK:
+            return CSV_HANDLER__OK;
+        case CSVH_READER__DONE:
+            return CSV_HANDLER__DONE;
+        case CSVH_READER__FILE_NOT_FOUND:
+            return CSV_HANDLER__FILE_NOT_FOUND;
+        case CSVH_READER__OUT_OF_MEMORY:
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        case CSVH_READER__UNSUPPORTED_INPUT:
+            return CSV_HANDLER__UNSUPPORTED_INPUT;
+        case CSVH_READER__NOT_MAPPED:
+            return CSV_HANDLER__NOT_A_FILE;
+        case CSVH_READER__HEADER_MISMATCH:
+            return CSV_HANDLER__HEADER_MISMATCH;
+        case CSVH_READER__READ_ERROR:
+            return CSV_HANDLER__READ_ERROR;
+    }
+
+    return CSV_HANDLER__UNKNOWN_ERROR;
+}
+
+/**
+ * Let go of the current line, freeing it if it's ours.
+ */
+static void freeLine(csv_handler *handler)
+{
+    if (handler->lineOwned) {
+        free(handler->line);
+        handler->lineOwned = 0;
+    }
+
+    handler->line = NULL;
+    handler->lineLen = 0;
+    handler->spanCount = -1;
+
+    if (handler->lineArena != NULL) {
+        csvh_arena_reset(handler->lineArena);
+    }
+}
+
+/**
+ * Do what csv_handler_run_parts does for what's left of the input, or with
+ * several files, for what's left of the current one and up to
+ * FILES_PER_ROUND files after it.  more is set if that all got done, and
+ * there are more files after those.
+ *
+ * @param   threadCount
+ * @param   run
+ * @param   data
+ * @param   out
+ * @param   more
+ */
+static char runPartRound(
+    csv_handler *handler,
+    int threadCount,
+    csv_handler_part_callback run,
+    void *data,
+    FILE *out,
+    char *more
+) {
+    const char *start;
+    const char *end;
+    char rc = CSV_HANDLER__OK;
+
+    *more = 0;
+
+    if (csvh_reader_mapped_rest(handler->reader, &start, &end) != CSVH_READER__OK) {
+        return CSV_HANDLER__OK;
+    }
+
+    int later = csvh_reader_later_files(handler->reader);
+    int window = threadCount * PARTS_AHEAD_PER_THREAD;
+    partRun context = {
+        handler,
+        NULL,
+        0,
+        calloc(window, sizeof(csvh_memout)),
+        window,
+        NULL,
+        (later < FILES_PER_ROUND) ? later : FILES_PER_ROUND,
+        handler->dialect.quote,
+        run,
+        data,
+        0
+    };
+
+    context.files = calloc(context.fileCount + 1, sizeof(csvh_reader *));
+
+    if (context.outputs == NULL
+        || context.files == NULL
+        || csvh_pool_run(threadCount, context.fileCount, openFileTask, &context) != CSVH_POOL__OK
+    ) {
+        endPartRun(&context);
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    // Only the files up to the first one that isn't a plain file are split up.
+    // That one (and everything after it) is left to be read as usual.
+    int fileCount = 0;
+    while (fileCount < context.fileCount && context.files[fileCount] != NULL) {
+        fileCount++;
+    }
+
+    if (fileCount == 0 && end - start < 2 * PART_SIZE) {
+        endPartRun(&context);
+        return CSV_HANDLER__OK;
+    }
+
+    const char *fileStart;
+    const char *fileEnd;
+
+    context.taskCount = countChunks(start, end);
+    for (int i = 0; i < fileCount; i++) {
+        csvh_reader_mapped_rest(context.files[i], &fileStart, &fileEnd);
+        context.taskCount += countChunks(fileStart, fileEnd);
+    }
+
+    context.tasks = calloc(context.taskCount + 1, sizeof(partTask));
+
+    if (context.tasks == NULL) {
+        endPartRun(&context);
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    int chunkInd = addChunks(context.tasks, 0, handler->reader, -1, start, end);
+    for (int i = 0; i < fileCount; i++) {
+        csvh_reader_mapped_rest(context.files[i], &fileStart, &fileEnd);
+        chunkInd = addChunks(context.tasks, chunkInd, context.files[i], i, fileStart, fileEnd);
+    }
+
+    // First, the quotes and line breaks in each chunk, all at once.  That's
+    // enough to tell where the parts start.
+    if (csvh_pool_run(threadCount, context.taskCount, countTask, &context) != CSVH_POOL__OK) {
+        endPartRun(&context);
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    int partCount = planParts(handler, context.tasks, context.taskCount);
+    csvh_pool *pool = NULL;
+
+    // The parts are all set up here, before any of them start, since they're
+    // copies of how the handler is now.
+    for (int i = 0; i < partCount && rc == CSV_HANDLER__OK; i++) {
+        rc = newPart(handler, &context.tasks[i].part, &context.tasks[i], i == 0);
+    }
+
+    if (rc != CSV_HANDLER__OK
+        || partCount < 2
+        || csvh_pool_start(
+            &pool,
+            threadCount,
+            partCount,
+            partTaskRun,
+            &context,
+            window
+        ) != CSVH_POOL__OK
+    ) {
+        endPartRun(&context);
+        return rc;
+    }
+
+    // Where reading picks back up (partCount if everything got read).
+    int stoppedAt = partCount;
+
+    for (int i = 0; i < partCount; i++) {
+        partTask *task = &context.tasks[i];
+        size_t at;
+
+        csvh_pool_wait_task(pool, i);
+
+        if (csvh_reader_malformed(task->part->reader, &at) > 0) {
+            // The part didn't start where it looked like it did, or it has
+            // mistakes of its own.  Either way, pick back up from the start
+            // of it, as usual (which says something about the mistakes).
+            stoppedAt = i;
+            break;
+        }
+
+        // (Part i + window doesn't start until part i is released, so
+        // they can share.)
+        csvh_memout *output = &context.outputs[i % window];
+        if (output->len > 0) {
+            fwrite(output->buff, 1, output->len, out);
+        }
+
+        // Everything read from the part counts as read from here, including
+        // where the restrictions are up to.
+        csvh_reader_skip_part(task->source, task->part->reader);
+        csvh_line_helper *helper = handler->lineHelper;
+        handler->lineHelper = task->part->lineHelper;
+        task->part->lineHelper = helper;
+        handler->lineBuff = NULL;
+
+        csvh_pool_release_task(pool, i);
+
+        if (task->rc != CSV_HANDLER__OK || !csvh_reader_at_end(task->part->reader)) {
+            // Failed, or stopped early (e.g., the restrictions are done), so
+            // the rest is left to be read as usual.
+            rc = task->rc;
+            stoppedAt = i;
+            break;
+        }
+    }
+
+    atomic_store(&context.stop, 1);
+    csvh_pool_release_task(pool, partCount - 1);
+    csvh_pool_finish(pool);
+
+    // With several files, move on to the file the parts stopped in (which
+    // carries on from where they left off), or past all of them.
+    if (stoppedAt == partCount && context.fileCount > 0) {
+        csvh_reader_skip_files(handler->reader, fileCount, NULL);
+        *more = (fileCount == context.fileCount && fileCount < later && rc == CSV_HANDLER__OK);
+    } else if (stoppedAt < partCount && context.tasks[stoppedAt].fileInd >= 0) {
+        int fileInd = context.tasks[stoppedAt].fileInd;
+
+        csvh_reader_skip_files(handler->reader, fileInd, context.files[fileInd]);
+        context.files[fileInd] = NULL;
+    }
+
+    endPartRun(&context);
+
+    return rc;
+}
+
+/**
+ * Close and free everything from runPartRound.  The parts go first, since
+ * they read out of the files.
+ *
+ * @param   run
+ */
+static void endPartRun(partRun *run)
+{
+    if (run->tasks != NULL) {
+        for (int i = 0; i < run->taskCount; i++) {
+            csv_handler_close(run->tasks[i].part);
+        }
+    }
+
+    if (run->files != NULL) {
+        for (int i = 0; i < run->fileCount; i++) {
+            csvh_reader_close(run->files[i]);
+        }
+    }
+
+    if (run->outputs != NULL) {
+        for (int i = 0; i < run->outputCount; i++) {
+            csvh_memout_free(&run->outputs[i]);
+        }
+    }
+
+    free(run->tasks);
+    free(run->files);
+    free(run->outputs);
+}
+
+/**
+ * How many chunks of PART_SIZE (or less, for the last one) from start to end
+ * is.
+ *
+ * @param   start
+ * @param   end
+ */
+static int countChunks(const char *start, const char *end)
+{
+    return (end - start + PART_SIZE - 1) / PART_SIZE;
+}
+
+/**
+ * Split from start to end of source into chunks, put in tasks from ind on,
+ * and return the index after the last one.
+ *
+ * @param   tasks
+ * @param   ind
+ * @param   source
+ * @param   fileInd     Which file after the current one source is, or -1 for
+ *                      the input itself.
+ * @param   start
+ * @param   end
+ */
+static int addChunks(
+    partTask *tasks,
+    int ind,
+    csvh_reader *source,
+    int fileInd,
+    const char *start,
+    const char *end
+) {
+    for (const char *chunk = start; chunk < end; chunk += PART_SIZE) {
+        tasks[ind].start = chunk;
+        tasks[ind].end = (end - chunk > PART_SIZE) ? chunk + PART_SIZE : end;
+        tasks[ind].source = source;
+        tasks[ind].fileInd = fileInd;
+        ind++;
+    }
+
+    return ind;
+}
+
+/**
+ * Split what's left of the input into parts, at the first line break outside
+ * of quotes in each chunk (going by the quotes in the chunks before it).  A
+ * chunk without one is part of the part before it.  Each file after the
+ * current one (if there are several) starts a part of its own.  The parts are
+ * put in tasks in place of the chunks, and the count of them is returned.
+ *
+ * @param   tasks
+ * @param   chunkCount
+ */
+static int planParts(csv_handler *handler, partTask *tasks, int chunkCount)
+{
+    // The line being held on to (see csv_handler_read_next_line) comes before
+    // the first part.
+    int firstLine = csvh_line_helper_get_line_num(handler->lineHelper) + 1 + (handler->lineBuff != NULL);
+    long breaks = 0;
+    int count = 0;
+
+    for (int first = 0, last; first < chunkCount; first = last + 1) {
+        // The chunks of one file.
+        csvh_reader *source = tasks[first].source;
+        int fileInd = tasks[first].fileInd;
+        const char *end;
+        int quoted = 0;
+
+        for (last = first; last + 1 < chunkCount && tasks[last + 1].source == source; last++) {}
+        end = tasks[last].end;
+
+        tasks[count].start = tasks[first].start;
+        tasks[count].source = source;
+        tasks[count].fileInd = fileInd;
+        tasks[count].firstLine = firstLine + breaks;
+        count++;
+
+        for (int i = first; i <= last; i++) {
+            csvh_scan_counts counts = tasks[i].counts;
+            const char *split = (counts.firstBreak[quoted] != NULL) ? counts.firstBreak[quoted] + 1 : NULL;
+
+            if (i > first && split != NULL && split < end) {
+                tasks[count - 1].end = split;
+                tasks[count].start = split;
+                tasks[count].source = source;
+                tasks[count].fileInd = fileInd;
+                tasks[count].firstLine = firstLine + breaks + 1;
+                count++;
+            }
+
+            breaks += counts.breaks[quoted];
+            quoted ^= counts.oddQuotes;
+        }
+
+        tasks[count - 1].end = end;
+
+        // A last line without a line break still counts.
+        if (end[-1] != '\n') {
+            breaks++;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Open a file after the current one, to split up (see runPartRound).  It's
+ * left NULL if it can't be.
+ *
+ * @param   context
+ * @param   taskInd
+ */
+static void openFileTask(void *context, int taskInd)
+{
+    partRun *run = context;
+
+    csvh_reader_open_later_file(&run->files[taskInd], run->handler->reader, taskInd);
+}
+
+/**
+ * Count the quotes and line breaks in a chunk (see csv_handler_run_parts).
+ *
+ * @param   context
+ * @param   taskInd
+ */
+static void countTask(void *context, int taskInd)
+{
+    partRun *run = context;
+    partTask *task = &run->tasks[taskInd];
+
+    csvh_scan_count(task->start, task->end, run->quote, &task->counts);
+}
+
+/**
+ * Read through a part (see csv_handler_run_parts), holding on to its output.
+ *
+ * @param   context
+ * @param   taskInd
+ */
+static void partTaskRun(void *context, int taskInd)
+{
+    partRun *run = context;
+    partTask *task = &run->tasks[taskInd];
+
+    if (atomic_load(&run->stop)) {
+        return;
+    }
+
+    csvh_memout *output = &run->outputs[taskInd % run->outputCount];
+    FILE *stream = csvh_memout_open(output);
+
+    if (stream == NULL) {
+        task->rc = CSV_HANDLER__OUT_OF_MEMORY;
+        return;
+    }
+
+    task->rc = run->run(task->part, stream, run->data);
+
+    if (csvh_memout_close(output) != CSVH_MEMOUT__OK && task->rc == CSV_HANDLER__OK) {
+        task->rc = CSV_HANDLER__OUT_OF_MEMORY;
+    }
+}
+
+/**
+ * Set up a handler for a part of the input, from start up to end of the task,
+ * that's the same as this one as of now.  Only the first part gets the line
+ * being held on to, if there is one.
+ *
+ * @param   part
+ * @param   task
+ * @param   first
+ */
+static char newPart(csv_handler *handler, csv_handler **part, partTask *task, char first)
+{
+    csv_handler *p = malloc(sizeof(csv_handler));
+
+    *part = p;
+
+    if (p == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    *p = *handler;
+    p->isPart = 1;
+    p->reader = NULL;
+    p->line = NULL;
+    p->lineLen = 0;
+    p->lineOwned = 0;
+    p->malformedReported = 0;
+    p->spans = NULL;
+    p->spanCap = 0;
+    p->spanCount = -1;
+    p->lineArena = NULL;
+    p->entireInput = NULL;
+    p->lineNums = NULL;
+    p->outputSpans = NULL;
+    p->lineHelper = csvh_line_helper_copy(handler->lineHelper);
+
+    if (!first) {
+        p->lineBuff = NULL;
+    }
+
+    if (p->lineHelper == NULL) {
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    if (!first) {
+        csvh_line_helper_set_line_num(p->lineHelper, task->firstLine, 1);
+    }
+
+    if (handler->outputSpans != NULL) {
+        p->outputSpans = malloc(sizeof(csv_span) * getSelectedFieldCount(handler));
+        if (p->outputSpans == NULL) {
+            return CSV_HANDLER__OUT_OF_MEMORY;
+        }
+    }
+
+    return fromReaderRc(csvh_reader_open_part(&p->reader, task->source, task->start, task->end));
+}
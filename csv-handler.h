@@ -1,6 +1,15 @@
 #ifndef csvhandler_h
 #define csvhandler_h
 
+#include <stddef.h>
+#include <stdio.h>
+
+#include "csv.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Constants
 
 #define CSV_HANDLER__OK                 0
@@ -13,55 +22,165 @@
 #define CSV_HANDLER__INVALID_INPUT      7
 #define CSV_HANDLER__HEADER_NOT_FOUND   8
 #define CSV_HANDLER__UNKNOWN_ERROR      9
+#define CSV_HANDLER__UNSUPPORTED_INPUT  10
+#define CSV_HANDLER__NOT_A_FILE         11
+#define CSV_HANDLER__HEADER_MISMATCH    12
+#define CSV_HANDLER__READ_ERROR         13
+
+typedef struct csv_handler csv_handler;
+
+/**
+ * For csv_handler_stream: called with each line's output fields, or with each
+ * of them in turn (pos is its place in the output), and the line's number.
+ * Return CSV_HANDLER__OK to go on.
+ */
+typedef char (*csv_handler_record_callback)(
+    void *data,
+    int lineNum,
+    const csv_span *fields,
+    int count
+);
+
+typedef char (*csv_handler_field_callback)(
+    void *data,
+    int lineNum,
+    int pos,
+    const csv_span *field
+);
+
+/**
+ * For csv_handler_set_malformed_callback: called when there are quoting
+ * mistakes in the input, with the count of them since last time, and the byte
+ * where the quote to blame for the last one was.
+ */
+typedef void (*csv_handler_malformed_callback)(void *data, long count, size_t at);
+
+/**
+ * For csv_handler_run_parts: called with each part of the input, on a thread
+ * of its own, to read through the part's lines (same as usual, with
+ * csv_handler_read_next_line) and write them to out.  Return
+ * CSV_HANDLER__OK once they're done.
+ */
+typedef char (*csv_handler_part_callback)(csv_handler *part, FILE *out, void *data);
+
+csv_handler *csv_handler_new();
 
 // Functions for typical output and vertical output.
-void csv_handler_set_has_headers(char hasHeadersIn);
+void csv_handler_set_has_headers(csv_handler *handler, char hasHeadersIn);
+
+char csv_handler_set_delim(csv_handler *handler, const char *delimIn);
+
+char csv_handler_set_quoting(csv_handler *handler, char quote, char escape);
+
+void csv_handler_set_sniff(csv_handler *handler, char sniffIn);
+
+char csv_handler_set_encoding(csv_handler *handler, const char *name);
+
+void csv_handler_set_max_record(csv_handler *handler, long bytes);
+
+char csv_handler_set_input_file(csv_handler *handler, char *path);
+
+char csv_handler_set_input_files(csv_handler *handler, char **paths, int count);
+
+char csv_handler_set_read_ahead(csv_handler *handler);
+
+char csv_handler_set_use_index(csv_handler *handler);
+
+char csv_handler_set_follow(csv_handler *handler);
 
-void csv_handler_set_delim(char delimIn);
+char csv_handler_set_tail(csv_handler *handler, int count, char reverse);
 
-char csv_handler_skip_next_line();
+char csv_handler_skip_next_line(csv_handler *handler);
 
-char csv_handler_read_next_line();
+char csv_handler_skip_lines(csv_handler *handler, int count);
 
-char csv_handler_set_headers_from_line();
+char csv_handler_read_next_line(csv_handler *handler);
 
-char csv_handler_restrict_by_lines(char *lines);
+char csv_handler_set_headers_from_line(csv_handler *handler);
 
-char csv_handler_restrict_by_ranges(char *critHeader, char *ranges);
+char csv_handler_restrict_by_lines(csv_handler *handler, char *lines);
 
-char csv_handler_restrict_by_equals(char *critHeader, char *equals);
+char csv_handler_restrict_by_ranges(csv_handler *handler, char *critHeader, char *ranges);
 
-char csv_handler_output_headers(char **outputLine);
+char csv_handler_restrict_by_equals(csv_handler *handler, char *critHeader, char *equals);
 
-char csv_handler_raw_line(char **wholeLine);
+char csv_handler_restrict_by_equals_file(
+    csv_handler *handler,
+    char *critHeader,
+    char *path,
+    char *column
+);
 
-char csv_handler_output_line(char **outputLine);
+char csv_handler_restrict_by_filter(csv_handler *handler, char *expr);
 
-char csv_handler_output_line_number(char **outputString);
+char csv_handler_set_exclude(csv_handler *handler, char exclude);
 
-char csv_handler_output_line_padding(char **outputString);
+char csv_handler_output_headers(csv_handler *handler, char **outputLine);
 
-char csv_handler_border_line(char **outputLine);
+char csv_handler_raw_line(csv_handler *handler, char **wholeLine);
 
-char csv_handler_output_vertical_entry(char **outputEntry);
+char csv_handler_output_line(csv_handler *handler, char **outputLine);
 
-char csv_handler_vertical_border_line(char **outputLine);
+char csv_handler_output_line_number(csv_handler *handler, char **outputString);
+
+char csv_handler_output_line_padding(csv_handler *handler, char **outputString);
+
+char csv_handler_border_line(csv_handler *handler, char **outputLine);
+
+char csv_handler_output_vertical_entry(csv_handler *handler, char **outputEntry);
+
+char csv_handler_vertical_border_line(csv_handler *handler, char **outputLine);
+
+// Functions for getting the fields without any output (e.g., when embedded).
+
+char csv_handler_line_fields(csv_handler *handler, const csv_span **fields, int *count);
+
+int csv_handler_line_num(csv_handler *handler);
+
+void csv_handler_set_callbacks(
+    csv_handler *handler,
+    csv_handler_record_callback recordCallback,
+    csv_handler_field_callback fieldCallback,
+    void *data
+);
+
+char csv_handler_stream(csv_handler *handler);
+
+void csv_handler_set_malformed_callback(
+    csv_handler *handler,
+    csv_handler_malformed_callback callback,
+    void *data
+);
+
+long csv_handler_malformed(csv_handler *handler, size_t *at);
+
+char csv_handler_run_parts(
+    csv_handler *handler,
+    int threadCount,
+    csv_handler_part_callback run,
+    void *data,
+    FILE *out
+);
 
 // Functions for transposed output.
 
-char csv_handler_initialize_transpose();
+char csv_handler_initialize_transpose(csv_handler *handler);
 
-char csv_handler_transposed_line(char **outputLine);
+char csv_handler_transposed_line(csv_handler *handler, char **outputLine);
 
-char csv_handler_transposed_number_line(char **outputLine);
+char csv_handler_transposed_number_line(csv_handler *handler, char **outputLine);
 
-char csv_handler_transposed_border_line(char **outputLine);
+char csv_handler_transposed_border_line(csv_handler *handler, char **outputLine);
 
 // Other functions.
-void csv_handler_set_width(int newWidth);
+void csv_handler_set_width(csv_handler *handler, int newWidth);
+
+char csv_handler_set_selected_fields(csv_handler *handler, char *fields);
 
-char csv_handler_set_selected_fields(char *fields);
+char csv_handler_close(csv_handler *handler);
 
-char csv_handler_close();
+#ifdef __cplusplus
+}
+#endif
 
 #endif
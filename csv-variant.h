@@ -0,0 +1,213 @@
+/*
+ *  The byte-by-byte parsers, built once for each kind of dialect: csv.c
+ *  includes this once per kind, so that whether there's an escape character
+ *  or a delimiter of more than one byte is settled when it's compiled, not
+ *  checked for every byte.  (The quote and the bytes of the delimiter are
+ *  still whatever the dialect says.)  Before including it, define:
+ *
+ *  VARIANT( name )         name of a function for this kind, e.g. name##_plain
+ *  VARIANT_ESCAPED         1 if the dialect has an escape character
+ *  VARIANT_MULTI_DELIM     1 if its delimiter is more than one byte
+ *
+ *  Everything this defines, those included, is undefined again at the end.
+ *
+ *  A quote only opens a quoted field at the very start of a field; anywhere
+ *  else, it's just a character, same as in csvh-scan.c.
+ */
+
+#if VARIANT_ESCAPED
+#define ESCAPE_LOCAL const char esc = dialect->escape;
+#define IS_ESCAPE( c ) ( (c) == esc )
+#else
+#define ESCAPE_LOCAL
+#define IS_ESCAPE( c ) 0
+#endif
+
+#if VARIANT_MULTI_DELIM
+#define DELIM_LOCAL const size_t dlen = dialect->delimLen;
+#define AT_DELIM( ptr, end ) \
+    ( *(ptr) == del && (size_t) ( (end) - (ptr) ) >= dlen && memcmp( (ptr) + 1, dialect->delim + 1, dlen - 1 ) == 0 )
+#define DELIM_REST ( dlen - 1 )
+#else
+#define DELIM_LOCAL
+#define AT_DELIM( ptr, end ) ( *(ptr) == del )
+#define DELIM_REST 0
+#endif
+
+/*
+ *  Count the fields of a line.  Returns -1 if a quoted field is never closed.
+ */
+static int VARIANT(count)( const csv_dialect *dialect, const char *line, size_t len ) {
+    const char del = dialect->delim[0], q = dialect->quote;
+    ESCAPE_LOCAL
+    DELIM_LOCAL
+    const char *ptr, *end, *field;
+    int cnt, fQuote;
+
+    for ( cnt = 1, fQuote = 0, ptr = field = line, end = line + len; ptr < end; ptr++ ) {
+        if ( fQuote ) {
+            if ( IS_ESCAPE( *ptr ) && ptr + 1 < end ) {
+                ptr++;
+            } else if ( *ptr == q ) {
+                if ( ptr + 1 < end && ptr[1] == q ) {
+                    ptr++;
+                } else {
+                    fQuote = 0;
+                }
+            }
+            continue;
+        }
+
+        if ( *ptr == q && ptr == field ) {
+            fQuote = 1;
+        } else if ( AT_DELIM( ptr, end ) ) {
+            cnt++;
+            ptr += DELIM_REST;
+            field = ptr + 1;
+        }
+    }
+
+    return fQuote ? -1 : cnt;
+}
+
+/*
+ *  Split a line into spans of its fields, the way split_spans does, but with
+ *  every field it gets to unescaped.  Picks up at field first (which line
+ *  starts at), and stops after field want-1 (INT_MAX for all of them).
+ */
+static int VARIANT(split)( const csv_dialect *dialect, char *line, size_t len, int want, csv_span **spans, int *cap, int first ) {
+    const char del = dialect->delim[0], q = dialect->quote;
+    ESCAPE_LOCAL
+    DELIM_LOCAL
+    char *ptr, *end, *field, *optr;
+    int fieldcnt, fQuote;
+
+    fieldcnt = ( want == INT_MAX ) ? first + VARIANT(count)( dialect, line, len ) : want;
+
+    if ( fieldcnt < first || grow_spans( spans, cap, fieldcnt ) ) {
+        return -1;
+    }
+
+    fieldcnt = first;
+    end = line + len;
+
+    for ( ptr = field = optr = line, fQuote = 0; ; ptr++ ) {
+        if ( fQuote ) {
+            if ( ptr == end ) {
+                return -1;
+            }
+
+            if ( IS_ESCAPE( *ptr ) && ptr + 1 < end ) {
+                *optr++ = *++ptr;
+            } else if ( *ptr == q ) {
+                if ( ptr + 1 < end && ptr[1] == q ) {
+                    *optr++ = q;
+                    ptr++;
+                } else {
+                    fQuote = 0;
+                }
+            } else {
+                *optr++ = *ptr;
+            }
+
+            continue;
+        }
+
+        if ( ptr != end && *ptr == q && ptr == field ) {
+            fQuote = 1;
+        } else if ( ptr == end || AT_DELIM( ptr, end ) ) {
+            (*spans)[fieldcnt].start = field;
+            (*spans)[fieldcnt].len = optr - field;
+            fieldcnt++;
+
+            if ( ptr == end || fieldcnt == want ) {
+                break;
+            }
+
+            ptr += DELIM_REST;
+            field = optr = ptr + 1;
+        } else if ( optr != ptr ) {
+            *optr++ = *ptr;
+        } else {
+            /* Nothing's been unescaped in this field, so there's nothing to
+             * move (and the line might not be writable, if it has no
+             * quotes). */
+            optr++;
+        }
+    }
+
+    return fieldcnt;
+}
+
+/*
+ *  Copy out just field ind, unescaped and null-terminated, into out (which
+ *  needs room for len+1 bytes), the way parse_csv_field does.  Fields before
+ *  it get copied in too, each over the last, which is simpler than keeping
+ *  track of whether it's got there yet.
+ */
+static int VARIANT(field)( const csv_dialect *dialect, const char *line, size_t len, int ind, char *out ) {
+    const char del = dialect->delim[0], q = dialect->quote;
+    ESCAPE_LOCAL
+    DELIM_LOCAL
+    const char *ptr, *end, *field;
+    char *optr;
+    int fieldcnt, fQuote;
+
+    end = line + len;
+
+    for ( ptr = field = line, optr = out, fieldcnt = 0, fQuote = 0; ; ptr++ ) {
+        if ( fQuote ) {
+            if ( ptr == end ) {
+                return -1;
+            }
+
+            if ( IS_ESCAPE( *ptr ) && ptr + 1 < end ) {
+                *optr++ = *++ptr;
+            } else if ( *ptr == q ) {
+                if ( ptr + 1 < end && ptr[1] == q ) {
+                    *optr++ = q;
+                    ptr++;
+                } else {
+                    fQuote = 0;
+                }
+            } else {
+                *optr++ = *ptr;
+            }
+
+            continue;
+        }
+
+        if ( ptr != end && *ptr == q && ptr == field ) {
+            fQuote = 1;
+        } else if ( ptr == end || AT_DELIM( ptr, end ) ) {
+            if ( fieldcnt == ind ) {
+                break;
+            }
+
+            if ( ptr == end ) {
+                /* The line ends first. */
+                optr = out;
+                break;
+            }
+
+            fieldcnt++;
+            ptr += DELIM_REST;
+            field = ptr + 1;
+            optr = out;
+        } else {
+            *optr++ = *ptr;
+        }
+    }
+
+    *optr = '\0';
+    return 0;
+}
+
+#undef ESCAPE_LOCAL
+#undef IS_ESCAPE
+#undef DELIM_LOCAL
+#undef AT_DELIM
+#undef DELIM_REST
+#undef VARIANT
+#undef VARIANT_ESCAPED
+#undef VARIANT_MULTI_DELIM
@@ -1,9 +1,95 @@
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#include "csv.h"
+#include "csvh-scan.h"
+
 // Note: This has been modified from the original source to fit our needs by
-// adding an delimiter option.
+// adding an delimiter option.  The fields are now found a block at a time
+// (see csvh-scan.c), going byte by byte only when the quoting is off, or the
+// dialect has an escape character or a delimiter of more than one byte (see
+// csv-variant.h).
+
+/* How many field ends to find without allocating. */
+#define STACK_FIELDS 64
+
+/* Kinds of dialect, each with its own byte-by-byte parser.  Only plain ones
+ * are ever looked at a block at a time. */
+#define KIND_PLAIN          0
+#define KIND_ESCAPED        1
+#define KIND_MULTI          2
+#define KIND_MULTI_ESCAPED  3
+
+static void plain_dialect( csv_dialect *dialect, char del );
+static char **parse_csv_slow( const csv_dialect *dialect, const char *line, size_t len );
+static char *copy_field( const char *field, size_t len, char q );
+static void unquote_field( char *out, const char *field, size_t len, char q );
+static size_t unescape_field( char *field, size_t len, char q );
+static int split_spans( const csv_dialect *dialect, char *line, size_t len, const char *needed, int want, csv_span **spans, int *cap );
+static int grow_spans( csv_span **spans, int *cap, int need );
+
+#define VARIANT( name ) name##_plain
+#define VARIANT_ESCAPED 0
+#define VARIANT_MULTI_DELIM 0
+#include "csv-variant.h"
+
+#define VARIANT( name ) name##_escaped
+#define VARIANT_ESCAPED 1
+#define VARIANT_MULTI_DELIM 0
+#include "csv-variant.h"
+
+#define VARIANT( name ) name##_multi
+#define VARIANT_ESCAPED 0
+#define VARIANT_MULTI_DELIM 1
+#include "csv-variant.h"
+
+#define VARIANT( name ) name##_multi_escaped
+#define VARIANT_ESCAPED 1
+#define VARIANT_MULTI_DELIM 1
+#include "csv-variant.h"
+
+/* The byte-by-byte parsers, by kind. */
+static const struct {
+    int (*count)( const csv_dialect *dialect, const char *line, size_t len );
+    int (*split)( const csv_dialect *dialect, char *line, size_t len, int want, csv_span **spans, int *cap, int first );
+    int (*field)( const csv_dialect *dialect, const char *line, size_t len, int ind, char *out );
+} variants[] = {
+    [KIND_PLAIN] = { count_plain, split_plain, field_plain },
+    [KIND_ESCAPED] = { count_escaped, split_escaped, field_escaped },
+    [KIND_MULTI] = { count_multi, split_multi, field_multi },
+    [KIND_MULTI_ESCAPED] = { count_multi_escaped, split_multi_escaped, field_multi_escaped },
+};
+
+/*
+ *  Set up a dialect (see csv.h).  escape can be '\0' for none; if it's the
+ *  same as the quote, that's the same as none.  Returns -1 if the delimiter is
+ *  empty or too long, or the quote or escape character can't be told apart
+ *  from it or from a line break.
+ */
+int csv_dialect_init( csv_dialect *dialect, const char *delim, char quote, char escape ) {
+    size_t len = strlen( delim );
+
+    if ( escape == quote ) {
+        escape = '\0';
+    }
+
+    if ( len == 0 || len > CSV_MAX_DELIM || quote == '\0'
+        || quote == '\n' || quote == '\r' || memchr( delim, quote, len )
+        || escape == '\n' || escape == '\r' || ( escape && memchr( delim, escape, len ) )
+        || memchr( delim, '\n', len ) ) {
+        return -1;
+    }
+
+    memcpy( dialect->delim, delim, len + 1 );
+    dialect->delimLen = len;
+    dialect->quote = quote;
+    dialect->escape = escape;
+    dialect->kind = ( escape ? KIND_ESCAPED : KIND_PLAIN ) | ( len > 1 ? KIND_MULTI : KIND_PLAIN );
+
+    return 0;
+}
 
 void free_csv_line( char **parsed ) {
     char **ptr;
@@ -16,33 +102,31 @@ void free_csv_line( char **parsed ) {
 }
 
 int count_fields( const char *line, char del) {
-    const char *ptr;
-    int cnt, fQuote;
+    return count_fields_len( line, strlen(line), del );
+}
 
-    for ( cnt = 1, fQuote = 0, ptr = line; *ptr; ptr++ ) {
-        if ( fQuote ) {
-            if ( *ptr == '\"' ) {
-                fQuote = 0;
-            }
-            continue;
-        }
+int count_fields_len( const char *line, size_t len, char del ) {
+    csv_dialect dialect;
+    int cnt = csvh_scan_fields( line, len, del, '\"', NULL, 0 );
 
-        if ( *ptr == '\"' ) {
-            fQuote = 1;
-            continue;
-        } else if ( *ptr == del ) {
-            cnt++;
-            continue;
-        } else {
-            continue;
-        }
+    if ( cnt == CSVH_SCAN__IRREGULAR ) {
+        plain_dialect( &dialect, del );
+        return count_plain( &dialect, line, len );
     }
 
-    if ( fQuote ) {
-        return -1;
-    }
+    return ( cnt == CSVH_SCAN__UNBALANCED ) ? -1 : cnt;
+}
 
-    return cnt;
+/*
+ *  Set up the default dialect, but with del for the delimiter.
+ */
+static void plain_dialect( csv_dialect *dialect, char del ) {
+    dialect->delim[0] = del;
+    dialect->delim[1] = '\0';
+    dialect->delimLen = 1;
+    dialect->quote = '\"';
+    dialect->escape = '\0';
+    dialect->kind = KIND_PLAIN;
 }
 
 /*
@@ -51,92 +135,340 @@ int count_fields( const char *line, char del) {
  *  array of strings, one for every cell in the row.
  */
 char **parse_csv( const char *line, char del ) {
-    char **buf, **bptr, *tmp, *tptr;
-    const char *ptr;
-    int fieldcnt, fQuote, fEnd;
+    csv_dialect dialect;
 
-    fieldcnt = count_fields( line, del );
+    plain_dialect( &dialect, del );
+    return parse_csv_len( &dialect, line, strlen(line) );
+}
 
-    if ( fieldcnt == -1 ) {
-        return NULL;
+/*
+ *  Same as parse_csv, but for any dialect, and the line is given by its length
+ *  and does not have to be null-terminated (e.g. a record pointing into a
+ *  memory-mapped file).
+ */
+char **parse_csv_len( const csv_dialect *dialect, const char *line, size_t len ) {
+    size_t stackEnds[STACK_FIELDS], *ends = stackEnds;
+    char **buf;
+    size_t start;
+    int fieldcnt, i;
+
+    if ( dialect->kind != KIND_PLAIN ) {
+        return parse_csv_slow( dialect, line, len );
     }
 
-    buf = malloc( sizeof(char*) * (fieldcnt+1) );
+    fieldcnt = csvh_scan_fields( line, len, dialect->delim[0], dialect->quote, ends, STACK_FIELDS );
 
-    if ( !buf ) {
+    if ( fieldcnt == CSVH_SCAN__IRREGULAR ) {
+        return parse_csv_slow( dialect, line, len );
+    }
+
+    if ( fieldcnt == CSVH_SCAN__UNBALANCED ) {
         return NULL;
     }
 
-    tmp = malloc( strlen(line) + 1 );
+    if ( fieldcnt > STACK_FIELDS ) {
+        ends = malloc( sizeof(size_t) * fieldcnt );
 
-    if ( !tmp ) {
-        free( buf );
-        return NULL;
+        if ( !ends ) {
+            return NULL;
+        }
+
+        csvh_scan_fields( line, len, dialect->delim[0], dialect->quote, ends, fieldcnt );
     }
 
-    bptr = buf;
+    buf = malloc( sizeof(char*) * (fieldcnt+1) );
 
-    for ( ptr = line, fQuote = 0, *tmp = '\0', tptr = tmp, fEnd = 0; ; ptr++ ) {
-        if ( fQuote ) {
-            if ( !*ptr ) {
+    if ( buf ) {
+        for ( i = 0, start = 0; i < fieldcnt; start = ends[i] + 1, i++ ) {
+            buf[i] = copy_field( line + start, ends[i] - start, dialect->quote );
+
+            if ( !buf[i] ) {
+                buf[i] = NULL;
+                free_csv_line( buf );
+                buf = NULL;
                 break;
             }
+        }
+    }
 
-            if ( *ptr == '\"' ) {
-                if ( ptr[1] == '\"' ) {
-                    *tptr++ = '\"';
-                    ptr++;
-                    continue;
-                }
-                fQuote = 0;
-            }
-            else {
-                *tptr++ = *ptr;
-            }
+    if ( buf ) {
+        buf[fieldcnt] = NULL;
+    }
+
+    if ( ends != stackEnds ) {
+        free( ends );
+    }
+
+    return buf;
+}
+
+/*
+ *  Copy out just field ind of a line into out (unquoted and null-terminated,
+ *  same as parse_csv_len would give it), without looking at the line past the
+ *  end of it.  out needs room for len+1 bytes.  A field the line doesn't have
+ *  is empty.  Returns -1 if the quoting is unbalanced or out of memory.
+ */
+int parse_csv_field( const csv_dialect *dialect, const char *line, size_t len, int ind, char *out ) {
+    size_t ends[STACK_FIELDS];
+    size_t base, start;
+    int fieldcnt, want, rest;
+
+    if ( dialect->kind != KIND_PLAIN ) {
+        return variants[dialect->kind].field( dialect, line, len, ind, out );
+    }
 
-            continue;
+    /* The line is gone through STACK_FIELDS fields at a time.  Each bunch
+     * starts right after a delimiter, so outside of quotes. */
+    for ( base = 0, rest = ind; ; base += ends[STACK_FIELDS-1] + 1, rest -= STACK_FIELDS ) {
+        want = ( rest < STACK_FIELDS ) ? rest + 1 : STACK_FIELDS;
+        fieldcnt = csvh_scan_fields_upto( line + base, len - base, dialect->delim[0], dialect->quote, ends, want, want );
+
+        if ( fieldcnt == CSVH_SCAN__IRREGULAR ) {
+            break;
         }
 
-        if ( *ptr == '\"' ) {
-            fQuote = 1;
-            continue;
-        } else if ( *ptr == '\0' || *ptr == del ) {
-            if ( *ptr == '\0' ) {
-                fEnd = 1;
-            }
+        if ( fieldcnt == CSVH_SCAN__UNBALANCED ) {
+            return -1;
+        }
 
-            *tptr = '\0';
-            *bptr = strdup( tmp );
+        if ( fieldcnt < want || ( rest >= STACK_FIELDS && ends[STACK_FIELDS-1] == len - base ) ) {
+            /* The line ends first. */
+            *out = '\0';
+            return 0;
+        }
 
-            if ( !*bptr ) {
-                for ( bptr--; bptr >= buf; bptr-- ) {
-                    free( *bptr );
-                }
-                free( buf );
-                free( tmp );
+        if ( rest < STACK_FIELDS ) {
+            start = ( rest == 0 ) ? 0 : ends[rest-1] + 1;
+            unquote_field( out, line + base + start, ends[rest] - start, dialect->quote );
+            return 0;
+        }
+    }
 
-                return NULL;
-            }
+    /* The quoting is off somewhere, so go byte by byte (from the start, since
+     * that's what out has room for). */
+    return field_plain( dialect, line, len, ind, out );
+}
 
-            bptr++;
-            tptr = tmp;
+/*
+ *  Split a record into spans of its fields, pointing into the record itself,
+ *  so nothing is copied or allocated per field.  The span of a quoted field
+ *  is what's inside of the quotes; if that has doubled quotes in it, they're
+ *  unescaped in place (moving the rest of the field down), so line has to be
+ *  writable if it has any quotes.  Fields without quotes aren't touched.
+ *
+ *  spans is grown as needed, and cap is its size, so both can be reused from
+ *  one record to the next.  Returns the count of fields, or -1 if a quoted
+ *  field is never closed or out of memory.
+ */
+int parse_csv_spans( const csv_dialect *dialect, char *line, size_t len, csv_span **spans, int *cap ) {
+    return split_spans( dialect, line, len, NULL, INT_MAX, spans, cap );
+}
 
-            if ( fEnd ) {
-                break;
+/*
+ *  Same as parse_csv_spans, but only for the first count fields: the line
+ *  isn't looked at past the end of field count-1, so it returns at most count.
+ *  Fields i where needed[i] is zero are left as they are in the line (still
+ *  quoted and escaped, if they were), which saves unescaping them.
+ */
+int parse_csv_spans_needed( const csv_dialect *dialect, char *line, size_t len, const char *needed, int count, csv_span **spans, int *cap ) {
+    return split_spans( dialect, line, len, needed, count, spans, cap );
+}
+
+/*
+ *  Does the work for parse_csv_spans and parse_csv_spans_needed.  needed can
+ *  be NULL for all of them.  (Only plain dialects leave any fields as they
+ *  are.)
+ */
+static int split_spans( const csv_dialect *dialect, char *line, size_t len, const char *needed, int want, csv_span **spans, int *cap ) {
+    size_t ends[STACK_FIELDS];
+    size_t base, start;
+    int fieldcnt, got, limit, i;
+    const char del = dialect->delim[0], q = dialect->quote;
+    csv_span *span;
+
+    if ( dialect->kind != KIND_PLAIN ) {
+        return variants[dialect->kind].split( dialect, line, len, want, spans, cap, 0 );
+    }
+
+    /* Found STACK_FIELDS fields at a time, so nothing needs to be allocated
+     * for the ends.  Each bunch starts right after a delimiter, so outside of
+     * quotes. */
+    for ( fieldcnt = 0, base = 0; ; base += ends[STACK_FIELDS-1] + 1 ) {
+        limit = ( want - fieldcnt < STACK_FIELDS ) ? want - fieldcnt : STACK_FIELDS;
+        got = csvh_scan_fields_upto( line + base, len - base, del, q, ends, limit, limit );
+
+        if ( got == CSVH_SCAN__IRREGULAR ) {
+            return split_plain( dialect, line + base, len - base, want, spans, cap, fieldcnt );
+        }
+
+        if ( got == CSVH_SCAN__UNBALANCED || grow_spans( spans, cap, fieldcnt + got ) ) {
+            return -1;
+        }
+
+        for ( i = 0, start = 0; i < got; start = ends[i] + 1, i++ ) {
+            span = &(*spans)[fieldcnt + i];
+
+            if ( ends[i] > start && line[base + start] == q && ( !needed || needed[fieldcnt + i] ) ) {
+                span->start = line + base + start + 1;
+                span->len = unescape_field( line + base + start + 1, ends[i] - start - 1, q );
             } else {
+                span->start = line + base + start;
+                span->len = ends[i] - start;
+            }
+        }
+
+        fieldcnt += got;
+
+        if ( got < limit || fieldcnt == want || ends[got-1] == len - base ) {
+            return fieldcnt;
+        }
+    }
+}
+
+/*
+ *  Make sure there's room for need spans.  Returns nonzero if out of memory.
+ */
+static int grow_spans( csv_span **spans, int *cap, int need ) {
+    csv_span *grown;
+    int newcap;
+
+    if ( need <= *cap ) {
+        return 0;
+    }
+
+    for ( newcap = *cap ? *cap : 16; newcap < need; newcap *= 2 ) {}
+
+    grown = realloc( *spans, sizeof(csv_span) * newcap );
+
+    if ( !grown ) {
+        return 1;
+    }
+
+    *spans = grown;
+    *cap = newcap;
+    return 0;
+}
+
+/*
+ *  Unescape what comes after the opening quote (q) of a field, in place:
+ *  doubled quotes become one, and the closing quote is dropped (anything after
+ *  it is kept).  Returns the new length.
+ */
+static size_t unescape_field( char *field, size_t len, char q ) {
+    char *ptr, *optr, *end;
+
+    for ( ptr = optr = field, end = field + len; ptr < end; ptr++ ) {
+        if ( *ptr == q ) {
+            if ( ptr + 1 < end && ptr[1] == q ) {
+                *optr++ = q;
+                ptr++;
                 continue;
             }
-        } else {
-            *tptr++ = *ptr;
-            continue;
+
+            memmove( optr, ptr + 1, end - ptr - 1 );
+            optr += end - ptr - 1;
+            break;
         }
 
-        if ( fEnd ) {
+        *optr++ = *ptr;
+    }
+
+    return optr - field;
+}
+
+/*
+ *  Copy one field, taking off its quotes if it's quoted.  The quotes are
+ *  known to be in place (see csvh-scan.c).
+ */
+static char *copy_field( const char *field, size_t len, char q ) {
+    char *out;
+
+    out = malloc( len + 1 );
+
+    if ( !out ) {
+        return NULL;
+    }
+
+    unquote_field( out, field, len, q );
+    return out;
+}
+
+/*
+ *  Same as copy_field, into out, which needs room for len+1 bytes.
+ */
+static void unquote_field( char *out, const char *field, size_t len, char q ) {
+    char *optr;
+    const char *ptr, *end;
+
+    if ( len == 0 || *field != q ) {
+        memcpy( out, field, len );
+        out[len] = '\0';
+        return;
+    }
+
+    for ( ptr = field + 1, end = field + len, optr = out; ptr < end; ptr++ ) {
+        if ( *ptr == q ) {
+            if ( ptr + 1 < end && ptr[1] == q ) {
+                *optr++ = q;
+                ptr++;
+                continue;
+            }
+
+            /* Closing quote.  Anything after it is kept as is. */
+            memcpy( optr, ptr + 1, end - ptr - 1 );
+            optr += end - ptr - 1;
             break;
         }
+
+        *optr++ = *ptr;
+    }
+
+    *optr = '\0';
+}
+
+/*
+ *  Byte-by-byte version of parse_csv_len, for when the quoting is off (or the
+ *  dialect isn't plain): the line is copied, split in place, and then each
+ *  field is copied out of that.
+ */
+static char **parse_csv_slow( const csv_dialect *dialect, const char *line, size_t len ) {
+    char **buf = NULL, *tmp;
+    csv_span *spans = NULL;
+    int cap = 0, fieldcnt, i;
+
+    tmp = malloc( len + 1 );
+
+    if ( !tmp ) {
+        return NULL;
+    }
+
+    memcpy( tmp, line, len );
+    fieldcnt = variants[dialect->kind].split( dialect, tmp, len, INT_MAX, &spans, &cap, 0 );
+
+    if ( fieldcnt >= 0 ) {
+        buf = malloc( sizeof(char*) * (fieldcnt+1) );
+    }
+
+    if ( buf ) {
+        for ( i = 0; i < fieldcnt; i++ ) {
+            buf[i] = malloc( spans[i].len + 1 );
+
+            if ( !buf[i] ) {
+                free_csv_line( buf );
+                buf = NULL;
+                break;
+            }
+
+            memcpy( buf[i], spans[i].start, spans[i].len );
+            buf[i][spans[i].len] = '\0';
+        }
+    }
+
+    if ( buf ) {
+        buf[fieldcnt] = NULL;
     }
 
-    *bptr = NULL;
+    free( spans );
     free( tmp );
     return buf;
 }
@@ -1,8 +1,54 @@
 #ifndef CSV_DOT_H_INCLUDE_GUARD
 #define CSV_DOT_H_INCLUDE_GUARD
 
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One field of a record: where it starts and how long it is.  Not
+ * null-terminated. */
+typedef struct {
+    const char *start;
+    size_t len;
+} csv_span;
+
+/* Longest a delimiter can be. */
+#define CSV_MAX_DELIM 8
+
+/* How the fields of a record are told apart: the delimiter (which can be
+ * more than one byte, e.g. "||"), the quote, and the escape character, if
+ * there is one.  Inside of a quoted field, the escape character makes the
+ * byte after it a plain character (so a quote can be escaped either with it
+ * or by doubling it); anywhere else, it's a plain character itself.
+ *
+ * Set up with csv_dialect_init, which also picks the kind of parser to use
+ * for it.  Each kind is built separately (see csv-variant.h), so what the
+ * dialect allows isn't checked over again for every byte. */
+typedef struct {
+    char delim[CSV_MAX_DELIM + 1];
+    size_t delimLen;
+    char quote;
+    char escape;
+    int kind;
+} csv_dialect;
+
+/* Comma-separated, with double quotes that are escaped by doubling them. */
+#define CSV_DIALECT_DEFAULT { ",", 1, '\"', '\0', 0 }
+
+int csv_dialect_init( csv_dialect *dialect, const char *delim, char quote, char escape );
 char **parse_csv( const char *line, char del );
+char **parse_csv_len( const csv_dialect *dialect, const char *line, size_t len );
+int parse_csv_spans( const csv_dialect *dialect, char *line, size_t len, csv_span **spans, int *cap );
+int parse_csv_spans_needed( const csv_dialect *dialect, char *line, size_t len, const char *needed, int count, csv_span **spans, int *cap );
+int parse_csv_field( const csv_dialect *dialect, const char *line, size_t len, int ind, char *out );
 void free_csv_line( char **parsed );
 int count_fields(const char *line, char del);
+int count_fields_len( const char *line, size_t len, char del );
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
@@ -0,0 +1,200 @@
+#include <stdlib.h>
+
+#include "csvh-arena.h"
+
+// This is a helper module for csv-handler.c.
+
+// It hands out memory for things that only last until the next record (the
+// strings that get printed for a record, and such), by bumping a pointer
+// along one block, and takes all of it back at once when it's reset.  So in
+// the usual case there's no call to malloc or free at all per record.
+
+// If a record needs more than the block has left, the rest of what it needs
+// comes from extra blocks, which are only freed at the next reset.  At that
+// point the main block is also made big enough to hold everything the record
+// needed, so after a few records (at most, one for each time a record is
+// bigger than any before it) it stops needing extra blocks.
+
+/**
+ * Everything handed out is aligned to this.
+ */
+#define ALIGN 16
+
+/**
+ * Extra blocks are at least this big.
+ */
+#define MIN_EXTRA 4096
+
+typedef struct extraBlock {
+    struct extraBlock *next;
+    size_t size;
+    size_t used;
+} extraBlock;
+
+struct csvh_arena {
+    char *block;
+    size_t size;
+    size_t used;
+
+    /**
+     * Most recent first.
+     */
+    extraBlock *extra;
+
+    /**
+     * Bytes handed out from the extra blocks since the last reset.
+     */
+    size_t extraUsed;
+};
+
+// START forward declarations for static functions.
+
+static size_t alignUp(size_t size);
+
+static void *allocExtra(csvh_arena *arena, size_t size);
+
+// END forward declarations.
+
+/**
+ * Make a new arena, with a block of the given size to start with.  Returns
+ * NULL if out of memory.
+ *
+ * @param   size
+ */
+csvh_arena *csvh_arena_new(size_t size)
+{
+    csvh_arena *arena = malloc(sizeof(csvh_arena));
+
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    arena->size = alignUp(size ? size : ALIGN);
+    arena->block = malloc(arena->size);
+    arena->used = 0;
+    arena->extra = NULL;
+    arena->extraUsed = 0;
+
+    if (arena->block == NULL) {
+        free(arena);
+        return NULL;
+    }
+
+    return arena;
+}
+
+/**
+ * Get memory that lasts until the next reset.  Returns NULL if out of memory.
+ *
+ * @param   arena
+ * @param   size
+ */
+void *csvh_arena_alloc(csvh_arena *arena, size_t size)
+{
+    size = alignUp(size);
+
+    if (arena->size - arena->used >= size) {
+        void *ptr = arena->block + arena->used;
+        arena->used += size;
+        return ptr;
+    }
+
+    return allocExtra(arena, size);
+}
+
+/**
+ * Take back everything handed out since the last reset.  Whatever was handed
+ * out can't be used after this.
+ *
+ * @param   arena
+ */
+void csvh_arena_reset(csvh_arena *arena)
+{
+    if (arena->extra != NULL) {
+        size_t needed = arena->used + arena->extraUsed;
+        size_t newSize = arena->size;
+
+        while (arena->extra != NULL) {
+            extraBlock *next = arena->extra->next;
+            free(arena->extra);
+            arena->extra = next;
+        }
+
+        for (; newSize < needed; newSize *= 2) {}
+
+        // Doesn't matter what was in it, so no need for realloc.
+        char *newBlock = malloc(newSize);
+
+        if (newBlock != NULL) {
+            free(arena->block);
+            arena->block = newBlock;
+            arena->size = newSize;
+        }
+        // Otherwise just keep the old one.  It'll need extra blocks again.
+    }
+
+    arena->used = 0;
+    arena->extraUsed = 0;
+}
+
+/**
+ * Free the arena and everything in it.
+ *
+ * @param   arena
+ */
+void csvh_arena_free(csvh_arena *arena)
+{
+    if (arena == NULL) {
+        return;
+    }
+
+    csvh_arena_reset(arena);
+    free(arena->block);
+    free(arena);
+}
+
+
+// Static functions below this line.
+
+/**
+ * Round up to a multiple of ALIGN.
+ *
+ * @param   size
+ */
+static size_t alignUp(size_t size)
+{
+    return (size + ALIGN - 1) & ~((size_t) ALIGN - 1);
+}
+
+/**
+ * Get memory from an extra block, when the main block is full.
+ *
+ * @param   arena
+ * @param   size
+ */
+static void *allocExtra(csvh_arena *arena, size_t size)
+{
+    extraBlock *block = arena->extra;
+    size_t header = alignUp(sizeof(extraBlock));
+
+    if (block == NULL || block->size - block->used < size) {
+        size_t blockSize = (size > MIN_EXTRA) ? size : MIN_EXTRA;
+
+        block = malloc(header + blockSize);
+
+        if (block == NULL) {
+            return NULL;
+        }
+
+        block->next = arena->extra;
+        block->size = blockSize;
+        block->used = 0;
+        arena->extra = block;
+    }
+
+    void *ptr = (char *) block + header + block->used;
+    block->used += size;
+    arena->extraUsed += size;
+
+    return ptr;
+}
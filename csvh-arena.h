@@ -0,0 +1,16 @@
+#ifndef csvh_arena_h
+#define csvh_arena_h
+
+#include <stddef.h>
+
+typedef struct csvh_arena csvh_arena;
+
+csvh_arena *csvh_arena_new(size_t size);
+
+void *csvh_arena_alloc(csvh_arena *arena, size_t size);
+
+void csvh_arena_reset(csvh_arena *arena);
+
+void csvh_arena_free(csvh_arena *arena);
+
+#endif
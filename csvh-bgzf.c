@@ -0,0 +1,643 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CSVIEW_GZIP
+#include <zlib.h>
+#endif
+
+#include "csvh-bgzf.h"
+#include "csvh-pool.h"
+#include "csvh-scan.h"
+
+// This is a helper module for csvh-reader.c.
+
+// BGZF (what bgzip and samtools write) is gzip cut up into independent members
+// of at most 64 KiB of data each, with the compressed size of each member in
+// its header.  Any gzip reader can read it as normal, but since every block
+// stands alone, the blocks can be decompressed in any order and at the same
+// time.  So this module:
+//
+// - Walks the block headers once to build an index of where each block is,
+//   compressed and uncompressed (this doesn't decompress anything, it just
+//   hops from header to header).
+//
+// - Reads sequentially by decompressing a batch of blocks at once on a thread
+//   pool.
+//
+// - Finds "the record N records after this offset" without handing any of the
+//   data in between to the parser: the blocks are decompressed in parallel,
+//   a batch at a time, and the records in them are found by csvh-scan.c, the
+//   same way the reader finds them.  A batch is one stretch of the input, so
+//   a record can be scanned across blocks.  It stops early at a record that
+//   the reader might give up on (see csvh_bgzf_find_record), and leaves the
+//   rest to reading.
+//
+// - Turns offsets in the uncompressed input into virtual ones and back, the
+//   way samtools does: where the block starts in the file, shifted up 16
+//   bits, plus where in the block's data.  That's what the row-offset index
+//   keeps for BGZF input (see csvh-index.c).
+
+// It only works on input that's all in memory (i.e., mapped).
+
+/**
+ * The most data a BGZF block can hold.
+ */
+#define BLOCK_MAX 65536
+
+/**
+ * Blocks decompressed at once, per thread.
+ */
+#define BATCH_PER_THREAD 4
+
+typedef struct {
+    /**
+     * Where the block (its header) starts.
+     */
+    size_t off;
+
+    /**
+     * Where the deflate data is, and its length.
+     */
+    size_t dataOff;
+    size_t dataLen;
+
+    /**
+     * Where the block's data goes in the uncompressed input, and its length.
+     */
+    size_t uOff;
+    size_t uLen;
+} block;
+
+struct csvh_bgzf {
+    const unsigned char *start;
+    size_t len;
+
+    block *blocks;
+    int blockCount;
+
+    /**
+     * Where the last block ends (so, not counting any padding after it).
+     */
+    size_t blocksEnd;
+
+    int threadCount;
+
+    /**
+     * Decompressed blocks, one right after the other (so it's the stretch of
+     * the input from where the first one starts).  batchFirst is the index of
+     * the first one.  There's room for batchCap blocks of BLOCK_MAX.
+     */
+    char *batch;
+    int batchCap;
+    int batchFirst;
+    int batchCount;
+
+    /**
+     * Set by the tasks if a block didn't decompress.
+     */
+    char corrupt;
+
+    /**
+     * Where sequential reads are up to.
+     */
+    int readBlock;
+    size_t readPos;
+};
+
+
+
+// START forward declarations for static functions.
+
+#ifdef CSVIEW_GZIP
+static size_t blockSize(const unsigned char *start, size_t len, size_t *dataOff);
+#endif
+
+static char loadBatch(csvh_bgzf *bgzf, int first);
+
+static void decompressTask(void *contextIn, int taskInd);
+
+static int findBlock(csvh_bgzf *bgzf, size_t offset);
+
+static int findBlockAt(csvh_bgzf *bgzf, size_t off);
+
+static size_t batchStart(csvh_bgzf *bgzf);
+
+// END forward declarations.
+
+/**
+ * Index the blocks of the input.  Gives CSVH_BGZF__NOT_BGZF if it isn't BGZF
+ * (including plain gzip), or if this build doesn't do gzip at all.
+ *
+ * The input has to stick around until csvh_bgzf_close.
+ *
+ * @param   bgzf
+ * @param   start
+ * @param   len
+ */
+char csvh_bgzf_open(csvh_bgzf **bgzf, const char *start, size_t len)
+{
+#ifndef CSVIEW_GZIP
+    (void) start;
+    (void) len;
+    *bgzf = NULL;
+    return CSVH_BGZF__NOT_BGZF;
+#else
+    const unsigned char *ustart = (const unsigned char *) start;
+    size_t dataOff;
+
+    *bgzf = NULL;
+
+    if (blockSize(ustart, len, &dataOff) == 0) {
+        return CSVH_BGZF__NOT_BGZF;
+    }
+
+    csvh_bgzf *b = calloc(1, sizeof(csvh_bgzf));
+    if (b == NULL) {
+        return CSVH_BGZF__OUT_OF_MEMORY;
+    }
+    b->start = ustart;
+    b->len = len;
+
+    int blockCap = 0;
+    size_t offset = 0;
+    size_t uOffset = 0;
+    size_t size;
+
+    while (offset < len) {
+        if ((size = blockSize(ustart + offset, len - offset, &dataOff)) == 0) {
+            // Not a BGZF block.  (Might be padding, might be a plain gzip
+            // member tacked on the end.)  Only OK if everything before it was
+            // BGZF, and it's all zeros.
+            for (size_t i = offset; i < len; i++) {
+                if (ustart[i] != 0) {
+                    free(b->blocks);
+                    free(b);
+                    return CSVH_BGZF__NOT_BGZF;
+                }
+            }
+            break;
+        }
+
+        if (b->blockCount == blockCap) {
+            blockCap = (blockCap == 0) ? 1024 : blockCap * 2;
+            block *blocks = realloc(b->blocks, blockCap * sizeof(block));
+            if (blocks == NULL) {
+                free(b->blocks);
+                free(b);
+                return CSVH_BGZF__OUT_OF_MEMORY;
+            }
+            b->blocks = blocks;
+        }
+
+        const unsigned char *isize = ustart + offset + size - 4;
+        block *blk = &b->blocks[b->blockCount++];
+        blk->off = offset;
+        blk->dataOff = offset + dataOff;
+        blk->dataLen = size - dataOff - 8;
+        blk->uOff = uOffset;
+        blk->uLen = isize[0] | isize[1] << 8 | isize[2] << 16 | (size_t) isize[3] << 24;
+
+        if (blk->uLen > BLOCK_MAX) {
+            free(b->blocks);
+            free(b);
+            return CSVH_BGZF__NOT_BGZF;
+        }
+
+        uOffset += blk->uLen;
+        offset += size;
+    }
+
+    b->blocksEnd = offset;
+
+    b->threadCount = csvh_pool_default_threads();
+    b->batchCap = b->threadCount * BATCH_PER_THREAD;
+    b->batch = malloc((size_t) b->batchCap * BLOCK_MAX);
+
+    if (b->batch == NULL) {
+        free(b->blocks);
+        free(b);
+        return CSVH_BGZF__OUT_OF_MEMORY;
+    }
+
+    *bgzf = b;
+
+    return CSVH_BGZF__OK;
+#endif
+}
+
+/**
+ * Decompress up to cap bytes into dest, carrying on from the last read (or
+ * seek).  Returns the count, 0 at the end, or -1 if the input is corrupt.
+ *
+ * Has the same signature as csvh_readahead_fill, so it can be run on the
+ * read-ahead thread.
+ *
+ * @param   bgzf
+ * @param   dest
+ * @param   cap
+ */
+long csvh_bgzf_read(void *bgzfIn, char *dest, size_t cap)
+{
+    csvh_bgzf *bgzf = bgzfIn;
+    size_t got = 0;
+
+    while (got < cap && bgzf->readBlock < bgzf->blockCount) {
+        if (bgzf->readBlock < bgzf->batchFirst
+            || bgzf->readBlock >= bgzf->batchFirst + bgzf->batchCount
+        ) {
+            if (got > 0) {
+                // Hand over what there is before going off to do a batch.
+                break;
+            }
+
+            if (loadBatch(bgzf, bgzf->readBlock) != CSVH_BGZF__OK) {
+                return -1;
+            }
+        }
+
+        block *blk = &bgzf->blocks[bgzf->readBlock];
+        size_t avail = blk->uLen - bgzf->readPos;
+        size_t take = (avail < cap - got) ? avail : cap - got;
+
+        memcpy(dest + got, bgzf->batch + (blk->uOff - batchStart(bgzf)) + bgzf->readPos, take);
+        got += take;
+        bgzf->readPos += take;
+
+        if (bgzf->readPos == blk->uLen) {
+            bgzf->readBlock++;
+            bgzf->readPos = 0;
+        }
+    }
+
+    return got;
+}
+
+/**
+ * Make the next read start at an offset in the uncompressed input.
+ *
+ * @param   bgzf
+ * @param   offset
+ */
+char csvh_bgzf_seek(csvh_bgzf *bgzf, size_t offset)
+{
+    int ind = findBlock(bgzf, offset);
+
+    bgzf->readBlock = ind;
+    bgzf->readPos = (ind < bgzf->blockCount) ? offset - bgzf->blocks[ind].uOff : 0;
+
+    return CSVH_BGZF__OK;
+}
+
+/**
+ * Find where the record count records after the one starting at from starts.
+ * target is set to its offset, and found to how many records were passed.
+ *
+ * The records are found just like the reader finds them, with its dialect and
+ * maxRecord (see csvh_reader_set_resync).  But this stops short (with found
+ * less than count, and target the start of the record it stopped at) at the
+ * end of the input, and at any record that the reader might give up on: one
+ * with a quoted field that's closed somewhere other than at the end of a
+ * field or never closed, or one that's longer than maxRecord or than a
+ * batch.  Those are left to be read through the usual way.
+ *
+ * Doesn't change where reads are up to.
+ *
+ * @param   bgzf
+ * @param   from    Has to be the start of a record.
+ * @param   count
+ * @param   dialect
+ * @param   maxRecord
+ * @param   target
+ * @param   found
+ */
+char csvh_bgzf_find_record(
+    csvh_bgzf *bgzf,
+    size_t from,
+    long count,
+    const csv_dialect *dialect,
+    size_t maxRecord,
+    size_t *target,
+    long *found
+) {
+    size_t size = csvh_bgzf_size(bgzf);
+    size_t pos = from;
+
+    *found = 0;
+
+    while (*found < count && pos < size) {
+        int ind = findBlock(bgzf, pos);
+
+        if (ind < bgzf->batchFirst || ind >= bgzf->batchFirst + bgzf->batchCount) {
+            char rc;
+            if ((rc = loadBatch(bgzf, ind)) != CSVH_BGZF__OK) {
+                *target = pos;
+                return rc;
+            }
+        }
+
+        block *last = &bgzf->blocks[bgzf->batchFirst + bgzf->batchCount - 1];
+        size_t start = batchStart(bgzf);
+        char *recStart = bgzf->batch + (pos - start);
+        char *end = bgzf->batch + (last->uOff + last->uLen - start);
+        char fQuote = 0;
+        csvh_scan_check check = csvh_scan_start_check(dialect, recStart);
+        char *ptr = csvh_scan_find_record_end(recStart, end, &fQuote, &check);
+
+        if (ptr == NULL) {
+            if (check.badClose
+                || last->uOff + last->uLen == size
+                || ind == bgzf->batchFirst
+            ) {
+                // Given up on, the last record, or too long to tell.
+                break;
+            }
+
+            // Runs past the end of the batch, so start one where it starts.
+            char rc;
+            if ((rc = loadBatch(bgzf, ind)) != CSVH_BGZF__OK) {
+                *target = pos;
+                return rc;
+            }
+            continue;
+        }
+
+        if (maxRecord != 0 && (size_t) (ptr - recStart) > maxRecord) {
+            break;
+        }
+
+        (*found)++;
+        pos += ptr - recStart + 1;
+    }
+
+    *target = pos;
+
+    return CSVH_BGZF__OK;
+}
+
+/**
+ * Virtual offset of an offset in the uncompressed input: where its block
+ * starts in the file << 16, plus where in the block it is.  The end of the
+ * input is the end of the last block << 16.
+ *
+ * @param   bgzf
+ * @param   offset
+ */
+uint64_t csvh_bgzf_virtual_offset(csvh_bgzf *bgzf, size_t offset)
+{
+    int ind = findBlock(bgzf, offset);
+
+    if (ind == bgzf->blockCount) {
+        return (uint64_t) bgzf->blocksEnd << 16;
+    }
+
+    block *blk = &bgzf->blocks[ind];
+
+    return (uint64_t) blk->off << 16 | (offset - blk->uOff);
+}
+
+/**
+ * Offset in the uncompressed input of a virtual offset (see
+ * csvh_bgzf_virtual_offset).  Gives CSVH_BGZF__CORRUPT if there's no block
+ * starting where it says, or the block isn't that long.
+ *
+ * @param   bgzf
+ * @param   virtualOffset
+ * @param   offset
+ */
+char csvh_bgzf_from_virtual(csvh_bgzf *bgzf, uint64_t virtualOffset, size_t *offset)
+{
+    size_t off = virtualOffset >> 16;
+    size_t inBlock = virtualOffset & 0xffff;
+
+    if (off == bgzf->blocksEnd && inBlock == 0) {
+        *offset = csvh_bgzf_size(bgzf);
+        return CSVH_BGZF__OK;
+    }
+
+    int ind = findBlockAt(bgzf, off);
+
+    if (ind < 0 || (inBlock > 0 && inBlock >= bgzf->blocks[ind].uLen)) {
+        return CSVH_BGZF__CORRUPT;
+    }
+
+    *offset = bgzf->blocks[ind].uOff + inBlock;
+
+    return CSVH_BGZF__OK;
+}
+
+/**
+ * Size of the uncompressed input.
+ *
+ * @param   bgzf
+ */
+size_t csvh_bgzf_size(csvh_bgzf *bgzf)
+{
+    if (bgzf->blockCount == 0) {
+        return 0;
+    }
+
+    block *last = &bgzf->blocks[bgzf->blockCount - 1];
+    return last->uOff + last->uLen;
+}
+
+/**
+ * Free everything.
+ *
+ * @param   bgzf
+ */
+char csvh_bgzf_close(csvh_bgzf *bgzf)
+{
+    if (bgzf == NULL) {
+        return CSVH_BGZF__OK;
+    }
+
+    free(bgzf->batch);
+    free(bgzf->blocks);
+    free(bgzf);
+
+    return CSVH_BGZF__OK;
+}
+
+
+// Static functions below this line.
+
+#ifdef CSVIEW_GZIP
+/**
+ * If there's a BGZF block at start, return its total size and set dataOff to
+ * where its deflate data starts.  Otherwise 0.
+ *
+ * @param   start
+ * @param   len
+ * @param   dataOff
+ */
+static size_t blockSize(const unsigned char *start, size_t len, size_t *dataOff)
+{
+    // ID1 ID2 CM FLG MTIME(4) XFL OS XLEN(2), then the extra subfields.
+    if (len < 18
+        || start[0] != 0x1f || start[1] != 0x8b || start[2] != 8
+        || !(start[3] & 4)
+    ) {
+        return 0;
+    }
+
+    size_t xlen = start[10] | start[11] << 8;
+    if (12 + xlen > len) {
+        return 0;
+    }
+
+    const unsigned char *field = start + 12;
+    const unsigned char *fieldsEnd = field + xlen;
+
+    while (field + 4 <= fieldsEnd) {
+        size_t fieldLen = field[2] | field[3] << 8;
+
+        if (field[0] == 'B' && field[1] == 'C' && fieldLen == 2 && field + 6 <= fieldsEnd) {
+            size_t size = (field[4] | field[5] << 8) + 1;
+
+            // Header, then deflate data, then CRC32 and ISIZE.
+            if (size < 12 + xlen + 8 || size > len) {
+                return 0;
+            }
+
+            *dataOff = 12 + xlen;
+            return size;
+        }
+
+        field += 4 + fieldLen;
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * Decompress the blocks from first on into the batch buffer, as many as fit.
+ *
+ * @param   bgzf
+ * @param   first
+ */
+static char loadBatch(csvh_bgzf *bgzf, int first)
+{
+    int batchCount = bgzf->blockCount - first;
+    if (batchCount > bgzf->batchCap) {
+        batchCount = bgzf->batchCap;
+    }
+
+    bgzf->batchFirst = first;
+    bgzf->batchCount = batchCount;
+    bgzf->corrupt = 0;
+
+    char rc = csvh_pool_run(bgzf->threadCount, batchCount, decompressTask, bgzf);
+
+    if (rc != CSVH_POOL__OK || bgzf->corrupt) {
+        bgzf->batchCount = 0;
+        return (rc == CSVH_POOL__OUT_OF_MEMORY) ? CSVH_BGZF__OUT_OF_MEMORY : CSVH_BGZF__CORRUPT;
+    }
+
+    return CSVH_BGZF__OK;
+}
+
+/**
+ * Pool task: decompress one block of the batch, to where it goes in it.
+ *
+ * @param   contextIn   The csvh_bgzf.
+ * @param   taskInd
+ */
+static void decompressTask(void *contextIn, int taskInd)
+{
+#ifdef CSVIEW_GZIP
+    csvh_bgzf *bgzf = contextIn;
+    block *blk = &bgzf->blocks[bgzf->batchFirst + taskInd];
+    char *dest = bgzf->batch + (blk->uOff - batchStart(bgzf));
+    z_stream gz;
+
+    memset(&gz, 0, sizeof(gz));
+
+    // Negative window bits means raw deflate: the gzip header and trailer are
+    // already dealt with.
+    if (inflateInit2(&gz, -15) != Z_OK) {
+        bgzf->corrupt = 1;
+        return;
+    }
+
+    gz.next_in = (unsigned char *) bgzf->start + blk->dataOff;
+    gz.avail_in = blk->dataLen;
+    gz.next_out = (unsigned char *) dest;
+    gz.avail_out = blk->uLen;
+
+    int zrc = inflate(&gz, Z_FINISH);
+    inflateEnd(&gz);
+
+    if (zrc != Z_STREAM_END || gz.avail_out != 0) {
+        bgzf->corrupt = 1;
+    }
+#else
+    (void) contextIn;
+    (void) taskInd;
+#endif
+}
+
+/**
+ * Index of the block an uncompressed offset is in (the block count if it's at
+ * or past the end).
+ *
+ * @param   bgzf
+ * @param   offset
+ */
+static int findBlock(csvh_bgzf *bgzf, size_t offset)
+{
+    int low = 0;
+    int high = bgzf->blockCount;
+
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        block *blk = &bgzf->blocks[mid];
+
+        if (offset < blk->uOff) {
+            high = mid;
+        } else if (offset >= blk->uOff + blk->uLen) {
+            low = mid + 1;
+        } else {
+            return mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * Index of the block that starts at off in the file, or -1 if none does.
+ *
+ * @param   bgzf
+ * @param   off
+ */
+static int findBlockAt(csvh_bgzf *bgzf, size_t off)
+{
+    int low = 0;
+    int high = bgzf->blockCount;
+
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        size_t midOff = bgzf->blocks[mid].off;
+
+        if (off < midOff) {
+            high = mid;
+        } else if (off > midOff) {
+            low = mid + 1;
+        } else {
+            return mid;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Offset in the uncompressed input of the start of the batch.
+ *
+ * @param   bgzf
+ */
+static size_t batchStart(csvh_bgzf *bgzf)
+{
+    return (bgzf->batchCount > 0) ? bgzf->blocks[bgzf->batchFirst].uOff : 0;
+}
@@ -0,0 +1,42 @@
+#ifndef csvh_bgzf_h
+#define csvh_bgzf_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "csv.h"
+
+// Constants
+
+#define CSVH_BGZF__OK                   0
+#define CSVH_BGZF__NOT_BGZF             1
+#define CSVH_BGZF__OUT_OF_MEMORY        2
+#define CSVH_BGZF__CORRUPT              3
+
+typedef struct csvh_bgzf csvh_bgzf;
+
+char csvh_bgzf_open(csvh_bgzf **bgzf, const char *start, size_t len);
+
+long csvh_bgzf_read(void *bgzf, char *dest, size_t cap);
+
+char csvh_bgzf_seek(csvh_bgzf *bgzf, size_t offset);
+
+char csvh_bgzf_find_record(
+    csvh_bgzf *bgzf,
+    size_t from,
+    long count,
+    const csv_dialect *dialect,
+    size_t maxRecord,
+    size_t *target,
+    long *found
+);
+
+uint64_t csvh_bgzf_virtual_offset(csvh_bgzf *bgzf, size_t offset);
+
+char csvh_bgzf_from_virtual(csvh_bgzf *bgzf, uint64_t virtualOffset, size_t *offset);
+
+size_t csvh_bgzf_size(csvh_bgzf *bgzf);
+
+char csvh_bgzf_close(csvh_bgzf *bgzf);
+
+#endif
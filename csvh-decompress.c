@@ -0,0 +1,447 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CSVIEW_GZIP
+#include <zlib.h>
+#endif
+#ifdef CSVIEW_XZ
+#include <lzma.h>
+#endif
+#ifdef CSVIEW_ZSTD
+#include <zstd.h>
+#endif
+
+#include "csvh-decompress.h"
+
+// This is a helper module for csvh-reader.c.
+
+// It turns compressed input back into plain CSV as a stream of bytes, so the
+// reader can split it into records same as anything else.  Which formats are
+// actually supported depends on what the build was given (see the makefile);
+// the formats are always *recognized*, though, so that the user gets told
+// instead of being shown garbage.
+
+// Concatenated streams (e.g., `cat a.gz b.gz`) are read as one.
+
+// Input that's cut off partway through a stream is an error, same as input
+// that's corrupt, and so is the source failing to read.  Either way, what came
+// out before it still gets handed out first.
+
+/**
+ * How much compressed input to read at a time.
+ */
+#define IN_CHUNK 65536
+
+struct csvh_decompress {
+    int format;
+
+    /**
+     * Where compressed input comes from after the prefix runs out.  If NULL,
+     * the prefix is all of the input.
+     */
+    csvh_readahead_fill fill;
+    void *source;
+
+    /**
+     * Buffer for compressed input, if it has to be read in.
+     */
+    char *inBuff;
+    size_t inCap;
+
+    /**
+     * Compressed input not used yet.
+     */
+    const char *in;
+    size_t inLen;
+
+    /**
+     * No more compressed input to read.
+     */
+    char inEof;
+
+    /**
+     * Finished the last stream.
+     */
+    char finished;
+
+    /**
+     * Got to the end of at least one stream.  Anything unreadable after that
+     * is treated as the end rather than an error (some tools pad with zeros).
+     */
+    char streamEnded;
+
+    /**
+     * Partway through a stream: something came out of it (or, for the first
+     * one, went into it) since the last one ended.
+     */
+    char midStream;
+
+    /**
+     * The input was corrupt, cut off, or couldn't be read.
+     */
+    char failed;
+
+#ifdef CSVIEW_GZIP
+    z_stream gz;
+#endif
+#ifdef CSVIEW_XZ
+    lzma_stream xz;
+#endif
+#ifdef CSVIEW_ZSTD
+    ZSTD_DCtx *zstd;
+#endif
+};
+
+// START forward declarations for static functions.
+
+static char initFormat(csvh_decompress *decompress);
+
+static long step(csvh_decompress *decompress, char *dest, size_t cap);
+
+#if defined(CSVIEW_GZIP) || defined(CSVIEW_XZ) || defined(CSVIEW_ZSTD)
+static void markMidStream(csvh_decompress *decompress, size_t used, size_t produced);
+#endif
+
+// END forward declarations.
+
+/**
+ * Figure out the compression format from the first bytes of the input.
+ *
+ * @param   start
+ * @param   len
+ */
+int csvh_decompress_detect(const char *start, size_t len)
+{
+    const unsigned char *ptr = (const unsigned char *) start;
+
+    if (len >= 2 && ptr[0] == 0x1f && ptr[1] == 0x8b) {
+        return CSVH_DECOMPRESS_FORMAT__GZIP;
+    }
+    if (len >= 6 && memcmp(ptr, "\xfd" "7zXZ\0", 6) == 0) {
+        return CSVH_DECOMPRESS_FORMAT__XZ;
+    }
+    if (len >= 4 && ptr[0] == 0x28 && ptr[1] == 0xb5 && ptr[2] == 0x2f && ptr[3] == 0xfd) {
+        return CSVH_DECOMPRESS_FORMAT__ZSTD;
+    }
+
+    return CSVH_DECOMPRESS_FORMAT__NONE;
+}
+
+/**
+ * Start decompressing.
+ *
+ * The prefix is the start of the compressed input, which was already read to
+ * detect the format.  If fill is NULL, the prefix is the entire input and is
+ * used where it is (so it has to stick around), otherwise it's copied.
+ *
+ * @param   decompress
+ * @param   format
+ * @param   fill
+ * @param   source
+ * @param   prefix
+ * @param   prefixLen
+ */
+char csvh_decompress_open(
+    csvh_decompress **decompress,
+    int format,
+    csvh_readahead_fill fill,
+    void *source,
+    const char *prefix,
+    size_t prefixLen
+) {
+    *decompress = calloc(1, sizeof(csvh_decompress));
+
+    if (*decompress == NULL) {
+        return CSVH_DECOMPRESS__OUT_OF_MEMORY;
+    }
+
+    (*decompress)->format = format;
+    (*decompress)->fill = fill;
+    (*decompress)->source = source;
+
+    if (fill == NULL) {
+        (*decompress)->in = prefix;
+        (*decompress)->inEof = 1;
+    } else {
+        (*decompress)->inCap = (prefixLen > IN_CHUNK) ? prefixLen : IN_CHUNK;
+        (*decompress)->inBuff = malloc((*decompress)->inCap);
+        if ((*decompress)->inBuff == NULL) {
+            free(*decompress);
+            *decompress = NULL;
+            return CSVH_DECOMPRESS__OUT_OF_MEMORY;
+        }
+        memcpy((*decompress)->inBuff, prefix, prefixLen);
+        (*decompress)->in = (*decompress)->inBuff;
+    }
+    (*decompress)->inLen = prefixLen;
+
+    char rc;
+    if ((rc = initFormat(*decompress)) != CSVH_DECOMPRESS__OK) {
+        free((*decompress)->inBuff);
+        free(*decompress);
+        *decompress = NULL;
+        return rc;
+    }
+
+    return CSVH_DECOMPRESS__OK;
+}
+
+/**
+ * Decompress up to cap bytes into dest.  Returns the count, 0 at the end, or
+ * -1 if the input is corrupt, ends partway through a stream, or couldn't be
+ * read (and again on every call after that).
+ *
+ * Has the same signature as csvh_readahead_fill, so it can be run on the
+ * read-ahead thread.
+ *
+ * @param   decompress
+ * @param   dest
+ * @param   cap
+ */
+long csvh_decompress_read(void *decompressIn, char *dest, size_t cap)
+{
+    csvh_decompress *decompress = decompressIn;
+    long got;
+
+    if (decompress->failed) {
+        return -1;
+    }
+
+    while (!decompress->finished) {
+        if (decompress->inLen == 0 && !decompress->inEof) {
+            got = decompress->fill(decompress->source, decompress->inBuff, decompress->inCap);
+            if (got < 0) {
+                decompress->failed = 1;
+                return -1;
+            } else if (got == 0) {
+                decompress->inEof = 1;
+            } else {
+                decompress->in = decompress->inBuff;
+                decompress->inLen = got;
+            }
+        }
+
+        got = step(decompress, dest, cap);
+
+        if (got < 0) {
+            if (decompress->streamEnded && !decompress->midStream) {
+                decompress->finished = 1;
+                return 0;
+            }
+            decompress->failed = 1;
+            return -1;
+        }
+
+        if (got > 0) {
+            return got;
+        }
+
+        if (decompress->inLen == 0 && decompress->inEof && !decompress->finished) {
+            // Nothing came out and nothing more can go in.
+            if (decompress->midStream) {
+                // Cut off.
+                decompress->failed = 1;
+                return -1;
+            }
+            decompress->finished = 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Free everything.
+ *
+ * @param   decompress
+ */
+char csvh_decompress_close(csvh_decompress *decompress)
+{
+    if (decompress == NULL) {
+        return CSVH_DECOMPRESS__OK;
+    }
+
+    switch (decompress->format) {
+#ifdef CSVIEW_GZIP
+        case CSVH_DECOMPRESS_FORMAT__GZIP:
+            inflateEnd(&decompress->gz);
+            break;
+#endif
+#ifdef CSVIEW_XZ
+        case CSVH_DECOMPRESS_FORMAT__XZ:
+            lzma_end(&decompress->xz);
+            break;
+#endif
+#ifdef CSVIEW_ZSTD
+        case CSVH_DECOMPRESS_FORMAT__ZSTD:
+            ZSTD_freeDCtx(decompress->zstd);
+            break;
+#endif
+    }
+
+    free(decompress->inBuff);
+    free(decompress);
+
+    return CSVH_DECOMPRESS__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Set up the library for the format.
+ *
+ * @param   decompress
+ */
+static char initFormat(csvh_decompress *decompress)
+{
+    switch (decompress->format) {
+#ifdef CSVIEW_GZIP
+        case CSVH_DECOMPRESS_FORMAT__GZIP:
+            // 15 + 32 means the largest window, and detect gzip vs zlib header.
+            if (inflateInit2(&decompress->gz, 15 + 32) != Z_OK) {
+                return CSVH_DECOMPRESS__OUT_OF_MEMORY;
+            }
+            return CSVH_DECOMPRESS__OK;
+#endif
+#ifdef CSVIEW_XZ
+        case CSVH_DECOMPRESS_FORMAT__XZ:
+            decompress->xz = (lzma_stream) LZMA_STREAM_INIT;
+            if (lzma_stream_decoder(&decompress->xz, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+                return CSVH_DECOMPRESS__OUT_OF_MEMORY;
+            }
+            return CSVH_DECOMPRESS__OK;
+#endif
+#ifdef CSVIEW_ZSTD
+        case CSVH_DECOMPRESS_FORMAT__ZSTD:
+            decompress->zstd = ZSTD_createDCtx();
+            if (decompress->zstd == NULL) {
+                return CSVH_DECOMPRESS__OUT_OF_MEMORY;
+            }
+            return CSVH_DECOMPRESS__OK;
+#endif
+    }
+
+    return CSVH_DECOMPRESS__UNSUPPORTED;
+}
+
+/**
+ * Run the library once over the input that's available.  Returns the count of
+ * bytes that came out, or -1 on corrupt input.
+ *
+ * @param   decompress
+ * @param   dest
+ * @param   cap
+ */
+static long step(csvh_decompress *decompress, char *dest, size_t cap)
+{
+    size_t used = 0;
+    size_t produced = 0;
+
+    switch (decompress->format) {
+#ifdef CSVIEW_GZIP
+        case CSVH_DECOMPRESS_FORMAT__GZIP: {
+            z_stream *gz = &decompress->gz;
+            gz->next_in = (unsigned char *) decompress->in;
+            gz->avail_in = decompress->inLen;
+            gz->next_out = (unsigned char *) dest;
+            gz->avail_out = cap;
+
+            int zrc = inflate(gz, Z_NO_FLUSH);
+
+            used = decompress->inLen - gz->avail_in;
+            produced = cap - gz->avail_out;
+
+            if (zrc == Z_STREAM_END) {
+                // Might be another member after this one.
+                decompress->streamEnded = 1;
+                decompress->midStream = 0;
+                inflateReset(gz);
+            } else if (zrc != Z_OK && zrc != Z_BUF_ERROR) {
+                return -1;
+            } else {
+                markMidStream(decompress, used, produced);
+            }
+            break;
+        }
+#endif
+#ifdef CSVIEW_XZ
+        case CSVH_DECOMPRESS_FORMAT__XZ: {
+            lzma_stream *xz = &decompress->xz;
+            xz->next_in = (const uint8_t *) decompress->in;
+            xz->avail_in = decompress->inLen;
+            xz->next_out = (uint8_t *) dest;
+            xz->avail_out = cap;
+
+            lzma_ret xrc = lzma_code(
+                xz,
+                (decompress->inEof && decompress->inLen == 0) ? LZMA_FINISH : LZMA_RUN
+            );
+            // With LZMA_CONCATENATED, the decoder needs LZMA_FINISH to know
+            // there are no more streams coming.
+
+            used = decompress->inLen - xz->avail_in;
+            produced = cap - xz->avail_out;
+
+            if (xrc == LZMA_STREAM_END) {
+                // Only happens after the last of the concatenated streams.
+                decompress->streamEnded = 1;
+                decompress->midStream = 0;
+                decompress->finished = 1;
+            } else if (xrc != LZMA_OK && xrc != LZMA_BUF_ERROR) {
+                return -1;
+            } else {
+                markMidStream(decompress, used, produced);
+            }
+            break;
+        }
+#endif
+#ifdef CSVIEW_ZSTD
+        case CSVH_DECOMPRESS_FORMAT__ZSTD: {
+            ZSTD_inBuffer zin = { decompress->in, decompress->inLen, 0 };
+            ZSTD_outBuffer zout = { dest, cap, 0 };
+
+            size_t zrc = ZSTD_decompressStream(decompress->zstd, &zout, &zin);
+
+            if (ZSTD_isError(zrc)) {
+                return -1;
+            }
+
+            used = zin.pos;
+            produced = zout.pos;
+
+            if (zrc == 0) {
+                // End of a frame.  Another one might follow.
+                decompress->streamEnded = 1;
+                decompress->midStream = 0;
+            } else {
+                markMidStream(decompress, used, produced);
+            }
+            break;
+        }
+#endif
+    }
+
+    decompress->in += used;
+    decompress->inLen -= used;
+
+    return produced;
+}
+
+#if defined(CSVIEW_GZIP) || defined(CSVIEW_XZ) || defined(CSVIEW_ZSTD)
+/**
+ * Note that a step that didn't end a stream got partway into one.  After the
+ * first stream, input that doesn't produce anything doesn't count, since it
+ * might just be padding (see streamEnded).
+ *
+ * @param   decompress
+ * @param   used
+ * @param   produced
+ */
+static void markMidStream(csvh_decompress *decompress, size_t used, size_t produced)
+{
+    if (produced > 0 || (used > 0 && !decompress->streamEnded)) {
+        decompress->midStream = 1;
+    }
+}
+#endif
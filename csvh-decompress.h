@@ -0,0 +1,44 @@
+#ifndef csvh_decompress_h
+#define csvh_decompress_h
+
+#include <stddef.h>
+
+#include "csvh-readahead.h"
+
+// Constants
+
+#define CSVH_DECOMPRESS__OK                 0
+#define CSVH_DECOMPRESS__OUT_OF_MEMORY      1
+#define CSVH_DECOMPRESS__UNSUPPORTED        2
+
+// Compression formats.
+
+#define CSVH_DECOMPRESS_FORMAT__NONE        0
+#define CSVH_DECOMPRESS_FORMAT__GZIP        1
+#define CSVH_DECOMPRESS_FORMAT__XZ          2
+#define CSVH_DECOMPRESS_FORMAT__ZSTD        3
+
+/**
+ * How many bytes from the start of the input csvh_decompress_detect wants to
+ * see to be sure.
+ */
+#define CSVH_DECOMPRESS_MAGIC_LEN           6
+
+typedef struct csvh_decompress csvh_decompress;
+
+int csvh_decompress_detect(const char *start, size_t len);
+
+char csvh_decompress_open(
+    csvh_decompress **decompress,
+    int format,
+    csvh_readahead_fill fill,
+    void *source,
+    const char *prefix,
+    size_t prefixLen
+);
+
+long csvh_decompress_read(void *decompress, char *dest, size_t cap);
+
+char csvh_decompress_close(csvh_decompress *decompress);
+
+#endif
@@ -0,0 +1,1801 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <regex.h>
+#endif
+
+#include "csv.h"
+#include "csvh-match.h"
+#include "csvh-scan.h"
+#include "csvh-set.h"
+
+#include "csvh-filter.h"
+
+// This is a helper module for csvh-line-helper.c.
+
+// It's for restricting lines with an expression that can test several
+// columns at once, e.g.:
+//
+//     Amount 100-500 and State in (CA,NV) and not Status = void
+//
+// The tests are:
+//
+//     Column = value           The value, exactly (!= for anything else).
+//     Column < number          Also <=, >, and >=.
+//     Column 3-4,6,9-13        In one of the ranges (like -r r).
+//     Column in a,b,c          Any one of the values (like -r e).
+//     Column contains a,b,c    Has any one of them in it.
+//     Column starts a,b,c      Starts with any one of them.
+//     Column ends a,b,c        Ends with any one of them.
+//     Column matches a,b,c     Matches any one of the (POSIX extended)
+//                              regular expressions.  Not on Windows.
+//
+// A list of values can also be in parentheses, "in (a,b,c)".  Instead of one
+// column, a test can be of several in parentheses, "(Subject,Body) contains
+// urgent", and then it passes if any one of them does.
+//
+// Tests are put together with "and", "or", "not", and parentheses ("and"
+// goes before "or").  Column names and values with spaces or any of the
+// characters ( ) , = ! < > in them go in double quotes, with any double
+// quotes inside of them doubled.
+
+// The expression is parsed once, into a tree, and then compiled into a flat
+// program: a list of steps, each a single test with the step to go to next
+// if it passes and the one if it doesn't (or the answer, if that's the end).
+// "and", "or" and "not" don't need steps of their own, they're just where
+// the steps lead, so a line's done being checked as soon as the answer is
+// known, and "not" costs nothing.  The tests under each "and" and "or" are
+// put cheapest first (comparing strings before looking through them, and
+// regular expressions last), since they can be done in any order.
+
+// However many values a test has, it only goes through the field once: "in"
+// looks it up in a hash set (csvh-set.c), and "contains", "starts" and
+// "ends" look for all of them at once (csvh-match.c).  Before a regular
+// expression is tried, the field is checked for some string that has to be
+// in anything it matches, if there is one.
+
+// Only the fields that the tests look at get parsed out of a line, and
+// nothing after the last of them.  Fields are looked at right where they are
+// in the line, unless one the tests look at has quotes to take off: then just
+// the fields up to the last one that's needed are copied, to parse them there
+// (since that's done in place).
+
+// The program is never changed once it's compiled, so it's shared by copies
+// of the filter (see csvh_filter_copy), which only need their own room to
+// parse lines into (and their own compiled regular expressions, since
+// they're locked while in use).
+
+// Token types.
+#define TOKEN__END          0
+#define TOKEN__WORD         1
+#define TOKEN__STRING       2   // In quotes, so never a keyword.
+#define TOKEN__OPEN         3
+#define TOKEN__CLOSE        4
+#define TOKEN__COMMA        5
+#define TOKEN__EQ           6
+#define TOKEN__NE           7
+#define TOKEN__LT           8
+#define TOKEN__LE           9
+#define TOKEN__GT           10
+#define TOKEN__GE           11
+
+// Node kinds.
+#define NODE__TEST          0
+#define NODE__NOT           1
+#define NODE__AND           2
+#define NODE__OR            3
+
+// Test kinds.
+#define TEST__EQUALS        0
+#define TEST__IN            1
+#define TEST__NUMBER        2
+#define TEST__CONTAINS      3
+#define TEST__STARTS        4
+#define TEST__ENDS          5
+#define TEST__MATCHES       6
+
+// Where a step leads when it's the end.
+#define STEP__MATCH         -1
+#define STEP__NO_MATCH      -2
+
+/**
+ * A piece of the expression.  text is null-terminated, with the quotes taken
+ * off.
+ */
+typedef struct {
+    int type;
+    char *text;
+    size_t len;
+} filterToken;
+
+/**
+ * A range of numbers.  The bounds are left out when they're open.
+ */
+typedef struct {
+    double lower;
+    double upper;
+    char lowerOpen;
+    char upperOpen;
+} filterRange;
+
+/**
+ * A regular expression, and a string that anything it matches has to have in
+ * it (NULL if there isn't one).
+ */
+typedef struct {
+    char *source;
+    csvh_match *literal;
+} filterRegex;
+
+/**
+ * A single test of one or more fields (it passes if any one of them does).
+ * onTrue and onFalse are the index of the next step, or STEP__MATCH or
+ * STEP__NO_MATCH.
+ */
+typedef struct {
+    int test;
+
+    int *fields;
+    int fieldCount;
+
+    // TEST__EQUALS.
+    char *value;
+    size_t len;
+
+    // TEST__IN.
+    csvh_set *set;
+
+    // TEST__NUMBER.
+    filterRange *ranges;
+    int rangeCount;
+
+    // TEST__CONTAINS, TEST__STARTS, TEST__ENDS.
+    csvh_match *match;
+
+    // TEST__MATCHES.  Which of the program's regular expressions.
+    int regexFirst;
+    int regexCount;
+
+    int onTrue;
+    int onFalse;
+} filterStep;
+
+/**
+ * The parsed expression, before it's compiled.
+ */
+typedef struct filterNode {
+    int kind;
+
+    /**
+     * Guess at how long checking it takes, to put the cheaper ones first.
+     */
+    int cost;
+
+    struct filterNode **kids;
+    int kidCount;
+
+    filterStep step;
+} filterNode;
+
+/**
+ * The compiled program.  Shared by copies of the filter.
+ */
+typedef struct {
+    filterStep *steps;
+    int stepCount;
+    int entry;
+
+    /**
+     * Which fields the steps look at, up to the last one.
+     */
+    char *needed;
+    int fieldCount;
+
+    filterRegex *regexes;
+    int regexCount;
+
+    int refs;
+} filterProgram;
+
+struct csvh_filter {
+    filterProgram *program;
+
+    /**
+     * Copy of (the start of) the line being checked, if parsing its fields
+     * has to unescape them in place.
+     */
+    char *line;
+    size_t lineCap;
+
+    csv_span *spans;
+    int spanCap;
+
+    /**
+     * Where each field up to the last one needed ends, in the line being
+     * checked (see csvh_scan_fields_upto).
+     */
+    size_t *ends;
+
+    /**
+     * A field null-terminated, for strtod and regexec.
+     */
+    char *field;
+    size_t fieldCap;
+
+    /**
+     * The fields turned into numbers so far, for the line being checked
+     * (when numStamps[i] is stamp).
+     */
+    double *nums;
+    long *numStamps;
+    long stamp;
+
+#ifndef _WIN32
+    /**
+     * This copy's compiled regular expressions, for the program's.
+     */
+    regex_t *regexes;
+    int regexCount;
+#endif
+};
+
+/**
+ * Where parsing the expression is at.
+ */
+typedef struct {
+    filterToken *tokens;
+    int tokenCount;
+    int pos;
+
+    char **headers;
+
+    int testCount;
+    int fieldCount;
+
+    filterRegex *regexes;
+    int regexCount;
+
+    char rc;
+} filterParser;
+
+// START forward declarations for static functions.
+
+static char tokenize(filterParser *parser, const char *expr);
+
+static char addToken(filterParser *parser, int type, const char *text, size_t len);
+
+static char isKeyword(const filterToken *token, const char *keyword);
+
+static char isName(const filterToken *token);
+
+static filterNode *parseOr(filterParser *parser);
+
+static filterNode *parseAnd(filterParser *parser);
+
+static filterNode *parseNot(filterParser *parser);
+
+static char isColumnList(filterParser *parser);
+
+static filterNode *parseTest(filterParser *parser);
+
+static char parseColumns(filterParser *parser, int **fields, int *fieldCount);
+
+static char parseValues(filterParser *parser, filterNode *test);
+
+static char addValue(filterParser *parser, filterStep *step, filterToken *value);
+
+static char addRange(filterParser *parser, filterStep *step, filterRange range);
+
+static char addRegex(filterParser *parser, filterStep *step, filterToken *value);
+
+static size_t requiredLiteral(const char *regex, char *literal);
+
+static char parseBounds(const char *text, double *lower, double *upper);
+
+static filterNode *newNode(filterParser *parser, int kind);
+
+static filterNode *newTest(filterParser *parser, int test, int *fields, int fieldCount);
+
+static char addKid(filterParser *parser, filterNode *node, filterNode *kid);
+
+static void sortKids(filterNode *node);
+
+static int compile(filterProgram *program, filterNode *node, int onTrue, int onFalse);
+
+static void freeStep(filterStep *step);
+
+static void freeNode(filterNode *node);
+
+static void freeRegexes(filterRegex *regexes, int count);
+
+static void freeProgram(filterProgram *program);
+
+static int spanFields(
+    csvh_filter *filter,
+    const csv_dialect *dialect,
+    const char *line,
+    size_t len
+);
+
+static char copyLine(csvh_filter *filter, const char *line, size_t len);
+
+static char testField(csvh_filter *filter, const filterStep *step, int field);
+
+static double fieldNumber(csvh_filter *filter, int field);
+
+static char fieldMatches(csvh_filter *filter, int regex, int field);
+
+static const char *terminateField(csvh_filter *filter, const csv_span *span);
+
+// END forward declarations.
+
+/**
+ * Parse and compile an expression (see the top of this file).  headers are
+ * the column names, NULL-terminated.  Let go of the filter with
+ * csvh_filter_free.
+ *
+ * @param   filter
+ * @param   expr
+ * @param   headers
+ */
+char csvh_filter_compile(csvh_filter **filter, const char *expr, char **headers)
+{
+    filterParser parser = { 0 };
+    parser.headers = headers;
+
+    *filter = NULL;
+
+    parser.rc = tokenize(&parser, expr);
+
+    filterNode *root = NULL;
+    if (parser.rc == CSVH_FILTER__OK) {
+        root = parseOr(&parser);
+        if (root != NULL && parser.tokens[parser.pos].type != TOKEN__END) {
+            // Something left over, like an extra ')'.
+            parser.rc = CSVH_FILTER__INVALID_INPUT;
+        }
+    }
+
+    for (int i = 0; i < parser.tokenCount; i++) {
+        free(parser.tokens[i].text);
+    }
+    free(parser.tokens);
+
+    if (parser.rc != CSVH_FILTER__OK) {
+        freeNode(root);
+        freeRegexes(parser.regexes, parser.regexCount);
+        return parser.rc;
+    }
+
+    filterProgram *program = calloc(1, sizeof(filterProgram));
+    csvh_filter *made = calloc(1, sizeof(csvh_filter));
+
+    if (program == NULL || made == NULL) {
+        free(program);
+        free(made);
+        freeNode(root);
+        freeRegexes(parser.regexes, parser.regexCount);
+        return CSVH_FILTER__OUT_OF_MEMORY;
+    }
+
+    program->refs = 1;
+    program->fieldCount = parser.fieldCount;
+    program->regexes = parser.regexes;
+    program->regexCount = parser.regexCount;
+    program->steps = calloc(parser.testCount, sizeof(filterStep));
+    program->needed = calloc(parser.fieldCount, 1);
+    made->program = program;
+
+    if (program->steps == NULL || program->needed == NULL) {
+        csvh_filter_free(made);
+        freeNode(root);
+        return CSVH_FILTER__OUT_OF_MEMORY;
+    }
+
+    sortKids(root);
+    program->entry = compile(program, root, STEP__MATCH, STEP__NO_MATCH);
+    freeNode(root);
+
+    for (int i = 0; i < program->stepCount; i++) {
+        for (int j = 0; j < program->steps[i].fieldCount; j++) {
+            program->needed[program->steps[i].fields[j]] = 1;
+        }
+    }
+
+    // The rest of it (room for parsing lines) is the same as for a copy.
+    *filter = csvh_filter_copy(made);
+    csvh_filter_free(made);
+
+    return (*filter != NULL) ? CSVH_FILTER__OK : CSVH_FILTER__OUT_OF_MEMORY;
+}
+
+/**
+ * Check a line.  matches is set to whether it passes.  The line doesn't
+ * have to be null-terminated.  Returns CSVH_FILTER__INVALID_INPUT if it
+ * can't be parsed.
+ *
+ * @param   filter
+ * @param   dialect
+ * @param   line
+ * @param   len
+ * @param   matches
+ */
+char csvh_filter_match(
+    csvh_filter *filter,
+    const csv_dialect *dialect,
+    const char *line,
+    size_t len,
+    char *matches
+) {
+    filterProgram *program = filter->program;
+    int count = spanFields(filter, dialect, line, len);
+
+    if (count == -2) {
+        return CSVH_FILTER__OUT_OF_MEMORY;
+    }
+    if (count < 0) {
+        return CSVH_FILTER__INVALID_INPUT;
+    }
+
+    // Fields the line doesn't have are empty.
+    for (int i = count; i < program->fieldCount; i++) {
+        filter->spans[i].start = "";
+        filter->spans[i].len = 0;
+    }
+
+    filter->stamp++;
+
+    int at = program->entry;
+    while (at >= 0) {
+        const filterStep *step = &program->steps[at];
+        char passes = 0;
+
+        for (int i = 0; i < step->fieldCount && !passes; i++) {
+            passes = testField(filter, step, step->fields[i]);
+        }
+
+        at = passes ? step->onTrue : step->onFalse;
+    }
+
+    *matches = (at == STEP__MATCH);
+
+    return CSVH_FILTER__OK;
+}
+
+/**
+ * Make another filter with the same program, to check lines with at the same
+ * time as this one (e.g., on another thread).  Returns NULL if out of
+ * memory.
+ *
+ * @param   filter
+ */
+csvh_filter *csvh_filter_copy(csvh_filter *filter)
+{
+    csvh_filter *copy = calloc(1, sizeof(csvh_filter));
+
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    filterProgram *program = filter->program;
+    int fieldCount = program->fieldCount;
+
+    copy->program = program;
+    program->refs++;
+    copy->spans = malloc(sizeof(csv_span) * fieldCount);
+    copy->spanCap = fieldCount;
+    copy->nums = malloc(sizeof(double) * fieldCount);
+    copy->numStamps = calloc(fieldCount, sizeof(long));
+    copy->ends = malloc(sizeof(size_t) * fieldCount);
+
+    if (copy->spans == NULL || copy->nums == NULL || copy->numStamps == NULL || copy->ends == NULL) {
+        csvh_filter_free(copy);
+        return NULL;
+    }
+
+#ifndef _WIN32
+    if (program->regexCount > 0) {
+        copy->regexes = malloc(sizeof(regex_t) * program->regexCount);
+        if (copy->regexes == NULL) {
+            csvh_filter_free(copy);
+            return NULL;
+        }
+
+        // (They were already compiled once while parsing, so this only fails
+        // if out of memory.)
+        for (; copy->regexCount < program->regexCount; copy->regexCount++) {
+            if (regcomp(
+                &copy->regexes[copy->regexCount],
+                program->regexes[copy->regexCount].source,
+                REG_EXTENDED | REG_NOSUB
+            ) != 0) {
+                csvh_filter_free(copy);
+                return NULL;
+            }
+        }
+    }
+#endif
+
+    return copy;
+}
+
+/**
+ * Let go of a filter.
+ *
+ * @param   filter
+ */
+void csvh_filter_free(csvh_filter *filter)
+{
+    if (filter == NULL) {
+        return;
+    }
+
+    if (filter->program != NULL && --filter->program->refs == 0) {
+        freeProgram(filter->program);
+    }
+
+#ifndef _WIN32
+    for (int i = 0; i < filter->regexCount; i++) {
+        regfree(&filter->regexes[i]);
+    }
+    free(filter->regexes);
+#endif
+
+    free(filter->line);
+    free(filter->field);
+    free(filter->ends);
+    free(filter->spans);
+    free(filter->nums);
+    free(filter->numStamps);
+    free(filter);
+}
+
+
+// Static functions below this line.
+
+/**
+ * Split the expression up into tokens, ending with a TOKEN__END.
+ *
+ * @param   parser
+ * @param   expr
+ */
+static char tokenize(filterParser *parser, const char *expr)
+{
+    const char *at = expr;
+    char rc = CSVH_FILTER__OK;
+
+    while (rc == CSVH_FILTER__OK) {
+        while (isspace((unsigned char) *at)) {
+            at++;
+        }
+
+        switch (*at) {
+            case '\0':
+                return addToken(parser, TOKEN__END, "", 0);
+            case '(':
+                rc = addToken(parser, TOKEN__OPEN, at++, 1);
+                continue;
+            case ')':
+                rc = addToken(parser, TOKEN__CLOSE, at++, 1);
+                continue;
+            case ',':
+                rc = addToken(parser, TOKEN__COMMA, at++, 1);
+                continue;
+            case '=':
+                rc = addToken(parser, TOKEN__EQ, at++, 1);
+                continue;
+            case '!':
+                if (at[1] != '=') {
+                    return CSVH_FILTER__INVALID_INPUT;
+                }
+                rc = addToken(parser, TOKEN__NE, at, 2);
+                at += 2;
+                continue;
+            case '<':
+            case '>':
+                if (at[1] == '=') {
+                    rc = addToken(parser, (*at == '<') ? TOKEN__LE : TOKEN__GE, at, 2);
+                    at += 2;
+                } else {
+                    rc = addToken(parser, (*at == '<') ? TOKEN__LT : TOKEN__GT, at, 1);
+                    at++;
+                }
+                continue;
+            case '"': {
+                // Take out the quotes (and undouble the ones inside) in place,
+                // once the token has its own copy.
+                const char *start = ++at;
+                while (*at != '\0' && (*at != '"' || at[1] == '"')) {
+                    at += (*at == '"') ? 2 : 1;
+                }
+                if (*at != '"') {
+                    return CSVH_FILTER__INVALID_INPUT;
+                }
+                if ((rc = addToken(parser, TOKEN__STRING, start, at - start)) != CSVH_FILTER__OK) {
+                    return rc;
+                }
+                at++;
+
+                filterToken *token = &parser->tokens[parser->tokenCount - 1];
+                size_t len = 0;
+                for (size_t i = 0; i < token->len; i++) {
+                    token->text[len++] = token->text[i];
+                    if (token->text[i] == '"') {
+                        i++;
+                    }
+                }
+                token->text[len] = '\0';
+                token->len = len;
+                continue;
+            }
+        }
+
+        const char *start = at;
+        while (*at != '\0' && !isspace((unsigned char) *at) && strchr("(),=!<>\"", *at) == NULL) {
+            at++;
+        }
+        rc = addToken(parser, TOKEN__WORD, start, at - start);
+    }
+
+    return rc;
+}
+
+/**
+ * Add a token, with a copy of its text.
+ *
+ * @param   parser
+ * @param   type
+ * @param   text
+ * @param   len
+ */
+static char addToken(filterParser *parser, int type, const char *text, size_t len)
+{
+    filterToken *tokens = realloc(parser->tokens, sizeof(filterToken) * (parser->tokenCount + 1));
+
+    if (tokens == NULL) {
+        return CSVH_FILTER__OUT_OF_MEMORY;
+    }
+    parser->tokens = tokens;
+
+    char *copy = malloc(len + 1);
+    if (copy == NULL) {
+        return CSVH_FILTER__OUT_OF_MEMORY;
+    }
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+
+    tokens[parser->tokenCount++] = (filterToken) { type, copy, len };
+
+    return CSVH_FILTER__OK;
+}
+
+/**
+ * Whether the token is the keyword (in any case).  Quoted ones never are.
+ *
+ * @param   token
+ * @param   keyword
+ */
+static char isKeyword(const filterToken *token, const char *keyword)
+{
+    if (token->type != TOKEN__WORD || token->len != strlen(keyword)) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < token->len; i++) {
+        if (tolower((unsigned char) token->text[i]) != keyword[i]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Whether the token can be a column name.
+ *
+ * @param   token
+ */
+static char isName(const filterToken *token)
+{
+    return (token->type == TOKEN__WORD || token->type == TOKEN__STRING)
+        && !isKeyword(token, "and")
+        && !isKeyword(token, "or")
+        && !isKeyword(token, "not");
+}
+
+/**
+ * Parse one or more "and"s with "or" between them.
+ *
+ * @param   parser
+ */
+static filterNode *parseOr(filterParser *parser)
+{
+    filterNode *first = parseAnd(parser);
+
+    if (first == NULL || !isKeyword(&parser->tokens[parser->pos], "or")) {
+        return first;
+    }
+
+    filterNode *node = newNode(parser, NODE__OR);
+    if (node == NULL) {
+        freeNode(first);
+        return NULL;
+    }
+    if (!addKid(parser, node, first)) {
+        freeNode(node);
+        return NULL;
+    }
+
+    while (isKeyword(&parser->tokens[parser->pos], "or")) {
+        parser->pos++;
+        if (!addKid(parser, node, parseAnd(parser))) {
+            freeNode(node);
+            return NULL;
+        }
+    }
+
+    return node;
+}
+
+/**
+ * Parse one or more tests (or "not"s, or parentheses) with "and" between
+ * them.
+ *
+ * @param   parser
+ */
+static filterNode *parseAnd(filterParser *parser)
+{
+    filterNode *first = parseNot(parser);
+
+    if (first == NULL || !isKeyword(&parser->tokens[parser->pos], "and")) {
+        return first;
+    }
+
+    filterNode *node = newNode(parser, NODE__AND);
+    if (node == NULL) {
+        freeNode(first);
+        return NULL;
+    }
+    if (!addKid(parser, node, first)) {
+        freeNode(node);
+        return NULL;
+    }
+
+    while (isKeyword(&parser->tokens[parser->pos], "and")) {
+        parser->pos++;
+        if (!addKid(parser, node, parseNot(parser))) {
+            freeNode(node);
+            return NULL;
+        }
+    }
+
+    return node;
+}
+
+/**
+ * Parse a test, an expression in parentheses, or "not" before either.
+ *
+ * @param   parser
+ */
+static filterNode *parseNot(filterParser *parser)
+{
+    filterToken *token = &parser->tokens[parser->pos];
+
+    if (isKeyword(token, "not")) {
+        parser->pos++;
+
+        filterNode *node = newNode(parser, NODE__NOT);
+        if (node == NULL || !addKid(parser, node, parseNot(parser))) {
+            freeNode(node);
+            return NULL;
+        }
+        return node;
+    }
+
+    if (token->type == TOKEN__OPEN && !isColumnList(parser)) {
+        parser->pos++;
+
+        filterNode *node = parseOr(parser);
+        if (node != NULL && parser->tokens[parser->pos].type != TOKEN__CLOSE) {
+            parser->rc = CSVH_FILTER__INVALID_INPUT;
+            freeNode(node);
+            return NULL;
+        }
+        parser->pos++;
+        return node;
+    }
+
+    return parseTest(parser);
+}
+
+/**
+ * Whether the parentheses coming up are around column names for a test,
+ * rather than around an expression.  They are if there's nothing but names
+ * and commas in them, and then not "and" or "or" or the end.
+ *
+ * @param   parser
+ */
+static char isColumnList(filterParser *parser)
+{
+    int at = parser->pos + 1;
+
+    for (;;) {
+        if (!isName(&parser->tokens[at++])) {
+            return 0;
+        }
+        if (parser->tokens[at].type == TOKEN__CLOSE) {
+            break;
+        }
+        if (parser->tokens[at++].type != TOKEN__COMMA) {
+            return 0;
+        }
+    }
+
+    filterToken *after = &parser->tokens[at + 1];
+
+    return after->type != TOKEN__END
+        && after->type != TOKEN__CLOSE
+        && !isKeyword(after, "and")
+        && !isKeyword(after, "or");
+}
+
+/**
+ * Parse a single test: a column name (or several in parentheses), then what
+ * it's tested for.
+ *
+ * @param   parser
+ */
+static filterNode *parseTest(filterParser *parser)
+{
+    int *fields;
+    int fieldCount;
+
+    if (!parseColumns(parser, &fields, &fieldCount)) {
+        return NULL;
+    }
+
+    filterToken *op = &parser->tokens[parser->pos++];
+    int test = -1;
+    filterNode *node;
+
+    switch (op->type) {
+        case TOKEN__EQ:
+        case TOKEN__NE: {
+            filterToken *value = &parser->tokens[parser->pos];
+            if (value->type != TOKEN__WORD && value->type != TOKEN__STRING) {
+                break;
+            }
+            parser->pos++;
+
+            filterNode *equals = newTest(parser, TEST__EQUALS, fields, fieldCount);
+            if (equals == NULL) {
+                return NULL;
+            }
+            // Take the text from the token.
+            equals->step.value = value->text;
+            equals->step.len = value->len;
+            value->text = NULL;
+
+            if (op->type == TOKEN__EQ) {
+                return equals;
+            }
+
+            node = newNode(parser, NODE__NOT);
+            if (node == NULL) {
+                freeNode(equals);
+                return NULL;
+            }
+            if (!addKid(parser, node, equals)) {
+                freeNode(node);
+                return NULL;
+            }
+            return node;
+        }
+        case TOKEN__LT:
+        case TOKEN__LE:
+        case TOKEN__GT:
+        case TOKEN__GE: {
+            filterToken *value = &parser->tokens[parser->pos];
+            char *end;
+            double num = strtod(value->text, &end);
+
+            if (value->type != TOKEN__WORD || end == value->text || *end != '\0') {
+                break;
+            }
+            parser->pos++;
+
+            filterRange range = { -HUGE_VAL, HUGE_VAL, 0, 0 };
+            if (op->type == TOKEN__LT || op->type == TOKEN__LE) {
+                range.upper = num;
+                range.upperOpen = (op->type == TOKEN__LT);
+            } else {
+                range.lower = num;
+                range.lowerOpen = (op->type == TOKEN__GT);
+            }
+
+            node = newTest(parser, TEST__NUMBER, fields, fieldCount);
+            if (node != NULL && !addRange(parser, &node->step, range)) {
+                freeNode(node);
+                return NULL;
+            }
+            return node;
+        }
+        case TOKEN__WORD:
+            if (isKeyword(op, "in")) {
+                test = TEST__IN;
+            } else if (isKeyword(op, "contains")) {
+                test = TEST__CONTAINS;
+            } else if (isKeyword(op, "starts")) {
+                test = TEST__STARTS;
+            } else if (isKeyword(op, "ends")) {
+                test = TEST__ENDS;
+            } else if (isKeyword(op, "matches")) {
+#ifndef _WIN32
+                test = TEST__MATCHES;
+#endif
+            } else {
+                // Ranges, right after the column.
+                parser->pos--;
+                test = TEST__NUMBER;
+            }
+            break;
+        case TOKEN__OPEN:
+            // Ranges, in parentheses.
+            parser->pos--;
+            test = TEST__NUMBER;
+            break;
+    }
+
+    if (test == -1) {
+        if (parser->rc == CSVH_FILTER__OK) {
+            parser->rc = CSVH_FILTER__INVALID_INPUT;
+        }
+        free(fields);
+        return NULL;
+    }
+
+    node = newTest(parser, test, fields, fieldCount);
+    if (node != NULL && !parseValues(parser, node)) {
+        freeNode(node);
+        return NULL;
+    }
+
+    return node;
+}
+
+/**
+ * Parse the column name (or names, in parentheses) a test is of, into an
+ * array of their indexes.  Returns 0 if they can't be.
+ *
+ * @param   parser
+ * @param   fields
+ * @param   fieldCount
+ */
+static char parseColumns(filterParser *parser, int **fields, int *fieldCount)
+{
+    char list = (parser->tokens[parser->pos].type == TOKEN__OPEN);
+
+    if (list) {
+        // (isColumnList already made sure it's names and commas.)
+        parser->pos++;
+    }
+
+    *fields = NULL;
+    *fieldCount = 0;
+
+    for (;;) {
+        filterToken *name = &parser->tokens[parser->pos++];
+
+        if (!isName(name)) {
+            parser->rc = CSVH_FILTER__INVALID_INPUT;
+            break;
+        }
+
+        int field = 0;
+        while (parser->headers[field] != NULL && strcmp(parser->headers[field], name->text) != 0) {
+            field++;
+        }
+        if (parser->headers[field] == NULL) {
+            parser->rc = CSVH_FILTER__HEADER_NOT_FOUND;
+            break;
+        }
+        if (field + 1 > parser->fieldCount) {
+            parser->fieldCount = field + 1;
+        }
+
+        int *grown = realloc(*fields, sizeof(int) * (*fieldCount + 1));
+        if (grown == NULL) {
+            parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+            break;
+        }
+        *fields = grown;
+        (*fields)[(*fieldCount)++] = field;
+
+        if (!list) {
+            return 1;
+        }
+
+        if (parser->tokens[parser->pos++].type == TOKEN__CLOSE) {
+            return 1;
+        }
+    }
+
+    free(*fields);
+    *fields = NULL;
+
+    return 0;
+}
+
+/**
+ * Parse the values a test is for: one or more of them with commas in between,
+ * maybe in parentheses.  Returns 0 if they can't be.
+ *
+ * @param   parser
+ * @param   test
+ */
+static char parseValues(filterParser *parser, filterNode *test)
+{
+    filterStep *step = &test->step;
+    char list = (parser->tokens[parser->pos].type == TOKEN__OPEN);
+
+    if (list) {
+        parser->pos++;
+    }
+
+    switch (step->test) {
+        case TEST__IN:
+            step->set = csvh_set_new();
+            if (step->set == NULL) {
+                parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+                return 0;
+            }
+            break;
+        case TEST__CONTAINS:
+        case TEST__STARTS:
+        case TEST__ENDS:
+            step->match = csvh_match_new(
+                (step->test == TEST__CONTAINS) ? CSVH_MATCH_KIND__CONTAINS
+                    : (step->test == TEST__STARTS) ? CSVH_MATCH_KIND__PREFIX
+                    : CSVH_MATCH_KIND__SUFFIX
+            );
+            if (step->match == NULL) {
+                parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+                return 0;
+            }
+            break;
+        case TEST__MATCHES:
+            step->regexFirst = parser->regexCount;
+            break;
+    }
+
+    for (;;) {
+        filterToken *value = &parser->tokens[parser->pos++];
+
+        if (value->type != TOKEN__WORD && value->type != TOKEN__STRING) {
+            parser->rc = CSVH_FILTER__INVALID_INPUT;
+            return 0;
+        }
+
+        if (!addValue(parser, step, value)) {
+            return 0;
+        }
+
+        if (parser->tokens[parser->pos].type != TOKEN__COMMA) {
+            break;
+        }
+        parser->pos++;
+    }
+
+    if (list && parser->tokens[parser->pos++].type != TOKEN__CLOSE) {
+        parser->rc = CSVH_FILTER__INVALID_INPUT;
+        return 0;
+    }
+
+    if (step->match != NULL && csvh_match_build(step->match) != CSVH_MATCH__OK) {
+        parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Add one value to a test.  Returns 0 if it can't be.
+ *
+ * @param   parser
+ * @param   step
+ * @param   value
+ */
+static char addValue(filterParser *parser, filterStep *step, filterToken *value)
+{
+    filterRange range = { 0, 0, 0, 0 };
+
+    switch (step->test) {
+        case TEST__IN:
+            if (csvh_set_add(step->set, value->text, value->len) != CSVH_SET__OK) {
+                parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+                return 0;
+            }
+            return 1;
+        case TEST__CONTAINS:
+        case TEST__STARTS:
+        case TEST__ENDS:
+            if (csvh_match_add(step->match, value->text, value->len) != CSVH_MATCH__OK) {
+                parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+                return 0;
+            }
+            return 1;
+        case TEST__MATCHES:
+            return addRegex(parser, step, value);
+        case TEST__NUMBER:
+            if (!parseBounds(value->text, &range.lower, &range.upper)) {
+                parser->rc = CSVH_FILTER__INVALID_INPUT;
+                return 0;
+            }
+            return addRange(parser, step, range);
+    }
+
+    return 0;
+}
+
+/**
+ * Add a range of numbers to a test.
+ *
+ * @param   parser
+ * @param   step
+ * @param   range
+ */
+static char addRange(filterParser *parser, filterStep *step, filterRange range)
+{
+    filterRange *ranges = realloc(step->ranges, sizeof(filterRange) * (step->rangeCount + 1));
+
+    if (ranges == NULL) {
+        parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+        return 0;
+    }
+
+    step->ranges = ranges;
+    step->ranges[step->rangeCount++] = range;
+
+    return 1;
+}
+
+/**
+ * Add a regular expression to a test.  It's compiled here just to make sure
+ * it can be (each copy of the filter compiles its own).
+ *
+ * @param   parser
+ * @param   step
+ * @param   value
+ */
+static char addRegex(filterParser *parser, filterStep *step, filterToken *value)
+{
+#ifndef _WIN32
+    regex_t check;
+
+    if (regcomp(&check, value->text, REG_EXTENDED | REG_NOSUB) != 0) {
+        parser->rc = CSVH_FILTER__INVALID_INPUT;
+        return 0;
+    }
+    regfree(&check);
+
+    filterRegex *regexes = realloc(parser->regexes, sizeof(filterRegex) * (parser->regexCount + 1));
+    if (regexes == NULL) {
+        parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+        return 0;
+    }
+    parser->regexes = regexes;
+
+    filterRegex *regex = &parser->regexes[parser->regexCount];
+    regex->source = value->text;
+    regex->literal = NULL;
+    value->text = NULL;
+    parser->regexCount++;
+    step->regexCount++;
+
+    char *literal = malloc(strlen(regex->source) + 1);
+    if (literal == NULL) {
+        parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+        return 0;
+    }
+
+    size_t len = requiredLiteral(regex->source, literal);
+    if (len > 0) {
+        regex->literal = csvh_match_new(CSVH_MATCH_KIND__CONTAINS);
+        if (regex->literal == NULL
+            || csvh_match_add(regex->literal, literal, len) != CSVH_MATCH__OK
+            || csvh_match_build(regex->literal) != CSVH_MATCH__OK
+        ) {
+            free(literal);
+            parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+            return 0;
+        }
+    }
+    free(literal);
+
+    return 1;
+#else
+    parser->rc = CSVH_FILTER__INVALID_INPUT;
+    return 0;
+#endif
+}
+
+/**
+ * Find the longest string that anything a regular expression matches has to
+ * have in it, as is, and copy it to literal (which needs as much room as the
+ * expression).  Returns how long it is, 0 if there isn't one.
+ *
+ * This only has to be sure, not thorough: anything inside of parentheses or
+ * brackets is just passed over, and with a '|' anywhere, there's no telling.
+ *
+ * @param   regex
+ * @param   literal
+ */
+static size_t requiredLiteral(const char *regex, char *literal)
+{
+    size_t best = 0;
+    size_t runStart = 0;
+    size_t runLen = 0;
+    size_t len = strlen(regex);
+    char *run = malloc(len + 1);
+
+    if (run == NULL || strchr(regex, '|') != NULL) {
+        free(run);
+        return 0;
+    }
+
+    size_t i = 0;
+    while (i <= len) {
+        char c = regex[i];
+        char ends = 1;
+
+        if (c == '\\' && regex[i + 1] != '\0' && strchr(".[]()*+?{}|^$\\", regex[i + 1]) != NULL) {
+            // An escaped special character is just itself.  (Others, like
+            // "\<" or "\w", aren't.)
+            run[runLen++] = regex[i + 1];
+            i += 2;
+            ends = 0;
+        } else if (c == '*' || c == '?' || c == '{') {
+            // What came right before might not be there at all.
+            if (runLen > runStart) {
+                runLen--;
+            }
+            if (c == '{') {
+                while (regex[i] != '\0' && regex[i] != '}') {
+                    i++;
+                }
+            }
+            i++;
+        } else if (c == '[') {
+            i++;
+            if (regex[i] == '^') {
+                i++;
+            }
+            if (regex[i] == ']') {
+                i++;
+            }
+            while (regex[i] != '\0' && regex[i] != ']') {
+                i++;
+            }
+            i++;
+        } else if (c == '(') {
+            int depth = 0;
+            do {
+                if (regex[i] == '\\' && regex[i + 1] != '\0') {
+                    i++;
+                } else if (regex[i] == '(') {
+                    depth++;
+                } else if (regex[i] == ')') {
+                    depth--;
+                }
+                i++;
+            } while (depth > 0 && regex[i] != '\0');
+        } else if (c == '+') {
+            // What came before is there, unless another repeat after this
+            // one says it might not be (and what's after is apart either
+            // way).
+            char optional = 0;
+            for (i++; regex[i] == '+' || regex[i] == '*' || regex[i] == '?' || regex[i] == '{'; i++) {
+                optional |= (regex[i] != '+');
+                if (regex[i] == '{') {
+                    while (regex[i + 1] != '\0' && regex[i] != '}') {
+                        i++;
+                    }
+                }
+            }
+            if (optional && runLen > runStart) {
+                runLen--;
+            }
+        } else if (c == '\0' || c == '\\' || strchr(".^$)", c) != NULL) {
+            i += (c == '\\') ? 2 : 1;
+        } else {
+            run[runLen++] = c;
+            i++;
+            ends = 0;
+        }
+
+        if (ends) {
+            if (runLen - runStart > best) {
+                best = runLen - runStart;
+                memcpy(literal, run + runStart, best);
+            }
+            runStart = runLen;
+        }
+    }
+
+    free(run);
+
+    return best;
+}
+
+/**
+ * Turn a single range ("lower-upper", or just a value) into numbers, the
+ * same as for -r r (either bound can be negative, so the '-' between them is
+ * the first one after the lower bound).  Returns 0 if it isn't one.
+ *
+ * @param   text
+ * @param   lower
+ * @param   upper
+ */
+static char parseBounds(const char *text, double *lower, double *upper)
+{
+    char *end;
+
+    *lower = strtod(text, &end);
+
+    if (end == text) {
+        return 0;
+    }
+
+    if (*end == '\0') {
+        *upper = *lower;
+        return 1;
+    }
+
+    if (*end != '-') {
+        return 0;
+    }
+
+    const char *upperStr = end + 1;
+    *upper = strtod(upperStr, &end);
+
+    return end != upperStr && *end == '\0';
+}
+
+/**
+ * Make a node (sets parser->rc if out of memory).
+ *
+ * @param   parser
+ * @param   kind
+ */
+static filterNode *newNode(filterParser *parser, int kind)
+{
+    filterNode *node = calloc(1, sizeof(filterNode));
+
+    if (node == NULL) {
+        parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+        return NULL;
+    }
+
+    node->kind = kind;
+
+    return node;
+}
+
+/**
+ * Make a test node, of the fields given (it takes the array).  Comparing
+ * strings is cheapest, then looking them up in a set or checking their ends,
+ * then turning fields into numbers, then looking all through them, and
+ * regular expressions cost the most.
+ *
+ * @param   parser
+ * @param   test
+ * @param   fields
+ * @param   fieldCount
+ */
+static filterNode *newTest(filterParser *parser, int test, int *fields, int fieldCount)
+{
+    static const int costs[] = {
+        [TEST__EQUALS] = 1,
+        [TEST__IN] = 2,
+        [TEST__STARTS] = 2,
+        [TEST__ENDS] = 2,
+        [TEST__NUMBER] = 3,
+        [TEST__CONTAINS] = 4,
+        [TEST__MATCHES] = 8,
+    };
+
+    filterNode *node = newNode(parser, NODE__TEST);
+
+    if (node == NULL) {
+        free(fields);
+        return NULL;
+    }
+
+    node->step.test = test;
+    node->step.fields = fields;
+    node->step.fieldCount = fieldCount;
+    node->cost = costs[test] * fieldCount;
+    parser->testCount++;
+
+    return node;
+}
+
+/**
+ * Add a kid to an "and", "or", or "not" node.  Returns 0 if it can't (kid
+ * being NULL means parsing it failed), and the kid is freed.
+ *
+ * @param   parser
+ * @param   node
+ * @param   kid
+ */
+static char addKid(filterParser *parser, filterNode *node, filterNode *kid)
+{
+    if (kid == NULL) {
+        return 0;
+    }
+
+    filterNode **kids = realloc(node->kids, sizeof(filterNode *) * (node->kidCount + 1));
+    if (kids == NULL) {
+        parser->rc = CSVH_FILTER__OUT_OF_MEMORY;
+        freeNode(kid);
+        return 0;
+    }
+
+    node->kids = kids;
+    node->kids[node->kidCount++] = kid;
+    node->cost += kid->cost;
+
+    return 1;
+}
+
+/**
+ * Put the kids of every "and" and "or" in order of cost, cheapest first.
+ * (Kids that cost the same stay in the order they were given in.)
+ *
+ * @param   node
+ */
+static void sortKids(filterNode *node)
+{
+    for (int i = 0; i < node->kidCount; i++) {
+        sortKids(node->kids[i]);
+    }
+
+    if (node->kind != NODE__AND && node->kind != NODE__OR) {
+        return;
+    }
+
+    for (int i = 1; i < node->kidCount; i++) {
+        filterNode *kid = node->kids[i];
+        int j = i;
+
+        for (; j > 0 && node->kids[j - 1]->cost > kid->cost; j--) {
+            node->kids[j] = node->kids[j - 1];
+        }
+        node->kids[j] = kid;
+    }
+}
+
+/**
+ * Add the steps for a node to the program, going to onTrue if it's true and
+ * onFalse if it isn't.  Returns the step to start it at.
+ *
+ * The kids of an "and" or "or" are compiled last to first, so that each one
+ * knows where the next one starts.
+ *
+ * @param   program
+ * @param   node
+ * @param   onTrue
+ * @param   onFalse
+ */
+static int compile(filterProgram *program, filterNode *node, int onTrue, int onFalse)
+{
+    int next;
+
+    switch (node->kind) {
+        case NODE__NOT:
+            return compile(program, node->kids[0], onFalse, onTrue);
+        case NODE__AND:
+            next = onTrue;
+            for (int i = node->kidCount - 1; i >= 0; i--) {
+                next = compile(program, node->kids[i], next, onFalse);
+            }
+            return next;
+        case NODE__OR:
+            next = onFalse;
+            for (int i = node->kidCount - 1; i >= 0; i--) {
+                next = compile(program, node->kids[i], onTrue, next);
+            }
+            return next;
+    }
+
+    // A test.  The program takes what it has.
+    filterStep *step = &program->steps[program->stepCount];
+    *step = node->step;
+    step->onTrue = onTrue;
+    step->onFalse = onFalse;
+    memset(&node->step, 0, sizeof(filterStep));
+
+    return program->stepCount++;
+}
+
+/**
+ * Free what a step has.
+ *
+ * @param   step
+ */
+static void freeStep(filterStep *step)
+{
+    free(step->fields);
+    free(step->value);
+    csvh_set_free(step->set);
+    free(step->ranges);
+    csvh_match_free(step->match);
+}
+
+/**
+ * Free a node and everything under it.
+ *
+ * @param   node
+ */
+static void freeNode(filterNode *node)
+{
+    if (node == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < node->kidCount; i++) {
+        freeNode(node->kids[i]);
+    }
+
+    free(node->kids);
+    freeStep(&node->step);
+    free(node);
+}
+
+/**
+ * Free regular expressions (the sources, not compiled ones).
+ *
+ * @param   regexes
+ * @param   count
+ */
+static void freeRegexes(filterRegex *regexes, int count)
+{
+    for (int i = 0; i < count; i++) {
+        free(regexes[i].source);
+        csvh_match_free(regexes[i].literal);
+    }
+
+    free(regexes);
+}
+
+/**
+ * Free a program.
+ *
+ * @param   program
+ */
+static void freeProgram(filterProgram *program)
+{
+    for (int i = 0; i < program->stepCount; i++) {
+        freeStep(&program->steps[i]);
+    }
+
+    freeRegexes(program->regexes, program->regexCount);
+    free(program->steps);
+    free(program->needed);
+    free(program);
+}
+
+/**
+ * Find the fields of a line that the tests look at (and the ones before
+ * them), and return how many the line has, up to the last one needed.
+ * Returns -1 if the line can't be parsed, or -2 if out of memory.
+ *
+ * @param   filter
+ * @param   dialect
+ * @param   line
+ * @param   len
+ */
+static int spanFields(
+    csvh_filter *filter,
+    const csv_dialect *dialect,
+    const char *line,
+    size_t len
+) {
+    filterProgram *program = filter->program;
+    int want = program->fieldCount;
+    int count = -1;
+    size_t start = 0;
+
+    if (dialect->escape == '\0' && dialect->delimLen == 1) {
+        count = csvh_scan_fields_upto(line, len, dialect->delim[0], dialect->quote, filter->ends, want, want);
+    }
+
+    for (int i = 0; i < count; start = filter->ends[i] + 1, i++) {
+        if (program->needed[i] && filter->ends[i] > start && line[start] == dialect->quote) {
+            // It's quoted, so the quotes have to come off.  Only the fields
+            // up to the last one needed have to be copied for that.
+            len = filter->ends[count - 1];
+            count = -1;
+            break;
+        }
+
+        filter->spans[i].start = line + start;
+        filter->spans[i].len = filter->ends[i] - start;
+    }
+
+    if (count >= 0) {
+        return count;
+    }
+
+    // Parsing takes the quotes off in place, so it's done on a copy.
+    if (copyLine(filter, line, len) != CSVH_FILTER__OK) {
+        return -2;
+    }
+
+    return parse_csv_spans_needed(
+        dialect,
+        filter->line,
+        len,
+        program->needed,
+        want,
+        &filter->spans,
+        &filter->spanCap
+    );
+}
+
+/**
+ * Copy (the start of) the line being checked, to parse it in place.
+ *
+ * @param   filter
+ * @param   line
+ * @param   len
+ */
+static char copyLine(csvh_filter *filter, const char *line, size_t len)
+{
+    if (filter->lineCap < len + 1) {
+        char *newLine = realloc(filter->line, len + 1);
+        if (newLine == NULL) {
+            return CSVH_FILTER__OUT_OF_MEMORY;
+        }
+        filter->line = newLine;
+        filter->lineCap = len + 1;
+    }
+    memcpy(filter->line, line, len);
+    filter->line[len] = '\0';
+
+    return CSVH_FILTER__OK;
+}
+
+/**
+ * Whether one field of the line being checked passes a step's test.
+ *
+ * @param   filter
+ * @param   step
+ * @param   field
+ */
+static char testField(csvh_filter *filter, const filterStep *step, int field)
+{
+    const csv_span *span = &filter->spans[field];
+
+    switch (step->test) {
+        case TEST__EQUALS:
+            return span->len == step->len && memcmp(span->start, step->value, step->len) == 0;
+        case TEST__IN:
+            return csvh_set_has(step->set, span->start, span->len);
+        case TEST__CONTAINS:
+        case TEST__STARTS:
+        case TEST__ENDS:
+            return csvh_match_find(step->match, span->start, span->len);
+        case TEST__NUMBER: {
+            double num = fieldNumber(filter, field);
+
+            for (int i = 0; i < step->rangeCount; i++) {
+                const filterRange *range = &step->ranges[i];
+
+                if ((range->lowerOpen ? num > range->lower : num >= range->lower)
+                    && (range->upperOpen ? num < range->upper : num <= range->upper)
+                ) {
+                    return 1;
+                }
+            }
+            return 0;
+        }
+        case TEST__MATCHES:
+            for (int i = step->regexFirst; i < step->regexFirst + step->regexCount; i++) {
+                const csvh_match *literal = filter->program->regexes[i].literal;
+
+                if (literal != NULL && !csvh_match_find(literal, span->start, span->len)) {
+                    continue;
+                }
+                if (fieldMatches(filter, i, field)) {
+                    return 1;
+                }
+            }
+            return 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Get a field of the line being checked as a number (0 if it isn't one, the
+ * same as for -r r).  Each field is only turned into one once per line.
+ *
+ * @param   filter
+ * @param   field
+ */
+static double fieldNumber(csvh_filter *filter, int field)
+{
+    if (filter->numStamps[field] == filter->stamp) {
+        return filter->nums[field];
+    }
+
+    csv_span *span = &filter->spans[field];
+    double num = 0;
+
+    if (span->len > 0) {
+        const char *terminated = terminateField(filter, span);
+
+        if (terminated != NULL) {
+            num = strtod(terminated, NULL);
+        }
+    }
+
+    filter->nums[field] = num;
+    filter->numStamps[field] = filter->stamp;
+
+    return num;
+}
+
+/**
+ * Whether a field of the line being checked matches one of the regular
+ * expressions.
+ *
+ * @param   filter
+ * @param   regex
+ * @param   field
+ */
+static char fieldMatches(csvh_filter *filter, int regex, int field)
+{
+#ifndef _WIN32
+    csv_span *span = &filter->spans[field];
+
+    if (span->len == 0) {
+        return regexec(&filter->regexes[regex], "", 0, NULL, 0) == 0;
+    }
+
+    const char *terminated = terminateField(filter, span);
+
+    return terminated != NULL && regexec(&filter->regexes[regex], terminated, 0, NULL, 0) == 0;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Copy a field of the line being checked, null-terminated (since the line
+ * itself can't be written to).  It's valid until the next call.  Returns NULL
+ * if out of memory.
+ *
+ * @param   filter
+ * @param   span
+ */
+static const char *terminateField(csvh_filter *filter, const csv_span *span)
+{
+    if (filter->fieldCap < span->len + 1) {
+        char *newField = realloc(filter->field, span->len + 1);
+        if (newField == NULL) {
+            return NULL;
+        }
+        filter->field = newField;
+        filter->fieldCap = span->len + 1;
+    }
+    memcpy(filter->field, span->start, span->len);
+    filter->field[span->len] = '\0';
+
+    return filter->field;
+}
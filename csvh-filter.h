@@ -0,0 +1,31 @@
+#ifndef csvh_filter_h
+#define csvh_filter_h
+
+#include <stddef.h>
+
+#include "csv.h"
+
+// Constants
+
+#define CSVH_FILTER__OK                 0
+#define CSVH_FILTER__OUT_OF_MEMORY      1
+#define CSVH_FILTER__INVALID_INPUT      2
+#define CSVH_FILTER__HEADER_NOT_FOUND   3
+
+typedef struct csvh_filter csvh_filter;
+
+char csvh_filter_compile(csvh_filter **filter, const char *expr, char **headers);
+
+char csvh_filter_match(
+    csvh_filter *filter,
+    const csv_dialect *dialect,
+    const char *line,
+    size_t len,
+    char *matches
+);
+
+csvh_filter *csvh_filter_copy(csvh_filter *filter);
+
+void csvh_filter_free(csvh_filter *filter);
+
+#endif
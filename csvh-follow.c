@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "csvh-follow.h"
+
+// This is a helper module for csvh-reader.c.
+
+// It waits for a file to get longer, for following a file that's still being
+// written to (like `tail -f`).  On Linux, inotify says when the file was
+// written to, so new rows show up right away.  Everywhere else (or if inotify
+// can't be used, e.g., out of watches) the size is just checked every
+// POLL_MS.
+
+// A file that gets shorter (truncated) is waited on until it's longer than it
+// was before.
+
+/**
+ * How often to check the size when polling.
+ */
+#define POLL_MS 10
+
+/**
+ * With inotify, still check the size this often, in case an event is missed
+ * (e.g., the file is on a network drive).
+ */
+#define INOTIFY_CHECK_MS 1000
+
+struct csvh_follow {
+    int fd;
+
+    /**
+     * inotify instance, or -1 if polling.
+     */
+    int notifyFd;
+};
+
+// START forward declarations for static functions.
+
+static void sleepMs(int ms);
+
+// END forward declarations.
+
+/**
+ * Start watching a file.
+ *
+ * @param   follow
+ * @param   fd      Used to check the size.
+ * @param   path    File to watch.  If NULL, goes by fd.
+ */
+char csvh_follow_open(csvh_follow **follow, int fd, const char *path)
+{
+    *follow = calloc(1, sizeof(csvh_follow));
+
+    if (*follow == NULL) {
+        return CSVH_FOLLOW__OUT_OF_MEMORY;
+    }
+
+    (*follow)->fd = fd;
+    (*follow)->notifyFd = -1;
+
+#ifdef __linux__
+    char fdPath[32];
+    if (path == NULL) {
+        snprintf(fdPath, sizeof(fdPath), "/proc/self/fd/%d", fd);
+        path = fdPath;
+    }
+
+    int notifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (notifyFd >= 0) {
+        if (inotify_add_watch(notifyFd, path, IN_MODIFY) >= 0) {
+            (*follow)->notifyFd = notifyFd;
+        } else {
+            close(notifyFd);
+        }
+    }
+#else
+    (void) path;
+#endif
+
+    return CSVH_FOLLOW__OK;
+}
+
+/**
+ * Wait until the file is longer than knownSize, and set newSize to its size.
+ * Never gives up.
+ *
+ * @param   follow
+ * @param   knownSize
+ * @param   newSize
+ */
+char csvh_follow_wait(csvh_follow *follow, size_t knownSize, size_t *newSize)
+{
+    struct stat st;
+
+    while (1) {
+        if (fstat(follow->fd, &st) != 0) {
+            return CSVH_FOLLOW__READ_ERROR;
+        }
+
+        if ((size_t) st.st_size > knownSize) {
+            *newSize = st.st_size;
+            return CSVH_FOLLOW__OK;
+        }
+
+#ifdef __linux__
+        if (follow->notifyFd >= 0) {
+            struct pollfd pfd = { follow->notifyFd, POLLIN, 0 };
+            char events[4096];
+
+            if (poll(&pfd, 1, INOTIFY_CHECK_MS) > 0) {
+                // Don't care what the events say, just that there were some.
+                while (read(follow->notifyFd, events, sizeof(events)) > 0) {}
+            }
+            continue;
+        }
+#endif
+
+        sleepMs(POLL_MS);
+    }
+}
+
+/**
+ * Stop watching and free everything.
+ *
+ * @param   follow
+ */
+char csvh_follow_close(csvh_follow *follow)
+{
+    if (follow == NULL) {
+        return CSVH_FOLLOW__OK;
+    }
+
+    if (follow->notifyFd >= 0) {
+        close(follow->notifyFd);
+    }
+
+    free(follow);
+
+    return CSVH_FOLLOW__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Sleep for a number of milliseconds.
+ *
+ * @param   ms
+ */
+static void sleepMs(int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+#endif
+}
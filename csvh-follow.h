@@ -0,0 +1,20 @@
+#ifndef csvh_follow_h
+#define csvh_follow_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_FOLLOW__OK                 0
+#define CSVH_FOLLOW__OUT_OF_MEMORY      1
+#define CSVH_FOLLOW__READ_ERROR         2
+
+typedef struct csvh_follow csvh_follow;
+
+char csvh_follow_open(csvh_follow **follow, int fd, const char *path);
+
+char csvh_follow_wait(csvh_follow *follow, size_t knownSize, size_t *newSize);
+
+char csvh_follow_close(csvh_follow *follow);
+
+#endif
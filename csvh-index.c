@@ -0,0 +1,580 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "csvh-bgzf.h"
+#include "csvh-scan.h"
+#include "csvh-index.h"
+
+// This is a helper module for csvh-reader.c.
+
+// It keeps a sidecar file next to the CSV file (same name plus ".csvidx") with
+// the offset of every INTERVALth record, so that getting to record N is a
+// jump to the nearest one before it plus reading through fewer than INTERVAL
+// records, instead of reading through all N.
+
+// The sidecar remembers the size and modification time of the file it was
+// made for.  If they still match, it's used as is.  If the file only got
+// longer and the start and end of what was indexed are still the same, the
+// new part is indexed and the sidecar is updated (that's the usual case with
+// files that get rows appended).  Anything else, and it's thrown out and made
+// over.
+
+// Records are found the same way the reader finds them (see csvh-scan.c), so
+// quotes out of place are plain characters here too.  But a record the reader
+// would give up on (a quoted field that's closed in the middle of a field, or
+// still open after the longest a record can be) is where indexing stops: the
+// reader picks back up after it in a way that depends on what's around it,
+// so past that point, records are just read through.  The delimiter and that
+// longest record length are kept in the sidecar too, and if they're not what
+// they were, it's made over.
+
+// A BGZF file (see csvh-bgzf.c) gets an index too.  Its offsets are virtual
+// ones (where the block starts in the file, and where in the block's data),
+// so a jump goes straight to the right block.  The records are found the way
+// csvh_bgzf_find_record finds them, which stops short at anything the reader
+// might give up on, so indexing does too.  Appending blocks (e.g., with cat)
+// counts as only appending, going by the compressed bytes before the block
+// where indexing stopped.
+
+// The sidecar is written in the machine's own byte order.  It's a cache, not
+// something to copy between machines; the worst that happens is it gets
+// rebuilt.  If it can't be written at all (e.g., read-only directory), the
+// index is still used for this run.
+
+/**
+ * Records between offsets in the index.
+ */
+#define INTERVAL 1024
+
+/**
+ * Bytes at the start and at the end of the indexed part that are hashed to
+ * check that the file was only appended to.
+ */
+#define EDGE_LEN 256
+
+#define MAGIC "CSVIDX2"
+
+#define SUFFIX ".csvidx"
+
+typedef struct {
+    char magic[8];
+    uint64_t fileSize;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    uint64_t interval;
+
+    /**
+     * Complete records (i.e., ending with a newline) indexed.
+     */
+    uint64_t recordCount;
+
+    /**
+     * Offset just past the last complete record indexed.
+     */
+    uint64_t indexedTo;
+
+    uint64_t edgeHash;
+    uint64_t offsetCount;
+
+    /**
+     * What the records were found with: the bytes of the delimiter that
+     * quotes go by (see csvh_scan_check), and the longest a record can be
+     * inside of a quoted field.
+     */
+    char delimStart;
+    char delimEnd;
+
+    /**
+     * Set if the file is BGZF, so the offsets (and indexedTo) are virtual
+     * ones (see csvh_bgzf_virtual_offset).
+     */
+    char bgzf;
+    char padding[5];
+    uint64_t maxRecord;
+
+    /**
+     * Set if indexing stopped at a record the reader gives up on, so that
+     * what's after indexedTo isn't known to be one last record.
+     */
+    uint64_t stopped;
+} indexHeader;
+
+struct csvh_index {
+    indexHeader header;
+
+    /**
+     * offsets[i] is where record i * INTERVAL starts.
+     */
+    uint64_t *offsets;
+    size_t offsetCap;
+};
+
+// START forward declarations for static functions.
+
+static char *sidecarPath(const char *csvPath);
+
+static char load(csvh_index *index, const char *path);
+
+static char extend(
+    csvh_index *index,
+    const char *start,
+    size_t len,
+    const csv_dialect *dialect
+);
+
+static char extendBgzf(csvh_index *index, csvh_bgzf *bgzf, const csv_dialect *dialect);
+
+static char addOffset(csvh_index *index, uint64_t offset);
+
+static void save(csvh_index *index, const char *path);
+
+static uint64_t edgeHash(const char *start, size_t end);
+
+// END forward declarations.
+
+/**
+ * Get the index for a file that's been mapped, loading the sidecar if it's
+ * good and bringing it up to date otherwise.  The dialect and maxRecord are
+ * the reader's (see csvh_reader_set_resync), so that the records are the ones
+ * it finds.
+ *
+ * @param   index
+ * @param   csvPath
+ * @param   start   The whole file.
+ * @param   len
+ * @param   bgzf    Its blocks, if it's BGZF.  Otherwise NULL.
+ * @param   dialect
+ * @param   maxRecord
+ */
+char csvh_index_open(
+    csvh_index **index,
+    const char *csvPath,
+    const char *start,
+    size_t len,
+    csvh_bgzf *bgzf,
+    const csv_dialect *dialect,
+    size_t maxRecord
+) {
+    struct stat st;
+
+    if (stat(csvPath, &st) != 0) {
+        return CSVH_INDEX__FILE_NOT_FOUND;
+    }
+
+    char *path = sidecarPath(csvPath);
+    if (path == NULL) {
+        return CSVH_INDEX__OUT_OF_MEMORY;
+    }
+
+    *index = calloc(1, sizeof(csvh_index));
+    if (*index == NULL) {
+        free(path);
+        return CSVH_INDEX__OUT_OF_MEMORY;
+    }
+
+    csvh_index *ind = *index;
+    char upToDate = 0;
+    char delimStart = dialect->delim[0];
+    char delimEnd = dialect->delim[dialect->delimLen - 1];
+    char isBgzf = (bgzf != NULL);
+
+    if (load(ind, path)) {
+        indexHeader *h = &ind->header;
+        // (Where the compressed bytes up to what's indexed end, for BGZF.)
+        uint64_t edgeEnd = isBgzf ? h->indexedTo >> 16 : h->indexedTo;
+
+        if (h->delimStart != delimStart
+            || h->delimEnd != delimEnd
+            || h->maxRecord != maxRecord
+            || h->bgzf != isBgzf
+        ) {
+            // Made for other records.
+            ind->header.offsetCount = 0;
+        } else if (h->fileSize == len
+            && h->mtimeSec == st.st_mtim.tv_sec
+            && h->mtimeNsec == st.st_mtim.tv_nsec
+        ) {
+            upToDate = 1;
+        } else if (h->fileSize >= len
+            || edgeEnd > len
+            || h->edgeHash != edgeHash(start, edgeEnd)
+        ) {
+            // Not just appended to.
+            ind->header.offsetCount = 0;
+        }
+    }
+
+    if (ind->header.offsetCount == 0) {
+        memset(&ind->header, 0, sizeof(indexHeader));
+        memcpy(ind->header.magic, MAGIC, sizeof(ind->header.magic));
+        ind->header.interval = INTERVAL;
+        ind->header.delimStart = delimStart;
+        ind->header.delimEnd = delimEnd;
+        ind->header.maxRecord = maxRecord;
+        ind->header.bgzf = isBgzf;
+
+        // Record 0 is always at the start.
+        if (!addOffset(ind, 0)) {
+            free(path);
+            csvh_index_close(ind);
+            *index = NULL;
+            return CSVH_INDEX__OUT_OF_MEMORY;
+        }
+    }
+
+    if (!upToDate) {
+        if (isBgzf ? !extendBgzf(ind, bgzf, dialect) : !extend(ind, start, len, dialect)) {
+            free(path);
+            csvh_index_close(ind);
+            *index = NULL;
+            return CSVH_INDEX__OUT_OF_MEMORY;
+        }
+
+        ind->header.fileSize = len;
+        ind->header.mtimeSec = st.st_mtim.tv_sec;
+        ind->header.mtimeNsec = st.st_mtim.tv_nsec;
+        ind->header.edgeHash = edgeHash(
+            start,
+            isBgzf ? ind->header.indexedTo >> 16 : ind->header.indexedTo
+        );
+
+        save(ind, path);
+    }
+
+    free(path);
+
+    return CSVH_INDEX__OK;
+}
+
+/**
+ * Find the closest record at or before the one asked for that the index
+ * knows where it is.
+ *
+ * @param   index
+ * @param   record          Counting from 0 at the start of the file.
+ * @param   indexedRecord
+ * @param   offset          A virtual one for BGZF (see csvh_index_open).
+ */
+void csvh_index_find(
+    csvh_index *index,
+    long record,
+    long *indexedRecord,
+    uint64_t *offset
+) {
+    uint64_t ind = (record < 0) ? 0 : (uint64_t) record / INTERVAL;
+
+    if (ind >= index->header.offsetCount) {
+        ind = index->header.offsetCount - 1;
+    }
+
+    *indexedRecord = ind * INTERVAL;
+    *offset = index->offsets[ind];
+}
+
+/**
+ * Count of complete records indexed.  indexedTo is set to where the last one
+ * ends, so anything after that is one more record without a newline.
+ * Returns -1 if indexing stopped early (at a record the reader gives up on),
+ * so the count of records in the file isn't known.
+ *
+ * @param   index
+ * @param   indexedTo
+ */
+long csvh_index_record_count(csvh_index *index, size_t *indexedTo)
+{
+    *indexedTo = index->header.indexedTo;
+
+    if (index->header.stopped) {
+        return -1;
+    }
+
+    return index->header.recordCount;
+}
+
+/**
+ * Free everything.
+ *
+ * @param   index
+ */
+char csvh_index_close(csvh_index *index)
+{
+    if (index == NULL) {
+        return CSVH_INDEX__OK;
+    }
+
+    free(index->offsets);
+    free(index);
+
+    return CSVH_INDEX__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Path of the sidecar.  Needs to be freed.
+ *
+ * @param   csvPath
+ */
+static char *sidecarPath(const char *csvPath)
+{
+    char *path = malloc(strlen(csvPath) + sizeof(SUFFIX));
+
+    if (path != NULL) {
+        strcpy(path, csvPath);
+        strcat(path, SUFFIX);
+    }
+
+    return path;
+}
+
+/**
+ * Read the sidecar in.  Returns 1 if there was one and it looks sane (which
+ * doesn't mean it's up to date).
+ *
+ * @param   index
+ * @param   path
+ */
+static char load(csvh_index *index, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return 0;
+    }
+
+    indexHeader *h = &index->header;
+
+    if (fread(h, sizeof(indexHeader), 1, file) != 1
+        || memcmp(h->magic, MAGIC, sizeof(h->magic)) != 0
+        || h->interval != INTERVAL
+        || h->offsetCount == 0
+        || h->offsetCount != h->recordCount / INTERVAL + 1
+    ) {
+        fclose(file);
+        h->offsetCount = 0;
+        return 0;
+    }
+
+    index->offsets = malloc(h->offsetCount * sizeof(uint64_t));
+    if (index->offsets == NULL
+        || fread(index->offsets, sizeof(uint64_t), h->offsetCount, file) != h->offsetCount
+    ) {
+        fclose(file);
+        free(index->offsets);
+        index->offsets = NULL;
+        h->offsetCount = 0;
+        return 0;
+    }
+    index->offsetCap = h->offsetCount;
+
+    fclose(file);
+
+    return 1;
+}
+
+/**
+ * Index the complete records after what's already been indexed, up to the
+ * first one the reader would give up on, if any.  Returns 0 if out of memory.
+ *
+ * This goes through the records the same way the reader's mappedNextRecord
+ * does, including only looking maxRecord bytes in for the end of a quoted
+ * field.
+ *
+ * @param   index
+ * @param   start
+ * @param   len
+ * @param   dialect
+ */
+static char extend(
+    csvh_index *index,
+    const char *start,
+    size_t len,
+    const csv_dialect *dialect
+) {
+    indexHeader *h = &index->header;
+    // (The scan never writes to it.)
+    char *map = (char *) start;
+    char *end = map + len;
+
+    h->stopped = 0;
+
+    while (h->indexedTo < len) {
+        char *recStart = map + h->indexedTo;
+        char *limit = (h->maxRecord != 0 && len - h->indexedTo > h->maxRecord)
+            ? recStart + h->maxRecord
+            : end;
+        char fQuote = 0;
+        csvh_scan_check check = csvh_scan_start_check(dialect, recStart);
+        char *ptr = csvh_scan_find_record_end(recStart, limit, &fQuote, &check);
+
+        if (ptr == NULL && limit < end && !fQuote && !check.badClose) {
+            // Long, but not because of a quoted field.
+            ptr = csvh_scan_find_record_end(limit, end, &fQuote, &check);
+        }
+
+        if (ptr == NULL) {
+            // Either the last record doesn't have a newline, or the reader
+            // would give up on this one.
+            h->stopped = fQuote || check.badClose;
+            break;
+        }
+
+        h->recordCount++;
+        h->indexedTo = ptr - map + 1;
+
+        if (h->recordCount % INTERVAL == 0 && !addOffset(index, h->indexedTo)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Index the records of a BGZF file after what's already been indexed, up to
+ * where csvh_bgzf_find_record stops short.  Returns 0 if out of memory.
+ *
+ * @param   index
+ * @param   bgzf
+ * @param   dialect
+ */
+static char extendBgzf(csvh_index *index, csvh_bgzf *bgzf, const csv_dialect *dialect)
+{
+    indexHeader *h = &index->header;
+    size_t pos;
+    size_t target;
+    long found;
+
+    h->stopped = 1;
+
+    if (csvh_bgzf_from_virtual(bgzf, h->indexedTo, &pos) != CSVH_BGZF__OK) {
+        return 1;
+    }
+
+    while (pos < csvh_bgzf_size(bgzf)) {
+        // Up to the next record that gets an offset.
+        long wanted = INTERVAL - h->recordCount % INTERVAL;
+
+        switch (csvh_bgzf_find_record(bgzf, pos, wanted, dialect, h->maxRecord, &target, &found)) {
+            case CSVH_BGZF__OK:
+                break;
+            case CSVH_BGZF__OUT_OF_MEMORY:
+                return 0;
+            default:
+                // Corrupt, so the reader won't get past here either.
+                return 1;
+        }
+
+        h->recordCount += found;
+        h->indexedTo = csvh_bgzf_virtual_offset(bgzf, target);
+        pos = target;
+
+        if (found < wanted) {
+            // Stopped short.  (Might just be at a last record without a
+            // newline, but that's not worth telling apart: the count of
+            // records is only used for plain files.)
+            break;
+        }
+
+        if (!addOffset(index, h->indexedTo)) {
+            return 0;
+        }
+    }
+
+    h->stopped = (pos < csvh_bgzf_size(bgzf));
+
+    return 1;
+}
+
+/**
+ * Add an offset to the end of the index.  Returns 0 if out of memory.
+ *
+ * @param   index
+ * @param   offset
+ */
+static char addOffset(csvh_index *index, uint64_t offset)
+{
+    if (index->header.offsetCount == index->offsetCap) {
+        size_t newCap = index->offsetCap ? index->offsetCap * 2 : 1024;
+        uint64_t *newOffsets = realloc(index->offsets, newCap * sizeof(uint64_t));
+
+        if (newOffsets == NULL) {
+            return 0;
+        }
+
+        index->offsets = newOffsets;
+        index->offsetCap = newCap;
+    }
+
+    index->offsets[index->header.offsetCount++] = offset;
+
+    return 1;
+}
+
+/**
+ * Write the sidecar out.  Goes to a temporary file first so that another
+ * csview reading it at the same time never sees half of one.
+ *
+ * @param   index
+ * @param   path
+ */
+static void save(csvh_index *index, const char *path)
+{
+    char *tmpPath = malloc(strlen(path) + sizeof(".tmp"));
+
+    if (tmpPath == NULL) {
+        return;
+    }
+
+    strcpy(tmpPath, path);
+    strcat(tmpPath, ".tmp");
+
+    FILE *file = fopen(tmpPath, "wb");
+
+    if (file == NULL) {
+        free(tmpPath);
+        return;
+    }
+
+    char ok = fwrite(&index->header, sizeof(indexHeader), 1, file) == 1
+        && fwrite(index->offsets, sizeof(uint64_t), index->header.offsetCount, file)
+            == index->header.offsetCount;
+
+    if (fclose(file) != 0 || !ok || rename(tmpPath, path) != 0) {
+        remove(tmpPath);
+    }
+
+    free(tmpPath);
+}
+
+/**
+ * Hash of the first and last EDGE_LEN bytes before end (FNV-1a).
+ *
+ * @param   start
+ * @param   end
+ */
+static uint64_t edgeHash(const char *start, size_t end)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t headEnd = (end > EDGE_LEN) ? EDGE_LEN : end;
+    size_t tailStart = (end > EDGE_LEN) ? end - EDGE_LEN : 0;
+
+    if (tailStart < headEnd) {
+        tailStart = headEnd;
+    }
+
+    for (size_t i = 0; i < headEnd; i++) {
+        hash ^= (unsigned char) start[i];
+        hash *= 0x100000001b3ULL;
+    }
+    for (size_t i = tailStart; i < end; i++) {
+        hash ^= (unsigned char) start[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
@@ -0,0 +1,39 @@
+#ifndef csvh_index_h
+#define csvh_index_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "csv.h"
+#include "csvh-bgzf.h"
+
+// Constants
+
+#define CSVH_INDEX__OK                  0
+#define CSVH_INDEX__OUT_OF_MEMORY       1
+#define CSVH_INDEX__FILE_NOT_FOUND      2
+
+typedef struct csvh_index csvh_index;
+
+char csvh_index_open(
+    csvh_index **index,
+    const char *csvPath,
+    const char *start,
+    size_t len,
+    csvh_bgzf *bgzf,
+    const csv_dialect *dialect,
+    size_t maxRecord
+);
+
+void csvh_index_find(
+    csvh_index *index,
+    long record,
+    long *indexedRecord,
+    uint64_t *offset
+);
+
+long csvh_index_record_count(csvh_index *index, size_t *indexedTo);
+
+char csvh_index_close(csvh_index *index);
+
+#endif
@@ -1,47 +1,187 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "csvh-filter.h"
 #include "csvh-line-helper.h"
 
+#define SHOULD_SKIP(LINE) csvh_line_helper_should_skip(helper, LINE, strlen(LINE))
+
 int main()
 {
+    csvh_line_helper *helper = csvh_line_helper_new();
+
     // Line intervals.
-    //int res = csvh_line_helper_init_lines("4,7-11,13,15-17");
+    //int res = csvh_line_helper_init_lines(helper, "4,7-11,13,15-17");
     //printf("res: %d\n", res);
     //int line = 0; // zero is header in this case.
 
     //for (int i = 1; i < 21; i++) {
-    //    printf("line: %d, res: %d\n", line++, csvh_line_helper_should_skip(""));
+    //    printf("line: %d, res: %d\n", line++, SHOULD_SKIP(""));
     //}
 
     // Ranges.
-    //csvh_line_helper_init_ranges(2, "5-7,11.1-12.8, 15");
-
-    //printf("header, always print: should be 0: %d\n", csvh_line_helper_should_skip("blah"));
-    //printf("integer range 1: should be 1: %d\n", csvh_line_helper_should_skip("a,b,1"));
-    //printf("double range 2: should be 1: %d\n", csvh_line_helper_should_skip("a,b,4.9"));
-    //printf("integer range 3: should be 0: %d\n", csvh_line_helper_should_skip("a,b,5"));
-    //printf("double range 4: should be 0: %d\n", csvh_line_helper_should_skip("a,b,5.1"));
-    //printf("double range 5: should be 0: %d\n", csvh_line_helper_should_skip("a,b,6.999"));
-    //printf("integer range 6: should be 0: %d\n", csvh_line_helper_should_skip("a,b,7"));
-    //printf("double range 7: should be 1: %d\n", csvh_line_helper_should_skip("a,b,7.0001"));
-    //printf("integer range 8: should be 1: %d\n", csvh_line_helper_should_skip("a,b,8"));
-    //printf("double range 9: should be 1: %d\n", csvh_line_helper_should_skip("a,b,11"));
-    //printf("double range 10: should be 0: %d\n", csvh_line_helper_should_skip("a,b,11.1"));
-    //printf("double range 11: should be 0: %d\n", csvh_line_helper_should_skip("a,b,12"));
-    //printf("double range 12: should be 1: %d\n", csvh_line_helper_should_skip("a,b,13"));
-    //printf("integer range 13: should be 1: %d\n", csvh_line_helper_should_skip("a,b,14"));
-    //printf("integer range 14: should be 1: %d\n", csvh_line_helper_should_skip("a,b,16"));
-    //printf("integer range 15: should be 0: %d\n", csvh_line_helper_should_skip("a,b,15"));
-    //printf("integer range 15: should be 0, but might not be: %d\n", csvh_line_helper_should_skip("a,b,15.0"));
+    //csvh_line_helper_init_ranges(helper, 2, "5-7,11.1-12.8, 15");
+
+    //printf("header, always print: should be 0: %d\n", SHOULD_SKIP("blah"));
+    //printf("integer range 1: should be 1: %d\n", SHOULD_SKIP("a,b,1"));
+    //printf("double range 2: should be 1: %d\n", SHOULD_SKIP("a,b,4.9"));
+    //printf("integer range 3: should be 0: %d\n", SHOULD_SKIP("a,b,5"));
+    //printf("double range 4: should be 0: %d\n", SHOULD_SKIP("a,b,5.1"));
+    //printf("double range 5: should be 0: %d\n", SHOULD_SKIP("a,b,6.999"));
+    //printf("integer range 6: should be 0: %d\n", SHOULD_SKIP("a,b,7"));
+    //printf("double range 7: should be 1: %d\n", SHOULD_SKIP("a,b,7.0001"));
+    //printf("integer range 8: should be 1: %d\n", SHOULD_SKIP("a,b,8"));
+    //printf("double range 9: should be 1: %d\n", SHOULD_SKIP("a,b,11"));
+    //printf("double range 10: should be 0: %d\n", SHOULD_SKIP("a,b,11.1"));
+    //printf("double range 11: should be 0: %d\n", SHOULD_SKIP("a,b,12"));
+    //printf("double range 12: should be 1: %d\n", SHOULD_SKIP("a,b,13"));
+    //printf("integer range 13: should be 1: %d\n", SHOULD_SKIP("a,b,14"));
+    //printf("integer range 14: should be 1: %d\n", SHOULD_SKIP("a,b,16"));
+    //printf("integer range 15: should be 0: %d\n", SHOULD_SKIP("a,b,15"));
+    //printf("integer range 15: should be 0, but might not be: %d\n", SHOULD_SKIP("a,b,15.0"));
 
     // Equals
-    csvh_line_helper_init_equals(2,"blah,blas");
-
-    printf("header, always print: should be 0: %d\n", csvh_line_helper_should_skip("blah"));
-    printf("value 1: should be 1: %d\n", csvh_line_helper_should_skip("someval,someval,someval"));
-    printf("value 2: should be 1: %d\n", csvh_line_helper_should_skip("blah,someval,someval"));
-    printf("value 3: should be 1: %d\n", csvh_line_helper_should_skip("someval,blah,someval"));
-    printf("value 4: should be 0: %d\n", csvh_line_helper_should_skip("someval,someval,blah"));
-    printf("value 5: should be 0: %d\n", csvh_line_helper_should_skip("someval,someval,blas"));
+    csvh_line_helper_init_equals(helper, 2,"blah,blas");
+
+    printf("header, always print: should be 0: %d\n", SHOULD_SKIP("blah"));
+    printf("value 1: should be 1: %d\n", SHOULD_SKIP("someval,someval,someval"));
+    printf("value 2: should be 1: %d\n", SHOULD_SKIP("blah,someval,someval"));
+    printf("value 3: should be 1: %d\n", SHOULD_SKIP("someval,blah,someval"));
+    printf("value 4: should be 0: %d\n", SHOULD_SKIP("someval,someval,blah"));
+    printf("value 5: should be 0: %d\n", SHOULD_SKIP("someval,someval,blas"));
+
+    csvh_line_helper_close(helper);
+
+    // Negative ranges, with a negative decimal bound, and ones that overlap
+    // and get merged (into -5-2).
+    helper = csvh_line_helper_new();
+    csvh_line_helper_init_ranges(helper, 1, "-10--2.5,-1-1");
+
+    printf("header, always print: should be 0: %d\n", SHOULD_SKIP("a,b"));
+    printf("negative range, below: should be 1: %d\n", SHOULD_SKIP("x,-11"));
+    printf("negative range, lower bound: should be 0: %d\n", SHOULD_SKIP("x,-10"));
+    printf("negative range, inside: should be 0: %d\n", SHOULD_SKIP("x,-5"));
+    printf("negative range, upper bound: should be 0: %d\n", SHOULD_SKIP("x,-2.5"));
+    printf("negative range, between: should be 1: %d\n", SHOULD_SKIP("x,-2.4"));
+    printf("across zero, lower bound: should be 0: %d\n", SHOULD_SKIP("x,-1"));
+    printf("across zero, zero: should be 0: %d\n", SHOULD_SKIP("x,0"));
+    printf("across zero, upper bound: should be 0: %d\n", SHOULD_SKIP("x,1"));
+    printf("across zero, above: should be 1: %d\n", SHOULD_SKIP("x,1.5"));
+    printf("not a number, taken as 0: should be 0: %d\n", SHOULD_SKIP("x,abc"));
+
+    csvh_line_helper_close(helper);
+
+    helper = csvh_line_helper_new();
+    csvh_line_helper_init_ranges(helper, 1, "-3-2,-5--1");
+
+    SHOULD_SKIP("a,b");
+    printf("merged negative ranges, lower: should be 0: %d\n", SHOULD_SKIP("x,-5"));
+    printf("merged negative ranges, upper: should be 0: %d\n", SHOULD_SKIP("x,2"));
+    printf("merged negative ranges, above: should be 1: %d\n", SHOULD_SKIP("x,2.1"));
+    printf("NaN: should be 1: %d\n", SHOULD_SKIP("x,nan"));
+
+    csvh_line_helper_close(helper);
+
+    // Line intervals that overlap, touch, are out of order or are backwards
+    // get merged into 2-6, 8-12.
+    helper = csvh_line_helper_new();
+    csvh_line_helper_init_lines(helper, "9-12,2-4,3-6,8,15-14");
+
+    printf("header, always print: should be 0: %d\n", SHOULD_SKIP("a,b"));
+    printf("line 1: should be 1: %d\n", SHOULD_SKIP("1,1"));
+    printf("lines to skip after 1: should be 0: %d\n", csvh_line_helper_lines_to_skip(helper));
+    printf("line 2: should be 0: %d\n", SHOULD_SKIP("2,2"));
+    printf("line 3: should be 0: %d\n", SHOULD_SKIP("3,3"));
+    printf("line 4: should be 0: %d\n", SHOULD_SKIP("4,4"));
+    printf("line 5: should be 0: %d\n", SHOULD_SKIP("5,5"));
+    printf("line 6: should be 0: %d\n", SHOULD_SKIP("6,6"));
+    printf("lines to skip after 6: should be 1: %d\n", csvh_line_helper_lines_to_skip(helper));
+    printf("line 7: should be 1: %d\n", SHOULD_SKIP("7,7"));
+    printf("line 8: should be 0: %d\n", SHOULD_SKIP("8,8"));
+    printf("lines to skip after 8: should be 0: %d\n", csvh_line_helper_lines_to_skip(helper));
+    csvh_line_helper_advance(helper, 3);
+    printf("line 12: should be 0: %d\n", SHOULD_SKIP("12,12"));
+    printf("line 13: should be 2: %d\n", SHOULD_SKIP("13,13"));
+    printf("line 14: should be 2: %d\n", SHOULD_SKIP("14,14"));
+
+    csvh_line_helper_close(helper);
+
+    // The same, going backwards from line 9.
+    helper = csvh_line_helper_new();
+    csvh_line_helper_init_lines(helper, "9-12,2-4,3-6,8,15-14");
+    SHOULD_SKIP("a,b");
+    csvh_line_helper_set_line_num(helper, 9, -1);
+
+    printf("back, line 9: should be 0: %d\n", SHOULD_SKIP("9,9"));
+    printf("back, line 8: should be 0: %d\n", SHOULD_SKIP("8,8"));
+    printf("back, lines to skip after 8: should be 1: %d\n", csvh_line_helper_lines_to_skip(helper));
+    printf("back, line 7: should be 1: %d\n", SHOULD_SKIP("7,7"));
+    printf("back, line 6: should be 0: %d\n", SHOULD_SKIP("6,6"));
+    csvh_line_helper_advance(helper, 4);
+    printf("back, line 1: should be 2: %d\n", SHOULD_SKIP("1,1"));
+
+    csvh_line_helper_close(helper);
+
+    // Filter precedence: "and" goes before "or", and "not" only takes the
+    // test right after it.
+    char *headers[] = { "A", "B", "C", NULL };
+    csvh_filter *filter = NULL;
+
+    helper = csvh_line_helper_new();
+    printf("compile 1: should be 0: %d\n",
+        csvh_filter_compile(&filter, "A = 1 or B = 1 and C = 1", headers));
+    csvh_line_helper_init_filter(helper, filter);
+
+    printf("header, always print: should be 0: %d\n", SHOULD_SKIP("A,B,C"));
+    printf("precedence 1: should be 0: %d\n", SHOULD_SKIP("1,0,0"));
+    printf("precedence 2: should be 1: %d\n", SHOULD_SKIP("0,1,0"));
+    printf("precedence 3: should be 0: %d\n", SHOULD_SKIP("0,1,1"));
+    printf("precedence 4: should be 1: %d\n", SHOULD_SKIP("0,0,1"));
+
+    csvh_line_helper_close(helper);
+
+    helper = csvh_line_helper_new();
+    printf("compile 2: should be 0: %d\n",
+        csvh_filter_compile(&filter, "(A = 1 or B = 1) and C = 1", headers));
+    csvh_line_helper_init_filter(helper, filter);
+
+    SHOULD_SKIP("A,B,C");
+    printf("parentheses 1: should be 1: %d\n", SHOULD_SKIP("1,0,0"));
+    printf("parentheses 2: should be 0: %d\n", SHOULD_SKIP("1,0,1"));
+    printf("parentheses 3: should be 0: %d\n", SHOULD_SKIP("0,1,1"));
+    printf("parentheses 4: should be 1: %d\n", SHOULD_SKIP("0,0,1"));
+
+    csvh_line_helper_close(helper);
+
+    helper = csvh_line_helper_new();
+    printf("compile 3: should be 0: %d\n",
+        csvh_filter_compile(&filter, "not A = 1 and B = 1 or not (C = 1 or C = 2)", headers));
+    csvh_line_helper_init_filter(helper, filter);
+
+    SHOULD_SKIP("A,B,C");
+    printf("not 1: should be 0: %d\n", SHOULD_SKIP("0,1,1"));
+    printf("not 2: should be 1: %d\n", SHOULD_SKIP("1,1,1"));
+    printf("not 3: should be 0: %d\n", SHOULD_SKIP("1,1,3"));
+    printf("not 4: should be 1: %d\n", SHOULD_SKIP("0,0,2"));
+    printf("not 5: should be 0: %d\n", SHOULD_SKIP("\"1\",\"x,y\",3"));
+
+    csvh_line_helper_close(helper);
+
+    // Quotes around a field that's looked at, and stray ones past it.
+    helper = csvh_line_helper_new();
+    csvh_filter_compile(&filter, "B = \"x,y\"", headers);
+    csvh_line_helper_init_filter(helper, filter);
+
+    SHOULD_SKIP("A,B,C");
+    printf("quoted 1: should be 0: %d\n", SHOULD_SKIP("0,\"x,y\",0"));
+    printf("quoted 2: should be 1: %d\n", SHOULD_SKIP("0,x,y"));
+    printf("quoted 3: should be 0: %d\n", SHOULD_SKIP("0,\"x,y\",a\"b"));
+
+    csvh_line_helper_close(helper);
+
+    printf("bad expression: should be 2: %d\n",
+        csvh_filter_compile(&filter, "A = 1 or", headers));
+    printf("unknown column: should be 3: %d\n",
+        csvh_filter_compile(&filter, "D = 1", headers));
 }
@@ -2,10 +2,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include "csv.h"
 
+#include "csvh-filter.h"
 #include "csvh-line-helper.h"
+#include "csvh-set.h"
 
 // This is a helper module for csv-handler.c.
 
@@ -29,106 +32,362 @@
 #define COND_TYPE__RANGE        3
 // Value equals
 #define COND_TYPE__EQUALS       4
+// Filter expression (see csvh-filter.c).
+#define COND_TYPE__FILTER       5
 
 // END output condition types.
 
+/**
+ * A line interval condition, parsed once from its string (see
+ * csvh_line_helper_init_lines).  A single line is an interval with the same
+ * lower and upper bound.
+ */
+typedef struct {
+    int lower;
+    int upper;
+} lineRange;
+
+/**
+ * A value range condition, compiled once from its string (see
+ * csvh_line_helper_init_ranges).  A single value is a range with the same
+ * lower and upper bound.
+ */
+typedef struct {
+    double lower;
+    double upper;
+} valueRange;
+
 // Forward declarations for static functions.
 
-static char condLine();
+static char condLine(csvh_line_helper *helper);
+
+static int firstLineRangeEndingAt(csvh_line_helper *helper, int lineNum);
+
+static int lastLineRangeStartingAt(csvh_line_helper *helper, int lineNum);
 
-static char condRange(char **parsedLine);
+static char condRange(csvh_line_helper *helper, char *val);
 
-static char condEquals(char **parsedLine);
+static char condEquals(csvh_line_helper *helper, char *val);
 
-static char strIsInt(char *inputStr);
+static char condFilter(csvh_line_helper *helper, const char *unparsedLine, size_t len);
 
-static void condLineBounds(int *bounds, int condInd);
+static char applyExclude(csvh_line_helper *helper, char res);
 
-static char condRangeCompare(char *val, char *range);
+static char parseLineRange(const char *cond, lineRange *range);
 
-static int stringHasChar(char *testStr, char inChar);
+static char parseLineBound(const char *str, const char *end, int *bound);
+
+static int compareLineRanges(const void *a, const void *b);
+
+static char parseRange(const char *cond, valueRange *range);
+
+static int compareValueRanges(const void *a, const void *b);
 
 // END forward declarations.
 
 /**
- * Array of strings defining output conditions.
+ * Everything about the lines being gone through.  See csvh_line_helper_new.
  */
-static char **conds;
+struct csvh_line_helper {
+    /**
+     * Critical index, i.e., the index determining the column that we use for
+     * incoming records to determine if they match our restrictions.  (In
+     * other words, if our restriction is "Column 5 must be equal to 'zebra',
+     * then the critical index is 5.)  Not applicable for all condition types.
+     */
+    int critInd;
+
+    /**
+     * The type of line conditions we're using (i.e., intervals, ranges,
+     * etc.).
+     *
+     * This can change while traversing the file, i.e., a line interval can
+     * have a single line or it can have an actual interval., but in the
+     * current design it will never switch "type families", i.e., switching
+     * from a line interval type to a value range type.
+     *
+     * (Note: I don't think the above is still 100% relevant?  There's only
+     * one "line" type after a refactor.)
+     *
+     * One exception is that anything other than "none" type can switch to
+     * "done" type.
+     *
+     * Also, I added the dark type to counterbalance the psychic type.
+     */
+    int condType;
+
+    /**
+     * The current line number.  Starts at zero, but the first non-header row
+     * is the first line.  (Meaning that, header or not, the first row of
+     * actual data is row 1.)
+     */
+    int lineNum;
+
+    /**
+     * What gets added to lineNum for each line.  -1 when the lines come in
+     * reverse.
+     */
+    int lineStep;
+
+    /**
+     * The line intervals, for line conditions: sorted, with any that overlap
+     * or touch merged, so that the one a line is in (or the next one after
+     * it) can be found with a binary search.
+     */
+    lineRange *lines;
+    int lineCount;
+
+    /**
+     * Delimiter and quoting of the lines passed in.
+     */
+    csv_dialect dialect;
+
+    /**
+     * The value ranges, for range conditions.  Sorted and merged the same
+     * way as lines.
+     */
+    valueRange *ranges;
+    int rangeCount;
+
+    /**
+     * The values, for equals conditions.  Shared with
+     * copies of the helper.
+     */
+    csvh_set *equals;
+
+    /**
+     * The compiled expression, for filter conditions.
+     */
+    csvh_filter *filter;
+
+    /**
+     * Yes to put out the lines that *don't* meet a range or equals
+     * condition, instead of the ones that do.
+     */
+    char exclude;
+
+    /**
+     * Where the value of the critical field gets copied to.  Reused from line
+     * to line, and only ever grows.
+     */
+    char *critVal;
+    size_t critValCap;
+
+    /**
+     * Yes if file has a header, no if either it doesn't have one or it's
+     * already been passed.
+     */
+    char hasHeader;
+};
 
 /**
- * Critical index, i.e., the index determining the column that we use for
- * incoming records to determine if they match our restrictions.  (In other
- * words, if our restriction is "Column 5 must be equal to 'zebra', then the
- * critical index is 5.)  Not applicable for all condition types.
+ * Start going through lines, with no restrictions until one of the
+ * csvh_line_helper_init_* functions is called.  Returns NULL if out of
+ * memory.  Let go of it with csvh_line_helper_close.
  */
-static int critInd = -1;
+csvh_line_helper *csvh_line_helper_new()
+{
+    csvh_line_helper *helper = calloc(1, sizeof(csvh_line_helper));
 
-/**
- * The type of line conditions we're using (i.e., intervals, ranges, etc.).
- *
- * This can change while traversing the file, i.e., a line interval can
- * have a single line or it can have an actual interval., but in the
- * current design it will never switch "type families", i.e., switching
- * from a line interval type to a value range type.
- *
- * (Note: I don't think the above is still 100% relevant?  There's only one
- * "line" type after a refactor.)
- *
- * One exception is that anything other than "none" type can switch to
- * "done" type.
- *
- * Also, I added the dark type to counterbalance the psychic type.
- */
-static int condType = COND_TYPE__NONE;
+    if (helper == NULL) {
+        return NULL;
+    }
 
-/**
- * The current line number.  Starts at zero, but the first non-header row
- * is the first line.  (Meaning that, header or not, the first row of actual
- * data is row 1.)
- */
-static int lineNum = 0;
+    helper->critInd = -1;
+    helper->condType = COND_TYPE__NONE;
+    helper->lineStep = 1;
+    helper->dialect = (csv_dialect) CSV_DIALECT_DEFAULT;
+    helper->hasHeader = 1;
+
+    return helper;
+}
 
 /**
- * Yes if file has a header, no if either it doesn't have one or it's
- * already been passed.
+ * Make a copy of the helper, in the same state, to go through another stretch
+ * of the lines with (e.g., on another thread).  Returns NULL if out of memory.
  */
-static char hasHeader = 1;
+csvh_line_helper *csvh_line_helper_copy(csvh_line_helper *helper)
+{
+    csvh_line_helper *copy = malloc(sizeof(csvh_line_helper));
+
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    *copy = *helper;
+    copy->lines = NULL;
+    copy->ranges = NULL;
+    copy->equals = NULL;
+    copy->filter = NULL;
+    copy->critVal = NULL;
+    copy->critValCap = 0;
+
+    if (helper->lines != NULL) {
+        copy->lines = malloc(sizeof(lineRange) * (helper->lineCount + 1));
+        if (copy->lines == NULL) {
+            free(copy);
+            return NULL;
+        }
+        memcpy(copy->lines, helper->lines, sizeof(lineRange) * helper->lineCount);
+    }
+
+    if (helper->ranges != NULL) {
+        copy->ranges = malloc(sizeof(valueRange) * (helper->rangeCount + 1));
+        if (copy->ranges == NULL) {
+            csvh_line_helper_close(copy);
+            return NULL;
+        }
+        memcpy(copy->ranges, helper->ranges, sizeof(valueRange) * helper->rangeCount);
+    }
+
+    if (helper->equals != NULL) {
+        copy->equals = csvh_set_share(helper->equals);
+    }
+
+    if (helper->filter != NULL) {
+        copy->filter = csvh_filter_copy(helper->filter);
+        if (copy->filter == NULL) {
+            csvh_line_helper_close(copy);
+            return NULL;
+        }
+    }
+
+    return copy;
+}
 
 /**
  * Initialize with line ranges restrictions.
  *
+ * "lines" is a string like "2-5,7,10-14".  The intervals can come in any
+ * order and overlap; they're sorted and merged here, once, so that however
+ * many there are, finding the one a line is in is a binary search.  One with
+ * its bounds the wrong way around ("5-3") has no lines in it.
+ *
  * @param   lines
  */
-char csvh_line_helper_init_lines(char *lines)
+char csvh_line_helper_init_lines(csvh_line_helper *helper, char *lines)
 {
-    condType = COND_TYPE__LINE;
-    conds = parse_csv(lines, ',');
+    helper->condType = COND_TYPE__LINE;
+
+    char **conds = parse_csv(lines, ',');
     if (conds == NULL) {
         return CSVH_LINE_HELPER__INVALID_INPUT;
     }
 
+    int count = 0;
+    while (conds[count] != NULL) {
+        count++;
+    }
+
+    helper->lines = malloc(sizeof(lineRange) * (count + 1));
+    if (helper->lines == NULL) {
+        free_csv_line(conds);
+        return CSVH_LINE_HELPER__INTERNAL_ERROR;
+    }
+
+    helper->lineCount = 0;
+    for (int i = 0; i < count; i++) {
+        lineRange range;
+
+        if (!parseLineRange(conds[i], &range)) {
+            free_csv_line(conds);
+            return CSVH_LINE_HELPER__INVALID_INPUT;
+        }
+
+        if (range.lower <= range.upper) {
+            helper->lines[helper->lineCount++] = range;
+        }
+    }
+
+    free_csv_line(conds);
+
+    qsort(helper->lines, helper->lineCount, sizeof(lineRange), compareLineRanges);
+
+    // Merge intervals that overlap or are right next to each other.
+    int merged = 0;
+    for (int i = 0; i < helper->lineCount; i++) {
+        lineRange *last = (merged > 0) ? &helper->lines[merged - 1] : NULL;
+
+        if (last != NULL && (long) helper->lines[i].lower <= (long) last->upper + 1) {
+            if (helper->lines[i].upper > last->upper) {
+                last->upper = helper->lines[i].upper;
+            }
+        } else {
+            helper->lines[merged++] = helper->lines[i];
+        }
+    }
+    helper->lineCount = merged;
+
     return CSVH_LINE_HELPER__OK;
 }
 
 /**
  * Initialize with value ranges restrictions.
  *
- * "ranges" is string like "3-4,6,9-13".  Can also be rational numbers.
+ * "ranges" is string like "3-4,6,9-13".  Can also be rational numbers, and
+ * negative ones (e.g., "-10--2.5,-1-1").  They're turned into numbers here,
+ * once, instead of for every line, and sorted and merged like line intervals
+ * (see csvh_line_helper_init_lines) so a value is checked with a binary
+ * search.
  *
  * @param   critIndInput
  * @param   ranges
  */
-char csvh_line_helper_init_ranges(int critIndInput, char *ranges)
+char csvh_line_helper_init_ranges(csvh_line_helper *helper, int critIndInput, char *ranges)
 {
-    condType = COND_TYPE__RANGE;
+    helper->condType = COND_TYPE__RANGE;
 
-    critInd = critIndInput;
+    helper->critInd = critIndInput;
 
-    conds = parse_csv(ranges, ',');
+    char **conds = parse_csv(ranges, ',');
     if (conds == NULL) {
         return CSVH_LINE_HELPER__INVALID_INPUT;
     }
 
+    int count = 0;
+    while (conds[count] != NULL) {
+        count++;
+    }
+
+    helper->ranges = malloc(sizeof(valueRange) * (count + 1));
+    if (helper->ranges == NULL) {
+        free_csv_line(conds);
+        return CSVH_LINE_HELPER__INTERNAL_ERROR;
+    }
+
+    helper->rangeCount = 0;
+    for (int i = 0; i < count; i++) {
+        valueRange range;
+
+        if (!parseRange(conds[i], &range)) {
+            free_csv_line(conds);
+            return CSVH_LINE_HELPER__INVALID_INPUT;
+        }
+
+        // (Also drops ones with a bound that isn't a number.)
+        if (range.lower <= range.upper) {
+            helper->ranges[helper->rangeCount++] = range;
+        }
+    }
+
+    free_csv_line(conds);
+
+    qsort(helper->ranges, helper->rangeCount, sizeof(valueRange), compareValueRanges);
+
+    int merged = 0;
+    for (int i = 0; i < helper->rangeCount; i++) {
+        valueRange *last = (merged > 0) ? &helper->ranges[merged - 1] : NULL;
+
+        if (last != NULL && helper->ranges[i].lower <= last->upper) {
+            if (helper->ranges[i].upper > last->upper) {
+                last->upper = helper->ranges[i].upper;
+            }
+        } else {
+            helper->ranges[merged++] = helper->ranges[i];
+        }
+    }
+    helper->rangeCount = merged;
+
     return CSVH_LINE_HELPER__OK;
 }
 
@@ -136,31 +395,165 @@ char csvh_line_helper_init_ranges(int critIndInput, char *ranges)
  * Initialize with value equals restrictions.
  *
  * "equals" is string like "bob,sue,abdul alhazred".  Must equal exactly to
- * match.
+ * match.  Can be NULL, to start with no values and add them with
+ * csvh_line_helper_add_equal (e.g., when there are too many of them for a
+ * command line).
+ *
+ * The values go in a hash set, so checking a line takes the same time no
+ * matter how many of them there are.
  *
  * @param   critIndInput
- * @param   ranges
+ * @param   equals
  */
-char csvh_line_helper_init_equals(int critIndInput, char *equals)
+char csvh_line_helper_init_equals(csvh_line_helper *helper, int critIndInput, char *equals)
 {
-    condType = COND_TYPE__EQUALS;
+    helper->condType = COND_TYPE__EQUALS;
+
+    helper->critInd = critIndInput;
 
-    critInd = critIndInput;
+    helper->equals = csvh_set_new();
+    if (helper->equals == NULL) {
+        return CSVH_LINE_HELPER__INTERNAL_ERROR;
+    }
+
+    if (equals == NULL) {
+        return CSVH_LINE_HELPER__OK;
+    }
 
-    conds = parse_csv(equals, ',');
+    char **conds = parse_csv(equals, ',');
     if (conds == NULL) {
         return CSVH_LINE_HELPER__INVALID_INPUT;
     }
 
+    char res = CSVH_LINE_HELPER__OK;
+    for (int i = 0; conds[i] != NULL && res == CSVH_LINE_HELPER__OK; i++) {
+        res = csvh_line_helper_add_equal(helper, conds[i], strlen(conds[i]));
+    }
+
+    free_csv_line(conds);
+
+    return res;
+}
+
+/**
+ * Add one more value to equals restrictions (see
+ * csvh_line_helper_init_equals).  It doesn't have to be null-terminated.
+ *
+ * @param   value
+ * @param   len
+ */
+char csvh_line_helper_add_equal(csvh_line_helper *helper, const char *value, size_t len)
+{
+    if (helper->equals == NULL) {
+        return CSVH_LINE_HELPER__INVALID_INPUT;
+    }
+
+    if (csvh_set_add(helper->equals, value, len) != CSVH_SET__OK) {
+        return CSVH_LINE_HELPER__INTERNAL_ERROR;
+    }
+
+    return CSVH_LINE_HELPER__OK;
+}
+
+/**
+ * Initialize with a filter expression (see csvh-filter.c), already compiled.
+ * The helper takes it, and frees it when it's closed.
+ *
+ * @param   filter
+ */
+char csvh_line_helper_init_filter(csvh_line_helper *helper, csvh_filter *filter)
+{
+    helper->condType = COND_TYPE__FILTER;
+
+    helper->filter = filter;
+
     return CSVH_LINE_HELPER__OK;
 }
 
+/**
+ * Turn range, equals and filter restrictions around: put out the lines that
+ * don't meet them, and skip the ones that do (like an anti-join on the
+ * values).  Doesn't change line restrictions.
+ *
+ * @param   exclude
+ */
+void csvh_line_helper_set_exclude(csvh_line_helper *helper, char exclude)
+{
+    helper->exclude = exclude;
+}
+
+/**
+ * Set the delimiter and quoting of the lines that will be passed in.  (The
+ * conditions themselves are always separated by commas.)
+ *
+ * @param   dialectIn
+ */
+void csvh_line_helper_set_dialect(csvh_line_helper *helper, const csv_dialect *dialectIn)
+{
+    helper->dialect = *dialectIn;
+}
+
 /**
  * Get the current line number.
  */
-int csvh_line_helper_get_line_num()
+int csvh_line_helper_get_line_num(csvh_line_helper *helper)
+{
+    return helper->lineNum;
+}
+
+/**
+ * Set the number of the next line (not counting the header), and which way
+ * the numbers go after it, for when the lines don't start at the top of the
+ * file.  Numbers below 1 mean the line's true number isn't known.
+ *
+ * @param   nextLineNum
+ * @param   step
+ */
+void csvh_line_helper_set_line_num(csvh_line_helper *helper, int nextLineNum, int step)
+{
+    helper->lineNum = nextLineNum - step;
+    helper->lineStep = step;
+}
+
+/**
+ * How many lines coming up are sure to be skipped, so that the caller doesn't
+ * have to bother reading them at all.  (Call csvh_line_helper_advance after
+ * skipping them.)  Only ever more than zero for line conditions: it's the gap
+ * up to the next interval, whichever way the lines are going.
+ */
+int csvh_line_helper_lines_to_skip(csvh_line_helper *helper)
+{
+    int next = helper->lineNum + helper->lineStep;
+
+    if (helper->hasHeader || helper->condType != COND_TYPE__LINE || next < 1) {
+        return 0;
+    }
+
+    if (helper->lineStep == 1) {
+        int i = firstLineRangeEndingAt(helper, next);
+        // (Past the last one, the next line is read just to find that out.)
+        return (i < helper->lineCount && helper->lines[i].lower > next)
+            ? helper->lines[i].lower - next
+            : 0;
+    }
+
+    if (helper->lineStep == -1) {
+        int i = lastLineRangeStartingAt(helper, next);
+        return (i >= 0 && helper->lines[i].upper < next) ? next - helper->lines[i].upper : 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Count lines that were skipped without going through
+ * csvh_line_helper_should_skip.
+ *
+ * @param   count
+ */
+void csvh_line_helper_advance(csvh_line_helper *helper, int count)
 {
-    return lineNum;
+    helper->lineNum += count * helper->lineStep;
 }
 
 /**
@@ -172,61 +565,85 @@ int csvh_line_helper_get_line_num()
  * line from the input source, not just what's going to be in the output in
  * case the condition depends on a column that's not in the output.
  *
+ * The line doesn't have to be null-terminated.
+ *
  * @param   unparsedLine
+ * @param   len
  */
-char csvh_line_helper_should_skip(char *unparsedLine)
+char csvh_line_helper_should_skip(csvh_line_helper *helper, const char *unparsedLine, size_t len)
 {
-    if (hasHeader) {
+    if (helper->hasHeader) {
         // Always want to get the header.
         // Note that if there's no actual header, csv-handler.c creates one and
         // provides it.  The variable name is a little misleading, because it's
         // basically always true for the first line.
-        hasHeader = 0;
+        helper->hasHeader = 0;
         return CSVH_LINE_HELPER__OK;
     }
 
-    lineNum++;
+    helper->lineNum += helper->lineStep;
 
     // Don't waste time parsing lines for these.
-    switch (condType) {
+    switch (helper->condType) {
         case COND_TYPE__NONE:
             return CSVH_LINE_HELPER__OK;
         case COND_TYPE__DONE:
             return CSVH_LINE_HELPER__DONE;
         case COND_TYPE__LINE:
-            return condLine();
+            return condLine(helper);
+        case COND_TYPE__FILTER:
+            // (Parses the fields it needs itself.)
+            return applyExclude(helper, condFilter(helper, unparsedLine, len));
+    }
+
+    // Now get the value from the line, because it'll be used in the other
+    // condition checks.  Only that one field gets parsed, and nothing after it.
+    if (helper->critValCap < len + 1) {
+        char *newVal = realloc(helper->critVal, len + 1);
+        if (newVal == NULL) {
+            return CSVH_LINE_HELPER__INTERNAL_ERROR;
+        }
+        helper->critVal = newVal;
+        helper->critValCap = len + 1;
+    }
+
+    if (parse_csv_field(&helper->dialect, unparsedLine, len, helper->critInd, helper->critVal) != 0) {
+        // Unparseable.
+        return CSVH_LINE_HELPER__INVALID_INPUT;
     }
 
-    // Now parse the line, because it'll be used in the other condition checks.
-    char **parsedLine = parse_csv(unparsedLine, ',');
     char res = CSVH_LINE_HELPER__INTERNAL_ERROR;
     // If return this, it means that there's some kind of foreign condition
     // type that's defined but never used.
 
-    switch (condType) {
+    switch (helper->condType) {
         case COND_TYPE__RANGE:
-            res = condRange(parsedLine);
+            res = condRange(helper, helper->critVal);
             break;
         case COND_TYPE__EQUALS:
-            res = condEquals(parsedLine);
+            res = condEquals(helper, helper->critVal);
             break;
     }
 
-    free_csv_line(parsedLine);
-    parsedLine = NULL;
-    return res;
+    return applyExclude(helper, res);
 }
 
 /**
  * Close out all open variables, etc.
  */
-char csvh_line_helper_close()
+char csvh_line_helper_close(csvh_line_helper *helper)
 {
-    if (conds != NULL) {
-        free_csv_line(conds);
-        conds = NULL;
+    if (helper == NULL) {
+        return CSVH_LINE_HELPER__OK;
     }
 
+    free(helper->lines);
+    free(helper->ranges);
+    csvh_set_free(helper->equals);
+    csvh_filter_free(helper->filter);
+    free(helper->critVal);
+    free(helper);
+
     return CSVH_LINE_HELPER__OK;
 }
 
@@ -234,244 +651,300 @@ char csvh_line_helper_close()
 // Static functions below this line.
 
 /**
- * Handle line conditions.
+ * Handle line conditions.  Lines can come forward or backward (see
+ * csvh_line_helper_set_line_num), from anywhere in the file: the interval is
+ * looked up each time.  Once the lines have gone past the last interval,
+ * they're done.
  */
-static char condLine()
+static char condLine(csvh_line_helper *helper)
 {
-    static int lower = 0;
-    static int upper = 0;
-    static int condInd = -1; // The condition of the conds array that we're
-    // currently using.  With lines condition we can just go straight through.
-    // TODO: Figure out what that last sentence mean and better explain it.
-
-    if (lower == 0) {
-        // This means need to get the next segment.
+    int i;
 
-        condInd++;
+    if (helper->lineNum < 1) {
+        // Only works with lines with known numbers.
+        return CSVH_LINE_HELPER__INVALID_INPUT;
+    }
 
-        // Check if we're done with reading the conditions.
-        if (conds[condInd] == NULL) {
-            condType = COND_TYPE__DONE;
+    if (helper->lineStep == 1) {
+        i = firstLineRangeEndingAt(helper, helper->lineNum);
+        if (i == helper->lineCount) {
+            helper->condType = COND_TYPE__DONE;
             return CSVH_LINE_HELPER__DONE;
         }
-
-        int bounds[2];
-        condLineBounds(bounds, condInd);
-        lower = bounds[0];
-        upper = bounds[1];
-
-        if (lower == 0) {
-            return CSVH_LINE_HELPER__INVALID_INPUT;
+    } else if (helper->lineStep == -1) {
+        i = lastLineRangeStartingAt(helper, helper->lineNum);
+        if (i < 0) {
+            helper->condType = COND_TYPE__DONE;
+            return CSVH_LINE_HELPER__DONE;
         }
+    } else {
+        return CSVH_LINE_HELPER__INVALID_INPUT;
     }
 
-    if (lineNum == upper) {
-        lower = 0;
-        upper = 0;
+    if (helper->lineNum >= helper->lines[i].lower && helper->lineNum <= helper->lines[i].upper) {
         return CSVH_LINE_HELPER__OK;
     }
 
-    return (lineNum < lower) ? CSVH_LINE_HELPER__SKIP : CSVH_LINE_HELPER__OK;
+    return CSVH_LINE_HELPER__SKIP;
 }
 
 /**
- * Get the next upper and lower bound for line conditions, as an array of
- * two ints.
- *
- * Sets values as zero if input is invalid.
+ * The index of the first line interval that ends at or after the line, or
+ * lineCount if there isn't one.
  *
- * @param   bounds
- * @param   condInd
+ * @param   lineNum
  */
-static void condLineBounds(int *bounds, int condInd)
+static int firstLineRangeEndingAt(csvh_line_helper *helper, int lineNum)
 {
-    int isRange = stringHasChar(conds[condInd], '-');
+    int low = 0;
+    int high = helper->lineCount;
 
-    char *lowerStr;
-    char *upperStr;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
 
-    if (isRange) {
-        int breakInd = isRange - 1; // To make coding a little easier.
-        conds[condInd][breakInd] = '\0';
-        // Turning these into two different strings.
-
-        lowerStr = conds[condInd];
-        upperStr = conds[condInd] + breakInd + 1;
-    } else {
-        lowerStr = conds[condInd];
-        upperStr = lowerStr;
+        if (helper->lines[mid].upper < lineNum) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
     }
 
-    // Check that the strings are integers.
-    if (!strIsInt(lowerStr) || !strIsInt(upperStr)) {
-        bounds[0] = 0;
-        bounds[1] = 0;
-        return;
+    return low;
+}
+
+/**
+ * The index of the last line interval that starts at or before the line, or
+ * -1 if there isn't one.
+ *
+ * @param   lineNum
+ */
+static int lastLineRangeStartingAt(csvh_line_helper *helper, int lineNum)
+{
+    int low = 0;
+    int high = helper->lineCount;
+
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+
+        if (helper->lines[mid].lower <= lineNum) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
     }
 
-    bounds[0] = atoi(lowerStr);
-    bounds[1] = atoi(upperStr);
+    return low - 1;
 }
 
 /**
- * Check that a string is an integer.
+ * Turn a single line condition ("lower-upper", or just a line number) into
+ * numbers.  Returns 0 if it isn't one.
  *
- * @param   inputStr
+ * @param   cond
+ * @param   range
  */
-static char strIsInt(char *inputStr)
+static char parseLineRange(const char *cond, lineRange *range)
 {
-    for (int i = 0; inputStr[i] != '\0'; i++) {
-        if (!isdigit(inputStr[i])) {
+    const char *hyphen = strchr(cond, '-');
+
+    if (hyphen == NULL) {
+        if (!parseLineBound(cond, cond + strlen(cond), &range->lower)) {
             return 0;
         }
+        range->upper = range->lower;
+        return 1;
     }
 
-    return 1;
+    return parseLineBound(cond, hyphen, &range->lower)
+        && parseLineBound(hyphen + 1, hyphen + 1 + strlen(hyphen + 1), &range->upper);
 }
 
 /**
- * Handle range conditions.
+ * Turn the digits from str to end into a line number (1 or more).  Returns 0
+ * if they aren't one.
  *
- * @param   parsedLine
+ * @param   str
+ * @param   end
+ * @param   bound
  */
-static char condRange(char **parsedLine)
+static char parseLineBound(const char *str, const char *end, int *bound)
 {
-    // Loop through each condition and see if it applies.  Return OK on the
-    // *first* one where it's true.
-
-    char *val = parsedLine[critInd];
-    char *condDum;
-    // Need to make a dummy string because going to mutate it later, and don't
-    // want to change the original.
-
-    char rc;
-    for (int i = 0; conds[i] != NULL; i++) {
-        condDum = malloc(sizeof(char) * strlen(conds[i]) + 1);
-        strcpy(condDum, conds[i]);
-        if ((rc = condRangeCompare(val, condDum)) != CSVH_LINE_HELPER__SKIP) {
-            free(condDum);
-            return rc;
+    long num = 0;
+
+    if (str == end) {
+        return 0;
+    }
+
+    for (; str < end; str++) {
+        if (!isdigit((unsigned char) *str)) {
+            return 0;
+        }
+
+        num = num * 10 + (*str - '0');
+        if (num > INT_MAX) {
+            return 0;
         }
-        free(condDum);
-        // If this returns "skip", don't actually skip yet.  It just means
-        // that *this* range in the conds array does not apply.
     }
 
+    *bound = num;
 
-    return CSVH_LINE_HELPER__SKIP;
+    return num >= 1;
+}
+
+/**
+ * For sorting line intervals by where they start.
+ *
+ * @param   a
+ * @param   b
+ */
+static int compareLineRanges(const void *a, const void *b)
+{
+    int lowerA = ((const lineRange *) a)->lower;
+    int lowerB = ((const lineRange *) b)->lower;
+
+    return (lowerA > lowerB) - (lowerA < lowerB);
 }
 
 /**
- * Check value against the conditions passed.
+ * Handle range conditions.  The value is turned into a number once, and the
+ * only range it could be in is the last one that starts at or below it.
  *
  * @param   val
- * @param   range
  */
-static char condRangeCompare(char *val, char *range)
+static char condRange(csvh_line_helper *helper, char *val)
 {
-    int isRange = stringHasChar(range, '-');
-    char isDouble = stringHasChar(range, '.') || stringHasChar(val, '.');
-    char *eptr; // Seems to be needed to convert string to double.  Won't
-    // be used.
+    double num = strtod(val, NULL);
+    int low = 0;
+    int high = helper->rangeCount;
 
-    // Don't check both parts for double in case of range, b/c going to
-    // upconvert them anyway.
+    // (A value that isn't a number at all is 0, same as it's always been.
+    // One that's NaN doesn't get past either comparison.)
+    while (low < high) {
+        int mid = low + (high - low) / 2;
 
-    if (isRange) {
-        // See if within given range.
+        if (helper->ranges[mid].lower <= num) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
 
-        int breakInd = isRange - 1; // To make coding a little easier.
+    if (low > 0 && num <= helper->ranges[low - 1].upper) {
+        return CSVH_LINE_HELPER__OK;
+    }
 
-        range[breakInd] = '\0';
-        // Turning these into two different strings.
-        char *lowerStr = range;
-        char *upperStr = range + breakInd + 1;
+    return CSVH_LINE_HELPER__SKIP;
+}
 
-        if (isDouble) {
-            double valDbl = strtod(val, &eptr);
-            double lowerDbl = strtod(lowerStr, &eptr);
+/**
+ * Turn a single range condition ("lower-upper", or just a value) into
+ * numbers.  Either bound can be negative, so the '-' between them is the
+ * first one after the lower bound.  Returns 0 if it isn't one.
+ *
+ * @param   cond
+ * @param   range
+ */
+static char parseRange(const char *cond, valueRange *range)
+{
+    char *end;
 
-            if (valDbl < lowerDbl) {
-                return CSVH_LINE_HELPER__SKIP;
-            }
+    range->lower = strtod(cond, &end);
 
-            double upperDbl = strtod(upperStr, &eptr);
+    if (end == cond) {
+        return 0;
+    }
 
-            if (valDbl > upperDbl) {
-                return CSVH_LINE_HELPER__SKIP;
-            }
-        } else {
-            int valInt = atoi(val);
-            int lowerInt = atoi(lowerStr);
+    while (isspace((unsigned char) *end)) {
+        end++;
+    }
 
-            if (valInt < lowerInt) {
-                return CSVH_LINE_HELPER__SKIP;
-            }
+    if (*end == '\0') {
+        range->upper = range->lower;
+        return 1;
+    }
 
-            int upperInt = atoi(upperStr);
+    if (*end != '-') {
+        return 0;
+    }
 
-            if (valInt > upperInt) {
-                return CSVH_LINE_HELPER__SKIP;
-            }
-        }
+    const char *upperStr = end + 1;
+    range->upper = strtod(upperStr, &end);
 
-        // I feel like a function-like macro could simplify this, but I
-        // don't want to do it right now.  Definitely do it if I end up
-        // doing this pattern another time.
-    } else {
-        // Compare single value, but still needs to be as number.
+    if (end == upperStr) {
+        return 0;
+    }
 
-        if (isDouble) {
-            // If it's a double and not a range, it will almost certainly
-            // not match, but still need to put this here.
-            if (strtod(val, &eptr) != strtod(range, &eptr)) {
-                return CSVH_LINE_HELPER__SKIP;
-            }
-        } else {
-            if (atoi(val) != atoi(range)) {
-                return CSVH_LINE_HELPER__SKIP;
-            }
-        }
+    while (isspace((unsigned char) *end)) {
+        end++;
     }
 
-    return CSVH_LINE_HELPER__OK;
+    return *end == '\0';
 }
 
 /**
- * Handle equals condition.
- *
+ * For sorting value ranges by where they start.
  *
- * @param   parsedLine
+ * @param   a
+ * @param   b
  */
-static char condEquals(char **parsedLine)
+static int compareValueRanges(const void *a, const void *b)
 {
-    // Loop through each condition and see if it applies.  Return OK on the
-    // *first* one where it's true.
+    double lowerA = ((const valueRange *) a)->lower;
+    double lowerB = ((const valueRange *) b)->lower;
 
-    char *val = parsedLine[critInd];
+    return (lowerA > lowerB) - (lowerA < lowerB);
+}
 
-    for (int i = 0; conds[i] != NULL; i++) {
-        if (strcmp(conds[i],val) == 0) {
-            return CSVH_LINE_HELPER__OK;
-        }
+/**
+ * Handle equals condition.  One lookup in the set, however many values are
+ * in it.
+ *
+ * @param   val
+ */
+static char condEquals(csvh_line_helper *helper, char *val)
+{
+    if (csvh_set_has(helper->equals, val, strlen(val))) {
+        return CSVH_LINE_HELPER__OK;
     }
 
     return CSVH_LINE_HELPER__SKIP;
 }
 
 /**
- * Check if there's a hyphen in a string representing a condition.
+ * Handle filter condition.
  *
- * Returns one greater than the index (so that it's false instead of -1 if
- * it's just missing).
+ * @param   unparsedLine
+ * @param   len
+ */
+static char condFilter(csvh_line_helper *helper, const char *unparsedLine, size_t len)
+{
+    char matches;
+
+    switch (csvh_filter_match(helper->filter, &helper->dialect, unparsedLine, len, &matches)) {
+        case CSVH_FILTER__OK:
+            return matches ? CSVH_LINE_HELPER__OK : CSVH_LINE_HELPER__SKIP;
+        case CSVH_FILTER__INVALID_INPUT:
+            return CSVH_LINE_HELPER__INVALID_INPUT;
+    }
+
+    return CSVH_LINE_HELPER__INTERNAL_ERROR;
+}
+
+/**
+ * If restrictions are turned around (see csvh_line_helper_set_exclude), skip
+ * what would have been put out and vice versa.
  *
- * @param   testStr
- * @param   inChar
+ * @param   res
  */
-static int stringHasChar(char *testStr, char inChar)
+static char applyExclude(csvh_line_helper *helper, char res)
 {
-    int i = -1;
-    for (;testStr[++i] != inChar && testStr[i] != '\0';) {} // Because I can.
-    if (testStr[i] == '\0') { i = -1; }
-    return i + 1;
+    if (helper->exclude) {
+        if (res == CSVH_LINE_HELPER__OK) {
+            return CSVH_LINE_HELPER__SKIP;
+        } else if (res == CSVH_LINE_HELPER__SKIP) {
+            return CSVH_LINE_HELPER__OK;
+        }
+    }
+
+    return res;
 }
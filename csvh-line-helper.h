@@ -1,6 +1,11 @@
 #ifndef csvh_line_helper_h
 #define csvh_line_helper_h
 
+#include <stddef.h>
+
+#include "csv.h"
+#include "csvh-filter.h"
+
 // Constants
 
 #define CSVH_LINE_HELPER__OK                0
@@ -10,16 +15,36 @@
 #define CSVH_LINE_HELPER__INTERNAL_ERROR    4
 // "Internal error" means it's an error inside of the module itself.
 
-char csvh_line_helper_init_lines(char *lines);
+typedef struct csvh_line_helper csvh_line_helper;
+
+csvh_line_helper *csvh_line_helper_new();
+
+csvh_line_helper *csvh_line_helper_copy(csvh_line_helper *helper);
+
+char csvh_line_helper_init_lines(csvh_line_helper *helper, char *lines);
+
+char csvh_line_helper_init_ranges(csvh_line_helper *helper, int critIndInput, char *ranges);
+
+char csvh_line_helper_init_equals(csvh_line_helper *helper, int critIndInput, char *equals);
+
+char csvh_line_helper_add_equal(csvh_line_helper *helper, const char *value, size_t len);
+
+char csvh_line_helper_init_filter(csvh_line_helper *helper, csvh_filter *filter);
+
+void csvh_line_helper_set_exclude(csvh_line_helper *helper, char exclude);
+
+void csvh_line_helper_set_dialect(csvh_line_helper *helper, const csv_dialect *dialectIn);
+
+int csvh_line_helper_get_line_num(csvh_line_helper *helper);
 
-char csvh_line_helper_init_ranges(int critIndInput, char *ranges);
+void csvh_line_helper_set_line_num(csvh_line_helper *helper, int nextLineNum, int step);
 
-char csvh_line_helper_init_equals(int critIndInput, char *equals);
+int csvh_line_helper_lines_to_skip(csvh_line_helper *helper);
 
-int csvh_line_helper_get_line_num();
+void csvh_line_helper_advance(csvh_line_helper *helper, int count);
 
-char csvh_line_helper_should_skip(char *unparsedLine);
+char csvh_line_helper_should_skip(csvh_line_helper *helper, const char *unparsedLine, size_t len);
 
-char csvh_line_helper_close();
+char csvh_line_helper_close(csvh_line_helper *helper);
 
 #endif
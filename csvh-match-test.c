@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "csvh-match.h"
+
+// Besides a few known ahead of time, lots of made up patterns and texts (out
+// of a few letters, so they overlap a lot and the automaton has to fall back
+// often) are checked against looking for each pattern in turn.
+
+#define RANDOM_ROUNDS 2000
+#define MAX_PATTERNS 8
+#define MAX_LEN 12
+
+char matches(int kind, const char **patterns, const char *text);
+char naiveFind(int kind, char patterns[][MAX_LEN + 1], int count, const char *text);
+char randomRounds(int kind);
+void randomString(char *dest, int maxLen);
+
+int main()
+{
+    const char *classic[] = { "he", "she", "his", "hers", NULL };
+    const char *single[] = { "x", NULL };
+    const char *longer[] = { "abcd", "bc", NULL };
+
+    // Anywhere in the text.
+    printf("contains: should be 1: %d\n", matches(CSVH_MATCH_KIND__CONTAINS, classic, "ushers"));
+    printf("contains, suffix of a prefix: should be 1: %d\n",
+        matches(CSVH_MATCH_KIND__CONTAINS, classic, "ahishe"));
+    printf("contains, none: should be 0: %d\n", matches(CSVH_MATCH_KIND__CONTAINS, classic, "hxs"));
+    printf("contains, inside of a longer one: should be 1: %d\n",
+        matches(CSVH_MATCH_KIND__CONTAINS, longer, "abce"));
+    printf("contains, one byte: should be 1: %d\n", matches(CSVH_MATCH_KIND__CONTAINS, single, "aaax"));
+    printf("contains, empty text: should be 0: %d\n", matches(CSVH_MATCH_KIND__CONTAINS, classic, ""));
+
+    // At the start.
+    printf("prefix: should be 1: %d\n", matches(CSVH_MATCH_KIND__PREFIX, classic, "hers and his"));
+    printf("prefix, only inside: should be 0: %d\n", matches(CSVH_MATCH_KIND__PREFIX, classic, "ushers"));
+    printf("prefix, text too short: should be 0: %d\n", matches(CSVH_MATCH_KIND__PREFIX, longer, "ab"));
+
+    // At the end.
+    printf("suffix: should be 1: %d\n", matches(CSVH_MATCH_KIND__SUFFIX, classic, "ushers"));
+    printf("suffix, only inside: should be 0: %d\n", matches(CSVH_MATCH_KIND__SUFFIX, classic, "shed"));
+    printf("suffix, whole text: should be 1: %d\n", matches(CSVH_MATCH_KIND__SUFFIX, longer, "bc"));
+
+    printf("contains, random: should be 1: %d\n", randomRounds(CSVH_MATCH_KIND__CONTAINS));
+    printf("prefix, random: should be 1: %d\n", randomRounds(CSVH_MATCH_KIND__PREFIX));
+    printf("suffix, random: should be 1: %d\n", randomRounds(CSVH_MATCH_KIND__SUFFIX));
+}
+
+/**
+ * Whether any of the patterns (up to a NULL) is in text.
+ *
+ * @param   kind
+ * @param   patterns
+ * @param   text
+ */
+char matches(int kind, const char **patterns, const char *text)
+{
+    csvh_match *match = csvh_match_new(kind);
+
+    for (int i = 0; patterns[i] != NULL; i++) {
+        csvh_match_add(match, patterns[i], strlen(patterns[i]));
+    }
+    csvh_match_build(match);
+
+    char found = csvh_match_find(match, text, strlen(text));
+    csvh_match_free(match);
+
+    return found;
+}
+
+/**
+ * Whether any of the patterns is in text, looking for each one in turn.
+ *
+ * @param   kind
+ * @param   patterns
+ * @param   count
+ * @param   text
+ */
+char naiveFind(int kind, char patterns[][MAX_LEN + 1], int count, const char *text)
+{
+    size_t textLen = strlen(text);
+
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(patterns[i]);
+
+        if (len > textLen) {
+            continue;
+        }
+
+        if ((kind == CSVH_MATCH_KIND__CONTAINS && strstr(text, patterns[i]) != NULL)
+            || (kind == CSVH_MATCH_KIND__PREFIX && memcmp(text, patterns[i], len) == 0)
+            || (kind == CSVH_MATCH_KIND__SUFFIX && memcmp(text + textLen - len, patterns[i], len) == 0)
+        ) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Whether csvh_match_find agrees with naiveFind on every random round.
+ *
+ * @param   kind
+ */
+char randomRounds(int kind)
+{
+    char patterns[MAX_PATTERNS][MAX_LEN + 1];
+    char text[MAX_LEN * 4 + 1];
+
+    srand(kind + 1);
+
+    for (int round = 0; round < RANDOM_ROUNDS; round++) {
+        int count = 1 + rand() % MAX_PATTERNS;
+        csvh_match *match = csvh_match_new(kind);
+
+        for (int i = 0; i < count; i++) {
+            randomString(patterns[i], MAX_LEN);
+            csvh_match_add(match, patterns[i], strlen(patterns[i]));
+        }
+        csvh_match_build(match);
+
+        randomString(text, MAX_LEN * 4);
+        char found = csvh_match_find(match, text, strlen(text));
+        csvh_match_free(match);
+
+        if (found != naiveFind(kind, patterns, count, text)) {
+            printf("Disagree on %s\n", text);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Fill dest with 1 to maxLen letters out of "abc" (and the odd "z").
+ *
+ * @param   dest
+ * @param   maxLen
+ */
+void randomString(char *dest, int maxLen)
+{
+    int len = 1 + rand() % maxLen;
+
+    for (int i = 0; i < len; i++) {
+        dest[i] = (rand() % 20 == 0) ? 'z' : 'a' + rand() % 3;
+    }
+    dest[len] = '\0';
+}
@@ -0,0 +1,388 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "csvh-match.h"
+
+// This is a helper module for csvh-filter.c.
+
+// It looks for any of a bunch of strings (the patterns) at once: anywhere in
+// a text, at the start of it, or at the end of it.  However many patterns
+// there are, the text is only gone through once, a byte at a time.
+
+// The patterns are made into a trie: a state for each prefix of a pattern,
+// with a table of the state each byte goes to next.  For the start or the end
+// of a text, that's all it takes (the trie of the patterns backwards for the
+// end).  To find them anywhere, it's made into an Aho-Corasick automaton:
+// where there's no next state in the trie, the table gets the one for the
+// longest suffix of what's been seen that's still a prefix of some pattern,
+// so every byte of the text is just one lookup.
+
+// The table only has a column for each byte that's in some pattern (plus one
+// for all the others), so it stays small.  And while nothing's been matched
+// so far, the bytes that no pattern starts with are skipped over without
+// going through the table at all (with memchr, if there's only one byte any
+// pattern starts with).
+
+/**
+ * A match, set up with csvh_match_new and filled in with csvh_match_add.
+ * The patterns are kept until csvh_match_build makes the table.
+ */
+struct csvh_match {
+    int kind;
+
+    char *patterns;
+    size_t patternsLen;
+    size_t patternsCap;
+
+    /**
+     * Where each pattern ends in patterns.
+     */
+    size_t *ends;
+    int patternCount;
+    int endsCap;
+
+    /**
+     * The column of the table for each byte.
+     */
+    unsigned char classes[256];
+    int classCount;
+
+    /**
+     * The table: stateCount rows of classCount next states.  (Nothing goes
+     * back to the starting state, 0, in the trie, so 0 means there's no next
+     * state until it's filled in.)
+     */
+    int *next;
+    int stateCount;
+
+    /**
+     * Whether seeing each state means a pattern was found.
+     */
+    char *found;
+
+    /**
+     * The bytes that some pattern starts with, and the byte if there's only
+     * one of them.
+     */
+    char starts[256];
+    int startCount;
+    unsigned char onlyStart;
+
+    /**
+     * One of the patterns is empty, so everything matches.
+     */
+    char always;
+};
+
+// START forward declarations for static functions.
+
+static char buildTrie(csvh_match *match);
+
+static char buildLinks(csvh_match *match);
+
+static char findAnywhere(const csvh_match *match, const unsigned char *text, size_t len);
+
+// END forward declarations.
+
+/**
+ * Start a match of the kind given (CSVH_MATCH_KIND__*), with no patterns yet.
+ * Returns NULL if out of memory.  Let go of it with csvh_match_free.
+ *
+ * @param   kind
+ */
+csvh_match *csvh_match_new(int kind)
+{
+    csvh_match *match = calloc(1, sizeof(csvh_match));
+
+    if (match == NULL) {
+        return NULL;
+    }
+
+    match->kind = kind;
+
+    return match;
+}
+
+/**
+ * Add a pattern (it's copied).  Has to be before csvh_match_build.
+ *
+ * @param   match
+ * @param   pattern
+ * @param   len
+ */
+char csvh_match_add(csvh_match *match, const char *pattern, size_t len)
+{
+    if (len == 0) {
+        match->always = 1;
+        return CSVH_MATCH__OK;
+    }
+
+    if (match->patternsLen + len > match->patternsCap) {
+        size_t cap = (match->patternsCap > 0) ? match->patternsCap : 256;
+        while (cap < match->patternsLen + len) {
+            cap *= 2;
+        }
+
+        char *grown = realloc(match->patterns, cap);
+        if (grown == NULL) {
+            return CSVH_MATCH__OUT_OF_MEMORY;
+        }
+        match->patterns = grown;
+        match->patternsCap = cap;
+    }
+
+    if (match->patternCount == match->endsCap) {
+        int cap = (match->endsCap > 0) ? match->endsCap * 2 : 16;
+        size_t *grown = realloc(match->ends, sizeof(size_t) * cap);
+
+        if (grown == NULL) {
+            return CSVH_MATCH__OUT_OF_MEMORY;
+        }
+        match->ends = grown;
+        match->endsCap = cap;
+    }
+
+    memcpy(match->patterns + match->patternsLen, pattern, len);
+    match->patternsLen += len;
+    match->ends[match->patternCount++] = match->patternsLen;
+
+    return CSVH_MATCH__OK;
+}
+
+/**
+ * Make the table, once all of the patterns have been added.  They're let go
+ * of after this.
+ *
+ * @param   match
+ */
+char csvh_match_build(csvh_match *match)
+{
+    char rc = buildTrie(match);
+
+    if (rc == CSVH_MATCH__OK && match->kind == CSVH_MATCH_KIND__CONTAINS) {
+        rc = buildLinks(match);
+    }
+
+    free(match->patterns);
+    free(match->ends);
+    match->patterns = NULL;
+    match->ends = NULL;
+
+    return rc;
+}
+
+/**
+ * Whether any of the patterns is in the text (or at the start or end of it,
+ * depending on the kind).  Can be called from several threads at once.
+ *
+ * @param   match
+ * @param   text
+ * @param   len
+ */
+char csvh_match_find(const csvh_match *match, const char *text, size_t len)
+{
+    const unsigned char *bytes = (const unsigned char *) text;
+    int state = 0;
+
+    if (match->always) {
+        return 1;
+    }
+
+    switch (match->kind) {
+        case CSVH_MATCH_KIND__CONTAINS:
+            return findAnywhere(match, bytes, len);
+        case CSVH_MATCH_KIND__PREFIX:
+            for (size_t i = 0; i < len; i++) {
+                state = match->next[state * match->classCount + match->classes[bytes[i]]];
+                if (state == 0) {
+                    return 0;
+                }
+                if (match->found[state]) {
+                    return 1;
+                }
+            }
+            return 0;
+        case CSVH_MATCH_KIND__SUFFIX:
+            for (size_t i = len; i > 0; i--) {
+                state = match->next[state * match->classCount + match->classes[bytes[i - 1]]];
+                if (state == 0) {
+                    return 0;
+                }
+                if (match->found[state]) {
+                    return 1;
+                }
+            }
+            return 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Let go of a match.
+ *
+ * @param   match
+ */
+void csvh_match_free(csvh_match *match)
+{
+    if (match == NULL) {
+        return;
+    }
+
+    free(match->patterns);
+    free(match->ends);
+    free(match->next);
+    free(match->found);
+    free(match);
+}
+
+
+// Static functions below this line.
+
+/**
+ * Give each byte that's in a pattern its own column, and make the trie of
+ * the patterns (backwards for suffixes).
+ *
+ * @param   match
+ */
+static char buildTrie(csvh_match *match)
+{
+    match->classCount = 1;
+    for (size_t i = 0; i < match->patternsLen; i++) {
+        unsigned char byte = match->patterns[i];
+        if (match->classes[byte] == 0) {
+            match->classes[byte] = match->classCount++;
+        }
+    }
+
+    // There can't be more states than bytes in the patterns, plus the start.
+    int maxStates = match->patternsLen + 1;
+    match->next = calloc((size_t) maxStates * match->classCount, sizeof(int));
+    match->found = calloc(maxStates, 1);
+    match->stateCount = 1;
+
+    if (match->next == NULL || match->found == NULL) {
+        return CSVH_MATCH__OUT_OF_MEMORY;
+    }
+
+    char backwards = (match->kind == CSVH_MATCH_KIND__SUFFIX);
+    size_t start = 0;
+
+    for (int i = 0; i < match->patternCount; i++) {
+        size_t end = match->ends[i];
+        size_t len = end - start;
+        int state = 0;
+
+        for (size_t j = 0; j < len; j++) {
+            unsigned char byte = match->patterns[backwards ? end - 1 - j : start + j];
+            int *next = &match->next[state * match->classCount + match->classes[byte]];
+
+            if (*next == 0) {
+                *next = match->stateCount++;
+            }
+            state = *next;
+        }
+
+        match->found[state] = 1;
+        start = end;
+    }
+
+    for (int byte = 0; byte < 256; byte++) {
+        if (match->classes[byte] != 0 && match->next[match->classes[byte]] != 0) {
+            match->starts[byte] = 1;
+            match->onlyStart = byte;
+            match->startCount++;
+        }
+    }
+
+    return CSVH_MATCH__OK;
+}
+
+/**
+ * Fill in the rest of the table, for finding the patterns anywhere.  States
+ * are gone through shortest first, so the one each one falls back on is
+ * already done.
+ *
+ * @param   match
+ */
+static char buildLinks(csvh_match *match)
+{
+    int classCount = match->classCount;
+    int *fallBack = calloc(match->stateCount, sizeof(int));
+    int *queue = malloc(sizeof(int) * match->stateCount);
+
+    if (fallBack == NULL || queue == NULL) {
+        free(fallBack);
+        free(queue);
+        return CSVH_MATCH__OUT_OF_MEMORY;
+    }
+
+    int head = 0;
+    int tail = 0;
+    queue[tail++] = 0;
+
+    while (head < tail) {
+        int state = queue[head++];
+        int *row = &match->next[state * classCount];
+        int *fallBackRow = &match->next[fallBack[state] * classCount];
+
+        for (int class = 0; class < classCount; class++) {
+            int next = row[class];
+
+            if (next == 0) {
+                // (From the start, no next state just means staying there.)
+                row[class] = (state == 0) ? 0 : fallBackRow[class];
+                continue;
+            }
+
+            fallBack[next] = (state == 0) ? 0 : fallBackRow[class];
+            match->found[next] |= match->found[fallBack[next]];
+            queue[tail++] = next;
+        }
+    }
+
+    free(fallBack);
+    free(queue);
+
+    return CSVH_MATCH__OK;
+}
+
+/**
+ * Look for the patterns anywhere in the text.
+ *
+ * @param   match
+ * @param   text
+ * @param   len
+ */
+static char findAnywhere(const csvh_match *match, const unsigned char *text, size_t len)
+{
+    const unsigned char *at = text;
+    const unsigned char *end = text + len;
+    int state = 0;
+
+    while (at < end) {
+        if (state == 0) {
+            // Skip ahead to where a pattern could start.
+            if (match->startCount == 1) {
+                at = memchr(at, match->onlyStart, end - at);
+                if (at == NULL) {
+                    return 0;
+                }
+            } else {
+                while (at < end && !match->starts[*at]) {
+                    at++;
+                }
+                if (at == end) {
+                    return 0;
+                }
+            }
+        }
+
+        state = match->next[state * match->classCount + match->classes[*at++]];
+        if (match->found[state]) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef csvh_match_h
+#define csvh_match_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_MATCH__OK                  0
+#define CSVH_MATCH__OUT_OF_MEMORY       1
+
+// Where the patterns have to be.
+
+#define CSVH_MATCH_KIND__CONTAINS       0
+#define CSVH_MATCH_KIND__PREFIX         1
+#define CSVH_MATCH_KIND__SUFFIX         2
+
+typedef struct csvh_match csvh_match;
+
+csvh_match *csvh_match_new(int kind);
+
+char csvh_match_add(csvh_match *match, const char *pattern, size_t len);
+
+char csvh_match_build(csvh_match *match);
+
+char csvh_match_find(const csvh_match *match, const char *text, size_t len);
+
+void csvh_match_free(csvh_match *match);
+
+#endif
@@ -0,0 +1,195 @@
+// fopencookie is a glibc extension, so it's only declared with this.  It's
+// kept to this file so nothing else gets the GNU versions of anything.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csvh-memout.h"
+
+// This is a helper module for csv-handler.c.
+
+// It's for running code that writes to a stream, and holding on to what it
+// wrote to write out later.  With glibc, the stream writes straight into a
+// buffer that's kept from one use to the next.  Other POSIX systems have
+// open_memstream, which has a buffer of its own each time.  Anything else
+// gets a temporary file, read back in when it's closed.
+
+// START forward declarations for static functions.
+
+#ifdef __GLIBC__
+static ssize_t writeCookie(void *cookie, const char *buff, size_t size);
+#elif defined(_WIN32)
+static char readBack(csvh_memout *out, FILE *stream);
+#endif
+
+#if defined(__GLIBC__) || defined(_WIN32)
+static char reserve(csvh_memout *out, size_t len);
+#endif
+
+// END forward declarations.
+
+/**
+ * Open a stream that writes to out, from the start (whatever was there
+ * before is gone).  Returns NULL if it can't be opened.
+ *
+ * @param   out
+ */
+FILE *csvh_memout_open(csvh_memout *out)
+{
+    out->len = 0;
+
+#ifdef __GLIBC__
+    cookie_io_functions_t io = { NULL, writeCookie, NULL, NULL };
+
+    out->stream = fopencookie(out, "w", io);
+#elif !defined(_WIN32)
+    // The memory can't be reused: it's only handed over when the stream is
+    // closed, so it's swapped in then.
+    free(out->buff);
+    out->buff = NULL;
+    out->cap = 0;
+
+    out->stream = open_memstream(&out->buff, &out->len);
+#else
+    out->stream = tmpfile();
+#endif
+
+    return out->stream;
+}
+
+/**
+ * Close the stream from csvh_memout_open, after which what was written to it
+ * is at out->buff.
+ *
+ * @param   out
+ */
+char csvh_memout_close(csvh_memout *out)
+{
+    FILE *stream = out->stream;
+    char rc = CSVH_MEMOUT__OK;
+
+    out->stream = NULL;
+
+    if (stream == NULL) {
+        return CSVH_MEMOUT__OK;
+    }
+
+#if !defined(__GLIBC__) && defined(_WIN32)
+    rc = readBack(out, stream);
+#endif
+
+    if (fclose(stream) != 0 && rc == CSVH_MEMOUT__OK) {
+        rc = CSVH_MEMOUT__WRITE_ERROR;
+    }
+
+#if !defined(__GLIBC__) && !defined(_WIN32)
+    out->cap = out->len;
+#endif
+
+    return rc;
+}
+
+/**
+ * Free what's been written (closing the stream first, if it's open).
+ *
+ * @param   out
+ */
+void csvh_memout_free(csvh_memout *out)
+{
+    if (out == NULL) {
+        return;
+    }
+
+    csvh_memout_close(out);
+    free(out->buff);
+    out->buff = NULL;
+    out->len = 0;
+    out->cap = 0;
+}
+
+// Static functions below this line.
+
+#ifdef __GLIBC__
+/**
+ * Write to a csvh_memout (see csvh_memout_open).
+ *
+ * @param   cookie  The csvh_memout.
+ * @param   buff
+ * @param   size
+ */
+static ssize_t writeCookie(void *cookie, const char *buff, size_t size)
+{
+    csvh_memout *out = cookie;
+
+    if (reserve(out, out->len + size) != CSVH_MEMOUT__OK) {
+        return 0;
+    }
+
+    memcpy(out->buff + out->len, buff, size);
+    out->len += size;
+
+    return size;
+}
+#elif defined(_WIN32)
+/**
+ * Read what was written to the temporary file back in (see
+ * csvh_memout_open).
+ *
+ * @param   out
+ * @param   stream
+ */
+static char readBack(csvh_memout *out, FILE *stream)
+{
+    long len;
+
+    if (fflush(stream) != 0
+        || (len = ftell(stream)) < 0
+        || fseek(stream, 0, SEEK_SET) != 0
+    ) {
+        return CSVH_MEMOUT__WRITE_ERROR;
+    }
+
+    if (reserve(out, len) != CSVH_MEMOUT__OK) {
+        return CSVH_MEMOUT__OUT_OF_MEMORY;
+    }
+
+    if (fread(out->buff, 1, len, stream) != (size_t) len) {
+        return CSVH_MEMOUT__WRITE_ERROR;
+    }
+    out->len = len;
+
+    return CSVH_MEMOUT__OK;
+}
+#endif
+
+#if defined(__GLIBC__) || defined(_WIN32)
+/**
+ * Make sure there's room for len bytes at out->buff.
+ *
+ * @param   out
+ * @param   len
+ */
+static char reserve(csvh_memout *out, size_t len)
+{
+    if (len <= out->cap) {
+        return CSVH_MEMOUT__OK;
+    }
+
+    size_t cap = (out->cap > 0) ? out->cap : 65536;
+
+    while (cap < len) {
+        cap *= 2;
+    }
+
+    char *grown = realloc(out->buff, cap);
+    if (grown == NULL) {
+        return CSVH_MEMOUT__OUT_OF_MEMORY;
+    }
+    out->buff = grown;
+    out->cap = cap;
+
+    return CSVH_MEMOUT__OK;
+}
+#endif
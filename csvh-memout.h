@@ -0,0 +1,34 @@
+#ifndef csvh_memout_h
+#define csvh_memout_h
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Constants
+
+#define CSVH_MEMOUT__OK                 0
+#define CSVH_MEMOUT__OUT_OF_MEMORY      1
+#define CSVH_MEMOUT__WRITE_ERROR        2
+
+/**
+ * What's been written to a stream from csvh_memout_open: len bytes at buff,
+ * once it's closed.  Start it out zeroed.
+ */
+typedef struct {
+    char *buff;
+    size_t len;
+    size_t cap;
+
+    /**
+     * While it's open.
+     */
+    FILE *stream;
+} csvh_memout;
+
+FILE *csvh_memout_open(csvh_memout *out);
+
+char csvh_memout_close(csvh_memout *out);
+
+void csvh_memout_free(csvh_memout *out);
+
+#endif
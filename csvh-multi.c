@@ -0,0 +1,757 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "csvh-pool.h"
+#include "csvh-reader.h"
+
+#include "csvh-multi.h"
+
+// This is a helper module for csvh-reader.c.
+
+// It reads a list of files (e.g., daily partitions) as if they were one file:
+// the header of the first file, then the records of every file in order, with
+// each file's own header dropped after checking it's the same as the first.
+
+// Every file's header is checked when the list is opened, all at once on a
+// thread pool, so that a file that doesn't match is found before anything is
+// read.
+
+// After that, the files are opened and read from disk on a thread pool, a few
+// files ahead of the one whose records are being handed out, so that by the
+// time a file is needed it's already mapped and in memory (or, if it's
+// compressed, already being decompressed on its read-ahead thread).  The
+// records are handed out on the calling thread, strictly in file order.
+
+// Files after the current one can also be opened on their own, to be read
+// some other way (e.g., split up into parts, see csvh_reader_open_part), and
+// then skipped over, or picked up partway through (see
+// csvh_multi_skip_files).
+
+/**
+ * How many files can be opened ahead of the current one, per thread.
+ */
+#define FILES_AHEAD_PER_THREAD 2
+
+#define INDEX_SUFFIX ".csvidx"
+
+typedef struct {
+    csvh_reader *reader;
+
+    /**
+     * Result of opening the file and reading its header.
+     */
+    char rc;
+
+    /**
+     * Copy of the header from checking it, if the files have headers.
+     */
+    char *header;
+    size_t headerLen;
+
+    /**
+     * No records at all (not even a header).
+     */
+    char empty;
+
+    /**
+     * Set if the file was opened some other way (see csvh_multi_open_file),
+     * so its task doesn't bother.  (If it still gets to be the current file,
+     * it's opened then.)
+     */
+    atomic_char taken;
+} fileTask;
+
+struct csvh_multi {
+    char **files;
+    int fileCount;
+    char hasHeaders;
+    int encoding;
+
+    fileTask *tasks;
+    csvh_pool *pool;
+
+    /**
+     * Set when closing, so tasks that haven't started don't bother.
+     */
+    atomic_char stopping;
+
+    /**
+     * File whose records are being handed out.
+     */
+    int current;
+
+    /**
+     * Whether the current file's task has been waited on (and checked).
+     */
+    char currentReady;
+
+    /**
+     * The header all of the files have.  Taken from the first file that has
+     * one.
+     */
+    char *header;
+    size_t headerLen;
+
+    /**
+     * Whether the header has been handed out.
+     */
+    char headerOut;
+
+    /**
+     * Resync settings to pass on to each file's reader, if set (see
+     * csvh_reader_set_resync).
+     */
+    char resyncSet;
+    size_t maxRecord;
+    csv_dialect dialect;
+
+    /**
+     * Records given up on in the files that are done, and where the last one
+     * was (in its file).
+     */
+    long malformed;
+    size_t malformedAt;
+};
+
+// START forward declarations for static functions.
+
+static void headerTask(void *context, int taskInd);
+
+static char checkHeaders(csvh_multi *multi);
+
+static char readyCurrent(csvh_multi *multi);
+
+static void openTask(void *context, int taskInd);
+
+static void openFile(csvh_multi *multi, int fileInd);
+
+static char addFile(char ***files, int *fileCount, int *fileCap, const char *path);
+
+static char addDirectory(char ***files, int *fileCount, int *fileCap, const char *path);
+
+static int comparePaths(const void *a, const void *b);
+
+// END forward declarations.
+
+/**
+ * Turn a list of paths into a list of files: directories are replaced with
+ * the regular files in them, in name order (skipping hidden files and index
+ * sidecars).  The list needs to be freed with csvh_multi_free_files.
+ *
+ * @param   paths
+ * @param   count
+ * @param   files
+ * @param   fileCount
+ */
+char csvh_multi_expand(char **paths, int count, char ***files, int *fileCount)
+{
+    int fileCap = 0;
+    struct stat st;
+    char rc;
+
+    *files = NULL;
+    *fileCount = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (stat(paths[i], &st) != 0) {
+            csvh_multi_free_files(*files, *fileCount);
+            *files = NULL;
+            return CSVH_MULTI__FILE_NOT_FOUND;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            rc = addDirectory(files, fileCount, &fileCap, paths[i]);
+        } else {
+            rc = addFile(files, fileCount, &fileCap, paths[i]);
+        }
+
+        if (rc != CSVH_MULTI__OK) {
+            csvh_multi_free_files(*files, *fileCount);
+            *files = NULL;
+            return rc;
+        }
+    }
+
+    return CSVH_MULTI__OK;
+}
+
+/**
+ * Free a list from csvh_multi_expand.
+ *
+ * @param   files
+ * @param   fileCount
+ */
+void csvh_multi_free_files(char **files, int fileCount)
+{
+    if (files == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < fileCount; i++) {
+        free(files[i]);
+    }
+    free(files);
+}
+
+/**
+ * Start reading a list of files (from csvh_multi_expand, which this takes
+ * over).  If hasHeaders is set, every file's header is checked here, and
+ * CSVH_MULTI__HEADER_MISMATCH is returned if they're not all the same.
+ *
+ * @param   multi
+ * @param   files
+ * @param   fileCount
+ * @param   hasHeaders  Whether the files have headers (to check and drop).
+ * @param   encoding    See csvh_reader_open.
+ */
+char csvh_multi_open(
+    csvh_multi **multi,
+    char **files,
+    int fileCount,
+    char hasHeaders,
+    int encoding
+) {
+    *multi = calloc(1, sizeof(csvh_multi));
+
+    if (*multi == NULL) {
+        csvh_multi_free_files(files, fileCount);
+        return CSVH_MULTI__OUT_OF_MEMORY;
+    }
+
+    csvh_multi *m = *multi;
+    m->files = files;
+    m->fileCount = fileCount;
+    m->hasHeaders = hasHeaders;
+    m->encoding = encoding;
+    m->tasks = calloc(fileCount + 1, sizeof(fileTask));
+
+    int threadCount = csvh_pool_default_threads();
+    char rc = CSVH_MULTI__OK;
+
+    if (m->tasks == NULL) {
+        rc = CSVH_MULTI__OUT_OF_MEMORY;
+    } else if (hasHeaders) {
+        rc = (csvh_pool_run(threadCount, fileCount, headerTask, m) == CSVH_POOL__OK)
+            ? checkHeaders(m)
+            : CSVH_MULTI__OUT_OF_MEMORY;
+    }
+
+    if (rc == CSVH_MULTI__OK
+        && csvh_pool_start(
+            &m->pool,
+            threadCount,
+            fileCount,
+            openTask,
+            m,
+            threadCount * FILES_AHEAD_PER_THREAD
+        ) != CSVH_POOL__OK
+    ) {
+        rc = CSVH_MULTI__OUT_OF_MEMORY;
+    }
+
+    if (rc != CSVH_MULTI__OK) {
+        csvh_multi_close(m);
+        *multi = NULL;
+    }
+
+    return rc;
+}
+
+/**
+ * Get the next record: the header first, then every file's records in
+ * order.
+ *
+ * @param   multi
+ * @param   record
+ * @param   len
+ */
+char csvh_multi_next_record(csvh_multi *multi, char **record, size_t *len)
+{
+    char rc;
+
+    if (multi->header != NULL && !multi->headerOut) {
+        multi->headerOut = 1;
+        *record = multi->header;
+        *len = multi->headerLen;
+        return CSVH_MULTI__OK;
+    }
+
+    while (multi->current < multi->fileCount) {
+        fileTask *task = &multi->tasks[multi->current];
+
+        if ((rc = readyCurrent(multi)) != CSVH_MULTI__OK) {
+            return rc;
+        }
+
+        rc = task->empty ? CSVH_READER__DONE : csvh_reader_next_record(task->reader, record, len);
+
+        if (rc != CSVH_READER__DONE) {
+            return rc;
+        }
+
+        // On to the next file.
+        csvh_multi_skip_files(multi, 0, NULL);
+    }
+
+    return CSVH_MULTI__DONE;
+}
+
+/**
+ * Get the reader of the file whose records are being handed out (waiting for
+ * it to be opened, if need be).  Returns CSVH_MULTI__DONE if there are no
+ * files left.  It's valid until the next call into this module.
+ *
+ * @param   multi
+ * @param   reader
+ */
+char csvh_multi_current(csvh_multi *multi, csvh_reader **reader)
+{
+    char rc;
+
+    if (multi->current >= multi->fileCount) {
+        return CSVH_MULTI__DONE;
+    }
+
+    if ((rc = readyCurrent(multi)) != CSVH_MULTI__OK) {
+        return rc;
+    }
+
+    *reader = multi->tasks[multi->current].reader;
+
+    return CSVH_MULTI__OK;
+}
+
+/**
+ * Count of files after the one whose records are being handed out.
+ *
+ * @param   multi
+ */
+int csvh_multi_later_files(csvh_multi *multi)
+{
+    return (multi->current < multi->fileCount) ? multi->fileCount - multi->current - 1 : 0;
+}
+
+/**
+ * Open the ind-th file after the current one (0 for the next one) on its own,
+ * to read some other way, past its header.  Anything can be read from it
+ * except the header, which has already been checked.  Can be called from any
+ * thread.
+ *
+ * Either skip over it afterwards, or hand it back to pick up where it left
+ * off (see csvh_multi_skip_files).
+ *
+ * @param   multi
+ * @param   ind
+ * @param   reader
+ */
+char csvh_multi_open_file(csvh_multi *multi, int ind, csvh_reader **reader)
+{
+    fileTask *task = &multi->tasks[multi->current + 1 + ind];
+    char *record;
+    size_t len;
+    char rc;
+
+    atomic_store(&task->taken, 1);
+
+    if ((rc = csvh_reader_open(reader, multi->files[multi->current + 1 + ind], multi->encoding)) != CSVH_READER__OK) {
+        return rc;
+    }
+
+    if (multi->hasHeaders
+        && (rc = csvh_reader_next_record(*reader, &record, &len)) != CSVH_READER__OK
+        && rc != CSVH_READER__DONE
+    ) {
+        csvh_reader_close(*reader);
+        *reader = NULL;
+        return rc;
+    }
+
+    if (multi->resyncSet) {
+        csvh_reader_set_resync(*reader, multi->maxRecord, &multi->dialect);
+    }
+
+    return CSVH_MULTI__OK;
+}
+
+/**
+ * Move on past the current file and the count files after it, whose records
+ * were read some other way (see csvh_multi_open_file).  If reader is set,
+ * it's the file after those, opened with csvh_multi_open_file, and reading
+ * picks up where it left off (the multi takes it over).
+ *
+ * @param   multi
+ * @param   count
+ * @param   reader
+ */
+char csvh_multi_skip_files(csvh_multi *multi, int count, csvh_reader *reader)
+{
+    int to = multi->current + 1 + count;
+
+    for (int i = multi->current; i < to + (reader != NULL) && i < multi->fileCount; i++) {
+        fileTask *task = &multi->tasks[i];
+
+        if (i != multi->current || !multi->currentReady) {
+            csvh_pool_wait_task(multi->pool, i);
+        }
+
+        if (i == multi->current && task->reader != NULL) {
+            size_t at;
+            long malformed = csvh_reader_malformed(task->reader, &at);
+
+            if (malformed > 0) {
+                multi->malformed += malformed;
+                multi->malformedAt = at;
+            }
+        }
+
+        csvh_reader_close(task->reader);
+        task->reader = NULL;
+
+        if (i < to) {
+            csvh_pool_release_task(multi->pool, i);
+        }
+    }
+
+    multi->current = to;
+    multi->currentReady = 0;
+
+    if (reader != NULL) {
+        multi->tasks[to].reader = reader;
+        multi->tasks[to].rc = CSVH_MULTI__OK;
+        multi->tasks[to].empty = 0;
+        multi->currentReady = 1;
+    }
+
+    return CSVH_MULTI__OK;
+}
+
+/**
+ * Pass resync settings on to every file's reader (see csvh_reader_set_resync).
+ *
+ * @param   multi
+ * @param   maxRecord
+ * @param   dialect
+ */
+char csvh_multi_set_resync(csvh_multi *multi, size_t maxRecord, const csv_dialect *dialect)
+{
+    multi->resyncSet = 1;
+    multi->maxRecord = maxRecord;
+    multi->dialect = *dialect;
+
+    if (multi->currentReady
+        && multi->current < multi->fileCount
+        && multi->tasks[multi->current].reader != NULL
+    ) {
+        csvh_reader_set_resync(multi->tasks[multi->current].reader, maxRecord, dialect);
+    }
+
+    return CSVH_MULTI__OK;
+}
+
+/**
+ * Count of records given up on so far in all of the files (see
+ * csvh_reader_malformed).  at is where the last one was in its file.
+ *
+ * @param   multi
+ * @param   at
+ */
+long csvh_multi_malformed(csvh_multi *multi, size_t *at)
+{
+    long count = multi->malformed;
+    *at = multi->malformedAt;
+
+    if (multi->currentReady
+        && multi->current < multi->fileCount
+        && multi->tasks[multi->current].reader != NULL
+    ) {
+        size_t currentAt;
+        long currentCount = csvh_reader_malformed(multi->tasks[multi->current].reader, &currentAt);
+
+        if (currentCount > 0) {
+            count += currentCount;
+            *at = currentAt;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Stop and free everything.
+ *
+ * @param   multi
+ */
+char csvh_multi_close(csvh_multi *multi)
+{
+    if (multi == NULL) {
+        return CSVH_MULTI__OK;
+    }
+
+    if (multi->pool != NULL) {
+        // Let any tasks waiting on the window go, so they can see they're not
+        // needed.
+        atomic_store(&multi->stopping, 1);
+        csvh_pool_release_task(multi->pool, multi->fileCount - 1);
+        csvh_pool_finish(multi->pool);
+    }
+
+    if (multi->tasks != NULL) {
+        for (int i = 0; i < multi->fileCount; i++) {
+            csvh_reader_close(multi->tasks[i].reader);
+            free(multi->tasks[i].header);
+        }
+    }
+
+    free(multi->tasks);
+    free(multi->header);
+    csvh_multi_free_files(multi->files, multi->fileCount);
+    free(multi);
+
+    return CSVH_MULTI__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Pool task: read a file's header, to check it (see checkHeaders).  A file
+ * that can't be read is left for reading it in order to say so.
+ *
+ * @param   context
+ * @param   taskInd
+ */
+static void headerTask(void *context, int taskInd)
+{
+    csvh_multi *multi = context;
+    fileTask *task = &multi->tasks[taskInd];
+    csvh_reader *reader;
+    char *record;
+    size_t len;
+    char rc;
+
+    if (csvh_reader_open(&reader, multi->files[taskInd], multi->encoding) != CSVH_READER__OK) {
+        return;
+    }
+
+    if ((rc = csvh_reader_next_record(reader, &record, &len)) == CSVH_READER__OK) {
+        task->header = malloc(len + 1);
+        if (task->header != NULL) {
+            memcpy(task->header, record, len);
+            task->header[len] = '\0';
+            task->headerLen = len;
+        }
+    }
+
+    csvh_reader_close(reader);
+}
+
+/**
+ * Check that every file has the same header as the first one that has one
+ * (after headerTask), and keep that one.
+ *
+ * @param   multi
+ */
+static char checkHeaders(csvh_multi *multi)
+{
+    char rc = CSVH_MULTI__OK;
+
+    for (int i = 0; i < multi->fileCount; i++) {
+        fileTask *task = &multi->tasks[i];
+
+        if (task->header == NULL) {
+            continue;
+        }
+
+        if (multi->header == NULL) {
+            multi->header = task->header;
+            multi->headerLen = task->headerLen;
+            task->header = NULL;
+            continue;
+        }
+
+        if (task->headerLen != multi->headerLen
+            || memcmp(task->header, multi->header, multi->headerLen) != 0
+        ) {
+            rc = CSVH_MULTI__HEADER_MISMATCH;
+        }
+
+        free(task->header);
+        task->header = NULL;
+    }
+
+    return rc;
+}
+
+/**
+ * Wait for the current file to be opened, if it hasn't been yet, and set it
+ * up.  Returns whatever went wrong opening it.
+ *
+ * @param   multi
+ */
+static char readyCurrent(csvh_multi *multi)
+{
+    fileTask *task = &multi->tasks[multi->current];
+
+    if (!multi->currentReady) {
+        csvh_pool_wait_task(multi->pool, multi->current);
+        multi->currentReady = 1;
+
+        if (task->reader == NULL && task->rc == CSVH_MULTI__OK) {
+            openFile(multi, multi->current);
+        }
+
+        if (task->rc == CSVH_MULTI__OK && multi->resyncSet) {
+            csvh_reader_set_resync(task->reader, multi->maxRecord, &multi->dialect);
+        }
+    }
+
+    return task->rc;
+}
+
+/**
+ * Pool task: open a file, skip its header, and get it into memory.
+ *
+ * @param   context
+ * @param   taskInd
+ */
+static void openTask(void *context, int taskInd)
+{
+    csvh_multi *multi = context;
+    fileTask *task = &multi->tasks[taskInd];
+
+    if (atomic_load(&multi->stopping) || atomic_load(&task->taken)) {
+        return;
+    }
+
+    openFile(multi, taskInd);
+
+    if (task->rc == CSVH_READER__OK && !task->empty) {
+        csvh_reader_prefetch(task->reader);
+    }
+}
+
+/**
+ * Open a file and skip its header.
+ *
+ * @param   multi
+ * @param   fileInd
+ */
+static void openFile(csvh_multi *multi, int fileInd)
+{
+    fileTask *task = &multi->tasks[fileInd];
+    char *record;
+    size_t len;
+
+    task->rc = csvh_reader_open(&task->reader, multi->files[fileInd], multi->encoding);
+
+    if (task->rc != CSVH_READER__OK || !multi->hasHeaders) {
+        return;
+    }
+
+    task->rc = csvh_reader_next_record(task->reader, &record, &len);
+
+    if (task->rc == CSVH_READER__DONE) {
+        task->rc = CSVH_READER__OK;
+        task->empty = 1;
+    }
+}
+
+/**
+ * Add a copy of a path to the end of the list.
+ *
+ * @param   files
+ * @param   fileCount
+ * @param   fileCap
+ * @param   path
+ */
+static char addFile(char ***files, int *fileCount, int *fileCap, const char *path)
+{
+    if (*fileCount == *fileCap) {
+        int newCap = *fileCap ? *fileCap * 2 : 16;
+        char **newFiles = realloc(*files, newCap * sizeof(char *));
+
+        if (newFiles == NULL) {
+            return CSVH_MULTI__OUT_OF_MEMORY;
+        }
+
+        *files = newFiles;
+        *fileCap = newCap;
+    }
+
+    char *copy = malloc(strlen(path) + 1);
+    if (copy == NULL) {
+        return CSVH_MULTI__OUT_OF_MEMORY;
+    }
+    strcpy(copy, path);
+
+    (*files)[(*fileCount)++] = copy;
+
+    return CSVH_MULTI__OK;
+}
+
+/**
+ * Add the regular files in a directory, in name order.
+ *
+ * @param   files
+ * @param   fileCount
+ * @param   fileCap
+ * @param   path
+ */
+static char addDirectory(char ***files, int *fileCount, int *fileCap, const char *path)
+{
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    struct stat st;
+    int first = *fileCount;
+    char rc = CSVH_MULTI__OK;
+
+    if (dir == NULL) {
+        return CSVH_MULTI__FILE_NOT_FOUND;
+    }
+
+    while (rc == CSVH_MULTI__OK && (entry = readdir(dir)) != NULL) {
+        size_t nameLen = strlen(entry->d_name);
+
+        if (entry->d_name[0] == '.'
+            || (nameLen >= sizeof(INDEX_SUFFIX) - 1
+                && strcmp(entry->d_name + nameLen - (sizeof(INDEX_SUFFIX) - 1), INDEX_SUFFIX) == 0)
+        ) {
+            continue;
+        }
+
+        char *full = malloc(strlen(path) + nameLen + 2);
+        if (full == NULL) {
+            rc = CSVH_MULTI__OUT_OF_MEMORY;
+            break;
+        }
+        sprintf(full, "%s/%s", path, entry->d_name);
+
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode)) {
+            rc = addFile(files, fileCount, fileCap, full);
+        }
+        free(full);
+    }
+
+    closedir(dir);
+
+    if (rc == CSVH_MULTI__OK) {
+        qsort(*files + first, *fileCount - first, sizeof(char *), comparePaths);
+    }
+
+    return rc;
+}
+
+/**
+ * For qsort.
+ *
+ * @param   a
+ * @param   b
+ */
+static int comparePaths(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
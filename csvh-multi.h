@@ -0,0 +1,49 @@
+#ifndef csvh_multi_h
+#define csvh_multi_h
+
+#include <stddef.h>
+
+#include "csv.h"
+#include "csvh-reader.h"
+
+// Constants.  Same values as the CSVH_READER__ ones, since they get passed
+// straight through.
+
+#define CSVH_MULTI__OK                  0
+#define CSVH_MULTI__DONE                1
+#define CSVH_MULTI__FILE_NOT_FOUND      2
+#define CSVH_MULTI__OUT_OF_MEMORY       3
+#define CSVH_MULTI__READ_ERROR          4
+#define CSVH_MULTI__HEADER_MISMATCH     7
+
+typedef struct csvh_multi csvh_multi;
+
+char csvh_multi_expand(char **paths, int count, char ***files, int *fileCount);
+
+void csvh_multi_free_files(char **files, int fileCount);
+
+char csvh_multi_open(
+    csvh_multi **multi,
+    char **files,
+    int fileCount,
+    char hasHeaders,
+    int encoding
+);
+
+char csvh_multi_next_record(csvh_multi *multi, char **record, size_t *len);
+
+char csvh_multi_current(csvh_multi *multi, csvh_reader **reader);
+
+int csvh_multi_later_files(csvh_multi *multi);
+
+char csvh_multi_open_file(csvh_multi *multi, int ind, csvh_reader **reader);
+
+char csvh_multi_skip_files(csvh_multi *multi, int count, csvh_reader *reader);
+
+char csvh_multi_set_resync(csvh_multi *multi, size_t maxRecord, const csv_dialect *dialect);
+
+long csvh_multi_malformed(csvh_multi *multi, size_t *at);
+
+char csvh_multi_close(csvh_multi *multi);
+
+#endif
@@ -0,0 +1,377 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "csvh-pool.h"
+
+// This is a helper module for anything that wants to split work up across
+// threads.
+
+// Tasks are just numbers.  Each thread starts out owning every Nth task
+// (thread 0 has 0, N, 2N, ..., thread 1 has 1, N + 1, ...), and works through
+// its own from the lowest up.  A thread that runs out steals the *highest*
+// task another thread still has.  So the tasks finish roughly in order, which
+// is what matters when the results get used in order (see
+// csvh_pool_wait_task), and the stealing keeps everyone busy when some tasks
+// are a lot bigger than others.
+
+// If the results take up a lot of memory, a window can be set so that tasks
+// don't get too far ahead of the results being used: a task isn't started
+// until every task more than the window before it has been released (see
+// csvh_pool_release_task).  That can't deadlock as long as results are used
+// in order, because a thread only ever waits on a task that's ahead of every
+// task it hasn't started.
+
+/**
+ * The tasks a thread still owns: first, first + stride, ..., count of them.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    int first;
+    int count;
+} taskQueue;
+
+typedef struct {
+    csvh_pool *pool;
+    int ind;
+} workerArg;
+
+struct csvh_pool {
+    csvh_pool_task task;
+    void *context;
+
+    /**
+     * Threads actually running.
+     */
+    int threadCount;
+
+    /**
+     * One queue per thread that was asked for.  (Also the stride between the
+     * tasks in a queue.)
+     */
+    int queueCount;
+
+    int taskCount;
+
+    /**
+     * How far ahead of the released tasks to go.  0 means no limit.
+     */
+    int window;
+
+    /**
+     * Tasks before this one have been released.  Guarded by doneLock.
+     */
+    int released;
+
+    pthread_t *threads;
+    workerArg *args;
+    taskQueue *queues;
+
+    /**
+     * One per task.  Set when the task is finished.
+     */
+    char *done;
+    pthread_mutex_t doneLock;
+    pthread_cond_t doneCond;
+};
+
+// START forward declarations for static functions.
+
+static void *work(void *arg);
+
+static int popOwn(csvh_pool *pool, int ind);
+
+static int steal(csvh_pool *pool, int ind);
+
+// END forward declarations.
+
+/**
+ * Number of threads to use if not told otherwise: one per CPU (or just one,
+ * where there's no telling how many there are).
+ */
+int csvh_pool_default_threads()
+{
+    long count = 1;
+
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    count = info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return (count < 1) ? 1 : (int) count;
+}
+
+/**
+ * Start running tasks in the background.  Use csvh_pool_wait_task to wait on
+ * individual results, and always call csvh_pool_finish at the end.
+ *
+ * @param   pool
+ * @param   threadCount
+ * @param   taskCount
+ * @param   task
+ * @param   context     Passed along to every task.
+ * @param   window      0 for no limit.
+ */
+char csvh_pool_start(
+    csvh_pool **pool,
+    int threadCount,
+    int taskCount,
+    csvh_pool_task task,
+    void *context,
+    int window
+) {
+    if (threadCount < 1) {
+        threadCount = csvh_pool_default_threads();
+    }
+    if (threadCount > taskCount) {
+        threadCount = (taskCount < 1) ? 1 : taskCount;
+    }
+
+    *pool = calloc(1, sizeof(csvh_pool));
+    if (*pool == NULL) {
+        return CSVH_POOL__OUT_OF_MEMORY;
+    }
+
+    csvh_pool *p = *pool;
+    p->task = task;
+    p->context = context;
+    p->threadCount = threadCount;
+    p->queueCount = threadCount;
+    p->taskCount = taskCount;
+    p->window = window;
+    p->threads = calloc(threadCount, sizeof(pthread_t));
+    p->args = calloc(threadCount, sizeof(workerArg));
+    p->queues = calloc(threadCount, sizeof(taskQueue));
+    p->done = calloc(taskCount + 1, sizeof(char));
+
+    if (p->threads == NULL || p->args == NULL || p->queues == NULL || p->done == NULL) {
+        free(p->threads);
+        free(p->args);
+        free(p->queues);
+        free(p->done);
+        free(p);
+        *pool = NULL;
+        return CSVH_POOL__OUT_OF_MEMORY;
+    }
+
+    pthread_mutex_init(&p->doneLock, NULL);
+    pthread_cond_init(&p->doneCond, NULL);
+
+    for (int i = 0; i < threadCount; i++) {
+        pthread_mutex_init(&p->queues[i].lock, NULL);
+        p->queues[i].first = i;
+        p->queues[i].count = (taskCount > i) ? (taskCount - i - 1) / threadCount + 1 : 0;
+    }
+
+    for (int i = 0; i < threadCount; i++) {
+        p->args[i].pool = p;
+        p->args[i].ind = i;
+        if (pthread_create(&p->threads[i], NULL, work, &p->args[i]) != 0) {
+            // Whoever did start will steal this one's tasks.  If none did,
+            // have to do it all here (and all at once, since nothing can be
+            // released until this returns).
+            p->threadCount = i;
+            if (i == 0) {
+                p->window = 0;
+                work(&p->args[0]);
+            }
+            break;
+        }
+    }
+
+    return CSVH_POOL__OK;
+}
+
+/**
+ * Wait for a single task to be finished.
+ *
+ * @param   pool
+ * @param   taskInd
+ */
+char csvh_pool_wait_task(csvh_pool *pool, int taskInd)
+{
+    pthread_mutex_lock(&pool->doneLock);
+    while (!pool->done[taskInd]) {
+        pthread_cond_wait(&pool->doneCond, &pool->doneLock);
+    }
+    pthread_mutex_unlock(&pool->doneLock);
+
+    return CSVH_POOL__OK;
+}
+
+/**
+ * Say that a task's result has been used, so that tasks further on can start
+ * (if there's a window).
+ *
+ * @param   pool
+ * @param   taskInd
+ */
+char csvh_pool_release_task(csvh_pool *pool, int taskInd)
+{
+    pthread_mutex_lock(&pool->doneLock);
+    if (taskInd + 1 > pool->released) {
+        pool->released = taskInd + 1;
+        pthread_cond_broadcast(&pool->doneCond);
+    }
+    pthread_mutex_unlock(&pool->doneLock);
+
+    return CSVH_POOL__OK;
+}
+
+/**
+ * Wait for all of the tasks to be finished, and free everything.
+ *
+ * @param   pool
+ */
+char csvh_pool_finish(csvh_pool *pool)
+{
+    if (pool == NULL) {
+        return CSVH_POOL__OK;
+    }
+
+    for (int i = 0; i < pool->threadCount; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (int i = 0; i < pool->queueCount; i++) {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    }
+
+    pthread_mutex_destroy(&pool->doneLock);
+    pthread_cond_destroy(&pool->doneCond);
+
+    free(pool->threads);
+    free(pool->args);
+    free(pool->queues);
+    free(pool->done);
+    free(pool);
+
+    return CSVH_POOL__OK;
+}
+
+/**
+ * Run all of the tasks and wait for them to finish.
+ *
+ * @param   threadCount     Less than 1 means one per CPU.
+ * @param   taskCount
+ * @param   task
+ * @param   context
+ */
+char csvh_pool_run(int threadCount, int taskCount, csvh_pool_task task, void *context)
+{
+    csvh_pool *pool = NULL;
+    char rc;
+
+    if (threadCount < 1) {
+        threadCount = csvh_pool_default_threads();
+    }
+
+    if (threadCount == 1 || taskCount <= 1) {
+        // Not worth starting a thread just to wait on it.
+        for (int i = 0; i < taskCount; i++) {
+            task(context, i);
+        }
+        return CSVH_POOL__OK;
+    }
+
+    if ((rc = csvh_pool_start(&pool, threadCount, taskCount, task, context, 0)) != CSVH_POOL__OK) {
+        return rc;
+    }
+
+    return csvh_pool_finish(pool);
+}
+
+
+// Static functions below this line.
+
+/**
+ * A worker thread.  Runs its own tasks, then steals until there's nothing
+ * left anywhere.
+ *
+ * @param   arg
+ */
+static void *work(void *arg)
+{
+    workerArg *worker = arg;
+    csvh_pool *pool = worker->pool;
+    int taskInd;
+
+    while ((taskInd = popOwn(pool, worker->ind)) != -1
+        || (taskInd = steal(pool, worker->ind)) != -1
+    ) {
+        if (pool->window > 0) {
+            pthread_mutex_lock(&pool->doneLock);
+            while (taskInd >= pool->released + pool->window) {
+                pthread_cond_wait(&pool->doneCond, &pool->doneLock);
+            }
+            pthread_mutex_unlock(&pool->doneLock);
+        }
+
+        pool->task(pool->context, taskInd);
+
+        pthread_mutex_lock(&pool->doneLock);
+        pool->done[taskInd] = 1;
+        pthread_cond_broadcast(&pool->doneCond);
+        pthread_mutex_unlock(&pool->doneLock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Take the lowest task from a thread's own queue.  -1 if it's empty.
+ *
+ * @param   pool
+ * @param   ind
+ */
+static int popOwn(csvh_pool *pool, int ind)
+{
+    taskQueue *queue = &pool->queues[ind];
+    int taskInd = -1;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count > 0) {
+        taskInd = queue->first;
+        queue->first += pool->queueCount;
+        queue->count--;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return taskInd;
+}
+
+/**
+ * Take the highest task from some other thread's queue.  -1 if everyone's
+ * empty.
+ *
+ * @param   pool
+ * @param   ind
+ */
+static int steal(csvh_pool *pool, int ind)
+{
+    for (int i = 1; i < pool->queueCount; i++) {
+        taskQueue *victim = &pool->queues[(ind + i) % pool->queueCount];
+        int taskInd = -1;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->count > 0) {
+            victim->count--;
+            taskInd = victim->first + victim->count * pool->queueCount;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (taskInd != -1) {
+            return taskInd;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,36 @@
+#ifndef csvh_pool_h
+#define csvh_pool_h
+
+// Constants
+
+#define CSVH_POOL__OK                   0
+#define CSVH_POOL__OUT_OF_MEMORY        1
+#define CSVH_POOL__THREAD_ERROR         2
+
+/**
+ * A task run by the pool.  taskInd goes from 0 to the task count - 1.
+ */
+typedef void (*csvh_pool_task)(void *context, int taskInd);
+
+typedef struct csvh_pool csvh_pool;
+
+int csvh_pool_default_threads();
+
+char csvh_pool_start(
+    csvh_pool **pool,
+    int threadCount,
+    int taskCount,
+    csvh_pool_task task,
+    void *context,
+    int window
+);
+
+char csvh_pool_wait_task(csvh_pool *pool, int taskInd);
+
+char csvh_pool_release_task(csvh_pool *pool, int taskInd);
+
+char csvh_pool_finish(csvh_pool *pool);
+
+char csvh_pool_run(int threadCount, int taskCount, csvh_pool_task task, void *context);
+
+#endif
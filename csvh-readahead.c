@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "csvh-readahead.h"
+
+// This is a helper module for csvh-reader.c.
+
+// It runs a thread that keeps reading ahead of whoever is consuming the
+// input, so that waiting on a slow pipe or network file system overlaps with
+// parsing and printing instead of happening in between.
+
+// The thread and the consumer share a ring of large blocks.  There's exactly
+// one producer and one consumer, so the ring itself is lock-free: the
+// producer only ever moves head and the consumer only ever moves tail.  The
+// mutex and condition variables are only touched when one side actually has
+// to go to sleep because the ring is empty or full.
+
+// Stopping the thread is cooperative: it checks for it between blocks, and
+// when it's waiting for room in the ring.  A fill that could block for good
+// (e.g., on a pipe that's gone quiet) has to give up by itself once its source
+// is being closed (see readStream in csvh-reader.c), since the thread is never
+// cancelled.
+
+/**
+ * Number of blocks in the ring.  Must be a power of two.
+ */
+#define RING_SLOTS 8
+
+/**
+ * Size of each block in the ring.
+ */
+#define SLOT_SIZE (256 * 1024)
+
+struct csvh_readahead {
+    /**
+     * Where the thread reads from.
+     */
+    csvh_readahead_fill fill;
+    void *source;
+
+    /**
+     * The blocks, and how much of each is filled.  A filled length of zero
+     * marks the end of the input, and -1 an error.
+     */
+    char *slots[RING_SLOTS];
+    long slotLens[RING_SLOTS];
+
+    /**
+     * Count of blocks ever filled (producer) and ever used up (consumer).
+     * The slot for a count is count % RING_SLOTS.
+     */
+    atomic_size_t head;
+    atomic_size_t tail;
+
+    /**
+     * How far into the block at tail the consumer is.
+     */
+    long tailPos;
+
+    /**
+     * Consumer has hit the end marker, and what it was (0 for the end, -1 for
+     * an error), which is what every read after it gets too.
+     */
+    char done;
+    long doneLen;
+
+    /**
+     * Set to make the thread stop.
+     */
+    atomic_int stop;
+
+    /**
+     * For sleeping when one side has to wait for the other.
+     */
+    atomic_int consumerWaiting;
+    atomic_int producerWaiting;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+
+    pthread_t thread;
+
+    /**
+     * Whether the thread (and the lock, etc.) exist yet.
+     */
+    char started;
+};
+
+// START forward declarations for static functions.
+
+static void *produce(void *arg);
+
+static void wake(csvh_readahead *readahead, atomic_int *waiting, pthread_cond_t *cond);
+
+// END forward declarations.
+
+/**
+ * Start reading ahead from source on a new thread.
+ *
+ * @param   readahead
+ * @param   fill
+ * @param   source
+ */
+char csvh_readahead_start(
+    csvh_readahead **readahead,
+    csvh_readahead_fill fill,
+    void *source
+) {
+    *readahead = calloc(1, sizeof(csvh_readahead));
+
+    if (*readahead == NULL) {
+        return CSVH_READAHEAD__OUT_OF_MEMORY;
+    }
+
+    (*readahead)->fill = fill;
+    (*readahead)->source = source;
+
+    for (int i = 0; i < RING_SLOTS; i++) {
+        (*readahead)->slots[i] = malloc(SLOT_SIZE);
+        if ((*readahead)->slots[i] == NULL) {
+            csvh_readahead_stop(*readahead);
+            *readahead = NULL;
+            return CSVH_READAHEAD__OUT_OF_MEMORY;
+        }
+    }
+
+    pthread_mutex_init(&(*readahead)->lock, NULL);
+    pthread_cond_init(&(*readahead)->notEmpty, NULL);
+    pthread_cond_init(&(*readahead)->notFull, NULL);
+
+    if (pthread_create(&(*readahead)->thread, NULL, produce, *readahead) != 0) {
+        pthread_mutex_destroy(&(*readahead)->lock);
+        pthread_cond_destroy(&(*readahead)->notEmpty);
+        pthread_cond_destroy(&(*readahead)->notFull);
+        for (int i = 0; i < RING_SLOTS; i++) {
+            free((*readahead)->slots[i]);
+        }
+        free(*readahead);
+        *readahead = NULL;
+        return CSVH_READAHEAD__THREAD_ERROR;
+    }
+
+    (*readahead)->started = 1;
+
+    return CSVH_READAHEAD__OK;
+}
+
+/**
+ * Copy up to cap bytes of what's been read ahead into dest.  Only blocks if
+ * nothing at all has been read ahead yet.  Returns the count of bytes, 0 at
+ * the end of the input, or -1 if reading failed.
+ *
+ * @param   readahead
+ * @param   dest
+ * @param   cap
+ */
+long csvh_readahead_read(csvh_readahead *readahead, char *dest, size_t cap)
+{
+    if (readahead->done) {
+        return readahead->doneLen;
+    }
+
+    size_t tail = atomic_load_explicit(&readahead->tail, memory_order_relaxed);
+
+    if (atomic_load_explicit(&readahead->head, memory_order_acquire) == tail) {
+        // Nothing there, so need to sleep until the producer gets something.
+        pthread_mutex_lock(&readahead->lock);
+        atomic_store(&readahead->consumerWaiting, 1);
+        while (atomic_load(&readahead->head) == tail) {
+            pthread_cond_wait(&readahead->notEmpty, &readahead->lock);
+        }
+        atomic_store(&readahead->consumerWaiting, 0);
+        pthread_mutex_unlock(&readahead->lock);
+    }
+
+    int slot = tail & (RING_SLOTS - 1);
+    long slotLen = readahead->slotLens[slot];
+
+    if (slotLen <= 0) {
+        readahead->done = 1;
+        readahead->doneLen = (slotLen < 0) ? -1 : 0;
+        return readahead->doneLen;
+    }
+
+    long count = slotLen - readahead->tailPos;
+    if ((size_t) count > cap) {
+        count = cap;
+    }
+
+    memcpy(dest, readahead->slots[slot] + readahead->tailPos, count);
+    readahead->tailPos += count;
+
+    if (readahead->tailPos == slotLen) {
+        // Used up the block, so give it back.
+        readahead->tailPos = 0;
+        atomic_store(&readahead->tail, tail + 1);
+        wake(readahead, &readahead->producerWaiting, &readahead->notFull);
+    }
+
+    return count;
+}
+
+/**
+ * Stop the thread and free everything.
+ *
+ * @param   readahead
+ */
+char csvh_readahead_stop(csvh_readahead *readahead)
+{
+    if (readahead == NULL) {
+        return CSVH_READAHEAD__OK;
+    }
+
+    if (readahead->started) {
+        // It either sees this before filling the next block, or is waiting
+        // for room, and gets woken up for it.
+        atomic_store(&readahead->stop, 1);
+        wake(readahead, &readahead->producerWaiting, &readahead->notFull);
+        pthread_join(readahead->thread, NULL);
+
+        pthread_mutex_destroy(&readahead->lock);
+        pthread_cond_destroy(&readahead->notEmpty);
+        pthread_cond_destroy(&readahead->notFull);
+    }
+
+    for (int i = 0; i < RING_SLOTS; i++) {
+        free(readahead->slots[i]);
+    }
+
+    free(readahead);
+
+    return CSVH_READAHEAD__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * The read-ahead thread.  Fills blocks until the input runs out.
+ *
+ * @param   arg
+ */
+static void *produce(void *arg)
+{
+    csvh_readahead *readahead = arg;
+    long got;
+
+    do {
+        size_t head = atomic_load_explicit(&readahead->head, memory_order_relaxed);
+
+        if (head - atomic_load_explicit(&readahead->tail, memory_order_acquire) == RING_SLOTS) {
+            // Full, so need to sleep until the consumer gives a block back.
+            pthread_mutex_lock(&readahead->lock);
+            atomic_store(&readahead->producerWaiting, 1);
+            while (head - atomic_load(&readahead->tail) == RING_SLOTS
+                && !atomic_load(&readahead->stop)
+            ) {
+                pthread_cond_wait(&readahead->notFull, &readahead->lock);
+            }
+            atomic_store(&readahead->producerWaiting, 0);
+            pthread_mutex_unlock(&readahead->lock);
+        }
+
+        if (atomic_load(&readahead->stop)) {
+            break;
+        }
+
+        int slot = head & (RING_SLOTS - 1);
+
+        got = readahead->fill(readahead->source, readahead->slots[slot], SLOT_SIZE);
+
+        readahead->slotLens[slot] = got;
+        atomic_store(&readahead->head, head + 1);
+        wake(readahead, &readahead->consumerWaiting, &readahead->notEmpty);
+    } while (got > 0);
+
+    return NULL;
+}
+
+/**
+ * Wake the other side up if it's sleeping.
+ *
+ * The waiting side sets its flag before checking the ring one last time, and
+ * this side checks the flag after moving its index, so (with both being
+ * sequentially consistent) at least one of them sees the other's change.
+ *
+ * @param   readahead
+ * @param   waiting
+ * @param   cond
+ */
+static void wake(csvh_readahead *readahead, atomic_int *waiting, pthread_cond_t *cond)
+{
+    if (atomic_load(waiting)) {
+        pthread_mutex_lock(&readahead->lock);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&readahead->lock);
+    }
+}
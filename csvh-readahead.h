@@ -0,0 +1,30 @@
+#ifndef csvh_readahead_h
+#define csvh_readahead_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_READAHEAD__OK              0
+#define CSVH_READAHEAD__OUT_OF_MEMORY   1
+#define CSVH_READAHEAD__THREAD_ERROR    2
+
+/**
+ * Something for the read-ahead thread to read from.  Copies up to cap bytes
+ * into dest, returning the count, 0 at the end, or -1 on error.
+ */
+typedef long (*csvh_readahead_fill)(void *source, char *dest, size_t cap);
+
+typedef struct csvh_readahead csvh_readahead;
+
+char csvh_readahead_start(
+    csvh_readahead **readahead,
+    csvh_readahead_fill fill,
+    void *source
+);
+
+long csvh_readahead_read(csvh_readahead *readahead, char *dest, size_t cap);
+
+char csvh_readahead_stop(csvh_readahead *readahead);
+
+#endif
@@ -0,0 +1,2295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <poll.h>
+#endif
+
+#include "csvh-readahead.h"
+#include "csvh-decompress.h"
+#include "csvh-transcode.h"
+#include "csvh-bgzf.h"
+#include "csvh-index.h"
+#include "csvh-follow.h"
+#include "csvh-multi.h"
+#include "csvh-scan.h"
+#include "csv.h"
+
+#include "csvh-reader.h"
+
+// This is a helper module for csv-handler.c.
+
+// It's the only module that actually touches the input.  It hands out one
+// logical CSV record at a time (i.e., physical lines joined together when a
+// quoted field has a line break in it), without the trailing newline.
+
+// If the input is a regular file (either a path that was passed or stdin
+// redirected from a file), the file is memory-mapped and the records that are
+// handed out are pointers straight into the mapping.  Otherwise (pipes,
+// terminals, Windows) it's read through stdio.
+
+// Compressed input is recognized by its first few bytes and decompressed on
+// the fly.  The decompressing happens on the read-ahead thread, so it overlaps
+// with the parsing.
+
+// Input that isn't UTF-8 (UTF-16, Latin-1 or Windows-1252) is turned into
+// UTF-8 on the fly after that (see csvh-transcode.c), also on the read-ahead
+// thread.  Its encoding is told from its start unless it's given.  A byte
+// order mark at the start isn't handed out either way, so a UTF-8 file with
+// one is still read straight out of its mapping.
+
+// A mapped BGZF file (blocked gzip, as written by bgzip) is decompressed a
+// batch of blocks at a time on all of the CPUs.  Skipping ahead in one doesn't
+// go through the records in between at all (see csvh-bgzf.c).
+
+// A plain mapped file (or a mapped BGZF one) can also have a row-offset index
+// kept next to it (see csvh-index.c), so that skipping records is a jump.
+// In a BGZF file, that's a jump to the block the record is in, and anything
+// the index doesn't reach is skipped the usual BGZF way.
+
+// When following a mapped file that's still being written to, the reader
+// waits for more at the end instead of stopping, and remaps the file when it
+// grows.  Only complete records are handed out then; a last record without
+// its newline might still be getting written.
+
+// A mapped file can also be read from the end: either just the last N
+// records, or every record in reverse.  Going backwards, there's no way to
+// tell from a newline alone whether it's inside of a quoted field, so it's
+// read a stretch at a time, going forwards from a newline before it both ways:
+// as if a record starts there, and as if it's inside of a quoted field (with
+// wherever reading would pick back up if the reader gives up on that record).
+// The first record start that all of them get to is sure to be one, since
+// the reader gets to it either way, and the records from there on are read
+// going forwards the usual way (see findSureStart).  If they don't all get
+// to one, the stretch is made longer.  Counting quotes back from the end
+// instead would be thrown off by a single quote out of place.
+
+// The rest of a plain mapped file can also be split up, and each part read by
+// a reader of its own (see csvh_reader_open_part), on another thread.  The
+// parts all read straight out of the one mapping.
+
+// A list of files (or directories of them) can also be read as if it were
+// one file (see csvh-multi.c).  Each file gets a reader of its own then, and
+// the files after the current one can be opened on their own, to be split up
+// into parts too (see csvh_reader_open_later_file).
+
+// A quote that's not at the start of a field (e.g., a stray one in the middle
+// of an unquoted field) is taken as a plain character, same as csv.c does,
+// instead of making everything after it one endless quoted field.  And a
+// record that's still inside of a quoted field after a limit (or at the end
+// of the input) is given up on: the quote to blame is found, and reading picks
+// back up at the first newline after it.  Both are counted, so the caller can
+// say something (see csvh_reader_malformed).  The rules for that are in
+// csvh-scan.c, which the index and BGZF jumps and reading backwards go by too,
+// so they all find the same records.
+
+// A record that ends in a carriage return (i.e., a Windows line break) is
+// handed out without it.  One inside of a quoted field is kept.
+
+// Records handed out are *not* null-terminated, so always use the length.
+// They're valid until the next call into this module with the same reader.
+
+// Either way, finding the end of a record is a single pass over its bytes,
+// mostly a block at a time (see csvh-scan.c).  The quote state is carried
+// along while scanning, so a record with line breaks in it (or one that's way
+// longer than a read) is never re-scanned from the start.
+
+/**
+ * How long to wait on a stream with nothing in it before checking whether
+ * the reader is being closed, in milliseconds.
+ */
+#define CLOSING_POLL_MS 100
+
+/**
+ * How much to read from a stream at a time.  Also the starting size of the
+ * stream buffer.
+ */
+#define READ_CHUNK 65536
+
+/**
+ * With read-ahead on, how far ahead of the current record to ask the kernel
+ * to start paging in a mapped file.
+ */
+#define MAP_READ_AHEAD (16 * 1024 * 1024)
+
+/**
+ * Going backwards, how far back from the end of a stretch to start looking
+ * for a record start that's sure to be one.  Doubled until one's found.
+ */
+#define REVERSE_STRETCH 65536
+
+/**
+ * Skipping fewer records than this in a BGZF file just reads through them.
+ * Jumping means throwing away whatever was read ahead, so it's only worth it
+ * for a real distance.
+ */
+#define BGZF_SKIP_MIN 4096
+
+struct csvh_reader {
+    /**
+     * Stream being read, if not mapped.
+     */
+    FILE *stream;
+
+    /**
+     * Whether stream was opened by us (and needs to be closed by us).
+     */
+    char ownsStream;
+
+    /**
+     * Path of the file, if one was given.
+     */
+    char *path;
+
+    /**
+     * Start of the mapped file, if mapped.  NULL for an empty mapped file.
+     */
+    char *map;
+
+    /**
+     * Length of the mapping.  (For a part, where the part ends.)
+     */
+    size_t mapLen;
+
+    /**
+     * Set if the mapping belongs to another reader (see csvh_reader_open_part),
+     * so it's not ours to unmap.
+     */
+    char sharedMap;
+
+    /**
+     * Position of the next record in the mapping.
+     */
+    size_t pos;
+
+    /**
+     * Records handed out or skipped from the mapping (or the BGZF file) so
+     * far.
+     */
+    long recNum;
+
+    /**
+     * Row-offset index of the mapped (or BGZF) file, if asked for.
+     */
+    csvh_index *index;
+
+    /**
+     * Watches the mapped file for more records, if following it.
+     */
+    csvh_follow *follow;
+
+    /**
+     * Reading the end of the mapped file (see csvh_reader_set_tail).  The first
+     * record is handed out as usual if firstPending is set; after it, either
+     * reading jumps to tailStart, or (with reverse) goes backwards from the
+     * end down to tailStart.
+     */
+    char tail;
+    char reverse;
+    char firstPending;
+    size_t tailStart;
+
+    /**
+     * Going backwards, where the stretch still to be read ends, and the
+     * records of the last stretch read (their starts and lengths, in order),
+     * revCount of which are still to be handed out.
+     */
+    size_t revEnd;
+    size_t *revStarts;
+    size_t *revLens;
+    long revCount;
+    long revCap;
+
+    /**
+     * 1 if memory-mapped.
+     */
+    char mapped;
+
+    /**
+     * Buffer holding what's been read from the stream but not handed out yet
+     * (plus the record that was handed out last).
+     */
+    char *buff;
+
+    /**
+     * Allocated size of buff.  Grows geometrically.
+     */
+    size_t buffCap;
+
+    /**
+     * Count of valid bytes in buff.
+     */
+    size_t buffLen;
+
+    /**
+     * Offset of the start of buff in the (uncompressed) input.
+     */
+    size_t buffOffset;
+
+    /**
+     * Start of the next record in buff.
+     */
+    size_t recStart;
+
+    /**
+     * How far into buff has been scanned for the end of the next record.
+     */
+    size_t scanPos;
+
+    /**
+     * Whether scanPos is inside of a quoted field.
+     */
+    char fQuote;
+
+    /**
+     * Reached the end of the stream.
+     */
+    char eof;
+
+    /**
+     * Read-ahead thread for the stream, if turned on.
+     */
+    csvh_readahead *readahead;
+
+    /**
+     * Set while closing, so that the read-ahead thread stops waiting on the
+     * stream (see readStream).
+     */
+    atomic_char closing;
+
+    /**
+     * Decompressor, if the input is compressed.
+     */
+    csvh_decompress *decompress;
+
+    /**
+     * Transcoder, if the input isn't UTF-8.  It reads from the decompressor
+     * (or the block index, or the mapping, or the stream).
+     */
+    csvh_transcode *transcode;
+
+    /**
+     * Block index, if the input is a mapped BGZF file.  (Used instead of
+     * decompress.)
+     */
+    csvh_bgzf *bgzf;
+
+    /**
+     * For a mapped file with read-ahead on, how far the kernel has been asked
+     * to page in.  Zero if read-ahead is off.
+     */
+    size_t advisedTo;
+
+    /**
+     * Longest a record can be while inside of a quoted field.  0 for no limit.
+     */
+    size_t maxRecord;
+
+    /**
+     * For telling where records end and which quote was out of place.
+     */
+    csv_dialect dialect;
+
+    /**
+     * Count of quoting mistakes (quotes out of place, and records given up
+     * on), and where the quote to blame for the last one was (in the
+     * uncompressed input).
+     */
+    long malformed;
+    size_t malformedAt;
+
+    /**
+     * The files being read, if more than one.  (Nothing else is used then.)
+     */
+    csvh_multi *multi;
+};
+
+// START forward declarations for static functions.
+
+static char mapFile(csvh_reader *reader, int fd);
+
+static char mappedNextRecord(csvh_reader *reader, char **record, size_t *len);
+
+static char waitForMore(csvh_reader *reader);
+
+static char reverseNextRecord(csvh_reader *reader, char **record, size_t *len);
+
+static char findSureStart(csvh_reader *reader, size_t to, size_t stop, size_t *sure);
+
+static char findConvergence(
+    csvh_reader *reader,
+    size_t from,
+    size_t to,
+    size_t stop,
+    size_t *sure
+);
+
+static char loadStretch(
+    csvh_reader *reader,
+    size_t from,
+    size_t to,
+    char countMalformed,
+    char *reached
+);
+
+static char readToLoaded(csvh_reader *reader, size_t pos, size_t to, size_t *met);
+
+static void startStretchCopy(csvh_reader *reader, csvh_reader *copy, size_t pos);
+
+static char stretchNextRecord(csvh_reader *copy, size_t to, size_t *start, size_t *len);
+
+static char isLoadedStart(csvh_reader *reader, size_t start);
+
+static char streamNextRecord(csvh_reader *reader, char **record, size_t *len);
+
+static char fillBuffer(csvh_reader *reader);
+
+static char skipPastNewline(csvh_reader *reader);
+
+static long readStream(void *source, char *dest, size_t cap);
+
+static long readSource(void *source, char *dest, size_t cap);
+
+static long readDecompressed(void *source, char *dest, size_t cap);
+
+static char detectCompression(csvh_reader *reader);
+
+static char detectEncoding(csvh_reader *reader, int encoding);
+
+static void adviseMapped(csvh_reader *reader);
+
+static char bgzfSkipRecords(csvh_reader *reader, long count, long *skipped);
+
+static char bgzfJump(csvh_reader *reader, size_t target, char readAhead);
+
+static char indexSkipRecords(csvh_reader *reader, long count, long *skipped);
+
+static char isDefaultQuoting(csvh_reader *reader);
+
+// END forward declarations.
+
+/**
+ * Open a reader.  If path is NULL or empty, read from stdin.  encoding is one
+ * of the CSVH_TRANSCODE_ENCODING__ ones (AUTO to tell from the input).
+ *
+ * @param   reader
+ * @param   path
+ * @param   encoding
+ */
+char csvh_reader_open(csvh_reader **reader, const char *path, int encoding)
+{
+    *reader = calloc(1, sizeof(csvh_reader));
+
+    if (*reader == NULL) {
+        return CSVH_READER__OUT_OF_MEMORY;
+    }
+
+    (*reader)->maxRecord = CSVH_READER__DEFAULT_MAX_RECORD;
+    (*reader)->dialect = (csv_dialect) CSV_DIALECT_DEFAULT;
+
+    if (path == NULL || path[0] == '\0') {
+        (*reader)->stream = stdin;
+    } else {
+        (*reader)->stream = fopen(path, "rb");
+        if ((*reader)->stream == NULL) {
+            free(*reader);
+            *reader = NULL;
+            return CSVH_READER__FILE_NOT_FOUND;
+        }
+        (*reader)->ownsStream = 1;
+        (*reader)->path = malloc(strlen(path) + 1);
+        if ((*reader)->path == NULL) {
+            csvh_reader_close(*reader);
+            *reader = NULL;
+            return CSVH_READER__OUT_OF_MEMORY;
+        }
+        strcpy((*reader)->path, path);
+    }
+
+    // Not a problem if this doesn't work out.  Just fall back to stdio.
+    mapFile(*reader, fileno((*reader)->stream));
+
+    char rc;
+    if ((rc = detectCompression(*reader)) == CSVH_READER__OK
+        && (rc = detectEncoding(*reader, encoding)) == CSVH_READER__OK
+        && ((*reader)->decompress != NULL || (*reader)->bgzf != NULL || (*reader)->transcode != NULL)
+    ) {
+        // Decompressing (or transcoding) is the slow part, so give it its own
+        // thread.
+        rc = csvh_reader_start_read_ahead(*reader);
+    }
+
+    if (rc != CSVH_READER__OK) {
+        csvh_reader_close(*reader);
+        *reader = NULL;
+        return rc;
+    }
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Open a reader for a list of files and directories, read in order as if
+ * they were one file.  A directory is read as the files in it, in name order.
+ * If hasHeaders is set, every file's first record is checked to be the same
+ * as the first file's, and only the first file's is handed out.
+ *
+ * If it comes down to a single file, it's the same as csvh_reader_open.
+ *
+ * @param   reader
+ * @param   paths
+ * @param   count
+ * @param   hasHeaders
+ * @param   encoding    Of each of the files.
+ */
+char csvh_reader_open_many(
+    csvh_reader **reader,
+    char **paths,
+    int count,
+    char hasHeaders,
+    int encoding
+) {
+    char **files;
+    int fileCount;
+    char rc;
+
+    if ((rc = csvh_multi_expand(paths, count, &files, &fileCount)) != CSVH_MULTI__OK) {
+        *reader = NULL;
+        return rc;
+    }
+
+    if (fileCount == 0) {
+        *reader = NULL;
+        return CSVH_READER__FILE_NOT_FOUND;
+    }
+
+    if (fileCount == 1) {
+        rc = csvh_reader_open(reader, files[0], encoding);
+        csvh_multi_free_files(files, fileCount);
+        return rc;
+    }
+
+    *reader = calloc(1, sizeof(csvh_reader));
+
+    if (*reader == NULL) {
+        csvh_multi_free_files(files, fileCount);
+        return CSVH_READER__OUT_OF_MEMORY;
+    }
+
+    rc = csvh_multi_open(&(*reader)->multi, files, fileCount, hasHeaders, encoding);
+
+    if (rc != CSVH_MULTI__OK) {
+        free(*reader);
+        *reader = NULL;
+        return rc;
+    }
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Open a reader for just the first file of what csvh_reader_open_many would
+ * read (e.g., to look at a sample of it).
+ *
+ * @param   reader
+ * @param   paths
+ * @param   count
+ * @param   encoding
+ */
+char csvh_reader_open_first(csvh_reader **reader, char **paths, int count, int encoding)
+{
+    char **files;
+    int fileCount;
+    char rc;
+
+    *reader = NULL;
+
+    if ((rc = csvh_multi_expand(paths, count, &files, &fileCount)) != CSVH_MULTI__OK) {
+        return rc;
+    }
+
+    rc = (fileCount == 0)
+        ? CSVH_READER__FILE_NOT_FOUND
+        : csvh_reader_open(reader, files[0], encoding);
+    csvh_multi_free_files(files, fileCount);
+
+    return rc;
+}
+
+/**
+ * Look at what's next in the input without using any of it up.  sample is set
+ * to the next (up to) want bytes.  A stream is only read until there's that
+ * much, or lines line breaks, whichever comes first, so that a slow pipe
+ * isn't waited on for long.  complete is set if sample goes to the end of the
+ * input.  Not for several files (see csvh_reader_open_first).
+ *
+ * sample is valid until the next call into this module with the same reader.
+ *
+ * @param   reader
+ * @param   want
+ * @param   lines
+ * @param   sample
+ * @param   len
+ * @param   complete
+ */
+char csvh_reader_peek(
+    csvh_reader *reader,
+    size_t want,
+    int lines,
+    const char **sample,
+    size_t *len,
+    char *complete
+) {
+    char rc;
+
+    if (reader->multi != NULL) {
+        return CSVH_READER__NOT_MAPPED;
+    }
+
+    if (reader->mapped) {
+        size_t left = (reader->pos < reader->mapLen) ? reader->mapLen - reader->pos : 0;
+
+        *sample = reader->map + reader->pos;
+        *len = (left < want) ? left : want;
+        *complete = (*len == left && reader->follow == NULL);
+        return CSVH_READER__OK;
+    }
+
+    int found = 0;
+    size_t counted = 0; // From recStart, since fillBuffer can move it.
+
+    while (reader->buffLen - reader->recStart < want && !reader->eof) {
+        for (; reader->recStart + counted < reader->buffLen; counted++) {
+            found += (reader->buff[reader->recStart + counted] == '\n');
+        }
+        if (found >= lines) {
+            break;
+        }
+
+        if ((rc = fillBuffer(reader)) != CSVH_READER__OK) {
+            return rc;
+        }
+    }
+
+    *sample = reader->buff + reader->recStart;
+    *len = reader->buffLen - reader->recStart;
+    if (*len > want) {
+        *len = want;
+    }
+    *complete = reader->eof && *len == reader->buffLen - reader->recStart;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Get the next logical record.
+ *
+ * @param   reader
+ * @param   record
+ * @param   len
+ */
+char csvh_reader_next_record(csvh_reader *reader, char **record, size_t *len)
+{
+    char rc;
+
+    if (reader->multi != NULL) {
+        // (Each file's reader takes care of carriage returns.)
+        return csvh_multi_next_record(reader->multi, record, len);
+    }
+
+    if (reader->tail && reader->firstPending) {
+        rc = mappedNextRecord(reader, record, len);
+        reader->firstPending = 0;
+        if (reader->pos < reader->tailStart) {
+            reader->pos = reader->tailStart;
+        }
+    } else if (reader->tail && reader->reverse) {
+        rc = reverseNextRecord(reader, record, len);
+    } else if (reader->mapped) {
+        rc = mappedNextRecord(reader, record, len);
+    } else {
+        rc = streamNextRecord(reader, record, len);
+    }
+
+    if (rc == CSVH_READER__OK && *len > 0 && (*record)[*len - 1] == '\r') {
+        (*len)--;
+    }
+
+    return rc;
+}
+
+/**
+ * Skip the next logical record.
+ *
+ * @param   reader
+ */
+char csvh_reader_skip_record(csvh_reader *reader)
+{
+    char *record;
+    size_t len;
+
+    return csvh_reader_next_record(reader, &record, &len);
+}
+
+/**
+ * Skip count logical records.  skipped is set to how many there actually
+ * were (less than count if the input ran out).
+ *
+ * @param   reader
+ * @param   count
+ * @param   skipped
+ */
+char csvh_reader_skip_records(csvh_reader *reader, long count, long *skipped)
+{
+    char rc = CSVH_READER__OK;
+    long jumped = 0;
+    long more;
+
+    if (reader->index != NULL && !reader->tail) {
+        // (Record numbers aren't kept track of after a jump to the tail.)
+        if ((rc = indexSkipRecords(reader, count, &jumped)) != CSVH_READER__OK) {
+            *skipped = jumped;
+            return rc;
+        }
+    }
+
+    if (reader->bgzf != NULL
+        && reader->transcode == NULL
+        && count - jumped >= BGZF_SKIP_MIN
+    ) {
+        // (Stops short at a record that needs to be read to know what to do
+        // with it, and the rest are read through.)
+        rc = bgzfSkipRecords(reader, count - jumped, &more);
+        jumped += more;
+        if (rc != CSVH_READER__OK) {
+            *skipped = jumped;
+            return rc;
+        }
+    }
+
+    for (*skipped = jumped; *skipped < count; (*skipped)++) {
+        if ((rc = csvh_reader_skip_record(reader)) != CSVH_READER__OK) {
+            break;
+        }
+    }
+
+    return (rc == CSVH_READER__DONE) ? CSVH_READER__OK : rc;
+}
+
+/**
+ * Set how long a record can get while inside of a quoted field before it's
+ * given up on (0 for no limit), and the dialect (for its quoting).
+ *
+ * @param   reader
+ * @param   maxRecord
+ * @param   dialect
+ */
+char csvh_reader_set_resync(csvh_reader *reader, size_t maxRecord, const csv_dialect *dialect)
+{
+    if (reader->multi != NULL) {
+        return csvh_multi_set_resync(reader->multi, maxRecord, dialect);
+    }
+
+    reader->maxRecord = maxRecord;
+    reader->dialect = *dialect;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Count of quoting mistakes so far: quotes out of place (which are read as
+ * plain characters), and records given up on.  If there were any, at is set
+ * to where the quote to blame for the last one was.
+ *
+ * @param   reader
+ * @param   at
+ */
+long csvh_reader_malformed(csvh_reader *reader, size_t *at)
+{
+    if (reader->multi != NULL) {
+        return csvh_multi_malformed(reader->multi, at);
+    }
+
+    *at = reader->malformedAt;
+
+    return reader->malformed;
+}
+
+/**
+ * Keep a row-offset index next to the file (loading it if it's already
+ * there), so that skipping records can jump.  Does nothing unless the input
+ * is a plain or BGZF file that was opened by path (and not transcoded), and
+ * its quoting is the default (which is all the index knows about).
+ *
+ * @param   reader
+ */
+char csvh_reader_use_index(csvh_reader *reader)
+{
+    if (!(reader->mapped || (reader->bgzf != NULL && reader->transcode == NULL))
+        || reader->path == NULL
+        || reader->index != NULL
+        || !isDefaultQuoting(reader)
+    ) {
+        return CSVH_READER__OK;
+    }
+
+    char readAhead = (reader->readahead != NULL);
+
+    // Indexing a BGZF file goes through its blocks, which the read-ahead
+    // thread can't be doing at the same time.  What it read and the reader
+    // hasn't gotten yet is read over again after.
+    csvh_readahead_stop(reader->readahead);
+    reader->readahead = NULL;
+
+    char rc = csvh_index_open(
+        &reader->index,
+        reader->path,
+        reader->map,
+        reader->mapLen,
+        reader->bgzf,
+        &reader->dialect,
+        reader->maxRecord
+    );
+
+    if (reader->bgzf != NULL) {
+        csvh_bgzf_seek(reader->bgzf, reader->buffOffset + reader->buffLen);
+    }
+
+    if (readAhead && csvh_reader_start_read_ahead(reader) != CSVH_READER__OK) {
+        return CSVH_READER__OUT_OF_MEMORY;
+    }
+
+    switch (rc) {
+        case CSVH_INDEX__OK:
+            return CSVH_READER__OK;
+        case CSVH_INDEX__OUT_OF_MEMORY:
+            return CSVH_READER__OUT_OF_MEMORY;
+    }
+
+    return CSVH_READER__FILE_NOT_FOUND;
+}
+
+/**
+ * Keep waiting for more records at the end of the file instead of stopping,
+ * for a file that's still being written to.  Does nothing unless the input is
+ * mapped (a pipe already waits for more on its own).
+ *
+ * @param   reader
+ */
+char csvh_reader_set_follow(csvh_reader *reader)
+{
+    if (!reader->mapped || reader->follow != NULL) {
+        return CSVH_READER__OK;
+    }
+
+    switch (csvh_follow_open(&reader->follow, fileno(reader->stream), reader->path)) {
+        case CSVH_FOLLOW__OK:
+            return CSVH_READER__OK;
+        case CSVH_FOLLOW__OUT_OF_MEMORY:
+            return CSVH_READER__OUT_OF_MEMORY;
+    }
+
+    return CSVH_READER__READ_ERROR;
+}
+
+/**
+ * Only read the last count records, or (with reverse) read them last to first.
+ * A count less than 1 means all of them, which only makes sense with reverse.
+ * found is set to how many records there are to read (not counting the first,
+ * if keepFirst is set), or -1 if count is less than 1 and there's at least
+ * one (they aren't counted then, to save going over the whole file twice).
+ *
+ * With keepFirst, the first record (i.e., the header) is still handed out
+ * first, and never counted as one of the last records.
+ *
+ * Must be called before the first record is read (skipping is OK).  Only
+ * works on a mapped file.
+ *
+ * @param   reader
+ * @param   count
+ * @param   reverse
+ * @param   keepFirst
+ * @param   found
+ */
+char csvh_reader_set_tail(
+    csvh_reader *reader,
+    long count,
+    char reverse,
+    char keepFirst,
+    long *found
+) {
+    if (!reader->mapped) {
+        return CSVH_READER__NOT_MAPPED;
+    }
+
+    size_t stop = reader->pos;
+    size_t to = reader->mapLen;
+    size_t start = stop;
+    size_t len;
+    char reached;
+    char rc;
+
+    if (keepFirst && stop < reader->mapLen) {
+        // Wherever the first record ends (as it'll be read).
+        csvh_reader first;
+
+        startStretchCopy(reader, &first, stop);
+        stretchNextRecord(&first, reader->mapLen, &start, &len);
+        stop = (first.pos < reader->mapLen) ? first.pos : reader->mapLen;
+    }
+
+    // Walk back over the records from the end, a stretch at a time.
+    *found = 0;
+
+    if (stop < reader->mapLen && count < 1) {
+        start = stop;
+        *found = -1;
+    }
+
+    while (*found >= 0 && *found < count && to > stop) {
+        if ((rc = findSureStart(reader, to, stop, &start)) != CSVH_READER__OK
+            || (rc = loadStretch(reader, start, to, 0, &reached)) != CSVH_READER__OK
+        ) {
+            return rc;
+        }
+
+        if (*found + reader->revCount >= count) {
+            start = reader->revStarts[reader->revCount - (count - *found)];
+            *found = count;
+            break;
+        }
+
+        *found += reader->revCount;
+        to = start;
+    }
+
+    if (*found == 0) {
+        start = reader->mapLen;
+    }
+
+    reader->tail = 1;
+    reader->reverse = reverse;
+    reader->firstPending = keepFirst;
+    reader->tailStart = start;
+    reader->revEnd = reader->mapLen;
+    reader->revCount = 0;
+
+    if (!keepFirst && !reverse) {
+        reader->pos = start;
+    }
+
+#ifndef _WIN32
+    if (reverse && reader->map != NULL) {
+        // Not going to be in order.
+        madvise(reader->map, reader->mapLen, MADV_NORMAL);
+    }
+#endif
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Count of records in the whole file, if it can be known without reading it
+ * (i.e., there's an index).  Otherwise -1.
+ *
+ * @param   reader
+ */
+long csvh_reader_record_count(csvh_reader *reader)
+{
+    if (reader->index == NULL || !reader->mapped) {
+        return -1;
+    }
+
+    size_t indexedTo;
+    long count = csvh_index_record_count(reader->index, &indexedTo);
+
+    if (count < 0) {
+        return -1;
+    }
+
+    if (indexedTo < reader->mapLen) {
+        // Last record doesn't have a newline.
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * Turn on reading ahead of the records being handed out.  Must be called
+ * before anything is read.
+ *
+ * For a stream, a separate thread does the reading.  For a mapped file, the
+ * kernel is told ahead of time which pages are going to be needed.
+ *
+ * @param   reader
+ */
+char csvh_reader_start_read_ahead(csvh_reader *reader)
+{
+    if (reader->multi != NULL) {
+        // The files are already read ahead.
+        return CSVH_READER__OK;
+    }
+
+    if (reader->mapped) {
+        if (reader->advisedTo == 0) {
+            reader->advisedTo = reader->pos;
+            adviseMapped(reader);
+        }
+        return CSVH_READER__OK;
+    }
+
+    if (reader->readahead != NULL) {
+        return CSVH_READER__OK;
+    }
+
+    switch (csvh_readahead_start(&reader->readahead, readSource, reader)) {
+        case CSVH_READAHEAD__OK:
+            return CSVH_READER__OK;
+        case CSVH_READAHEAD__OUT_OF_MEMORY:
+            return CSVH_READER__OUT_OF_MEMORY;
+    }
+
+    return CSVH_READER__READ_ERROR;
+}
+
+/**
+ * Get the input into memory now, instead of as it's read: page in all of a
+ * mapped file, or start reading ahead on a stream.  Meant to be called off
+ * of the main thread, on a reader that's going to be needed soon.
+ *
+ * @param   reader
+ */
+char csvh_reader_prefetch(csvh_reader *reader)
+{
+    if (!reader->mapped) {
+        return csvh_reader_start_read_ahead(reader);
+    }
+
+#ifndef _WIN32
+    if (reader->map != NULL) {
+        long pageSize = sysconf(_SC_PAGESIZE);
+        volatile char sink = 0;
+
+        madvise(reader->map, reader->mapLen, MADV_WILLNEED);
+
+        // The advice is just advice; touching the pages makes sure.
+        for (size_t i = reader->pos; i < reader->mapLen; i += pageSize) {
+            sink ^= reader->map[i];
+        }
+        (void) sink;
+    }
+#endif
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Whether the input is memory-mapped.
+ *
+ * @param   reader
+ */
+char csvh_reader_is_mapped(csvh_reader *reader)
+{
+    return reader->mapped;
+}
+
+/**
+ * Get what's left to read of a plain mapped file, to split up into parts (see
+ * csvh_reader_open_part).  Returns CSVH_READER__NOT_MAPPED if the input isn't
+ * one: if it's a stream, or it's decompressed or transcoded, or it's read from
+ * the end or followed.  With several files, it's what's left of the current
+ * one (and the ones after it can be opened with
+ * csvh_reader_open_later_file).
+ *
+ * @param   reader
+ * @param   start
+ * @param   end
+ */
+char csvh_reader_mapped_rest(csvh_reader *reader, const char **start, const char **end)
+{
+    csvh_reader *current;
+
+    if (reader->multi != NULL) {
+        // (Whatever's wrong with the current file comes up when it's read.)
+        return (csvh_multi_current(reader->multi, &current) == CSVH_MULTI__OK && current != NULL)
+            ? csvh_reader_mapped_rest(current, start, end)
+            : CSVH_READER__NOT_MAPPED;
+    }
+
+    if (!reader->mapped
+        || reader->map == NULL
+        || reader->transcode != NULL
+        || reader->bgzf != NULL
+        || reader->decompress != NULL
+        || reader->follow != NULL
+        || reader->tail
+    ) {
+        return CSVH_READER__NOT_MAPPED;
+    }
+
+    *start = reader->map + ((reader->pos < reader->mapLen) ? reader->pos : reader->mapLen);
+    *end = reader->map + reader->mapLen;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Open a reader for just part of what whole has left (see
+ * csvh_reader_mapped_rest), from start up to end.  Both have to be the starts
+ * of records (or the end of the file).  It reads out of whole's mapping, so it
+ * has to be closed before whole is.  It's safe to read from parts on other
+ * threads, as long as whole isn't read from at the same time.
+ *
+ * @param   part
+ * @param   whole
+ * @param   start
+ * @param   end
+ */
+char csvh_reader_open_part(csvh_reader **part, csvh_reader *whole, const char *start, const char *end)
+{
+    if (whole->multi != NULL) {
+        csvh_multi_current(whole->multi, &whole);
+    }
+
+    *part = calloc(1, sizeof(csvh_reader));
+
+    if (*part == NULL) {
+        return CSVH_READER__OUT_OF_MEMORY;
+    }
+
+    (*part)->mapped = 1;
+    (*part)->sharedMap = 1;
+    (*part)->map = whole->map;
+    (*part)->mapLen = end - whole->map;
+    (*part)->pos = start - whole->map;
+    (*part)->maxRecord = whole->maxRecord;
+    (*part)->dialect = whole->dialect;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Pick up reading where part (from csvh_reader_open_part) left off, as if
+ * the records it read had been read from here instead.
+ *
+ * @param   reader
+ * @param   part
+ */
+char csvh_reader_skip_part(csvh_reader *reader, csvh_reader *part)
+{
+    if (reader->multi != NULL) {
+        csvh_multi_current(reader->multi, &reader);
+    }
+
+    reader->pos = part->pos;
+    reader->recNum += part->recNum;
+
+    if (reader->advisedTo != 0) {
+        reader->advisedTo = reader->pos;
+        adviseMapped(reader);
+    }
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Count of files after the current one, if there are several (see
+ * csvh_reader_open_many).
+ *
+ * @param   reader
+ */
+int csvh_reader_later_files(csvh_reader *reader)
+{
+    return (reader->multi != NULL) ? csvh_multi_later_files(reader->multi) : 0;
+}
+
+/**
+ * Open the ind-th file after the current one (0 for the next one) of several
+ * on its own, past its header, so that it can be split up into parts too.
+ * Returns CSVH_READER__NOT_MAPPED if it isn't a plain mapped file (see
+ * csvh_reader_mapped_rest).  Can be called from any thread, as long as
+ * reader isn't read from at the same time.
+ *
+ * Afterwards, skip over it, or hand it back to be read from where it left
+ * off (see csvh_reader_skip_files).
+ *
+ * @param   file
+ * @param   reader
+ * @param   ind
+ */
+char csvh_reader_open_later_file(csvh_reader **file, csvh_reader *reader, int ind)
+{
+    const char *start;
+    const char *end;
+    char rc;
+
+    *file = NULL;
+
+    if ((rc = csvh_multi_open_file(reader->multi, ind, file)) != CSVH_MULTI__OK) {
+        return rc;
+    }
+
+    if (csvh_reader_mapped_rest(*file, &start, &end) != CSVH_READER__OK) {
+        csvh_reader_close(*file);
+        *file = NULL;
+        return CSVH_READER__NOT_MAPPED;
+    }
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Move on past the current file of several, and the count files after it,
+ * whose records were read some other way.  If file is set, it's the one
+ * after those (from csvh_reader_open_later_file), and reading picks up where
+ * it left off (the reader takes it over).
+ *
+ * @param   reader
+ * @param   count
+ * @param   file
+ */
+char csvh_reader_skip_files(csvh_reader *reader, int count, csvh_reader *file)
+{
+    return csvh_multi_skip_files(reader->multi, count, file);
+}
+
+/**
+ * Whether everything in a mapped file (or part of one) has been read.
+ *
+ * @param   reader
+ */
+char csvh_reader_at_end(csvh_reader *reader)
+{
+    return reader->mapped && reader->pos >= reader->mapLen;
+}
+
+/**
+ * Close the reader and free it.
+ *
+ * @param   reader
+ */
+char csvh_reader_close(csvh_reader *reader)
+{
+    if (reader == NULL) {
+        return CSVH_READER__OK;
+    }
+
+    csvh_multi_close(reader->multi);
+
+    // Has to go first, since the thread is using the stream.
+    atomic_store(&reader->closing, 1);
+    csvh_readahead_stop(reader->readahead);
+    csvh_transcode_close(reader->transcode);
+    csvh_decompress_close(reader->decompress);
+    csvh_bgzf_close(reader->bgzf);
+    csvh_index_close(reader->index);
+    csvh_follow_close(reader->follow);
+
+#ifndef _WIN32
+    if (reader->map != NULL && !reader->sharedMap) {
+        munmap(reader->map, reader->mapLen);
+    }
+#endif
+
+    if (reader->ownsStream) {
+        fclose(reader->stream);
+    }
+
+    free(reader->buff);
+    free(reader->path);
+    free(reader->revStarts);
+    free(reader->revLens);
+    free(reader);
+
+    return CSVH_READER__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Try to memory-map the file behind fd.  Only works on regular files.
+ * Returns 1 if mapped, 0 if need to fall back to stdio.
+ *
+ * Maps from the current file offset, so that stdin that was partially read
+ * by someone else before us still starts at the right spot.
+ *
+ * @param   reader
+ * @param   fd
+ */
+static char mapFile(csvh_reader *reader, int fd)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    struct stat st;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start < 0 || start > st.st_size) {
+        return 0;
+    }
+
+    reader->mapped = 1;
+
+    if (st.st_size == 0) {
+        // Can't map an empty file, but nothing to read either.
+        return 1;
+    }
+
+    reader->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (reader->map == MAP_FAILED) {
+        reader->map = NULL;
+        reader->mapped = 0;
+        return 0;
+    }
+
+    madvise(reader->map, st.st_size, MADV_SEQUENTIAL);
+
+    reader->mapLen = st.st_size;
+    reader->pos = start;
+
+    return 1;
+#endif
+}
+
+/**
+ * Get the next record from the mapping.  No copying at all.
+ *
+ * @param   reader
+ * @param   record
+ * @param   len
+ */
+static char mappedNextRecord(csvh_reader *reader, char **record, size_t *len)
+{
+    char *start;
+    char *end;
+    char *limit;
+    char *ptr;
+    char *badQuote;
+    char fQuote;
+    csvh_scan_check check;
+    char rc;
+
+    while (1) {
+        start = reader->map + reader->pos;
+        end = reader->map + reader->mapLen;
+        limit = (reader->maxRecord != 0 && reader->mapLen - reader->pos > reader->maxRecord)
+            ? start + reader->maxRecord
+            : end;
+        fQuote = 0;
+        check = csvh_scan_start_check(&reader->dialect, start);
+        ptr = (reader->pos < reader->mapLen) ? csvh_scan_find_record_end(start, limit, &fQuote, &check) : NULL;
+
+        if (ptr == NULL && limit < end && !fQuote && !check.badClose) {
+            // Long, but not because of a quoted field.
+            ptr = csvh_scan_find_record_end(limit, end, &fQuote, &check);
+            limit = end;
+        }
+
+        if (check.badClose
+            || (ptr == NULL && fQuote && (limit < end || reader->follow == NULL))
+        ) {
+            // A quoted field was closed somewhere other than at the end of a
+            // field, is still open this far in, or is never closed before the
+            // end of the file.  Give up on the record.
+            ptr = csvh_scan_resync_point(start, limit, &check, &badQuote);
+            if (ptr == limit && limit < end) {
+                // No newline after the quote before the limit.  The rest of
+                // its line goes too, however long it is.
+                ptr = memchr(limit, '\n', end - limit);
+                if (ptr == NULL) {
+                    ptr = end;
+                }
+            }
+            reader->malformed++;
+            reader->malformedAt = badQuote - reader->map;
+            reader->pos = ptr - reader->map + (ptr < end); // Past the newline.
+            continue;
+        }
+
+        if (ptr != NULL) {
+            break;
+        }
+
+        if (reader->follow != NULL) {
+            // Whatever's there (if anything) might still be getting written.
+            if ((rc = waitForMore(reader)) != CSVH_READER__OK) {
+                return rc;
+            }
+            continue;
+        }
+
+        if (reader->pos >= reader->mapLen) {
+            return CSVH_READER__DONE;
+        }
+
+        // Last record doesn't have a newline.
+        ptr = end;
+        break;
+    }
+
+    if (check.strays > 0) {
+        reader->malformed += check.strays;
+        reader->malformedAt = check.lastStray - reader->map;
+    }
+
+    *record = start;
+    *len = ptr - start;
+    reader->pos += *len + 1; // +1 for the newline.  Fine if went past end.
+    reader->recNum++;
+
+    if (reader->advisedTo != 0 && reader->pos + MAP_READ_AHEAD / 2 > reader->advisedTo) {
+        adviseMapped(reader);
+    }
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Wait for the followed file to grow, and map it again with the new size.
+ *
+ * @param   reader
+ */
+static char waitForMore(csvh_reader *reader)
+{
+#ifdef _WIN32
+    return CSVH_READER__READ_ERROR;
+#else
+    size_t newLen;
+
+    if (csvh_follow_wait(reader->follow, reader->mapLen, &newLen) != CSVH_FOLLOW__OK) {
+        return CSVH_READER__READ_ERROR;
+    }
+
+    if (reader->map != NULL) {
+        munmap(reader->map, reader->mapLen);
+    }
+
+    reader->map = mmap(NULL, newLen, PROT_READ, MAP_PRIVATE, fileno(reader->stream), 0);
+
+    if (reader->map == MAP_FAILED) {
+        reader->map = NULL;
+        reader->mapLen = 0;
+        return CSVH_READER__READ_ERROR;
+    }
+
+    reader->mapLen = newLen;
+
+    return CSVH_READER__OK;
+#endif
+}
+
+/**
+ * Get the next record from the stream.
+ *
+ * @param   reader
+ * @param   record
+ * @param   len
+ */
+static char streamNextRecord(csvh_reader *reader, char **record, size_t *len)
+{
+    char *end;
+    char *badQuote;
+    csvh_scan_check check;
+    char rc;
+
+    while (1) {
+        check = csvh_scan_start_check(&reader->dialect, reader->buff + reader->recStart);
+        end = csvh_scan_find_record_end(
+            reader->buff + reader->scanPos,
+            reader->buff + reader->buffLen,
+            &reader->fQuote,
+            &check
+        );
+
+        if (check.strays > 0) {
+            reader->malformed += check.strays;
+            reader->malformedAt = reader->buffOffset + (check.lastStray - reader->buff);
+        }
+
+        if (end != NULL) {
+            break;
+        }
+
+        reader->scanPos = reader->buffLen;
+
+        if (check.badClose
+            || (reader->fQuote
+                && (reader->eof
+                    || (reader->maxRecord != 0
+                        && reader->buffLen - reader->recStart > reader->maxRecord)))
+        ) {
+            // Same as for a mapped file: give up on the record.
+            end = csvh_scan_resync_point(
+                reader->buff + reader->recStart,
+                reader->buff + reader->buffLen,
+                &check,
+                &badQuote
+            );
+            reader->malformed++;
+            reader->malformedAt = reader->buffOffset + (badQuote - reader->buff);
+            reader->recStart = end - reader->buff;
+            if (reader->recStart < reader->buffLen) {
+                reader->recStart++; // Past the newline.
+            } else if ((rc = skipPastNewline(reader)) != CSVH_READER__OK) {
+                // (There's no newline after the quote in the buffer yet.)
+                return rc;
+            }
+            reader->scanPos = reader->recStart;
+            reader->fQuote = 0;
+            continue;
+        }
+
+        if (reader->eof) {
+            if (reader->recStart == reader->buffLen) {
+                return CSVH_READER__DONE;
+            }
+
+            // Last record doesn't have a newline.
+            end = reader->buff + reader->buffLen;
+            break;
+        }
+
+        if ((rc = fillBuffer(reader)) != CSVH_READER__OK) {
+            return rc;
+        }
+    }
+
+    *record = reader->buff + reader->recStart;
+    *len = end - *record;
+
+    reader->recStart += *len;
+    if (reader->recStart < reader->buffLen) {
+        reader->recStart++; // Past the newline.
+    }
+    reader->scanPos = reader->recStart;
+    reader->fQuote = 0;
+    reader->recNum++;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Read more of the stream into the buffer.  Whatever's before the start of
+ * the next record is dropped to make room, and the buffer is grown if the
+ * record doesn't leave room for a full chunk.
+ *
+ * @param   reader
+ */
+static char fillBuffer(csvh_reader *reader)
+{
+    if (reader->recStart > 0) {
+        // Only ever moves the part of one record that's been read so far, and
+        // only once for that record, since recStart is zero afterwards.
+        memmove(
+            reader->buff,
+            reader->buff + reader->recStart,
+            reader->buffLen - reader->recStart
+        );
+        reader->buffLen -= reader->recStart;
+        reader->buffOffset += reader->recStart;
+        reader->scanPos -= reader->recStart;
+        reader->recStart = 0;
+    }
+
+    if (reader->buffCap - reader->buffLen < READ_CHUNK) {
+        size_t newCap = reader->buffCap ? reader->buffCap * 2 : READ_CHUNK;
+        char *newBuff = realloc(reader->buff, newCap);
+
+        if (newBuff == NULL) {
+            return CSVH_READER__OUT_OF_MEMORY;
+        }
+
+        reader->buff = newBuff;
+        reader->buffCap = newCap;
+    }
+
+    long got;
+    if (reader->readahead != NULL) {
+        got = csvh_readahead_read(
+            reader->readahead,
+            reader->buff + reader->buffLen,
+            reader->buffCap - reader->buffLen
+        );
+    } else {
+        got = readSource(
+            reader,
+            reader->buff + reader->buffLen,
+            reader->buffCap - reader->buffLen
+        );
+    }
+
+    if (got < 0) {
+        // The records before it have been handed out already.
+        return CSVH_READER__READ_ERROR;
+    }
+
+    if (got == 0) {
+        reader->eof = 1;
+        return CSVH_READER__OK;
+    }
+
+    reader->buffLen += got;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Drop the rest of the buffer, and keep reading (and dropping what's read)
+ * until getting to a newline, then set recStart right after it (or at the end
+ * of the input, if there isn't one).  For giving up on a record, when the
+ * quote to blame doesn't have a newline after it in the buffer.
+ *
+ * @param   reader
+ */
+static char skipPastNewline(csvh_reader *reader)
+{
+    char *newline;
+    char rc;
+
+    while (1) {
+        reader->recStart = reader->buffLen;
+        reader->scanPos = reader->buffLen;
+
+        if (reader->eof) {
+            return CSVH_READER__OK;
+        }
+
+        if ((rc = fillBuffer(reader)) != CSVH_READER__OK) {
+            return rc;
+        }
+
+        newline = memchr(reader->buff + reader->recStart, '\n', reader->buffLen - reader->recStart);
+        if (newline != NULL) {
+            reader->recStart = newline - reader->buff + 1;
+            return CSVH_READER__OK;
+        }
+    }
+}
+
+/**
+ * Read whatever's available from the stream, up to cap bytes.
+ *
+ * Using read() instead of fread() so that whatever's available from a pipe is
+ * used right away, instead of waiting for a full chunk.
+ *
+ * Waits for there to be something to read a little at a time, so that (on
+ * the read-ahead thread) it gives up once the reader is being closed, instead
+ * of holding that up for as long as the other end of a pipe stays quiet.
+ *
+ * @param   source  The reader.
+ * @param   dest
+ * @param   cap
+ */
+static long readStream(void *source, char *dest, size_t cap)
+{
+    csvh_reader *reader = source;
+    long got;
+
+#ifndef _WIN32
+    struct pollfd pfd = { fileno(reader->stream), POLLIN, 0 };
+    int ready;
+
+    do {
+        if (atomic_load(&reader->closing)) {
+            return 0;
+        }
+        ready = poll(&pfd, 1, CLOSING_POLL_MS);
+    } while (ready == 0 || (ready < 0 && errno == EINTR));
+#endif
+
+    do {
+        got = read(fileno(reader->stream), dest, cap);
+    } while (got < 0 && errno == EINTR);
+
+    return got;
+}
+
+/**
+ * Read up to cap bytes of plain UTF-8 CSV, decompressing and transcoding if
+ * needed.
+ *
+ * @param   source  The reader.
+ * @param   dest
+ * @param   cap
+ */
+static long readSource(void *source, char *dest, size_t cap)
+{
+    csvh_reader *reader = source;
+
+    if (reader->transcode != NULL) {
+        return csvh_transcode_read(reader->transcode, dest, cap);
+    }
+
+    return readDecompressed(reader, dest, cap);
+}
+
+/**
+ * Read up to cap bytes of plain CSV (in whatever encoding it's in),
+ * decompressing if needed.
+ *
+ * @param   source  The reader.
+ * @param   dest
+ * @param   cap
+ */
+static long readDecompressed(void *source, char *dest, size_t cap)
+{
+    csvh_reader *reader = source;
+
+    if (reader->bgzf != NULL) {
+        return csvh_bgzf_read(reader->bgzf, dest, cap);
+    }
+    if (reader->decompress != NULL) {
+        return csvh_decompress_read(reader->decompress, dest, cap);
+    }
+
+    return readStream(reader, dest, cap);
+}
+
+/**
+ * Check the start of the input for a compression format, and set up the
+ * decompressor if there is one.
+ *
+ * @param   reader
+ */
+static char detectCompression(csvh_reader *reader)
+{
+    const char *start;
+    size_t len;
+    char rc;
+
+    if (reader->mapped) {
+        start = reader->map + reader->pos;
+        len = reader->mapLen - reader->pos;
+    } else {
+        // Whatever gets read here stays in the buffer, so nothing's lost if
+        // it's not compressed.
+        while (reader->buffLen < CSVH_DECOMPRESS_MAGIC_LEN && !reader->eof) {
+            if ((rc = fillBuffer(reader)) != CSVH_READER__OK) {
+                return rc;
+            }
+        }
+        start = reader->buff;
+        len = reader->buffLen;
+    }
+
+    int format = csvh_decompress_detect(start, len);
+
+    if (format == CSVH_DECOMPRESS_FORMAT__NONE) {
+        return CSVH_READER__OK;
+    }
+
+    if (format == CSVH_DECOMPRESS_FORMAT__GZIP && reader->mapped) {
+        switch (csvh_bgzf_open(&reader->bgzf, start, len)) {
+            case CSVH_BGZF__OK:
+                break;
+            case CSVH_BGZF__NOT_BGZF:
+                // Plain gzip.
+                break;
+            default:
+                return CSVH_READER__OUT_OF_MEMORY;
+        }
+    }
+
+    if (reader->bgzf == NULL) {
+        switch (csvh_decompress_open(
+            &reader->decompress,
+            format,
+            reader->mapped ? NULL : readStream, // Mapping is all there already.
+            reader,
+            start,
+            len
+        )) {
+            case CSVH_DECOMPRESS__OK:
+                break;
+            case CSVH_DECOMPRESS__UNSUPPORTED:
+                return CSVH_READER__UNSUPPORTED_INPUT;
+            default:
+                return CSVH_READER__OUT_OF_MEMORY;
+        }
+    }
+
+    // Records come out of the decompressor now.  (The mapping, if any, sticks
+    // around as the decompressor's input.)
+    reader->mapped = 0;
+    reader->buffLen = 0;
+    reader->scanPos = 0;
+    reader->eof = 0;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Figure out the encoding of the (decompressed) input, if it's not given, and
+ * set up the transcoder if it's not UTF-8.  Either way, skip the byte order
+ * mark, if there is one.
+ *
+ * @param   reader
+ * @param   encoding
+ */
+static char detectEncoding(csvh_reader *reader, int encoding)
+{
+    const char *start;
+    size_t len;
+    size_t sampleLen;
+    char complete;
+    char rc;
+
+    if (reader->mapped) {
+        if (reader->pos >= reader->mapLen) {
+            return CSVH_READER__OK;
+        }
+        start = reader->map + reader->pos;
+        len = reader->mapLen - reader->pos;
+        complete = (len <= CSVH_TRANSCODE_SAMPLE);
+        sampleLen = complete ? len : CSVH_TRANSCODE_SAMPLE;
+    } else {
+        // Just whatever's been read so far (so that a slow pipe isn't waited
+        // on), as long as it's enough for a byte order mark.
+        while (reader->buffLen - reader->recStart < 4 && !reader->eof) {
+            if ((rc = fillBuffer(reader)) != CSVH_READER__OK) {
+                return rc;
+            }
+        }
+        start = reader->buff + reader->recStart;
+        len = reader->buffLen - reader->recStart;
+        complete = reader->eof;
+        sampleLen = len;
+    }
+
+    if (encoding == CSVH_TRANSCODE_ENCODING__AUTO) {
+        encoding = csvh_transcode_detect(start, sampleLen, complete);
+    }
+
+    size_t bomLen = csvh_transcode_bom_len(encoding, start, len);
+
+    if (encoding == CSVH_TRANSCODE_ENCODING__UTF8) {
+        if (reader->mapped) {
+            reader->pos += bomLen;
+        } else {
+            reader->recStart += bomLen;
+            reader->scanPos = reader->recStart;
+        }
+        return CSVH_READER__OK;
+    }
+
+    if (csvh_transcode_open(
+            &reader->transcode,
+            encoding,
+            reader->mapped ? NULL : readDecompressed, // Mapping is all there already.
+            reader,
+            start + bomLen,
+            len - bomLen
+        ) != CSVH_TRANSCODE__OK
+    ) {
+        return CSVH_READER__OUT_OF_MEMORY;
+    }
+
+    // Records come out of the transcoder now.
+    reader->mapped = 0;
+    reader->buffLen = 0;
+    reader->recStart = 0;
+    reader->scanPos = 0;
+    reader->eof = 0;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Ask the kernel to start paging in the next stretch of the mapped file.
+ *
+ * @param   reader
+ */
+static void adviseMapped(csvh_reader *reader)
+{
+#ifndef _WIN32
+    if (reader->advisedTo >= reader->mapLen) {
+        return;
+    }
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t from = reader->advisedTo - reader->advisedTo % pageSize;
+    size_t len = MAP_READ_AHEAD;
+
+    if (from + len > reader->mapLen) {
+        len = reader->mapLen - from;
+    }
+
+    madvise(reader->map + from, len, MADV_WILLNEED);
+    reader->advisedTo = from + len;
+#endif
+}
+
+/**
+ * Skip records in a BGZF file by jumping straight to where the one after them
+ * starts.
+ *
+ * @param   reader
+ * @param   count
+ * @param   skipped
+ */
+static char bgzfSkipRecords(csvh_reader *reader, long count, long *skipped)
+{
+    char readAhead = (reader->readahead != NULL);
+    size_t target;
+
+    // Whatever the thread already read is from before the jump.  (And it
+    // can't be going through the blocks while they're searched.)
+    csvh_readahead_stop(reader->readahead);
+    reader->readahead = NULL;
+
+    switch (csvh_bgzf_find_record(
+        reader->bgzf,
+        reader->buffOffset + reader->recStart,
+        count,
+        &reader->dialect,
+        reader->maxRecord,
+        &target,
+        skipped
+    )) {
+        case CSVH_BGZF__OK:
+            break;
+        case CSVH_BGZF__OUT_OF_MEMORY:
+            return CSVH_READER__OUT_OF_MEMORY;
+        default:
+            return CSVH_READER__READ_ERROR;
+    }
+
+    reader->recNum += *skipped;
+
+    return bgzfJump(reader, target, readAhead);
+}
+
+/**
+ * Carry on reading a BGZF file from target (in the uncompressed input), which
+ * has to be the start of a record.  Reading ahead has to be stopped first,
+ * and is started again if readAhead.
+ *
+ * @param   reader
+ * @param   target
+ * @param   readAhead
+ */
+static char bgzfJump(csvh_reader *reader, size_t target, char readAhead)
+{
+    csvh_bgzf_seek(reader->bgzf, target);
+
+    reader->buffOffset = target;
+    reader->buffLen = 0;
+    reader->recStart = 0;
+    reader->scanPos = 0;
+    reader->fQuote = 0;
+    reader->eof = 0;
+
+    return readAhead ? csvh_reader_start_read_ahead(reader) : CSVH_READER__OK;
+}
+
+/**
+ * Jump as close as the index allows to the record count records on.  skipped
+ * is set to how many records were jumped over.
+ *
+ * @param   reader
+ * @param   count
+ * @param   skipped
+ */
+static char indexSkipRecords(csvh_reader *reader, long count, long *skipped)
+{
+    long indexedRecord;
+    uint64_t offset;
+    size_t target;
+
+    *skipped = 0;
+
+    csvh_index_find(reader->index, reader->recNum + count, &indexedRecord, &offset);
+
+    if (indexedRecord <= reader->recNum) {
+        return CSVH_READER__OK;
+    }
+
+    if (reader->bgzf != NULL) {
+        if (csvh_bgzf_from_virtual(reader->bgzf, offset, &target) != CSVH_BGZF__OK) {
+            // The sidecar doesn't go with the file after all.  Read through.
+            return CSVH_READER__OK;
+        }
+
+        char readAhead = (reader->readahead != NULL);
+
+        // Whatever the thread already read is from before the jump.
+        csvh_readahead_stop(reader->readahead);
+        reader->readahead = NULL;
+
+        *skipped = indexedRecord - reader->recNum;
+        reader->recNum = indexedRecord;
+
+        return bgzfJump(reader, target, readAhead);
+    }
+
+    *skipped = indexedRecord - reader->recNum;
+    reader->recNum = indexedRecord;
+    reader->pos = offset;
+
+    if (reader->advisedTo != 0) {
+        reader->advisedTo = reader->pos;
+        adviseMapped(reader);
+    }
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Get the next record going backwards.
+ *
+ * @param   reader
+ * @param   record
+ * @param   len
+ */
+static char reverseNextRecord(csvh_reader *reader, char **record, size_t *len)
+{
+    size_t from;
+    char reached;
+    char rc;
+
+    while (reader->revCount == 0) {
+        if (reader->revEnd <= reader->tailStart) {
+            return CSVH_READER__DONE;
+        }
+
+        if ((rc = findSureStart(reader, reader->revEnd, reader->tailStart, &from)) != CSVH_READER__OK
+            || (rc = loadStretch(reader, from, reader->revEnd, 1, &reached)) != CSVH_READER__OK
+        ) {
+            return rc;
+        }
+
+        reader->revEnd = from;
+    }
+
+    reader->revCount--;
+    *record = reader->map + reader->revStarts[reader->revCount];
+    *len = reader->revLens[reader->revCount];
+    reader->recNum++;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Find a record start before to that's sure to be one, going back no further
+ * than stop (which has to be one).  to has to be one too, or the end of the
+ * file.
+ *
+ * @param   reader
+ * @param   to
+ * @param   stop
+ * @param   sure
+ */
+static char findSureStart(csvh_reader *reader, size_t to, size_t stop, size_t *sure)
+{
+    size_t stretch = REVERSE_STRETCH;
+    size_t from;
+    char rc;
+
+    while (to - stop > stretch) {
+        // Back to right after a newline.
+        for (from = to - stretch; from > stop && reader->map[from - 1] != '\n'; from--) {}
+
+        if (from == stop) {
+            break;
+        }
+
+        if ((rc = findConvergence(reader, from, to, stop, sure)) != CSVH_READER__OK) {
+            return rc;
+        }
+
+        if (*sure < to) {
+            return CSVH_READER__OK;
+        }
+
+        stretch *= 2;
+    }
+
+    *sure = stop;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Find the first record start at or after from that the reader gets to no
+ * matter whether from (right after a newline) is a record start or inside of
+ * a quoted field.  sure is set to to if there isn't one before it.
+ *
+ * Leaves the records read as if from is a record start loaded, to check the
+ * other ways against.
+ *
+ * @param   reader
+ * @param   from
+ * @param   to
+ * @param   stop    The earliest the record at from can start.
+ * @param   sure
+ */
+static char findConvergence(
+    csvh_reader *reader,
+    size_t from,
+    size_t to,
+    size_t stop,
+    size_t *sure
+) {
+    char *map = reader->map;
+    char reached;
+    size_t met;
+    char rc;
+
+    *sure = to;
+
+    // As if a record starts at from.  If that doesn't get to a record start
+    // at to, it's not one.
+    if ((rc = loadStretch(reader, from, to, 0, &reached)) != CSVH_READER__OK || !reached) {
+        return rc;
+    }
+
+    // As if from is inside of a quoted field.
+    char fQuote = 1;
+    csvh_scan_check check = csvh_scan_start_check(&reader->dialect, map + from);
+    char *ptr = csvh_scan_find_record_end(map + from, map + to, &fQuote, &check);
+    size_t latest = from;
+
+    if (ptr != NULL && (reader->maxRecord == 0 || (size_t) (ptr - map) - stop < reader->maxRecord)) {
+        // The record ends at ptr.
+        if ((rc = readToLoaded(reader, ptr - map + 1, to, &met)) != CSVH_READER__OK) {
+            return rc;
+        }
+        if (met <= to && met > latest) {
+            latest = met;
+        }
+    } else {
+        // The reader gives up on the record, and picks back up after the
+        // first newline after the quote it blames (see
+        // csvh_scan_resync_point).  That's back before from if the quote is,
+        // and otherwise, it's a newline after a quote, no further in than
+        // the first one after the closing quote that's out of place (or the
+        // end of the record, if it's only too long).
+        size_t last = to - 1;
+        char quoted = 0;
+
+        if (ptr != NULL) {
+            last = ptr - map;
+        } else if (check.badClose != NULL) {
+            const char *nl = memchr(check.badClose, '\n', map + to - check.badClose);
+
+            if (nl != NULL) {
+                last = nl - map;
+            }
+        }
+
+        for (size_t i = from; i <= last; i++) {
+            if (map[i] == reader->dialect.quote) {
+                quoted = 1;
+            } else if (map[i] == '\n') {
+                if (quoted) {
+                    if ((rc = readToLoaded(reader, i + 1, to, &met)) != CSVH_READER__OK) {
+                        return rc;
+                    }
+                    if (met <= to && met > latest) {
+                        latest = met;
+                    }
+                }
+                quoted = 0;
+            }
+        }
+    }
+
+    // (Reading from any of those that doesn't get to a record start at to
+    // isn't the way it's really read.)
+    *sure = latest;
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Load the records from from (as if a record starts there) up to to, the same
+ * way they're read going forwards.  reached is set if the last one ends right
+ * at to (or a record starts there).
+ *
+ * @param   reader
+ * @param   from
+ * @param   to
+ * @param   countMalformed  Whether to count quoting mistakes in them.
+ * @param   reached
+ */
+static char loadStretch(
+    csvh_reader *reader,
+    size_t from,
+    size_t to,
+    char countMalformed,
+    char *reached
+) {
+    csvh_reader copy;
+    size_t start = to + 1;
+    size_t len;
+    char rc;
+
+    startStretchCopy(reader, &copy, from);
+    reader->revCount = 0;
+
+    while ((rc = stretchNextRecord(&copy, to, &start, &len)) == CSVH_READER__OK) {
+        if (reader->revCount == reader->revCap) {
+            long newCap = reader->revCap ? reader->revCap * 2 : 1024;
+            size_t *newStarts = realloc(reader->revStarts, newCap * sizeof(size_t));
+
+            if (newStarts == NULL) {
+                return CSVH_READER__OUT_OF_MEMORY;
+            }
+            reader->revStarts = newStarts;
+
+            size_t *newLens = realloc(reader->revLens, newCap * sizeof(size_t));
+
+            if (newLens == NULL) {
+                return CSVH_READER__OUT_OF_MEMORY;
+            }
+            reader->revLens = newLens;
+            reader->revCap = newCap;
+        }
+
+        reader->revStarts[reader->revCount] = start;
+        reader->revLens[reader->revCount] = len;
+        reader->revCount++;
+    }
+
+    *reached = (start == to);
+
+    if (countMalformed && copy.malformed > reader->malformed) {
+        reader->malformed = copy.malformed;
+        reader->malformedAt = copy.malformedAt;
+    }
+
+    return (rc == CSVH_READER__DONE) ? CSVH_READER__OK : rc;
+}
+
+/**
+ * Read from pos (as if a record starts there) until getting to a record
+ * start that's loaded (see loadStretch), and set met to it.  Getting to a
+ * record start at to counts too.  If it goes past to instead, met is set past
+ * it.
+ *
+ * @param   reader
+ * @param   pos
+ * @param   to
+ * @param   met
+ */
+static char readToLoaded(csvh_reader *reader, size_t pos, size_t to, size_t *met)
+{
+    csvh_reader copy;
+    size_t len;
+    char rc;
+
+    startStretchCopy(reader, &copy, pos);
+    *met = pos;
+
+    while (*met < to && !isLoadedStart(reader, *met)) {
+        rc = stretchNextRecord(&copy, to, met, &len);
+
+        if (rc != CSVH_READER__OK && rc != CSVH_READER__DONE) {
+            return rc;
+        }
+    }
+
+    return CSVH_READER__OK;
+}
+
+/**
+ * Make a copy of the reader to read a stretch of the mapped file with, from
+ * pos, going forwards, without touching the reader itself.
+ *
+ * @param   reader
+ * @param   copy
+ * @param   pos
+ */
+static void startStretchCopy(csvh_reader *reader, csvh_reader *copy, size_t pos)
+{
+    *copy = *reader;
+    copy->pos = pos;
+    copy->follow = NULL;
+    copy->advisedTo = 0;
+}
+
+/**
+ * Read the next record of a stretch that ends at to, with a copy of the
+ * reader (see startStretchCopy).  Returns CSVH_READER__DONE at the end of
+ * the stretch, with start set to to if it ended right there, or past it if a
+ * record went over it.
+ *
+ * @param   copy
+ * @param   to
+ * @param   start
+ * @param   len
+ */
+static char stretchNextRecord(csvh_reader *copy, size_t to, size_t *start, size_t *len)
+{
+    char *record;
+    char rc;
+
+    if (copy->pos < to) {
+        if ((rc = mappedNextRecord(copy, &record, len)) == CSVH_READER__OK) {
+            *start = record - copy->map;
+            if (*start < to) {
+                return CSVH_READER__OK;
+            }
+            *start = (*start == to) ? to : to + 1;
+            return CSVH_READER__DONE;
+        } else if (rc != CSVH_READER__DONE) {
+            return rc;
+        }
+    }
+
+    // (A last record without a newline ends right at the end of the file.)
+    *start = (copy->pos == to || (copy->pos > to && to == copy->mapLen))
+        ? to
+        : to + 1;
+
+    return CSVH_READER__DONE;
+}
+
+/**
+ * Whether a record of the last stretch loaded starts at start.
+ *
+ * @param   reader
+ * @param   start
+ */
+static char isLoadedStart(csvh_reader *reader, size_t start)
+{
+    long lo = 0;
+    long hi = reader->revCount;
+
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+
+        if (reader->revStarts[mid] < start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo < reader->revCount && reader->revStarts[lo] == start;
+}
+
+/**
+ * Whether the quotes are double quotes, escaped by doubling them, which is
+ * all that the index is made for (it doesn't keep track of the quoting).
+ *
+ * @param   reader
+ */
+static char isDefaultQuoting(csvh_reader *reader)
+{
+    return reader->dialect.quote == '"' && reader->dialect.escape == '\0';
+}
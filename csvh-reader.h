@@ -0,0 +1,94 @@
+#ifndef csvh_reader_h
+#define csvh_reader_h
+
+#include <stddef.h>
+
+#include "csv.h"
+
+// Constants
+
+#define CSVH_READER__OK                 0
+#define CSVH_READER__DONE               1
+#define CSVH_READER__FILE_NOT_FOUND     2
+#define CSVH_READER__OUT_OF_MEMORY      3
+#define CSVH_READER__READ_ERROR         4
+#define CSVH_READER__UNSUPPORTED_INPUT  5
+#define CSVH_READER__NOT_MAPPED         6
+#define CSVH_READER__HEADER_MISMATCH    7
+
+/**
+ * How long a record can be while still inside of a quoted field before it's
+ * taken to be a quoting mistake, unless set otherwise.
+ */
+#define CSVH_READER__DEFAULT_MAX_RECORD (16 * 1024 * 1024)
+
+typedef struct csvh_reader csvh_reader;
+
+char csvh_reader_open(csvh_reader **reader, const char *path, int encoding);
+
+char csvh_reader_open_many(
+    csvh_reader **reader,
+    char **paths,
+    int count,
+    char hasHeaders,
+    int encoding
+);
+
+char csvh_reader_open_first(csvh_reader **reader, char **paths, int count, int encoding);
+
+char csvh_reader_peek(
+    csvh_reader *reader,
+    size_t want,
+    int lines,
+    const char **sample,
+    size_t *len,
+    char *complete
+);
+
+char csvh_reader_next_record(csvh_reader *reader, char **record, size_t *len);
+
+char csvh_reader_skip_record(csvh_reader *reader);
+
+char csvh_reader_skip_records(csvh_reader *reader, long count, long *skipped);
+
+char csvh_reader_set_resync(csvh_reader *reader, size_t maxRecord, const csv_dialect *dialect);
+
+long csvh_reader_malformed(csvh_reader *reader, size_t *at);
+
+char csvh_reader_use_index(csvh_reader *reader);
+
+char csvh_reader_set_follow(csvh_reader *reader);
+
+char csvh_reader_set_tail(
+    csvh_reader *reader,
+    long count,
+    char reverse,
+    char keepFirst,
+    long *found
+);
+
+long csvh_reader_record_count(csvh_reader *reader);
+
+char csvh_reader_start_read_ahead(csvh_reader *reader);
+
+char csvh_reader_prefetch(csvh_reader *reader);
+
+char csvh_reader_is_mapped(csvh_reader *reader);
+
+char csvh_reader_mapped_rest(csvh_reader *reader, const char **start, const char **end);
+
+char csvh_reader_open_part(csvh_reader **part, csvh_reader *whole, const char *start, const char *end);
+
+char csvh_reader_skip_part(csvh_reader *reader, csvh_reader *part);
+
+int csvh_reader_later_files(csvh_reader *reader);
+
+char csvh_reader_open_later_file(csvh_reader **file, csvh_reader *reader, int ind);
+
+char csvh_reader_skip_files(csvh_reader *reader, int count, csvh_reader *file);
+
+char csvh_reader_at_end(csvh_reader *reader);
+
+char csvh_reader_close(csvh_reader *reader);
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "csvh-scan.h"
+
+// Every way of looking at blocks (a byte at a time, SSE2 and AVX2) has to
+// find the same things in the same lines.  The lines have a quote, CRLF,
+// delimiter and so on put at every place in turn, so each of them lands on
+// (and either side of) every 16- and 32-byte boundary.
+
+#define LINE_LEN 200
+#define MAX_FIELDS 64
+#define RESULTS_CAP 1000000
+
+void makeLine(char *line, int pos, const char *special);
+long scanAll(long *results);
+long scanLine(char *line, size_t len, long *results);
+long offsetOf(const char *ptr, const char *line);
+
+const char *specials[] = {
+    ",",
+    "\"",
+    "\r\n",
+    "\n",
+    "\",\"",
+    "\"\"",
+    "x\"y",
+    ",\"a\r\nb\",",
+    NULL
+};
+
+int main()
+{
+    long *scalar = malloc(sizeof(long) * RESULTS_CAP);
+    long *other = malloc(sizeof(long) * RESULTS_CAP);
+    long scalarCount;
+    long count;
+    size_t ends[MAX_FIELDS];
+
+    printf("scalar: should be 1: %d\n", csvh_scan_use(CSVH_SCAN__SCALAR));
+    scalarCount = scanAll(scalar);
+
+    // A few known ahead of time: a quoted field with CRLF in it across the
+    // first 64-byte block, and a delimiter right on a 16- and 32-byte
+    // boundary.
+    char line[LINE_LEN];
+
+    memset(line, 'a', 100);
+    memcpy(line + 60, ",\"x\r\ny\",b", 10);
+    printf("fields across a block: should be 3: %d\n", csvh_scan_fields(line, 70, ',', '"', ends, MAX_FIELDS));
+    printf("first field end: should be 60: %d\n", (int) ends[0]);
+    printf("second field end: should be 67: %d\n", (int) ends[1]);
+
+    memset(line, 'a', 100);
+    line[16] = ',';
+    line[32] = ',';
+    printf("delimiters on boundaries: should be 3: %d\n", csvh_scan_fields(line, 100, ',', '"', ends, MAX_FIELDS));
+    printf("boundary ends: should be 16 32 100: %d %d %d\n", (int) ends[0], (int) ends[1], (int) ends[2]);
+
+    memcpy(line + 40, "\"a\"b", 4);
+    printf("closed mid-field: should be %d: %d\n", CSVH_SCAN__IRREGULAR,
+        csvh_scan_fields(line, 100, ',', '"', ends, MAX_FIELDS));
+
+    line[40] = ',';
+    line[41] = '"';
+    line[42] = 'a';
+    printf("never closed: should be %d: %d\n", CSVH_SCAN__UNBALANCED,
+        csvh_scan_fields(line, 100, ',', '"', ends, MAX_FIELDS));
+
+    if (csvh_scan_use(CSVH_SCAN__SSE2)) {
+        count = scanAll(other);
+        printf("SSE2 same as scalar: should be 1: %d\n",
+            count == scalarCount && memcmp(scalar, other, sizeof(long) * count) == 0);
+    } else {
+        printf("SSE2 not supported here.\n");
+    }
+
+    if (csvh_scan_use(CSVH_SCAN__AVX2)) {
+        count = scanAll(other);
+        printf("AVX2 same as scalar: should be 1: %d\n",
+            count == scalarCount && memcmp(scalar, other, sizeof(long) * count) == 0);
+    } else {
+        printf("AVX2 not supported here.\n");
+    }
+
+    free(scalar);
+    free(other);
+}
+
+/**
+ * Fill a line with a mix of plain, quoted and escaped fields, with special put
+ * in at pos.
+ *
+ * @param   line
+ * @param   pos
+ * @param   special
+ */
+void makeLine(char *line, int pos, const char *special)
+{
+    const char *pattern = "abc,def,\"g,h\"\"i\",jk,";
+    size_t patternLen = strlen(pattern);
+
+    for (int i = 0; i < LINE_LEN; i++) {
+        line[i] = pattern[i % patternLen];
+    }
+
+    memcpy(line + pos, special, strlen(special));
+}
+
+/**
+ * Scan every test line (the way set with csvh_scan_use), and put what was
+ * found in results.  Returns the count of them.
+ *
+ * @param   results
+ */
+long scanAll(long *results)
+{
+    char line[LINE_LEN];
+    long count = 0;
+
+    for (int i = 0; specials[i] != NULL; i++) {
+        for (int pos = 0; pos + strlen(specials[i]) <= LINE_LEN; pos++) {
+            makeLine(line, pos, specials[i]);
+
+            // The whole line, and cut off right after what was put in.
+            count += scanLine(line, LINE_LEN, results + count);
+            count += scanLine(line, pos + strlen(specials[i]), results + count);
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Scan a line every way there is, and put what was found in results (as
+ * offsets into the line).  Returns the count of them.
+ *
+ * @param   line
+ * @param   len
+ * @param   results
+ */
+long scanLine(char *line, size_t len, long *results)
+{
+    csv_dialect dialect = CSV_DIALECT_DEFAULT;
+    size_t ends[MAX_FIELDS];
+    csvh_scan_counts counts;
+    csvh_scan_check check;
+    const char *stop;
+    const char *found;
+    char fQuote;
+    long count = 0;
+    int fields;
+
+    fields = csvh_scan_fields(line, len, ',', '"', ends, MAX_FIELDS);
+    results[count++] = fields;
+    for (int i = 0; i < fields && i < MAX_FIELDS; i++) {
+        results[count++] = ends[i];
+    }
+
+    fields = csvh_scan_fields_upto(line, len, ',', '"', ends, MAX_FIELDS, 3);
+    results[count++] = fields;
+    for (int i = 0; i < fields && i < MAX_FIELDS; i++) {
+        results[count++] = ends[i];
+    }
+
+    csvh_scan_count(line, line + len, '"', &counts);
+    results[count++] = counts.oddQuotes;
+    results[count++] = counts.breaks[0];
+    results[count++] = counts.breaks[1];
+    results[count++] = offsetOf(counts.firstBreak[0], line);
+    results[count++] = offsetOf(counts.firstBreak[1], line);
+
+    fQuote = 0;
+    check = csvh_scan_start_check(&dialect, line);
+    found = csvh_scan_find_record_end(line, line + len, &fQuote, &check);
+    results[count++] = offsetOf(found, line);
+    results[count++] = fQuote;
+    results[count++] = check.strays;
+    results[count++] = offsetOf(check.lastStray, line);
+    results[count++] = offsetOf(check.badClose, line);
+
+    fQuote = 0;
+    found = csvh_scan_record_end(line, line + len, ',', '"', 1, &fQuote, &stop);
+    results[count++] = offsetOf(found, line);
+    results[count++] = offsetOf(stop, line);
+    results[count++] = fQuote;
+
+    return count;
+}
+
+/**
+ * Where ptr is in the line, or -1 for NULL.
+ *
+ * @param   ptr
+ * @param   line
+ */
+long offsetOf(const char *ptr, const char *line)
+{
+    return (ptr != NULL) ? ptr - line : -1;
+}
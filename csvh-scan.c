@@ -0,0 +1,730 @@
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#include "csvh-scan.h"
+
+// This is a helper module for csvh-reader.c, csvh-index.c, csvh-bgzf.c and
+// csv.c.
+
+// It finds the bytes that matter to CSV (quotes, delimiters and line breaks)
+// a block of CSVH_SCAN__BLOCK bytes at a time, as one bit per byte in a mask
+// for each.  On x86 that's done with AVX2 or SSE2 compares, whichever the CPU
+// has (checked the first time a block is looked at, by whichever thread gets
+// there first); anywhere else, a byte at a time.
+
+// Which bytes are inside of quoted fields then comes straight from the quote
+// mask: the prefix-XOR of it (bit i is the XOR of bits 0 through i) is set
+// from each opening quote up to the closing one.  That's only right if every
+// quote opens or closes a field, so each block's quotes are checked first:
+// an opening quote has to come right after a delimiter, line break or quote
+// (for an escaped quote), and a closing one right before one (or a carriage
+// return).  If any quote in a block isn't, the block is left to the caller to
+// go through byte by byte, since what a quote like that means is up to them.
+// Well-formed input never gets there.
+
+// The quote is whichever one the dialect uses.  The delimiter is taken to be
+// a single byte, and escape characters aren't known about, so csv.c only comes
+// here for dialects with neither (see csv-variant.h for the others), and
+// csvh-reader.c only for ones without an escape character whose delimiter
+// starts and ends with the same byte (which is all it needs to know).
+
+// csvh_scan_find_record_end is what everything that splits up records goes
+// by (csvh-reader.c, csvh-index.c and csvh-bgzf.c), so that they all agree on
+// where the records are even when the quoting is off: a quote that's not at
+// the start of a field is a plain character, and one that closes a field
+// somewhere other than at its end makes the record malformed.  It uses the
+// block scan for as long as the quotes are in place, and goes a byte at a
+// time otherwise.
+
+// csvh_scan_count is different: it's for splitting a file into parts that are
+// parsed at the same time (see csv_handler_run_parts), so it can't know where
+// it starts.  It takes every quote to open or close a field, without checking,
+// and counts the line breaks outside of quotes both ways.  The caller finds
+// out later whether that was right.
+
+typedef struct {
+    uint64_t quote;
+    uint64_t delim;
+    uint64_t newline;
+    uint64_t cr;
+} blockMasks;
+
+typedef void (*classifyFn)(const char *block, char delim, char quote, blockMasks *masks);
+
+// START forward declarations for static functions.
+
+static void classifyScalar(const char *block, char delim, char quote, blockMasks *masks);
+
+#ifdef SCAN_X86
+static void classifySse2(const char *block, char delim, char quote, blockMasks *masks);
+
+static void classifyAvx2(const char *block, char delim, char quote, blockMasks *masks);
+#endif
+
+static classifyFn getClassify();
+
+static uint64_t prefixXor(uint64_t bits);
+
+static char analyzeBlock(
+    const blockMasks *masks,
+    uint64_t afterEnd,
+    char *inQuote,
+    char *prevOk,
+    uint64_t *inside
+);
+
+static char isFieldEdge(char c, char delim, char quote);
+
+static void addBreaks(csvh_scan_counts *counts, int startQuoted, const char *block, uint64_t breaks);
+
+// END forward declarations.
+
+/**
+ * Fills in the masks for a block.  NULL until getClassify picks the one to
+ * use.  (Threads might race to pick it, but they all pick the same one.)
+ */
+static _Atomic(classifyFn) classify = NULL;
+
+/**
+ * Look for the end of a record (the first line break outside of quotes) a
+ * block at a time, starting at ptr.  Returns the line break, or NULL if it
+ * stopped first, with stop set to where: either there's less than a block
+ * left before end, or the block at stop has a quote out of place.
+ *
+ * fQuote is both in and out: whether ptr is inside of a quoted field.
+ * prevOk is whether a quote at ptr could open a field (i.e., ptr is the start
+ * of the record, or the byte before it is a delimiter, line break or quote).
+ *
+ * @param   ptr
+ * @param   end
+ * @param   delim
+ * @param   quote
+ * @param   prevOk
+ * @param   fQuote
+ * @param   stop
+ */
+const char *csvh_scan_record_end(
+    const char *ptr,
+    const char *end,
+    char delim,
+    char quote,
+    char prevOk,
+    char *fQuote,
+    const char **stop
+) {
+    classifyFn classifyBlock = getClassify();
+    blockMasks masks;
+    uint64_t inside;
+    uint64_t ends;
+
+    while (end - ptr >= CSVH_SCAN__BLOCK) {
+        classifyBlock(ptr, delim, quote, &masks);
+
+        // A closing quote at the very end can't be checked yet, so let it go,
+        // same as going byte by byte.
+        uint64_t afterEnd = (end - ptr == CSVH_SCAN__BLOCK || isFieldEdge(ptr[CSVH_SCAN__BLOCK], delim, quote))
+            ? 1ULL << 63
+            : 0;
+
+        if (!analyzeBlock(&masks, afterEnd, fQuote, &prevOk, &inside)) {
+            break;
+        }
+
+        ends = masks.newline & ~inside;
+        if (ends != 0) {
+            *fQuote = 0;
+            *stop = ptr;
+            return ptr + __builtin_ctzll(ends);
+        }
+
+        ptr += CSVH_SCAN__BLOCK;
+    }
+
+    *stop = ptr;
+    return NULL;
+}
+
+/**
+ * A csvh_scan_check for a record starting at recStart.
+ *
+ * @param   dialect
+ * @param   recStart
+ */
+csvh_scan_check csvh_scan_start_check(const csv_dialect *dialect, const char *recStart)
+{
+    return (csvh_scan_check) {
+        recStart,
+        dialect->quote,
+        dialect->escape,
+        dialect->delim[dialect->delimLen - 1],
+        dialect->delim[0],
+        0,
+        NULL,
+        NULL
+    };
+}
+
+/**
+ * Find the newline that ends the record, i.e., the first one that's not
+ * inside of a quoted field.  Returns NULL if there isn't one before end.
+ *
+ * fQuote is both in and out, so the scan can pick up where it left off.
+ *
+ * A quote only starts a quoted field at the start of a field (or right after
+ * a closing quote, for an escaped quote).  Anywhere else, it's a plain
+ * character, and it's counted in check.  A closing quote has to be at the end
+ * of a field; if it isn't, check.badClose is set to it and NULL is returned.
+ * Inside of a quoted field, the escape character (if there is one) makes the
+ * byte after it a plain one.
+ *
+ * With a delimiter of more than one byte, only its last byte is looked for
+ * before an opening quote, and its first after a closing one.  That's enough
+ * to find the record ends; the fields themselves are left to csv.c.
+ *
+ * @param   ptr
+ * @param   end
+ * @param   fQuote
+ * @param   check
+ */
+char *csvh_scan_find_record_end(char *ptr, char *end, char *fQuote, csvh_scan_check *check)
+{
+    const char quote = check->quote;
+    const char escape = check->escape;
+    const char delimEnd = check->delimEnd;
+    const char delimStart = check->delimStart;
+    char inQuote = *fQuote;
+
+    if (end - ptr >= CSVH_SCAN__BLOCK && escape == '\0' && delimStart == delimEnd) {
+        // Whole blocks at a time, for as long as the quotes are all in place.
+        const char *stop;
+        char prevOk = ptr == check->recStart
+            || ptr[-1] == delimEnd
+            || ptr[-1] == '\n'
+            || (ptr[-1] == quote && ptr - 1 != check->lastStray);
+        char *found = (char *) csvh_scan_record_end(ptr, end, delimStart, quote, prevOk, &inQuote, &stop);
+
+        if (found != NULL) {
+            *fQuote = 0;
+            return found;
+        }
+
+        ptr = (char *) stop;
+    }
+
+    if (escape != '\0' && inQuote && ptr < end) {
+        // The last scan might have stopped right after an escape character.
+        size_t run = 0;
+
+        for (; ptr - run > check->recStart && ptr[-1 - (long) run] == escape; run++) {}
+        ptr += run % 2;
+    }
+
+    for (; ptr < end; ptr++) {
+        if (*ptr == quote) {
+            if (inQuote) {
+                if (ptr + 1 < end
+                    && ptr[1] != quote
+                    && ptr[1] != delimStart
+                    && ptr[1] != '\n'
+                    && ptr[1] != '\r'
+                ) {
+                    check->badClose = ptr;
+                    *fQuote = inQuote;
+                    return NULL;
+                }
+                inQuote = 0;
+            } else if (ptr == check->recStart
+                || ptr[-1] == delimEnd
+                || ptr[-1] == '\n'
+                || (ptr[-1] == quote && ptr - 1 != check->lastStray)
+            ) {
+                inQuote = 1;
+            } else {
+                check->strays++;
+                check->lastStray = ptr;
+            }
+        } else if (*ptr == '\n' && !inQuote) {
+            *fQuote = inQuote;
+            return ptr;
+        } else if (*ptr == escape && inQuote && escape != '\0') {
+            ptr++;
+        }
+    }
+
+    *fQuote = inQuote;
+    return NULL;
+}
+
+/**
+ * For a record that's inside of a quoted field from start all the way to end,
+ * find the quote to blame, and where to pick back up after it: the first
+ * newline after it, or end if there isn't one.
+ *
+ * The quote to blame is the opening quote of the first quoted field that's
+ * closed somewhere other than at the end of a field (so the quote probably
+ * wasn't meant to open one).  If there isn't one, it's the last opening quote
+ * (which is never closed).
+ *
+ * @param   start
+ * @param   end
+ * @param   check
+ * @param   badQuote
+ */
+char *csvh_scan_resync_point(char *start, char *end, const csvh_scan_check *check, char **badQuote)
+{
+    char inQuote = 0;
+    char *ptr;
+
+    *badQuote = start;
+
+    for (ptr = start; ptr < end; ptr++) {
+        if (inQuote && *ptr == check->escape && check->escape != '\0') {
+            ptr++;
+            continue;
+        }
+
+        if (*ptr != check->quote) {
+            continue;
+        }
+
+        if (!inQuote) {
+            if (ptr == start || ptr[-1] == check->delimEnd || ptr[-1] == '\n') {
+                inQuote = 1;
+                *badQuote = ptr;
+            }
+            // Otherwise, it's a plain character (see csvh_scan_find_record_end).
+        } else if (ptr + 1 < end && ptr[1] == check->quote) {
+            ptr++; // Escaped quote.
+        } else if (ptr + 1 < end
+            && ptr[1] != check->delimStart
+            && ptr[1] != '\n'
+            && ptr[1] != '\r'
+        ) {
+            break;
+        } else {
+            inQuote = 0;
+        }
+    }
+
+    char *newline = memchr(*badQuote, '\n', end - *badQuote);
+
+    return (newline != NULL) ? newline : end;
+}
+
+/**
+ * Count the line breaks outside of quotes from ptr up to end, both if ptr is
+ * outside of a quoted field and if it's inside of one, and whether there's an
+ * odd number of quotes (see csvh_scan_counts).  Every quote is taken to open
+ * or close a field, which is only right if the quoting is well-formed.
+ *
+ * @param   ptr
+ * @param   end
+ * @param   quote
+ * @param   counts
+ */
+void csvh_scan_count(const char *ptr, const char *end, char quote, csvh_scan_counts *counts)
+{
+    classifyFn classifyBlock = getClassify();
+    blockMasks masks;
+    uint64_t quoted;
+    uint64_t flip = 0;
+
+    *counts = (csvh_scan_counts) { 0, { 0, 0 }, { NULL, NULL } };
+
+    for (; end - ptr >= CSVH_SCAN__BLOCK; ptr += CSVH_SCAN__BLOCK) {
+        // (Passing the quote as the delimiter too, since it doesn't matter.)
+        classifyBlock(ptr, quote, quote, &masks);
+
+        // Set inside of quotes, if the start was outside.
+        quoted = prefixXor(masks.quote) ^ flip;
+        addBreaks(counts, 0, ptr, masks.newline & ~quoted);
+        addBreaks(counts, 1, ptr, masks.newline & quoted);
+
+        flip = (uint64_t) 0 - (quoted >> 63);
+    }
+
+    char inQuote = flip & 1;
+
+    for (; ptr < end; ptr++) {
+        if (*ptr == quote) {
+            inQuote = !inQuote;
+        } else if (*ptr == '\n') {
+            counts->breaks[(int) inQuote]++;
+            if (counts->firstBreak[(int) inQuote] == NULL) {
+                counts->firstBreak[(int) inQuote] = ptr;
+            }
+        }
+    }
+
+    counts->oddQuotes = inQuote;
+}
+
+/**
+ * Find where the fields of a line end: the delimiters outside of quotes, and
+ * then the end of the line.  Returns the count of fields, and puts up to cap
+ * of their ends in ends (call again with a bigger array if the count is more
+ * than cap; ends can be NULL to just count).
+ *
+ * Returns CSVH_SCAN__UNBALANCED if a quoted field is never closed, or
+ * CSVH_SCAN__IRREGULAR if the line needs to be gone through byte by byte.
+ *
+ * @param   line
+ * @param   len
+ * @param   delim
+ * @param   quote
+ * @param   ends
+ * @param   cap
+ */
+int csvh_scan_fields(
+    const char *line,
+    size_t len,
+    char delim,
+    char quote,
+    size_t *ends,
+    int cap
+) {
+    return csvh_scan_fields_upto(line, len, delim, quote, ends, cap, INT_MAX);
+}
+
+/**
+ * Same as csvh_scan_fields, but stops once the ends of the first want fields
+ * have been found (returning want), without looking at the rest of the line.
+ * Whatever quoting there is past that point isn't checked.
+ *
+ * @param   line
+ * @param   len
+ * @param   delim
+ * @param   quote
+ * @param   ends
+ * @param   cap
+ * @param   want
+ */
+int csvh_scan_fields_upto(
+    const char *line,
+    size_t len,
+    char delim,
+    char quote,
+    size_t *ends,
+    int cap,
+    int want
+) {
+    classifyFn classifyBlock = getClassify();
+    char tail[CSVH_SCAN__BLOCK];
+    blockMasks masks;
+    uint64_t inside;
+    uint64_t delims;
+    char inQuote = 0;
+    char prevOk = 1;
+    int count = 1;
+
+    for (size_t pos = 0; pos < len; pos += CSVH_SCAN__BLOCK) {
+        const char *block = line + pos;
+        size_t left = len - pos;
+        uint64_t afterEnd;
+
+        if (left < CSVH_SCAN__BLOCK) {
+            // Pad the last bit out to a whole block, and count the padding as
+            // past the end of the field.
+            memcpy(tail, block, left);
+            memset(tail + left, 0, CSVH_SCAN__BLOCK - left);
+            classifyBlock(tail, delim, quote, &masks);
+
+            uint64_t valid = (1ULL << left) - 1;
+            masks.quote &= valid;
+            masks.delim &= valid;
+            masks.newline &= valid;
+            masks.cr &= valid;
+            afterEnd = ~valid >> 1 | 1ULL << 63;
+        } else {
+            classifyBlock(block, delim, quote, &masks);
+            afterEnd = (left == CSVH_SCAN__BLOCK || isFieldEdge(block[CSVH_SCAN__BLOCK], delim, quote))
+                ? 1ULL << 63
+                : 0;
+        }
+
+        if (!analyzeBlock(&masks, afterEnd, &inQuote, &prevOk, &inside)
+            || (masks.newline & ~inside) != 0
+        ) {
+            return CSVH_SCAN__IRREGULAR;
+        }
+
+        for (delims = masks.delim & ~inside; delims != 0; delims &= delims - 1) {
+            if (count <= cap) {
+                ends[count - 1] = pos + __builtin_ctzll(delims);
+            }
+            count++;
+        }
+
+        if (count > want) {
+            return want;
+        }
+    }
+
+    if (inQuote) {
+        return CSVH_SCAN__UNBALANCED;
+    }
+
+    if (count <= cap) {
+        ends[count - 1] = len;
+    }
+
+    return count;
+}
+
+/**
+ * Look at blocks the given way (CSVH_SCAN__SCALAR, CSVH_SCAN__SSE2 or
+ * CSVH_SCAN__AVX2) from now on, instead of the fastest one the CPU has, e.g.
+ * to check them against each other.  Returns 0 (and changes nothing) if the
+ * CPU or the build doesn't have it.
+ *
+ * @param   kind
+ */
+char csvh_scan_use(int kind)
+{
+    classifyFn fn = classifyScalar;
+
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if (kind == CSVH_SCAN__AVX2 && __builtin_cpu_supports("avx2")) {
+        fn = classifyAvx2;
+    } else if (kind == CSVH_SCAN__SSE2 && __builtin_cpu_supports("sse2")) {
+        fn = classifySse2;
+    } else if (kind != CSVH_SCAN__SCALAR) {
+        return 0;
+    }
+#else
+    if (kind != CSVH_SCAN__SCALAR) {
+        return 0;
+    }
+#endif
+
+    atomic_store_explicit(&classify, fn, memory_order_relaxed);
+
+    return 1;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Fill in the masks a byte at a time.
+ *
+ * @param   block
+ * @param   delim
+ * @param   quote
+ * @param   masks
+ */
+static void classifyScalar(const char *block, char delim, char quote, blockMasks *masks)
+{
+    blockMasks m = { 0, 0, 0, 0 };
+
+    for (int i = 0; i < CSVH_SCAN__BLOCK; i++) {
+        uint64_t bit = 1ULL << i;
+
+        if (block[i] == quote) {
+            m.quote |= bit;
+        } else if (block[i] == delim) {
+            m.delim |= bit;
+        } else if (block[i] == '\n') {
+            m.newline |= bit;
+        } else if (block[i] == '\r') {
+            m.cr |= bit;
+        }
+    }
+
+    *masks = m;
+}
+
+#ifdef SCAN_X86
+/**
+ * Fill in the masks 16 bytes at a time.
+ *
+ * @param   block
+ * @param   delim
+ * @param   quote
+ * @param   masks
+ */
+__attribute__((target("sse2")))
+static void classifySse2(const char *block, char delim, char quote, blockMasks *masks)
+{
+    const __m128i quotes = _mm_set1_epi8(quote);
+    const __m128i del = _mm_set1_epi8(delim);
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    blockMasks m = { 0, 0, 0, 0 };
+
+    for (int i = 0; i < CSVH_SCAN__BLOCK / 16; i++) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (block + 16 * i));
+        int shift = 16 * i;
+
+        m.quote |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quotes)) << shift;
+        m.delim |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, del)) << shift;
+        m.newline |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)) << shift;
+        m.cr |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, cr)) << shift;
+    }
+
+    *masks = m;
+}
+
+/**
+ * Fill in the masks 32 bytes at a time.
+ *
+ * @param   block
+ * @param   delim
+ * @param   quote
+ * @param   masks
+ */
+__attribute__((target("avx2")))
+static void classifyAvx2(const char *block, char delim, char quote, blockMasks *masks)
+{
+    const __m256i quotes = _mm256_set1_epi8(quote);
+    const __m256i del = _mm256_set1_epi8(delim);
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+
+    __m256i lo = _mm256_loadu_si256((const __m256i *) block);
+    __m256i hi = _mm256_loadu_si256((const __m256i *) (block + 32));
+
+#define MASK_OF(CHARS) \
+    ((uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, CHARS)) \
+        | (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, CHARS)) << 32)
+
+    masks->quote = MASK_OF(quotes);
+    masks->delim = MASK_OF(del);
+    masks->newline = MASK_OF(newline);
+    masks->cr = MASK_OF(cr);
+
+#undef MASK_OF
+}
+#endif
+
+/**
+ * Get the fastest way to fill in masks that the CPU supports, picking it the
+ * first time.
+ */
+static classifyFn getClassify()
+{
+    classifyFn fn = atomic_load_explicit(&classify, memory_order_relaxed);
+
+    if (fn != NULL) {
+        return fn;
+    }
+
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        fn = classifyAvx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        fn = classifySse2;
+    } else {
+        fn = classifyScalar;
+    }
+#else
+    fn = classifyScalar;
+#endif
+
+    atomic_store_explicit(&classify, fn, memory_order_relaxed);
+
+    return fn;
+}
+
+/**
+ * Bit i of the result is the XOR of bits 0 through i.
+ *
+ * @param   bits
+ */
+static uint64_t prefixXor(uint64_t bits)
+{
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+
+    return bits;
+}
+
+/**
+ * Work out which bytes of a block are inside of quoted fields (set in inside,
+ * from each opening quote up to but not including the closing one).  Returns
+ * 0, without changing anything, if a quote is out of place.
+ *
+ * inQuote and prevOk carry over from one block to the next (see
+ * csvh_scan_record_end).  Bit i of afterEnd is set if a closing quote can be
+ * at byte i no matter what, because the byte after it is past the end of what
+ * is being scanned, or (for bit 63) it's the first byte of the next block and
+ * it's a delimiter, line break, quote or carriage return.
+ *
+ * @param   masks
+ * @param   afterEnd
+ * @param   inQuote
+ * @param   prevOk
+ * @param   inside
+ */
+static char analyzeBlock(
+    const blockMasks *masks,
+    uint64_t afterEnd,
+    char *inQuote,
+    char *prevOk,
+    uint64_t *inside
+) {
+    uint64_t quoted = prefixXor(masks->quote) ^ (*inQuote ? ~0ULL : 0);
+    uint64_t opens = masks->quote & quoted;
+    uint64_t closes = masks->quote & ~quoted;
+    uint64_t edges = masks->delim | masks->newline | masks->quote;
+    uint64_t openOk = edges << 1 | (uint64_t) *prevOk;
+    uint64_t closeOk = (edges | masks->cr) >> 1 | afterEnd;
+
+    if ((opens & ~openOk) != 0 || (closes & ~closeOk) != 0) {
+        return 0;
+    }
+
+    *inside = quoted;
+    *inQuote = quoted >> 63;
+    *prevOk = edges >> 63;
+
+    return 1;
+}
+
+/**
+ * Whether a closing quote can come right before c.
+ *
+ * @param   c
+ * @param   delim
+ * @param   quote
+ */
+static char isFieldEdge(char c, char delim, char quote)
+{
+    return c == delim || c == '\n' || c == '\r' || c == quote;
+}
+
+/**
+ * Count a block's line breaks outside of quotes for one of the ways it could
+ * have started out (see csvh_scan_count).
+ *
+ * @param   counts
+ * @param   startQuoted
+ * @param   block
+ * @param   breaks
+ */
+static void addBreaks(csvh_scan_counts *counts, int startQuoted, const char *block, uint64_t breaks)
+{
+    if (breaks == 0) {
+        return;
+    }
+
+    if (counts->firstBreak[startQuoted] == NULL) {
+        counts->firstBreak[startQuoted] = block + __builtin_ctzll(breaks);
+    }
+    counts->breaks[startQuoted] += __builtin_popcountll(breaks);
+}
@@ -0,0 +1,125 @@
+#ifndef csvh_scan_h
+#define csvh_scan_h
+
+#include <stddef.h>
+
+#include "csv.h"
+
+// Constants
+
+/**
+ * Bytes looked at at once.
+ */
+#define CSVH_SCAN__BLOCK                64
+
+/**
+ * From csvh_scan_fields: a quoted field is never closed.
+ */
+#define CSVH_SCAN__UNBALANCED           -1
+
+/**
+ * From csvh_scan_fields: a quote is out of place (or there's a line break
+ * outside of quotes), so the line needs to be gone through byte by byte.
+ */
+#define CSVH_SCAN__IRREGULAR            -2
+
+/**
+ * For csvh_scan_use: ways of looking at a block.
+ */
+#define CSVH_SCAN__SCALAR               0
+#define CSVH_SCAN__SSE2                 1
+#define CSVH_SCAN__AVX2                 2
+
+/**
+ * From csvh_scan_count: what a stretch of the input looks like, both ways it
+ * could start out: [0] outside of a quoted field, [1] inside of one.
+ */
+typedef struct {
+    /**
+     * Whether the count of quotes in it is odd (i.e., it ends up the other
+     * way than it started).
+     */
+    char oddQuotes;
+
+    /**
+     * Count of line breaks outside of quotes, and the first one (NULL if
+     * there aren't any).
+     */
+    long breaks[2];
+    const char *firstBreak[2];
+} csvh_scan_counts;
+
+/**
+ * For csvh_scan_find_record_end: what's needed to tell a quote that's out of
+ * place, and the ones that were found.
+ */
+typedef struct {
+    /**
+     * Start of the record being scanned.
+     */
+    const char *recStart;
+
+    /**
+     * From the dialect: the quote, the escape character ('\0' if none), and
+     * the bytes of the delimiter a quote has to come right after (its last)
+     * to open a field and right before (its first) to close one.
+     */
+    char quote;
+    char escape;
+    char delimEnd;
+    char delimStart;
+
+    /**
+     * Count of opening quotes found out of place (which are plain
+     * characters), and the last one.
+     */
+    long strays;
+    const char *lastStray;
+
+    /**
+     * The closing quote of a quoted field, if it was somewhere other than at
+     * the end of a field (NULL otherwise).  The scan stops there.
+     */
+    const char *badClose;
+} csvh_scan_check;
+
+const char *csvh_scan_record_end(
+    const char *ptr,
+    const char *end,
+    char delim,
+    char quote,
+    char prevOk,
+    char *fQuote,
+    const char **stop
+);
+
+csvh_scan_check csvh_scan_start_check(const csv_dialect *dialect, const char *recStart);
+
+char *csvh_scan_find_record_end(char *ptr, char *end, char *fQuote, csvh_scan_check *check);
+
+char *csvh_scan_resync_point(char *start, char *end, const csvh_scan_check *check, char **badQuote);
+
+void csvh_scan_count(const char *ptr, const char *end, char quote, csvh_scan_counts *counts);
+
+int csvh_scan_fields(
+    const char *line,
+    size_t len,
+    char delim,
+    char quote,
+    size_t *ends,
+    int cap
+);
+
+int csvh_scan_fields_upto(
+    const char *line,
+    size_t len,
+    char delim,
+    char quote,
+    size_t *ends,
+    int cap,
+    int want
+);
+
+char csvh_scan_use(int kind);
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "csvh-set.h"
+
+// Enough values that the table has to grow a bunch of times along the way.
+
+#define VALUE_COUNT 20000
+
+char hasAll(csvh_set *set, int from, int to);
+char hasNone(csvh_set *set, int from, int to);
+int valueOf(int i, char *dest);
+
+int main()
+{
+    csvh_set *set = csvh_set_new();
+    char value[32];
+    int len;
+
+    for (int i = 0; i < VALUE_COUNT; i++) {
+        len = valueOf(i, value);
+        csvh_set_add(set, value, len);
+    }
+
+    printf("count: should be %d: %ld\n", VALUE_COUNT, csvh_set_count(set));
+    printf("has every value: should be 1: %d\n", hasAll(set, 0, VALUE_COUNT));
+    printf("has no others: should be 1: %d\n", hasNone(set, VALUE_COUNT, VALUE_COUNT * 2));
+
+    // Already in it.
+    len = valueOf(123, value);
+    csvh_set_add(set, value, len);
+    printf("count after adding one again: should be %d: %ld\n", VALUE_COUNT, csvh_set_count(set));
+
+    // Prefixes of values (same start, different lengths) aren't them.
+    printf("prefix of a value: should be 0: %d\n", csvh_set_has(set, value, len - 1));
+
+    // Values can have anything in them, including zero bytes, and be empty.
+    csvh_set_add(set, "a\0b", 3);
+    printf("zero byte: should be 1: %d\n", csvh_set_has(set, "a\0b", 3));
+    printf("zero byte, cut short: should be 0: %d\n", csvh_set_has(set, "a", 1));
+    printf("empty, before adding it: should be 0: %d\n", csvh_set_has(set, "", 0));
+    csvh_set_add(set, "", 0);
+    printf("empty: should be 1: %d\n", csvh_set_has(set, "", 0));
+
+    // A shared set sticks around until the last reference to it is let go.
+    csvh_set *shared = csvh_set_share(set);
+    csvh_set_free(set);
+    printf("shared, after the first is let go: should be 1: %d\n", hasAll(shared, 0, VALUE_COUNT));
+    csvh_set_free(shared);
+
+    // An empty set.
+    set = csvh_set_new();
+    printf("empty set: should be 0 1: %ld %d\n", csvh_set_count(set), hasNone(set, 0, 100));
+    csvh_set_free(set);
+}
+
+/**
+ * Whether the set has every value from from up to to.
+ *
+ * @param   set
+ * @param   from
+ * @param   to
+ */
+char hasAll(csvh_set *set, int from, int to)
+{
+    char value[32];
+
+    for (int i = from; i < to; i++) {
+        if (!csvh_set_has(set, value, valueOf(i, value))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Whether the set has none of the values from from up to to.
+ *
+ * @param   set
+ * @param   from
+ * @param   to
+ */
+char hasNone(csvh_set *set, int from, int to)
+{
+    char value[32];
+
+    for (int i = from; i < to; i++) {
+        if (csvh_set_has(set, value, valueOf(i, value))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Value number i (like a customer ID), in dest.  Returns its length.
+ *
+ * @param   i
+ * @param   dest
+ */
+int valueOf(int i, char *dest)
+{
+    return sprintf(dest, "CUST-%d", i * 7);
+}
@@ -0,0 +1,312 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csvh-set.h"
+
+// This is a helper module for csvh-line-helper.c.
+
+// It's a set of strings (the values an equals condition is looking for), so
+// that checking a field against it takes the same time no matter how many
+// values there are.  It's a hash table with open addressing: each slot holds
+// a value's hash and which value it is, and a lookup goes through the slots
+// from the one the hash picks until it finds the value or an empty slot.  At
+// most half of the slots are full, so that's usually one or two.
+
+// The values themselves are kept back to back in a single buffer, not
+// null-terminated (so they can have anything in them).
+
+// Once it's filled in, a set is only ever read, so it can be shared (e.g., by
+// copies of the line helper on other threads; see csvh_set_share).
+
+/**
+ * Starting number of slots.  Always a power of two.
+ */
+#define START_SLOTS 64
+
+/**
+ * A value in the set: where it is in the strings buffer.
+ */
+typedef struct {
+    size_t offset;
+    size_t len;
+} setValue;
+
+/**
+ * A slot of the table.  value is one more than the index of the value (so 0
+ * means it's empty).
+ */
+typedef struct {
+    uint64_t hash;
+    size_t value;
+} setSlot;
+
+struct csvh_set {
+    char *strings;
+    size_t stringsLen;
+    size_t stringsCap;
+
+    setValue *values;
+    long count;
+    long valuesCap;
+
+    setSlot *slots;
+    size_t slotCount;
+
+    /**
+     * How many have it (see csvh_set_share).
+     */
+    int refs;
+};
+
+// START forward declarations for static functions.
+
+static setSlot *findSlot(csvh_set *set, uint64_t hash, const char *value, size_t len);
+
+static char growSlots(csvh_set *set);
+
+static uint64_t hashValue(const char *value, size_t len);
+
+static uint64_t mix(uint64_t bits);
+
+// END forward declarations.
+
+/**
+ * Make a new, empty set.  Returns NULL if out of memory.  Let go of it with
+ * csvh_set_free.
+ */
+csvh_set *csvh_set_new()
+{
+    csvh_set *set = calloc(1, sizeof(csvh_set));
+
+    if (set == NULL) {
+        return NULL;
+    }
+
+    set->slotCount = START_SLOTS;
+    set->slots = calloc(set->slotCount, sizeof(setSlot));
+    set->refs = 1;
+
+    if (set->slots == NULL) {
+        free(set);
+        return NULL;
+    }
+
+    return set;
+}
+
+/**
+ * Add a value to the set, if it's not already in it.  It's copied.
+ *
+ * @param   set
+ * @param   value
+ * @param   len
+ */
+char csvh_set_add(csvh_set *set, const char *value, size_t len)
+{
+    uint64_t hash = hashValue(value, len);
+    setSlot *slot = findSlot(set, hash, value, len);
+
+    if (slot->value != 0) {
+        return CSVH_SET__OK;
+    }
+
+    if (set->stringsLen + len > set->stringsCap) {
+        size_t cap = (set->stringsCap > 0) ? set->stringsCap : 4096;
+
+        while (cap < set->stringsLen + len) {
+            cap *= 2;
+        }
+
+        char *grown = realloc(set->strings, cap);
+        if (grown == NULL) {
+            return CSVH_SET__OUT_OF_MEMORY;
+        }
+        set->strings = grown;
+        set->stringsCap = cap;
+    }
+
+    if (set->count == set->valuesCap) {
+        long cap = (set->valuesCap > 0) ? set->valuesCap * 2 : START_SLOTS;
+        setValue *grown = realloc(set->values, sizeof(setValue) * cap);
+
+        if (grown == NULL) {
+            return CSVH_SET__OUT_OF_MEMORY;
+        }
+        set->values = grown;
+        set->valuesCap = cap;
+    }
+
+    memcpy(set->strings + set->stringsLen, value, len);
+    set->values[set->count] = (setValue) { set->stringsLen, len };
+    set->stringsLen += len;
+    set->count++;
+
+    slot->hash = hash;
+    slot->value = set->count;
+
+    if ((size_t) set->count * 2 > set->slotCount) {
+        return growSlots(set);
+    }
+
+    return CSVH_SET__OK;
+}
+
+/**
+ * Whether the value is in the set.
+ *
+ * @param   set
+ * @param   value
+ * @param   len
+ */
+char csvh_set_has(csvh_set *set, const char *value, size_t len)
+{
+    return findSlot(set, hashValue(value, len), value, len)->value != 0;
+}
+
+/**
+ * How many values are in the set.
+ *
+ * @param   set
+ */
+long csvh_set_count(csvh_set *set)
+{
+    return set->count;
+}
+
+/**
+ * Get another reference to the set, for something else to read it through.
+ * Each one is let go of with csvh_set_free, and the set is only freed when
+ * the last one is.  (Taking and letting go of references isn't thread-safe,
+ * only reading is.)
+ *
+ * @param   set
+ */
+csvh_set *csvh_set_share(csvh_set *set)
+{
+    set->refs++;
+
+    return set;
+}
+
+/**
+ * Let go of a reference to the set, freeing it if it was the last one.
+ *
+ * @param   set
+ */
+void csvh_set_free(csvh_set *set)
+{
+    if (set == NULL || --set->refs > 0) {
+        return;
+    }
+
+    free(set->strings);
+    free(set->values);
+    free(set->slots);
+    free(set);
+}
+
+
+// Static functions below this line.
+
+/**
+ * Find the slot with the value in it, or else the empty slot it would go in.
+ *
+ * @param   set
+ * @param   hash
+ * @param   value
+ * @param   len
+ */
+static setSlot *findSlot(csvh_set *set, uint64_t hash, const char *value, size_t len)
+{
+    size_t mask = set->slotCount - 1;
+
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        setSlot *slot = &set->slots[i];
+
+        if (slot->value == 0) {
+            return slot;
+        }
+
+        if (slot->hash == hash) {
+            const setValue *found = &set->values[slot->value - 1];
+
+            if (found->len == len && memcmp(set->strings + found->offset, value, len) == 0) {
+                return slot;
+            }
+        }
+    }
+}
+
+/**
+ * Double the number of slots, and put every value back in.
+ *
+ * @param   set
+ */
+static char growSlots(csvh_set *set)
+{
+    size_t slotCount = set->slotCount * 2;
+    size_t mask = slotCount - 1;
+    setSlot *slots = calloc(slotCount, sizeof(setSlot));
+
+    if (slots == NULL) {
+        return CSVH_SET__OUT_OF_MEMORY;
+    }
+
+    for (size_t i = 0; i < set->slotCount; i++) {
+        if (set->slots[i].value == 0) {
+            continue;
+        }
+
+        size_t j = set->slots[i].hash & mask;
+        while (slots[j].value != 0) {
+            j = (j + 1) & mask;
+        }
+        slots[j] = set->slots[i];
+    }
+
+    free(set->slots);
+    set->slots = slots;
+    set->slotCount = slotCount;
+
+    return CSVH_SET__OK;
+}
+
+/**
+ * Hash a value, eight bytes at a time.
+ *
+ * @param   value
+ * @param   len
+ */
+static uint64_t hashValue(const char *value, size_t len)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ len;
+    uint64_t bits;
+
+    for (; len >= 8; value += 8, len -= 8) {
+        memcpy(&bits, value, 8);
+        hash = mix(hash ^ bits);
+    }
+
+    bits = 0;
+    memcpy(&bits, value, len);
+
+    return mix(hash ^ bits);
+}
+
+/**
+ * Scramble the bits, so that every bit of the result depends on every bit
+ * that went in (the splitmix64 finalizer).
+ *
+ * @param   bits
+ */
+static uint64_t mix(uint64_t bits)
+{
+    bits ^= bits >> 30;
+    bits *= 0xbf58476d1ce4e5b9ULL;
+    bits ^= bits >> 27;
+    bits *= 0x94d049bb133111ebULL;
+    bits ^= bits >> 31;
+
+    return bits;
+}
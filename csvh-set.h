@@ -0,0 +1,25 @@
+#ifndef csvh_set_h
+#define csvh_set_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_SET__OK                    0
+#define CSVH_SET__OUT_OF_MEMORY         1
+
+typedef struct csvh_set csvh_set;
+
+csvh_set *csvh_set_new();
+
+char csvh_set_add(csvh_set *set, const char *value, size_t len);
+
+char csvh_set_has(csvh_set *set, const char *value, size_t len);
+
+long csvh_set_count(csvh_set *set);
+
+csvh_set *csvh_set_share(csvh_set *set);
+
+void csvh_set_free(csvh_set *set);
+
+#endif
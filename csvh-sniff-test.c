@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "csvh-sniff.h"
+
+#define SNIFF_DELIM(SAMPLE) csvh_sniff_delim(SAMPLE, strlen(SAMPLE), 1, '"', &delim)
+#define SNIFF_HEADER(SAMPLE, DELIM) \
+    csvh_sniff_has_header(SAMPLE, strlen(SAMPLE), 1, '"', DELIM, &hasHeader)
+#define SNIFF_QUOTE(SAMPLE, DELIM) csvh_sniff_quote(SAMPLE, strlen(SAMPLE), 1, DELIM, &quote)
+
+int main()
+{
+    char delim;
+    char hasHeader;
+    char quote;
+    char rc;
+
+    // Delimiters.
+    delim = '?';
+    rc = SNIFF_DELIM("a,b,c\n1,2,3\n4,5,6\n");
+    printf("commas: should be 0 ,: %d %c\n", rc, delim);
+
+    delim = '?';
+    rc = SNIFF_DELIM("a\tb\n1\t2\n3\t4\n");
+    printf("tabs: should be 0 \\t: %d %s\n", rc, (delim == '\t') ? "\\t" : "?");
+
+    // Commas in the numbers, but not the same count in every row.
+    delim = '?';
+    rc = SNIFF_DELIM("a;b\n1,5;2,5\n3,25;4\n10;2,75\n");
+    printf("semicolons: should be 0 ;: %d %c\n", rc, delim);
+
+    // Quoted fields with other candidates in them don't count.
+    delim = '?';
+    rc = SNIFF_DELIM("a|b\n\"x,y,z\"|1\n\"w;v\"|2\nq|3\n");
+    printf("pipes around quoted fields: should be 0 |: %d %c\n", rc, delim);
+
+    delim = '?';
+    rc = SNIFF_DELIM("a\nb\nc\n");
+    printf("one column: should be 1 ?: %d %c\n", rc, delim);
+
+    // A cut off last row doesn't count, unless the sample is complete.
+    delim = '?';
+    rc = csvh_sniff_delim("a;b\n1;2\n3", 9, 0, '"', &delim);
+    printf("cut off sample: should be 0 ;: %d %c\n", rc, delim);
+
+    // CRLF.
+    delim = '?';
+    rc = SNIFF_DELIM("a;b\r\n1;2\r\n3;4\r\n");
+    printf("CRLF: should be 0 ;: %d %c\n", rc, delim);
+
+    // Quotes.
+    quote = '?';
+    rc = SNIFF_QUOTE("a,'b,c'\n'it''s',2\n'x',3\n", ',');
+    printf("single quotes: should be 0 ': %d %c\n", rc, quote);
+
+    quote = '?';
+    rc = SNIFF_QUOTE("a,\"b,c\"\n\"it's\",2\n\"x\",3\n", ',');
+    printf("double quotes around apostrophes: should be 0 \": %d %c\n", rc, quote);
+
+    // Apostrophes in words, and at the start of one, aren't quoting anything.
+    quote = '?';
+    rc = SNIFF_QUOTE("name;said\nbob;don't\nann;'twas\n", ';');
+    printf("apostrophes: should be 1 ?: %d %c\n", rc, quote);
+
+    quote = '?';
+    rc = SNIFF_QUOTE("a\tb\n1\t2\n", '\t');
+    printf("no quotes: should be 1 ?: %d %c\n", rc, quote);
+
+    // Closing right before CRLF, and cut off in a quoted field.
+    quote = '?';
+    rc = SNIFF_QUOTE("'a';'b'\r\n'c';'d'\r\n", ';');
+    printf("CRLF: should be 0 ': %d %c\n", rc, quote);
+
+    quote = '?';
+    rc = csvh_sniff_quote("'a','b'\n'c','d", 15, 0, ',', &quote);
+    printf("cut off sample: should be 0 ': %d %c\n", rc, quote);
+
+    // Headers.
+    hasHeader = -1;
+    rc = SNIFF_HEADER("name,age\nbob,31\nann,45\n", ',');
+    printf("numbers under text: should be 0 1: %d %d\n", rc, hasHeader);
+
+    hasHeader = -1;
+    rc = SNIFF_HEADER("1,2\n3,4\n5,6\n", ',');
+    printf("all numbers: should be 0 0: %d %d\n", rc, hasHeader);
+
+    hasHeader = -1;
+    rc = SNIFF_HEADER("code,state\nAB1,CA\nCD2,NV\n", ',');
+    printf("same lengths under others: should be 0 1: %d %d\n", rc, hasHeader);
+
+    hasHeader = -1;
+    rc = SNIFF_HEADER("abc,de\nfgh,ij\nklm,no\n", ',');
+    printf("same lengths all the way: should be 0 0: %d %d\n", rc, hasHeader);
+
+    hasHeader = -1;
+    rc = SNIFF_HEADER("apple,dog\nbanana split,cat\nfig,hamster\n", ',');
+    printf("text of every length: should be 1 -1: %d %d\n", rc, hasHeader);
+
+    hasHeader = -1;
+    rc = SNIFF_HEADER("\"name\",\"n\"\n\"x, y\",\"1\"\n\"z\",\"22\"\n", ',');
+    printf("quoted: should be 0 1: %d %d\n", rc, hasHeader);
+}
@@ -0,0 +1,573 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "csvh-sniff.h"
+
+// This is a helper module for csv-handler.c.
+
+// It guesses the dialect of the input from a sample of its start (at most
+// CSVH_SNIFF__SAMPLE bytes and CSVH_SNIFF__ROWS rows), so that -d and -n don't
+// usually have to be given.  Each guess is one pass over the sample.
+
+// The delimiter is whichever candidate splits the rows most consistently:
+// the one whose most common count per row is shared by the most rows.  A
+// candidate that isn't in most of the rows at all doesn't count, and a tie
+// goes to the one listed first (so a comma, if it's in the running).
+
+// Whether the first row is a header is voted on by the columns.  A column
+// whose values below the first row are all numbers votes for a header if the
+// first row's value isn't one, and against it if it is.  Otherwise, a column
+// whose values are all the same length votes for a header if the first row's
+// value is a different length, and against it if it's the same (this one only
+// once there are at least two rows below the first).
+
+// The quote is whichever candidate wraps the most fields cleanly, next to the
+// delimiter: opening right at the start of a field and closing right at its
+// end.  Each one that's anywhere else (like an apostrophe in a word) counts
+// against it.  If neither wraps more fields than it has out of place, or they
+// tie, it's left alone (so a double quote, usually).
+
+// The delimiter is guessed going by the dialect's quote, and the quote going
+// by the delimiter, so if the quote changes, the caller guesses the delimiter
+// over again.  Quotes are taken to be escaped by doubling them (an escape
+// character only makes a difference in the odd quoted field).
+
+/**
+ * Columns of the sample looked at for a header.
+ */
+#define HEADER_COLUMNS 64
+
+/**
+ * colLen values: not set yet, and not all the same.
+ */
+#define LEN_UNSET -1
+#define LEN_VARIES -2
+
+/**
+ * Delimiters to try, best first.
+ */
+static const char candidates[] = { ',', '\t', ';', '|' };
+
+#define CANDIDATE_COUNT ((int) sizeof(candidates))
+
+/**
+ * Quotes to try, best first.
+ */
+static const char quoteCandidates[] = { '"', '\'' };
+
+#define QUOTE_CANDIDATE_COUNT ((int) sizeof(quoteCandidates))
+
+/**
+ * What's known about the columns, for csvh_sniff_has_header.
+ */
+typedef struct {
+    /**
+     * Fields in the first row, and what they look like.
+     */
+    int headerCount;
+    char headerNumber[HEADER_COLUMNS];
+    size_t headerLen[HEADER_COLUMNS];
+
+    /**
+     * Rows after the first one with the same count of fields as it.
+     */
+    int dataRows;
+
+    /**
+     * Whether the column has been all numbers (or empty), and its length
+     * if they've all been the same.
+     */
+    char colNumber[HEADER_COLUMNS];
+    char colFilled[HEADER_COLUMNS];
+    long colLen[HEADER_COLUMNS];
+
+    /**
+     * The row being gone through: its fields so far, and what they look
+     * like.
+     */
+    int rowCount;
+    char rowNumber[HEADER_COLUMNS];
+    size_t rowLen[HEADER_COLUMNS];
+    char rowEmpty[HEADER_COLUMNS];
+} columnStats;
+
+// START forward declarations for static functions.
+
+static int compareInts(const void *a, const void *b);
+
+static int modeOf(int *counts, int rowCount, int *hits);
+
+static int scoreQuote(const char *sample, size_t len, char complete, char delim, char quote);
+
+static char isFieldEnd(const char *ptr, const char *end, char delim);
+
+static void addField(columnStats *stats, const char *start, const char *end, char quote);
+
+static void endRow(columnStats *stats);
+
+static char isNumber(const char *start, const char *end, char quote);
+
+// END forward declarations.
+
+/**
+ * Guess the delimiter.  complete is whether the sample is the whole input (so
+ * that its last row isn't cut off).  Returns CSVH_SNIFF__UNSURE, leaving
+ * delim alone, if no candidate splits the rows consistently.
+ *
+ * @param   sample
+ * @param   len
+ * @param   complete
+ * @param   quote
+ * @param   delim
+ */
+char csvh_sniff_delim(const char *sample, size_t len, char complete, char quote, char *delim)
+{
+    int counts[CANDIDATE_COUNT][CSVH_SNIFF__ROWS];
+    int row[CANDIDATE_COUNT] = { 0 };
+    int rowCount = 0;
+    char inQuote = 0;
+    char fieldStart = 1;
+    char blank = 1;
+    const char *end = sample + len;
+
+    for (const char *ptr = sample; ptr < end && rowCount < CSVH_SNIFF__ROWS; ptr++) {
+        if (inQuote) {
+            if (*ptr == quote) {
+                if (ptr + 1 < end && ptr[1] == quote) {
+                    ptr++;
+                } else {
+                    inQuote = 0;
+                }
+            }
+            continue;
+        }
+
+        if (*ptr == quote) {
+            inQuote = fieldStart;
+            fieldStart = 0;
+            blank = 0;
+            continue;
+        }
+
+        switch (*ptr) {
+            case '\n':
+                if (!blank) {
+                    for (int i = 0; i < CANDIDATE_COUNT; i++) {
+                        counts[i][rowCount] = row[i];
+                        row[i] = 0;
+                    }
+                    rowCount++;
+                }
+                blank = 1;
+                fieldStart = 1;
+                continue;
+            case '\r':
+                continue;
+            case ',':
+                row[0]++;
+                blank = 0;
+                fieldStart = 1;
+                continue;
+            case '\t':
+                row[1]++;
+                blank = 0;
+                fieldStart = 1;
+                continue;
+            case ';':
+                row[2]++;
+                blank = 0;
+                fieldStart = 1;
+                continue;
+            case '|':
+                row[3]++;
+                blank = 0;
+                fieldStart = 1;
+                continue;
+        }
+
+        // Any of the candidates could be the delimiter, so a field could
+        // start after any of them (see above).
+        fieldStart = 0;
+        blank = 0;
+    }
+
+    if (complete && !blank && !inQuote && rowCount < CSVH_SNIFF__ROWS) {
+        // The last row doesn't have a line break, but it's all there.
+        for (int i = 0; i < CANDIDATE_COUNT; i++) {
+            counts[i][rowCount] = row[i];
+        }
+        rowCount++;
+    }
+
+    int best = -1;
+    int bestHits = 0;
+
+    for (int i = 0; i < CANDIDATE_COUNT; i++) {
+        int hits;
+        int mode = modeOf(counts[i], rowCount, &hits);
+
+        if (mode > 0 && hits * 2 > rowCount && hits > bestHits) {
+            best = i;
+            bestHits = hits;
+        }
+    }
+
+    if (best == -1) {
+        return CSVH_SNIFF__UNSURE;
+    }
+
+    *delim = candidates[best];
+
+    return CSVH_SNIFF__OK;
+}
+
+/**
+ * Guess the quote, given the delimiter.  Returns CSVH_SNIFF__UNSURE, leaving
+ * quote alone, if no candidate wraps fields more often than not (e.g., there
+ * aren't any quotes at all), or it's a tie.
+ *
+ * @param   sample
+ * @param   len
+ * @param   complete
+ * @param   delim
+ * @param   quote
+ */
+char csvh_sniff_quote(const char *sample, size_t len, char complete, char delim, char *quote)
+{
+    int best = -1;
+    int bestScore = 0;
+    char tie = 0;
+
+    for (int i = 0; i < QUOTE_CANDIDATE_COUNT; i++) {
+        int score = scoreQuote(sample, len, complete, delim, quoteCandidates[i]);
+
+        if (score > bestScore) {
+            best = i;
+            bestScore = score;
+            tie = 0;
+        } else if (score == bestScore && score > 0) {
+            tie = 1;
+        }
+    }
+
+    if (best == -1 || tie) {
+        return CSVH_SNIFF__UNSURE;
+    }
+
+    *quote = quoteCandidates[best];
+
+    return CSVH_SNIFF__OK;
+}
+
+/**
+ * Guess whether the first row is a header, given the delimiter.  Returns
+ * CSVH_SNIFF__UNSURE, leaving hasHeader alone, if there's nothing to go on
+ * (e.g., every column is text of different lengths).
+ *
+ * @param   sample
+ * @param   len
+ * @param   complete
+ * @param   quote
+ * @param   delim
+ * @param   hasHeader
+ */
+char csvh_sniff_has_header(
+    const char *sample,
+    size_t len,
+    char complete,
+    char quote,
+    char delim,
+    char *hasHeader
+) {
+    columnStats stats;
+    int rows = 0;
+    char inQuote = 0;
+    const char *field = sample;
+    const char *end = sample + len;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.headerCount = -1;
+
+    for (const char *ptr = sample; ptr < end && rows < CSVH_SNIFF__ROWS; ptr++) {
+        if (inQuote) {
+            if (*ptr == quote) {
+                if (ptr + 1 < end && ptr[1] == quote) {
+                    ptr++;
+                } else {
+                    inQuote = 0;
+                }
+            }
+        } else if (*ptr == quote && ptr == field) {
+            inQuote = 1;
+        } else if (*ptr == delim) {
+            addField(&stats, field, ptr, quote);
+            field = ptr + 1;
+        } else if (*ptr == '\n') {
+            if (ptr != sample && ptr[-1] == '\r') {
+                addField(&stats, field, ptr - 1, quote);
+            } else {
+                addField(&stats, field, ptr, quote);
+            }
+            endRow(&stats);
+            rows++;
+            field = ptr + 1;
+        }
+    }
+
+    if (complete && !inQuote && field < end && rows < CSVH_SNIFF__ROWS) {
+        addField(&stats, field, end, quote);
+        endRow(&stats);
+    }
+
+    if (stats.dataRows == 0) {
+        return CSVH_SNIFF__UNSURE;
+    }
+
+    int votes = 0;
+    int columns = (stats.headerCount < HEADER_COLUMNS) ? stats.headerCount : HEADER_COLUMNS;
+
+    for (int i = 0; i < columns; i++) {
+        if (stats.colNumber[i] && stats.colFilled[i]) {
+            votes += stats.headerNumber[i] ? -1 : 1;
+        } else if (stats.colLen[i] >= 0 && stats.dataRows > 1) {
+            // (One value being the same length as itself says nothing.)
+            votes += ((long) stats.headerLen[i] != stats.colLen[i]) ? 1 : -1;
+        }
+    }
+
+    if (votes == 0) {
+        return CSVH_SNIFF__UNSURE;
+    }
+
+    *hasHeader = (votes > 0);
+
+    return CSVH_SNIFF__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Fields that quote wraps in the sample (see csvh_sniff_quote), less the
+ * count of it anywhere else.
+ *
+ * @param   sample
+ * @param   len
+ * @param   complete
+ * @param   delim
+ * @param   quote
+ */
+static int scoreQuote(const char *sample, size_t len, char complete, char delim, char quote)
+{
+    const char *end = sample + len;
+    const char *close;
+    char fieldStart = 1;
+    int rows = 0;
+    int score = 0;
+
+    for (const char *ptr = sample; ptr < end && rows < CSVH_SNIFF__ROWS; ptr++) {
+        if (*ptr == quote && fieldStart) {
+            // Find the closing quote, going past doubled ones.
+            for (close = ptr + 1; close < end; close++) {
+                if (*close == quote) {
+                    if (close + 1 < end && close[1] == quote) {
+                        close++;
+                    } else {
+                        break;
+                    }
+                }
+            }
+
+            if (close == end && !complete) {
+                // Cut off: can't tell.
+                break;
+            }
+
+            if (close < end && isFieldEnd(close + 1, end, delim)) {
+                score++;
+                ptr = close;
+                fieldStart = 0;
+                continue;
+            }
+        }
+
+        if (*ptr == quote) {
+            score--;
+            fieldStart = 0;
+        } else if (*ptr == '\n') {
+            rows++;
+            fieldStart = 1;
+        } else {
+            fieldStart = (*ptr == delim);
+        }
+    }
+
+    return score;
+}
+
+/**
+ * Whether a field can end at ptr (at a delimiter, a line break or the end of
+ * the sample).
+ *
+ * @param   ptr
+ * @param   end
+ * @param   delim
+ */
+static char isFieldEnd(const char *ptr, const char *end, char delim)
+{
+    return ptr == end || *ptr == delim || *ptr == '\n' || *ptr == '\r';
+}
+
+/**
+ * For qsort.
+ *
+ * @param   a
+ * @param   b
+ */
+static int compareInts(const void *a, const void *b)
+{
+    return *(const int *) a - *(const int *) b;
+}
+
+/**
+ * Most common of the counts (which get sorted), and how many rows have it.
+ *
+ * @param   counts
+ * @param   rowCount
+ * @param   hits
+ */
+static int modeOf(int *counts, int rowCount, int *hits)
+{
+    int mode = 0;
+
+    *hits = 0;
+    qsort(counts, rowCount, sizeof(int), compareInts);
+
+    for (int i = 0, run = 1; i < rowCount; i++, run++) {
+        if (i + 1 == rowCount || counts[i + 1] != counts[i]) {
+            if (run > *hits) {
+                *hits = run;
+                mode = counts[i];
+            }
+            run = 0;
+        }
+    }
+
+    return mode;
+}
+
+/**
+ * Note down a field of the row being gone through.
+ *
+ * @param   stats
+ * @param   start
+ * @param   end
+ * @param   quote
+ */
+static void addField(columnStats *stats, const char *start, const char *end, char quote)
+{
+    int ind = stats->rowCount++;
+
+    if (ind >= HEADER_COLUMNS) {
+        return;
+    }
+
+    stats->rowNumber[ind] = isNumber(start, end, quote);
+    stats->rowLen[ind] = end - start;
+    stats->rowEmpty[ind] = (start == end);
+}
+
+/**
+ * Fold the row that was just gone through into the column stats.
+ *
+ * @param   stats
+ */
+static void endRow(columnStats *stats)
+{
+    int count = stats->rowCount;
+    int columns = (count < HEADER_COLUMNS) ? count : HEADER_COLUMNS;
+
+    stats->rowCount = 0;
+
+    if (count == 1 && stats->rowEmpty[0]) {
+        // Blank line.
+        return;
+    }
+
+    if (stats->headerCount == -1) {
+        stats->headerCount = count;
+        memcpy(stats->headerNumber, stats->rowNumber, columns);
+        memcpy(stats->headerLen, stats->rowLen, columns * sizeof(size_t));
+        for (int i = 0; i < columns; i++) {
+            stats->colNumber[i] = 1;
+            stats->colLen[i] = LEN_UNSET;
+        }
+        return;
+    }
+
+    if (count != stats->headerCount) {
+        return;
+    }
+
+    stats->dataRows++;
+
+    for (int i = 0; i < columns; i++) {
+        if (stats->rowEmpty[i]) {
+            // Missing values don't say anything.
+            continue;
+        }
+
+        stats->colFilled[i] = 1;
+        stats->colNumber[i] &= stats->rowNumber[i];
+
+        if (stats->colLen[i] == LEN_UNSET) {
+            stats->colLen[i] = stats->rowLen[i];
+        } else if (stats->colLen[i] != (long) stats->rowLen[i]) {
+            stats->colLen[i] = LEN_VARIES;
+        }
+    }
+}
+
+/**
+ * Whether a field is a number (maybe quoted, maybe with spaces around it).
+ *
+ * @param   start
+ * @param   end
+ * @param   quote
+ */
+static char isNumber(const char *start, const char *end, char quote)
+{
+    char digits = 0;
+
+    if (end - start >= 2 && *start == quote && end[-1] == quote) {
+        start++;
+        end--;
+    }
+
+    for (; start < end && *start == ' '; start++) {}
+    for (; end > start && end[-1] == ' '; end--) {}
+
+    if (start < end && (*start == '-' || *start == '+')) {
+        start++;
+    }
+    for (; start < end && *start >= '0' && *start <= '9'; start++) {
+        digits = 1;
+    }
+    if (start < end && *start == '.') {
+        for (start++; start < end && *start >= '0' && *start <= '9'; start++) {
+            digits = 1;
+        }
+    }
+    if (digits && start < end && (*start == 'e' || *start == 'E')) {
+        start++;
+        if (start < end && (*start == '-' || *start == '+')) {
+            start++;
+        }
+        if (start == end || *start < '0' || *start > '9') {
+            return 0;
+        }
+        for (; start < end && *start >= '0' && *start <= '9'; start++) {}
+    }
+
+    return digits && start == end;
+}
@@ -0,0 +1,34 @@
+#ifndef csvh_sniff_h
+#define csvh_sniff_h
+
+#include <stddef.h>
+
+// Constants
+
+#define CSVH_SNIFF__OK                  0
+#define CSVH_SNIFF__UNSURE              1
+
+/**
+ * How much of the start of the input is worth looking at.
+ */
+#define CSVH_SNIFF__SAMPLE              65536
+
+/**
+ * Most rows of the sample looked at.
+ */
+#define CSVH_SNIFF__ROWS                256
+
+char csvh_sniff_delim(const char *sample, size_t len, char complete, char quote, char *delim);
+
+char csvh_sniff_quote(const char *sample, size_t len, char complete, char delim, char *quote);
+
+char csvh_sniff_has_header(
+    const char *sample,
+    size_t len,
+    char complete,
+    char quote,
+    char delim,
+    char *hasHeader
+);
+
+#endif
@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "csvh-transcode.h"
+
+// Each encoding is turned into UTF-8 both from all of the input at once and
+// from a source that hands it over a few bytes at a time (so characters, and
+// runs of ASCII, get cut off between reads).
+
+#define OUT_CAP 4096
+
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t chunk;
+} trickle;
+
+char transcodesTo(int encoding, const char *in, size_t inLen, const char *expected);
+size_t transcodeAll(int encoding, const char *in, size_t inLen, size_t chunk, char *out);
+long trickleFill(void *source, char *dest, size_t cap);
+
+int main()
+{
+    // Telling the encoding.
+    printf("UTF-16LE BOM: should be %d: %d\n", CSVH_TRANSCODE_ENCODING__UTF16LE,
+        csvh_transcode_detect("\xff\xfe" "a\0", 4, 1));
+    printf("UTF-16BE BOM: should be %d: %d\n", CSVH_TRANSCODE_ENCODING__UTF16BE,
+        csvh_transcode_detect("\xfe\xff\0a", 4, 1));
+    printf("UTF-16LE, no BOM: should be %d: %d\n", CSVH_TRANSCODE_ENCODING__UTF16LE,
+        csvh_transcode_detect("a\0,\0b\0", 6, 1));
+    printf("UTF-16BE, no BOM: should be %d: %d\n", CSVH_TRANSCODE_ENCODING__UTF16BE,
+        csvh_transcode_detect("\0a\0,\0b", 6, 1));
+    printf("UTF-8 BOM: should be %d: %d\n", CSVH_TRANSCODE_ENCODING__UTF8,
+        csvh_transcode_detect("\xef\xbb\xbf" "a,b", 6, 1));
+    printf("UTF-8: should be %d: %d\n", CSVH_TRANSCODE_ENCODING__UTF8,
+        csvh_transcode_detect("a,\xc3\xa9", 4, 1));
+    printf("not UTF-8: should be %d: %d\n", CSVH_TRANSCODE_ENCODING__CP1252,
+        csvh_transcode_detect("a,\xe9,b", 5, 1));
+
+    // A UTF-8 character cut off at the end of a sample doesn't count against
+    // it, unless that's all of the input.
+    printf("cut off sample: should be %d: %d\n", CSVH_TRANSCODE_ENCODING__UTF8,
+        csvh_transcode_detect("a,\xc3", 3, 0));
+    printf("cut off input: should be %d: %d\n", CSVH_TRANSCODE_ENCODING__CP1252,
+        csvh_transcode_detect("a,\xc3", 3, 1));
+
+    // Byte order marks.
+    printf("UTF-16LE BOM length: should be 2: %d\n",
+        (int) csvh_transcode_bom_len(CSVH_TRANSCODE_ENCODING__UTF16LE, "\xff\xfe" "a\0", 4));
+    printf("no BOM length: should be 0: %d\n",
+        (int) csvh_transcode_bom_len(CSVH_TRANSCODE_ENCODING__UTF16LE, "a\0,\0", 4));
+
+    // UTF-16 with an é and a character outside of the BMP (a surrogate pair),
+    // with and without a BOM.
+    printf("UTF-16LE: should be 1: %d\n", transcodesTo(
+        CSVH_TRANSCODE_ENCODING__UTF16LE,
+        "a\0,\0\xe9\0\n\0\x3d\xd8\x00\xde", 12,
+        "a,\xc3\xa9\n\xf0\x9f\x98\x80"
+    ));
+    printf("UTF-16LE with BOM: should be 1: %d\n", transcodesTo(
+        CSVH_TRANSCODE_ENCODING__UTF16LE,
+        "\xff\xfe" "a\0,\0\xe9\0", 8,
+        "a,\xc3\xa9"
+    ));
+    printf("UTF-16BE: should be 1: %d\n", transcodesTo(
+        CSVH_TRANSCODE_ENCODING__UTF16BE,
+        "\0a\0,\0\xe9\0\n\xd8\x3d\xde\x00", 12,
+        "a,\xc3\xa9\n\xf0\x9f\x98\x80"
+    ));
+    printf("UTF-16BE with BOM: should be 1: %d\n", transcodesTo(
+        CSVH_TRANSCODE_ENCODING__UTF16BE,
+        "\xfe\xff\0a\0,\0\xe9", 8,
+        "a,\xc3\xa9"
+    ));
+
+    // Half of a surrogate pair, and an odd byte at the end.
+    printf("lone surrogate: should be 1: %d\n", transcodesTo(
+        CSVH_TRANSCODE_ENCODING__UTF16LE,
+        "\x3d\xd8" "a\0", 4,
+        "\xef\xbf\xbd" "a"
+    ));
+    printf("odd byte at the end: should be 1: %d\n", transcodesTo(
+        CSVH_TRANSCODE_ENCODING__UTF16LE,
+        "a\0b", 3,
+        "a\xef\xbf\xbd"
+    ));
+
+    // A long run of ASCII (more than a block of it at once).
+    char utf16[100];
+    char ascii[51];
+    for (int i = 0; i < 50; i++) {
+        ascii[i] = (i % 10 == 9) ? ',' : 'a' + i % 26;
+        utf16[i * 2] = ascii[i];
+        utf16[i * 2 + 1] = '\0';
+    }
+    ascii[50] = '\0';
+    printf("UTF-16LE ASCII run: should be 1: %d\n",
+        transcodesTo(CSVH_TRANSCODE_ENCODING__UTF16LE, utf16, 100, ascii));
+
+    // 0x80 to 0x9f are where Windows-1252 and Latin-1 differ.
+    printf("Windows-1252: should be 1: %d\n", transcodesTo(
+        CSVH_TRANSCODE_ENCODING__CP1252,
+        "\x80,\x93x\x94,\xe9\n", 8,
+        "\xe2\x82\xac,\xe2\x80\x9cx\xe2\x80\x9d,\xc3\xa9\n"
+    ));
+    printf("Windows-1252 gap: should be 1: %d\n", transcodesTo(
+        CSVH_TRANSCODE_ENCODING__CP1252,
+        "\x81", 1,
+        "\xc2\x81"
+    ));
+    printf("Latin-1: should be 1: %d\n", transcodesTo(
+        CSVH_TRANSCODE_ENCODING__LATIN1,
+        "\x80,\xe9,\xff", 5,
+        "\xc2\x80,\xc3\xa9,\xc3\xbf"
+    ));
+}
+
+/**
+ * Whether in comes out as expected, transcoded all at once, and then a byte
+ * at a time and three at a time.  A byte order mark at the start is skipped,
+ * same as the reader does.
+ *
+ * @param   encoding
+ * @param   in
+ * @param   inLen
+ * @param   expected
+ */
+char transcodesTo(int encoding, const char *in, size_t inLen, const char *expected)
+{
+    size_t bomLen = csvh_transcode_bom_len(encoding, in, inLen);
+    size_t expectedLen = strlen(expected);
+    char out[OUT_CAP];
+    size_t chunks[] = { 0, 1, 3 };
+
+    for (int i = 0; i < 3; i++) {
+        size_t len = transcodeAll(encoding, in + bomLen, inLen - bomLen, chunks[i], out);
+
+        if (len != expectedLen || memcmp(out, expected, len) != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Transcode all of in into out.  Returns the length.
+ *
+ * @param   encoding
+ * @param   in
+ * @param   inLen
+ * @param   chunk       Bytes handed over at a time, or 0 for all at once.
+ * @param   out
+ */
+size_t transcodeAll(int encoding, const char *in, size_t inLen, size_t chunk, char *out)
+{
+    csvh_transcode *transcode;
+    trickle source = { in, inLen, chunk };
+    size_t len = 0;
+    long got;
+
+    if (chunk == 0) {
+        csvh_transcode_open(&transcode, encoding, NULL, NULL, in, inLen);
+    } else {
+        // Only the first chunk is handed over up front.
+        size_t prefixLen = (chunk < inLen) ? chunk : inLen;
+        source.data += prefixLen;
+        source.len -= prefixLen;
+        csvh_transcode_open(&transcode, encoding, trickleFill, &source, in, prefixLen);
+    }
+
+    while ((got = csvh_transcode_read(transcode, out + len, OUT_CAP - len)) > 0) {
+        len += got;
+    }
+
+    csvh_transcode_close(transcode);
+
+    return len;
+}
+
+/**
+ * Hand over the next few bytes of a trickle.
+ *
+ * @param   source
+ * @param   dest
+ * @param   cap
+ */
+long trickleFill(void *source, char *dest, size_t cap)
+{
+    trickle *t = source;
+    size_t take = (t->chunk < t->len) ? t->chunk : t->len;
+
+    if (take > cap) {
+        take = cap;
+    }
+
+    memcpy(dest, t->data, take);
+    t->data += take;
+    t->len -= take;
+
+    return take;
+}
@@ -0,0 +1,633 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "csvh-transcode.h"
+
+// This is a helper module for csvh-reader.c.
+
+// It turns input that isn't UTF-8 into UTF-8 as a stream of bytes, the same
+// way csvh-decompress.c turns compressed input into plain CSV, so that the
+// reader (and everything after it) only ever sees UTF-8.  That's UTF-16 (as
+// Excel's "Unicode text" is) and the single-byte Latin-1 and Windows-1252.
+
+// Which one the input is in is guessed from its start: a byte order mark
+// says, and so does a zero byte next to the first character (which is what
+// ASCII looks like in UTF-16).  Otherwise, if the start isn't valid UTF-8,
+// it's taken to be Windows-1252 (a superset of the printable part of
+// Latin-1), since that's what everything else on Windows writes.
+
+// Most of any CSV is ASCII whatever the encoding, so runs of it are converted
+// 16 bytes at a time where there's SSE2 (every x86-64), and 8 at a time
+// anywhere else.  Everything else goes a character at a time.
+
+// A character that can't be converted (an odd byte at the end of UTF-16, or
+// half of a surrogate pair) comes out as U+FFFD.
+
+// Line breaks are converted like any other character, and never changed:
+// it's the reader that takes the carriage return off the end of a record
+// (see csvh_reader_next_record), for UTF-8 input and this alike, so a \r\n
+// inside of a quoted field comes out the same either way.
+
+/**
+ * How much input to read at a time.
+ */
+#define IN_CHUNK 65536
+
+/**
+ * Most bytes that one character takes in UTF-8 (and in UTF-16).
+ */
+#define CHAR_MAX_LEN 4
+
+/**
+ * What the bytes 0x80 to 0x9f are in Windows-1252 (the rest are the same as
+ * in Latin-1).  The five that aren't anything are passed through as the C1
+ * control characters, same as Windows does.
+ */
+static const uint16_t cp1252High[32] = {
+    0x20ac, 0x0081, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021,
+    0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008d, 0x017d, 0x008f,
+    0x0090, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014,
+    0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0x009d, 0x017e, 0x0178
+};
+
+struct csvh_transcode {
+    int encoding;
+
+    /**
+     * Where input comes from after the prefix runs out.  If NULL, the prefix
+     * is all of the input.
+     */
+    csvh_readahead_fill fill;
+    void *source;
+
+    /**
+     * Buffer for input, if it has to be read in.
+     */
+    char *inBuff;
+    size_t inCap;
+
+    /**
+     * Input not used yet.  Might end partway through a character, which is
+     * kept until the rest of it is read.
+     */
+    const char *in;
+    size_t inLen;
+
+    /**
+     * No more input to read, and whether that's because reading it failed.
+     */
+    char inEof;
+    char failed;
+};
+
+// START forward declarations for static functions.
+
+static void refill(csvh_transcode *transcode);
+
+static size_t fromUtf16(csvh_transcode *transcode, char *dest, size_t cap, char bigEndian);
+
+static size_t fromSingleByte(csvh_transcode *transcode, char *dest, size_t cap);
+
+static size_t asciiRun16(const unsigned char *in, size_t units, char *out, char bigEndian);
+
+static size_t asciiRun8(const unsigned char *in, size_t len, char *out);
+
+static int putUtf8(char *out, uint32_t code);
+
+static char isUtf8(const unsigned char *ptr, size_t len, char complete);
+
+// END forward declarations.
+
+/**
+ * Get the encoding by its name (e.g., "utf-16le", "cp1252", or "auto" to
+ * guess).  Case, dashes and underscores don't matter.  Returns -1 if it's
+ * not one that's supported.
+ *
+ * @param   name
+ */
+int csvh_transcode_encoding(const char *name)
+{
+    static const struct {
+        const char *name;
+        int encoding;
+    } names[] = {
+        { "auto", CSVH_TRANSCODE_ENCODING__AUTO },
+        { "utf8", CSVH_TRANSCODE_ENCODING__UTF8 },
+        { "utf16le", CSVH_TRANSCODE_ENCODING__UTF16LE },
+        { "utf16be", CSVH_TRANSCODE_ENCODING__UTF16BE },
+        { "latin1", CSVH_TRANSCODE_ENCODING__LATIN1 },
+        { "iso88591", CSVH_TRANSCODE_ENCODING__LATIN1 },
+        { "cp1252", CSVH_TRANSCODE_ENCODING__CP1252 },
+        { "windows1252", CSVH_TRANSCODE_ENCODING__CP1252 },
+    };
+    char plain[16];
+    size_t len = 0;
+
+    for (; *name != '\0'; name++) {
+        if (*name == '-' || *name == '_') {
+            continue;
+        }
+        if (len + 1 == sizeof(plain)) {
+            return -1;
+        }
+        plain[len++] = (*name >= 'A' && *name <= 'Z') ? *name - 'A' + 'a' : *name;
+    }
+    plain[len] = '\0';
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(plain, names[i].name) == 0) {
+            return names[i].encoding;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Guess the encoding from the start of the input (ideally the first
+ * CSVH_TRANSCODE_SAMPLE bytes of it).  complete is whether that's all of the
+ * input, so that a character cut off at the end isn't held against it.
+ *
+ * @param   start
+ * @param   len
+ * @param   complete
+ */
+int csvh_transcode_detect(const char *start, size_t len, char complete)
+{
+    const unsigned char *ptr = (const unsigned char *) start;
+
+    if (len >= 3 && ptr[0] == 0xef && ptr[1] == 0xbb && ptr[2] == 0xbf) {
+        return CSVH_TRANSCODE_ENCODING__UTF8;
+    }
+    if (len >= 2 && ptr[0] == 0xff && ptr[1] == 0xfe) {
+        return CSVH_TRANSCODE_ENCODING__UTF16LE;
+    }
+    if (len >= 2 && ptr[0] == 0xfe && ptr[1] == 0xff) {
+        return CSVH_TRANSCODE_ENCODING__UTF16BE;
+    }
+
+    // No byte order mark.  A CSV doesn't have zero bytes in it, unless it's
+    // UTF-16.
+    if (len >= 2 && ptr[0] != 0 && ptr[1] == 0) {
+        return CSVH_TRANSCODE_ENCODING__UTF16LE;
+    }
+    if (len >= 2 && ptr[0] == 0 && ptr[1] != 0) {
+        return CSVH_TRANSCODE_ENCODING__UTF16BE;
+    }
+
+    if (!isUtf8(ptr, len, complete)) {
+        return CSVH_TRANSCODE_ENCODING__CP1252;
+    }
+
+    return CSVH_TRANSCODE_ENCODING__UTF8;
+}
+
+/**
+ * Length of the byte order mark at the start of the input, if it has the one
+ * for the encoding.  (It's not part of the CSV, so it isn't handed out.)
+ *
+ * @param   encoding
+ * @param   start
+ * @param   len
+ */
+size_t csvh_transcode_bom_len(int encoding, const char *start, size_t len)
+{
+    const unsigned char *ptr = (const unsigned char *) start;
+
+    switch (encoding) {
+        case CSVH_TRANSCODE_ENCODING__UTF8:
+            return (len >= 3 && ptr[0] == 0xef && ptr[1] == 0xbb && ptr[2] == 0xbf) ? 3 : 0;
+        case CSVH_TRANSCODE_ENCODING__UTF16LE:
+            return (len >= 2 && ptr[0] == 0xff && ptr[1] == 0xfe) ? 2 : 0;
+        case CSVH_TRANSCODE_ENCODING__UTF16BE:
+            return (len >= 2 && ptr[0] == 0xfe && ptr[1] == 0xff) ? 2 : 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Start transcoding from encoding (which can't be UTF-8 or AUTO).
+ *
+ * The prefix is the start of the input (after any byte order mark), which was
+ * already read to detect the encoding.  If fill is NULL, the prefix is the
+ * entire input and is used where it is (so it has to stick around),
+ * otherwise it's copied.
+ *
+ * @param   transcode
+ * @param   encoding
+ * @param   fill
+ * @param   source
+ * @param   prefix
+ * @param   prefixLen
+ */
+char csvh_transcode_open(
+    csvh_transcode **transcode,
+    int encoding,
+    csvh_readahead_fill fill,
+    void *source,
+    const char *prefix,
+    size_t prefixLen
+) {
+    *transcode = calloc(1, sizeof(csvh_transcode));
+
+    if (*transcode == NULL) {
+        return CSVH_TRANSCODE__OUT_OF_MEMORY;
+    }
+
+    (*transcode)->encoding = encoding;
+    (*transcode)->fill = fill;
+    (*transcode)->source = source;
+
+    if (fill == NULL) {
+        (*transcode)->in = prefix;
+        (*transcode)->inEof = 1;
+    } else {
+        (*transcode)->inCap = (prefixLen > IN_CHUNK) ? prefixLen : IN_CHUNK;
+        (*transcode)->inBuff = malloc((*transcode)->inCap);
+        if ((*transcode)->inBuff == NULL) {
+            free(*transcode);
+            *transcode = NULL;
+            return CSVH_TRANSCODE__OUT_OF_MEMORY;
+        }
+        memcpy((*transcode)->inBuff, prefix, prefixLen);
+        (*transcode)->in = (*transcode)->inBuff;
+    }
+    (*transcode)->inLen = prefixLen;
+
+    return CSVH_TRANSCODE__OK;
+}
+
+/**
+ * Transcode up to cap bytes (at least CHAR_MAX_LEN) into dest.  Returns the
+ * count, 0 at the end, or -1 if the input couldn't be read (once everything
+ * before that is handed out).  A character is never split between two calls.
+ *
+ * Has the same signature as csvh_readahead_fill, so it can be run on the
+ * read-ahead thread.
+ *
+ * @param   transcode
+ * @param   dest
+ * @param   cap
+ */
+long csvh_transcode_read(void *transcodeIn, char *dest, size_t cap)
+{
+    csvh_transcode *transcode = transcodeIn;
+    size_t got;
+
+    while (1) {
+        if (transcode->inLen < CHAR_MAX_LEN && !transcode->inEof) {
+            refill(transcode);
+        }
+
+        switch (transcode->encoding) {
+            case CSVH_TRANSCODE_ENCODING__UTF16LE:
+                got = fromUtf16(transcode, dest, cap, 0);
+                break;
+            case CSVH_TRANSCODE_ENCODING__UTF16BE:
+                got = fromUtf16(transcode, dest, cap, 1);
+                break;
+            default:
+                got = fromSingleByte(transcode, dest, cap);
+                break;
+        }
+
+        if (got > 0) {
+            return got;
+        }
+
+        if (transcode->inEof) {
+            if (transcode->inLen == 0 || transcode->failed) {
+                return transcode->failed ? -1 : 0;
+            }
+
+            // The input ends partway through a character.
+            transcode->inLen = 0;
+            return putUtf8(dest, 0xfffd);
+        }
+    }
+}
+
+/**
+ * Free everything.
+ *
+ * @param   transcode
+ */
+char csvh_transcode_close(csvh_transcode *transcode)
+{
+    if (transcode == NULL) {
+        return CSVH_TRANSCODE__OK;
+    }
+
+    free(transcode->inBuff);
+    free(transcode);
+
+    return CSVH_TRANSCODE__OK;
+}
+
+
+// Static functions below this line.
+
+/**
+ * Read more input in after whatever's left of the last (which is moved to the
+ * start of the buffer).
+ *
+ * @param   transcode
+ */
+static void refill(csvh_transcode *transcode)
+{
+    memmove(transcode->inBuff, transcode->in, transcode->inLen);
+    transcode->in = transcode->inBuff;
+
+    long got = transcode->fill(
+        transcode->source,
+        transcode->inBuff + transcode->inLen,
+        transcode->inCap - transcode->inLen
+    );
+
+    if (got <= 0) {
+        transcode->inEof = 1;
+        transcode->failed = (got < 0);
+    } else {
+        transcode->inLen += got;
+    }
+}
+
+/**
+ * Convert as much UTF-16 as there is room for.  Returns the count of bytes
+ * that came out.  A character cut off at the end of the input is left there
+ * (unless it's the end of all of it).
+ *
+ * @param   transcode
+ * @param   dest
+ * @param   cap
+ * @param   bigEndian
+ */
+static size_t fromUtf16(csvh_transcode *transcode, char *dest, size_t cap, char bigEndian)
+{
+    const unsigned char *in = (const unsigned char *) transcode->in;
+    const unsigned char *end = in + (transcode->inLen & ~(size_t) 1);
+    char *out = dest;
+    char *outEnd = dest + cap;
+
+    while (1) {
+        size_t units = (size_t) (end - in) / 2;
+        size_t room = outEnd - out;
+        size_t ascii = asciiRun16(in, (units < room) ? units : room, out, bigEndian);
+
+        in += 2 * ascii;
+        out += ascii;
+
+        if (end - in < 2 || outEnd - out < CHAR_MAX_LEN) {
+            break;
+        }
+
+        uint32_t code = bigEndian ? (in[0] << 8 | in[1]) : (in[1] << 8 | in[0]);
+
+        if (code >= 0xd800 && code < 0xdc00) {
+            // First half of a surrogate pair.
+            if (end - in < 4 && !transcode->inEof) {
+                break;
+            }
+
+            uint32_t low = (end - in < 4) ? 0
+                : bigEndian ? (in[2] << 8 | in[3]) : (in[3] << 8 | in[2]);
+
+            if (low >= 0xdc00 && low < 0xe000) {
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                in += 2;
+            } else {
+                code = 0xfffd;
+            }
+        } else if (code >= 0xdc00 && code < 0xe000) {
+            // Second half of a pair, without the first.
+            code = 0xfffd;
+        }
+
+        in += 2;
+        out += putUtf8(out, code);
+    }
+
+    transcode->inLen -= (const char *) in - transcode->in;
+    transcode->in = (const char *) in;
+
+    return out - dest;
+}
+
+/**
+ * Convert as much Latin-1 or Windows-1252 as there is room for.  Returns the
+ * count of bytes that came out.
+ *
+ * @param   transcode
+ * @param   dest
+ * @param   cap
+ */
+static size_t fromSingleByte(csvh_transcode *transcode, char *dest, size_t cap)
+{
+    const unsigned char *in = (const unsigned char *) transcode->in;
+    const unsigned char *end = in + transcode->inLen;
+    char cp1252 = (transcode->encoding == CSVH_TRANSCODE_ENCODING__CP1252);
+    char *out = dest;
+    char *outEnd = dest + cap;
+
+    while (1) {
+        size_t len = end - in;
+        size_t room = outEnd - out;
+        size_t ascii = asciiRun8(in, (len < room) ? len : room, out);
+
+        in += ascii;
+        out += ascii;
+
+        if (in == end || outEnd - out < CHAR_MAX_LEN) {
+            break;
+        }
+
+        uint32_t code = *in++;
+
+        if (cp1252 && code < 0xa0) {
+            code = cp1252High[code - 0x80];
+        }
+
+        out += putUtf8(out, code);
+    }
+
+    transcode->inLen -= (const char *) in - transcode->in;
+    transcode->in = (const char *) in;
+
+    return out - dest;
+}
+
+/**
+ * Copy over the UTF-16 code units at the start of in that are ASCII, up to
+ * units of them, as one byte each.  Returns how many there were.
+ *
+ * @param   in
+ * @param   units
+ * @param   out
+ * @param   bigEndian
+ */
+static size_t asciiRun16(const unsigned char *in, size_t units, char *out, char bigEndian)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Read as little-endian 16-bit values, ASCII is 0x00XX in little-endian
+    // UTF-16, and 0xXX00 in big-endian.
+    const __m128i notAscii = _mm_set1_epi16(bigEndian ? (short) 0x80ff : (short) 0xff80);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 8 <= units; i += 8) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) (in + 2 * i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(chunk, notAscii), zero)) != 0xffff) {
+            break;
+        }
+        if (bigEndian) {
+            chunk = _mm_srli_epi16(chunk, 8);
+        }
+        _mm_storel_epi64((__m128i *) (out + i), _mm_packus_epi16(chunk, chunk));
+    }
+#endif
+
+    for (; i < units; i++) {
+        unsigned char high = in[2 * i + !bigEndian];
+        unsigned char low = in[2 * i + bigEndian];
+
+        if (high != 0 || low >= 0x80) {
+            break;
+        }
+        out[i] = low;
+    }
+
+    return i;
+}
+
+/**
+ * Copy over the bytes at the start of in that are ASCII, up to len of them.
+ * Returns how many there were.
+ *
+ * @param   in
+ * @param   len
+ * @param   out
+ */
+static size_t asciiRun8(const unsigned char *in, size_t len, char *out)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) (in + i));
+
+        if (_mm_movemask_epi8(chunk) != 0) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *) (out + i), chunk);
+    }
+#else
+    for (; i + 8 <= len; i += 8) {
+        uint64_t chunk;
+
+        memcpy(&chunk, in + i, 8);
+        if (chunk & 0x8080808080808080ULL) {
+            break;
+        }
+        memcpy(out + i, &chunk, 8);
+    }
+#endif
+
+    for (; i < len && in[i] < 0x80; i++) {
+        out[i] = in[i];
+    }
+
+    return i;
+}
+
+/**
+ * Write a code point out as UTF-8.  Returns how many bytes it took.
+ *
+ * @param   out
+ * @param   code
+ */
+static int putUtf8(char *out, uint32_t code)
+{
+    if (code < 0x80) {
+        out[0] = code;
+        return 1;
+    }
+    if (code < 0x800) {
+        out[0] = 0xc0 | code >> 6;
+        out[1] = 0x80 | (code & 0x3f);
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = 0xe0 | code >> 12;
+        out[1] = 0x80 | (code >> 6 & 0x3f);
+        out[2] = 0x80 | (code & 0x3f);
+        return 3;
+    }
+
+    out[0] = 0xf0 | code >> 18;
+    out[1] = 0x80 | (code >> 12 & 0x3f);
+    out[2] = 0x80 | (code >> 6 & 0x3f);
+    out[3] = 0x80 | (code & 0x3f);
+    return 4;
+}
+
+/**
+ * Whether ptr is valid UTF-8 (no overlong forms or surrogates).  Unless it's
+ * complete, a character cut off at the very end is fine.
+ *
+ * @param   ptr
+ * @param   len
+ * @param   complete
+ */
+static char isUtf8(const unsigned char *ptr, size_t len, char complete)
+{
+    const unsigned char *end = ptr + len;
+
+    while (ptr < end) {
+        if (*ptr < 0x80) {
+            ptr++;
+            continue;
+        }
+
+        unsigned char c = *ptr;
+        int more;
+        unsigned char min = 0x80;
+        unsigned char max = 0xbf;
+
+        if (c >= 0xc2 && c <= 0xdf) {
+            more = 1;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            more = 2;
+            min = (c == 0xe0) ? 0xa0 : 0x80; // Overlong.
+            max = (c == 0xed) ? 0x9f : 0xbf; // Surrogate.
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            more = 3;
+            min = (c == 0xf0) ? 0x90 : 0x80; // Overlong.
+            max = (c == 0xf4) ? 0x8f : 0xbf; // Past U+10FFFF.
+        } else {
+            return 0;
+        }
+
+        for (int i = 1; i <= more; i++) {
+            if (ptr + i == end) {
+                return !complete;
+            }
+            if (ptr[i] < min || ptr[i] > max) {
+                return 0;
+            }
+            min = 0x80;
+            max = 0xbf;
+        }
+
+        ptr += more + 1;
+    }
+
+    return 1;
+}
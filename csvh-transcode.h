@@ -0,0 +1,49 @@
+#ifndef csvh_transcode_h
+#define csvh_transcode_h
+
+#include <stddef.h>
+
+#include "csvh-readahead.h"
+
+// Constants
+
+#define CSVH_TRANSCODE__OK                  0
+#define CSVH_TRANSCODE__OUT_OF_MEMORY       1
+
+// Encodings.
+
+#define CSVH_TRANSCODE_ENCODING__AUTO       0
+#define CSVH_TRANSCODE_ENCODING__UTF8       1
+#define CSVH_TRANSCODE_ENCODING__UTF16LE    2
+#define CSVH_TRANSCODE_ENCODING__UTF16BE    3
+#define CSVH_TRANSCODE_ENCODING__LATIN1     4
+#define CSVH_TRANSCODE_ENCODING__CP1252     5
+
+/**
+ * How much of the start of the input csvh_transcode_detect wants to see to
+ * tell UTF-8 from Windows-1252.
+ */
+#define CSVH_TRANSCODE_SAMPLE               65536
+
+typedef struct csvh_transcode csvh_transcode;
+
+int csvh_transcode_encoding(const char *name);
+
+int csvh_transcode_detect(const char *start, size_t len, char complete);
+
+size_t csvh_transcode_bom_len(int encoding, const char *start, size_t len);
+
+char csvh_transcode_open(
+    csvh_transcode **transcode,
+    int encoding,
+    csvh_readahead_fill fill,
+    void *source,
+    const char *prefix,
+    size_t prefixLen
+);
+
+long csvh_transcode_read(void *transcode, char *dest, size_t cap);
+
+char csvh_transcode_close(csvh_transcode *transcode);
+
+#endif
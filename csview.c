@@ -15,6 +15,8 @@ int argcG;
 
 char **argvG;
 
+csv_handler *handlerG;
+
 // START forward declarations for helper functions.
 
 char normalPrint();
@@ -25,12 +27,26 @@ char verticalPrint();
 
 char rawPrint();
 
+char normalLine(csv_handler *handler, FILE *out, char *unused);
+
+char verticalLine(csv_handler *handler, FILE *out, char *borderLine);
+
+char rawLine(csv_handler *handler, FILE *out, char *unused);
+
+char printLines(char (*printLine)(csv_handler *, FILE *, char *), char *lineData);
+
+char printPart(csv_handler *part, FILE *out, void *data);
+
 void printError(char rc);
 
+void printMalformed(void *unused, long count, size_t at);
+
 char printHeaders();
 
 char *getPassedOption(char in, char pos);
 
+char **getPassedList(char in, int *count);
+
 char isFlagSet(char in);
 
 // END forward declarations for helper functions.
@@ -42,25 +58,73 @@ int main(int argc, char **argv)
 
     char rc = 0;
 
+    if ((handlerG = csv_handler_new()) == NULL) {
+        printError(CSV_HANDLER__OUT_OF_MEMORY);
+        return CSV_HANDLER__OUT_OF_MEMORY;
+    }
+
+    csv_handler_set_malformed_callback(handlerG, printMalformed, NULL);
+
     if (isFlagSet('w')) {
-        csv_handler_set_width(atoi(getPassedOption('w', 1)));
+        csv_handler_set_width(handlerG, atoi(getPassedOption('w', 1)));
     }
     if (isFlagSet('n')) {
-        csv_handler_set_has_headers(0);
+        csv_handler_set_has_headers(handlerG, 0);
     }
     if (isFlagSet('d')) {
-        csv_handler_set_delim(getPassedOption('d', 1)[0]);
+        RETURN_ERR_IF_APP(csv_handler_set_delim(handlerG, getPassedOption('d', 1)))
+    }
+    if (isFlagSet('Q') || isFlagSet('E')) {
+        RETURN_ERR_IF_APP(
+            csv_handler_set_quoting(
+                handlerG,
+                isFlagSet('Q') ? getPassedOption('Q', 1)[0] : '\0',
+                getPassedOption('E', 1)[0]
+            )
+        )
+    }
+    if (isFlagSet('e')) {
+        RETURN_ERR_IF_APP(csv_handler_set_encoding(handlerG, getPassedOption('e', 1)))
+    }
+    if (isFlagSet('g')) {
+        csv_handler_set_sniff(handlerG, 0);
+    }
+    if (isFlagSet('q')) {
+        csv_handler_set_max_record(handlerG, atol(getPassedOption('q', 1)));
+    }
+    if (isFlagSet('i')) {
+        int inputCount;
+        char **inputs = getPassedList('i', &inputCount);
+        RETURN_ERR_IF_APP(csv_handler_set_input_files(handlerG, inputs, inputCount))
+    }
+    if (isFlagSet('I')) {
+        RETURN_ERR_IF_APP(csv_handler_set_use_index(handlerG))
+    }
+    if (isFlagSet('F')) {
+        RETURN_ERR_IF_APP(csv_handler_set_follow(handlerG))
+        // Show each line as soon as it comes in, not when the buffer fills.
+        setvbuf(stdout, NULL, _IOLBF, 0);
+    }
+    if (isFlagSet('a')) {
+        RETURN_ERR_IF_APP(csv_handler_set_read_ahead(handlerG))
     }
 
     if (isFlagSet('k')) {
         // I know this letter sucks, but 's' is already used.
-        int skipLines = atoi(getPassedOption('k', 1));
-        for (int i = 0; i < skipLines; i++) {
-            csv_handler_skip_next_line();
-        }
+        RETURN_ERR_IF_APP(csv_handler_skip_lines(handlerG, atoi(getPassedOption('k', 1))))
+    }
+
+    if (isFlagSet('t') || isFlagSet('b')) {
+        RETURN_ERR_IF_APP(
+            csv_handler_set_tail(
+                handlerG,
+                isFlagSet('t') ? atoi(getPassedOption('t', 1)) : 0,
+                isFlagSet('b')
+            )
+        )
     }
 
-    if ((rc = csv_handler_read_next_line()) != CSV_HANDLER__OK) {
+    if ((rc = csv_handler_read_next_line(handlerG)) != CSV_HANDLER__OK) {
         if (rc == CSV_HANDLER__DONE) {
             printf("File empty or is directory.\n");
         } else {
@@ -68,7 +132,7 @@ int main(int argc, char **argv)
         }
         return rc;
     }
-    RETURN_ERR_IF_APP(csv_handler_set_headers_from_line())
+    RETURN_ERR_IF_APP(csv_handler_set_headers_from_line(handlerG))
 
     // If applicable, print headers and exit.
     if (isFlagSet('h')) {
@@ -78,7 +142,7 @@ int main(int argc, char **argv)
 
     if (isFlagSet('f')) {
         RETURN_ERR_IF_APP(
-            csv_handler_set_selected_fields(getPassedOption('f', 1))
+            csv_handler_set_selected_fields(handlerG, getPassedOption('f', 1))
         )
     }
 
@@ -87,6 +151,7 @@ int main(int argc, char **argv)
         case 'l':
             RETURN_ERR_IF_APP(
                 csv_handler_restrict_by_lines(
+                    handlerG,
                     getPassedOption('r', 2)
                 )
             )
@@ -94,6 +159,7 @@ int main(int argc, char **argv)
         case 'r':
             RETURN_ERR_IF_APP(
                 csv_handler_restrict_by_ranges(
+                    handlerG,
                     getPassedOption('r', 2),
                     getPassedOption('r', 3)
                 )
@@ -102,13 +168,39 @@ int main(int argc, char **argv)
         case 'e':
             RETURN_ERR_IF_APP(
                 csv_handler_restrict_by_equals(
+                    handlerG,
                     getPassedOption('r', 2),
                     getPassedOption('r', 3)
                 )
             )
             break;
+        case 'f': {
+            // The values are in a file, maybe under a column of it.
+            int count;
+            char **args = getPassedList('r', &count);
+            RETURN_ERR_IF_APP(
+                csv_handler_restrict_by_equals_file(
+                    handlerG,
+                    getPassedOption('r', 2),
+                    getPassedOption('r', 3),
+                    (count > 3) ? args[3] : NULL
+                )
+            )
+            break;
+        }
+        case 'w':
+            RETURN_ERR_IF_APP(
+                csv_handler_restrict_by_filter(
+                    handlerG,
+                    getPassedOption('r', 2)
+                )
+            )
+            break;
         // No default.  That just means no restrictions.
     }
+    if (isFlagSet('x')) {
+        RETURN_ERR_IF_APP(csv_handler_set_exclude(handlerG, 1))
+    }
 
     // START Normal format.
     switch (getPassedOption('o', 1)[0]) {
@@ -126,6 +218,8 @@ int main(int argc, char **argv)
             break;
     }
 
+    csv_handler_close(handlerG); // Also stops the read-ahead thread, if any.
+
     return rc;
 }
 
@@ -141,7 +235,7 @@ char normalPrint() {
 
     // Print header.
     if (showLineNums) {
-        RETURN_ERR_IF_APP(csv_handler_output_line_padding(&borderPadd))
+        RETURN_ERR_IF_APP(csv_handler_output_line_padding(handlerG, &borderPadd))
     } else {
         // Code-wise, easiest to just make this an empty string, even if that's
         // not memory- or CPU-efficient.
@@ -149,8 +243,8 @@ char normalPrint() {
         borderPadd[0] = '\0';
         // Kinda ridiculous, but helps for code consistency to put on heap.
     }
-    RETURN_ERR_IF_APP(csv_handler_border_line(&borderLine))
-    RETURN_ERR_IF_APP(csv_handler_output_line(&outputLine))
+    RETURN_ERR_IF_APP(csv_handler_border_line(handlerG, &borderLine))
+    RETURN_ERR_IF_APP(csv_handler_output_line(handlerG, &outputLine))
 
     printf("%s", borderPadd);
     printf("%s\n", borderLine);
@@ -162,24 +256,11 @@ char normalPrint() {
     printf("%s\n", borderLine);
 
     // Print content.
-    while ((rc = csv_handler_read_next_line()) == CSV_HANDLER__OK) {
-        if (showLineNums) {
-            RETURN_ERR_IF_APP(csv_handler_output_line_number(&outputLine))
-            printf("%s", outputLine);
-        }
-        RETURN_ERR_IF_APP(csv_handler_output_line(&outputLine))
-        printf("%s\n", outputLine);
-    }
-
-    if (rc != CSV_HANDLER__DONE) {
-        printError(rc);
-        return rc;
-    }
+    RETURN_ERR_IF_APP(printLines(normalLine, NULL))
 
     printf("%s", borderPadd);
     printf("%s\n", borderLine);
 
-    free(outputLine);
     free(borderLine);
     free(borderPadd);
 
@@ -195,18 +276,18 @@ char transposedPrint()
     char *borderLine = NULL;
     char rc = 0;
 
-    RETURN_ERR_IF_APP(csv_handler_initialize_transpose()) // This pulls *everything* into memory;
+    RETURN_ERR_IF_APP(csv_handler_initialize_transpose(handlerG)) // This pulls *everything* into memory;
 
     if (!isFlagSet('s')) {
         // Don't suppress line numbers.
-        RETURN_ERR_IF_APP(csv_handler_transposed_number_line(&outputLine))
+        RETURN_ERR_IF_APP(csv_handler_transposed_number_line(handlerG, &outputLine))
         printf("%s\n", outputLine);
     }
 
-    RETURN_ERR_IF_APP(csv_handler_transposed_border_line(&borderLine))
+    RETURN_ERR_IF_APP(csv_handler_transposed_border_line(handlerG, &borderLine))
     printf("%s\n", borderLine);
 
-    while ((rc = csv_handler_transposed_line(&outputLine)) == CSV_HANDLER__OK) {
+    while ((rc = csv_handler_transposed_line(handlerG, &outputLine)) == CSV_HANDLER__OK) {
         printf("%s\n", outputLine);
     }
 
@@ -216,7 +297,6 @@ char transposedPrint()
     }
 
     printf("%s\n", borderLine);
-    free(outputLine);
     free(borderLine);
 
     return 0;
@@ -227,32 +307,15 @@ char transposedPrint()
  */
 char verticalPrint()
 {
-    char *outputLine = NULL;
     char *borderLine = NULL;
     char rc = 0;
-    char showLineNums = !isFlagSet('s');
-
-    RETURN_ERR_IF_APP(csv_handler_vertical_border_line(&borderLine))
-
-    while ((rc = csv_handler_read_next_line()) == CSV_HANDLER__OK) {
-        if (showLineNums) {
-            RETURN_ERR_IF_APP(csv_handler_output_line_number(&outputLine))
-            printf("%s Line %s %s\n", borderLine, outputLine, borderLine);
-        } else {
-            printf("%s%s\n", borderLine,borderLine);
-        }
 
-        RETURN_ERR_IF_APP(csv_handler_output_vertical_entry(&outputLine));
-        printf("%s\n", outputLine);
-    }
+    RETURN_ERR_IF_APP(csv_handler_vertical_border_line(handlerG, &borderLine))
 
-    if (rc != CSV_HANDLER__DONE) {
-        return rc;
-    }
+    RETURN_ERR_IF_APP(printLines(verticalLine, borderLine))
 
     //printf("%s\n", borderLine); // I think I like it better without the final line.
 
-    free(outputLine);
     free(borderLine);
 
     return 0;
@@ -266,23 +329,144 @@ char rawPrint()
     char *outputLine = NULL;
     char rc = 0;
 
-    RETURN_ERR_IF_APP(csv_handler_raw_line(&outputLine))
+    RETURN_ERR_IF_APP(csv_handler_raw_line(handlerG, &outputLine))
     printf("%s\n", outputLine);
     // This is necessary because already read first line!  So can't call
     // csv_handler_read_next_line again until this one is printed.
 
-    while ((rc = csv_handler_read_next_line()) == CSV_HANDLER__OK) {
-        csv_handler_raw_line(&outputLine);
-        printf("%s\n", outputLine);
+    RETURN_ERR_IF_APP(printLines(rawLine, NULL))
+
+    return 0;
+}
+
+/**
+ * Print the line in memory in normal format.
+ *
+ * @param   handler
+ * @param   out
+ * @param   unused
+ */
+char normalLine(csv_handler *handler, FILE *out, char *unused)
+{
+    char *outputLine = NULL;
+    char rc;
+
+    if (!isFlagSet('s')) {
+        if ((rc = csv_handler_output_line_number(handler, &outputLine)) != CSV_HANDLER__OK) {
+            return rc;
+        }
+        fprintf(out, "%s", outputLine);
     }
+    if ((rc = csv_handler_output_line(handler, &outputLine)) != CSV_HANDLER__OK) {
+        return rc;
+    }
+    fprintf(out, "%s\n", outputLine);
 
-    if (rc != CSV_HANDLER__DONE) {
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * Print the line in memory as a vertical entry.
+ *
+ * @param   handler
+ * @param   out
+ * @param   borderLine
+ */
+char verticalLine(csv_handler *handler, FILE *out, char *borderLine)
+{
+    char *outputLine = NULL;
+    char rc;
+
+    if (!isFlagSet('s')) {
+        if ((rc = csv_handler_output_line_number(handler, &outputLine)) != CSV_HANDLER__OK) {
+            return rc;
+        }
+        fprintf(out, "%s Line %s %s\n", borderLine, outputLine, borderLine);
+    } else {
+        fprintf(out, "%s%s\n", borderLine,borderLine);
+    }
+
+    if ((rc = csv_handler_output_vertical_entry(handler, &outputLine)) != CSV_HANDLER__OK) {
         return rc;
     }
+    fprintf(out, "%s\n", outputLine);
 
-    free(outputLine);
+    return CSV_HANDLER__OK;
+}
 
-    return 0;
+/**
+ * Print the line in memory in raw format.
+ *
+ * @param   handler
+ * @param   out
+ * @param   unused
+ */
+char rawLine(csv_handler *handler, FILE *out, char *unused)
+{
+    char *outputLine = NULL;
+
+    csv_handler_raw_line(handler, &outputLine);
+    fprintf(out, "%s\n", outputLine);
+
+    return CSV_HANDLER__OK;
+}
+
+/**
+ * The line printing function and what it needs, for printPart.
+ */
+typedef struct {
+    char (*printLine)(csv_handler *, FILE *, char *);
+    char *lineData;
+} partPrinter;
+
+/**
+ * Print the rest of the lines with printLine.  With -j, as much of the input
+ * as can be is split up and printed on that many threads at once first.
+ * Errors are left to the caller to print.
+ *
+ * @param   printLine
+ * @param   lineData    Passed along to printLine.
+ */
+char printLines(char (*printLine)(csv_handler *, FILE *, char *), char *lineData)
+{
+    partPrinter printer = { printLine, lineData };
+    char rc;
+
+    if (isFlagSet('j')) {
+        rc = csv_handler_run_parts(handlerG, atoi(getPassedOption('j', 1)), printPart, &printer, stdout);
+        if (rc != CSV_HANDLER__OK) {
+            return rc;
+        }
+    }
+
+    while ((rc = csv_handler_read_next_line(handlerG)) == CSV_HANDLER__OK) {
+        if ((rc = printLine(handlerG, stdout, lineData)) != CSV_HANDLER__OK) {
+            return rc;
+        }
+    }
+
+    return (rc == CSV_HANDLER__DONE) ? CSV_HANDLER__OK : rc;
+}
+
+/**
+ * Print the lines of a part of the input (see csv_handler_run_parts).
+ *
+ * @param   part
+ * @param   out
+ * @param   data    The partPrinter.
+ */
+char printPart(csv_handler *part, FILE *out, void *data)
+{
+    partPrinter *printer = data;
+    char rc;
+
+    while ((rc = csv_handler_read_next_line(part)) == CSV_HANDLER__OK) {
+        if ((rc = printer->printLine(part, out, printer->lineData)) != CSV_HANDLER__OK) {
+            return rc;
+        }
+    }
+
+    return (rc == CSV_HANDLER__DONE) ? CSV_HANDLER__OK : rc;
 }
 
 /**
@@ -327,10 +511,44 @@ void printError(char rc)
         case CSV_HANDLER__UNKNOWN_ERROR:
             printf("Unknown error!");
             break;
+        case CSV_HANDLER__UNSUPPORTED_INPUT:
+            printf("Error: Input is compressed in a format this build doesn't support.");
+            break;
+        case CSV_HANDLER__NOT_A_FILE:
+            printf("Error: Reading from the end needs a regular file for input (not a pipe, a compressed file or several files).");
+            break;
+        case CSV_HANDLER__HEADER_MISMATCH:
+            printf("Error: Input files don't all have the same header.");
+            break;
+        case CSV_HANDLER__READ_ERROR:
+            printf("Error: Couldn't read all of the input (it's corrupt or cut off, or reading it failed).");
+            break;
     }
     printf("\n");
 }
 
+/**
+ * Warn on stderr about quoting mistakes in the input (see
+ * csv_handler_set_malformed_callback).
+ *
+ * @param   unused
+ * @param   count
+ * @param   at
+ */
+void printMalformed(void *unused, long count, size_t at)
+{
+    if (count == 1) {
+        fprintf(stderr, "Warning: Quote out of place at byte %zu of the input.\n", at);
+    } else {
+        fprintf(
+            stderr,
+            "Warning: %ld quotes out of place, the last one at byte %zu of the input.\n",
+            count,
+            at
+        );
+    }
+}
+
 /**
  * Print the headers.
  */
@@ -338,7 +556,7 @@ char printHeaders()
 {
     char *outputLine = NULL;
     char rc;
-    while ((rc = csv_handler_output_headers(&outputLine)) == CSV_HANDLER__OK) {
+    while ((rc = csv_handler_output_headers(handlerG, &outputLine)) == CSV_HANDLER__OK) {
         printf("%s\n", outputLine);
     }
 
@@ -373,6 +591,29 @@ char *getPassedOption(char in, char pos)
     return "";
 }
 
+/**
+ * Get all of the arguments following an option, up to the next one that
+ * starts with '-' (e.g., several input files).  count is set to how many.
+ *
+ * @param   in
+ * @param   count
+ */
+char **getPassedList(char in, int *count)
+{
+    *count = 0;
+
+    for (int i = 1; i < argcG; i++) {
+        if (argvG[i][0] == '-' && argvG[i][1] == in) {
+            while (i + 1 + *count < argcG && argvG[i + 1 + *count][0] != '-') {
+                (*count)++;
+            }
+            return &argvG[i + 1];
+        }
+    }
+
+    return NULL;
+}
+
 /**
  * Determine if a flag is set.
  *